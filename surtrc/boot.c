@@ -263,6 +263,14 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE image_handle,
   TRY_EFI(uefi_call_wrapper(root_dir[0]->Close, 1, root_dir[0]));
   TRY_EFI(uefi_call_wrapper(guest[0]->Close, 1, guest[0]));
 
+  // Find the ACPI RSDP. Prefer the ACPI 2.0 one, which points to the XSDT.
+  void *acpi_rsdp = NULL;
+  if (EFI_ERROR(LibGetSystemConfigurationTable(&Acpi20TableGuid, &acpi_rsdp)) &&
+      EFI_ERROR(LibGetSystemConfigurationTable(&AcpiTableGuid, &acpi_rsdp))) {
+    LOG_WARN(L"ACPI RSDP is not found.");
+    acpi_rsdp = NULL;
+  }
+
   // Get memory map.
   int map_buffer_size = EFI_PAGE_SIZE * 4;
   UINT8 map_buffer[map_buffer_size];
@@ -315,6 +323,7 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE image_handle,
               .initrd_addr = (void *)initrd_start,
               .initrd_size = initrd_size,
           },
+      .acpi_rsdp = acpi_rsdp,
   };
   kernel_entry(&boot_info);
 
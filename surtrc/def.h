@@ -31,6 +31,8 @@ typedef struct {
   /** UEFI memory map. */
   MemoryMap map;
   GuestInfo guest_info;
+  /** Physical address of the ACPI RSDP. NULL if not found. */
+  void *acpi_rsdp;
 } BootInfo;
 
 #endif  // SURTRC_DEF_H
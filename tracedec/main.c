@@ -0,0 +1,219 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+typedef struct {
+  const char *name;
+  const char *fmt;
+} EventInfo;
+
+static const EventInfo events[TRACE_EVENT_NUM] = {
+#define TRACE_EVENT(name, fmt) {#name, fmt},
+#include "trace_events.h"
+#undef TRACE_EVENT
+};
+
+static TraceRecord *records;
+static size_t num_records;
+static size_t cap_records;
+
+static void add_record(const TraceRecord *record) {
+  // Slots that were never written.
+  if (record->tsc == 0) return;
+  if (num_records == cap_records) {
+    cap_records = cap_records ? cap_records * 2 : 1024;
+    records = realloc(records, cap_records * sizeof(TraceRecord));
+    if (records == NULL) {
+      perror("realloc");
+      exit(1);
+    }
+  }
+  records[num_records++] = *record;
+}
+
+/** Read a raw array of TraceRecord, e.g. `trace_buffers` dumped from memory
+ * by a debugger. */
+static void read_binary(FILE *in) {
+  TraceRecord record;
+  while (fread(&record, sizeof(record), 1, in) == 1) add_record(&record);
+}
+
+/** Read the "TRC" lines printed by trace_dump() out of a serial log. Other
+ * lines are skipped. */
+static void read_log(FILE *in) {
+  char line[512];
+  while (fgets(line, sizeof(line), in)) {
+    const char *trc = strstr(line, "TRC ");
+    if (trc == NULL) continue;
+
+    uint64_t words[sizeof(TraceRecord) / sizeof(uint64_t)];
+    const char *p = trc + 4;
+    size_t n = 0;
+    for (; n < sizeof(words) / sizeof(words[0]); n++) {
+      char *end;
+      words[n] = strtoull(p, &end, 16);
+      if (end == p) break;
+      p = end;
+    }
+    if (n != sizeof(words) / sizeof(words[0])) continue;
+
+    TraceRecord record;
+    memcpy(&record, words, sizeof(record));
+    add_record(&record);
+  }
+}
+
+static int compare_tsc(const void *a, const void *b) {
+  uint64_t lhs = ((const TraceRecord *)a)->tsc;
+  uint64_t rhs = ((const TraceRecord *)b)->tsc;
+  return lhs < rhs ? -1 : lhs > rhs;
+}
+
+/** Call `fn` with the name, conversion and value of each argument, as named
+ * by the event's format. Arguments the format does not name get "argN". */
+static void for_each_arg(const TraceRecord *record,
+                         void (*fn)(const char *name, size_t len, char conv,
+                                    uint64_t value, bool first)) {
+  const char *fmt =
+      record->event < TRACE_EVENT_NUM ? events[record->event].fmt : "";
+  for (size_t i = 0; i < record->nargs && i < TRACE_MAX_ARGS; i++) {
+    while (*fmt == ' ') fmt++;
+    const char *eq = strchr(fmt, '=');
+    if (*fmt != '\0' && eq != NULL && eq[1] == '%') {
+      fn(fmt, eq - fmt, eq[2], record->args[i], i == 0);
+      fmt = eq[2] != '\0' ? eq + 3 : eq + 2;
+    } else {
+      char name[8];
+      snprintf(name, sizeof(name), "arg%zu", i);
+      fn(name, strlen(name), 'x', record->args[i], i == 0);
+    }
+  }
+}
+
+static const char *event_name(const TraceRecord *record) {
+  return record->event < TRACE_EVENT_NUM ? events[record->event].name
+                                         : "unknown";
+}
+
+static void print_text_arg(const char *name, size_t len, char conv,
+                           uint64_t value, bool first) {
+  (void)first;
+  if (conv == 'd') {
+    printf(" %.*s=%" PRId64, (int)len, name, (int64_t)value);
+  } else {
+    printf(" %.*s=0x%" PRIx64, (int)len, name, value);
+  }
+}
+
+static void print_text(void) {
+  uint64_t base = num_records ? records[0].tsc : 0;
+  for (size_t i = 0; i < num_records; i++) {
+    const TraceRecord *record = &records[i];
+    printf("%14" PRIu64 " cpu%u %s", record->tsc - base, record->cpu,
+           event_name(record));
+    for_each_arg(record, print_text_arg);
+    printf("\n");
+  }
+}
+
+static void print_json_arg(const char *name, size_t len, char conv,
+                           uint64_t value, bool first) {
+  // JSON numbers lose precision above 2^53, so hex values are strings.
+  if (conv == 'd') {
+    printf("%s\"%.*s\":%" PRId64, first ? "" : ",", (int)len, name,
+           (int64_t)value);
+  } else {
+    printf("%s\"%.*s\":\"0x%" PRIx64 "\"", first ? "" : ",", (int)len, name,
+           value);
+  }
+}
+
+/** Print instant events in the Chrome trace event format, with a thread per
+ * CPU. */
+static void print_json(double tsc_mhz) {
+  uint64_t base = num_records ? records[0].tsc : 0;
+  printf("{\"traceEvents\":[\n");
+  for (size_t i = 0; i < num_records; i++) {
+    const TraceRecord *record = &records[i];
+    printf("{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":0,\"tid\":%u,"
+           "\"ts\":%.3f,\"args\":{",
+           event_name(record), record->cpu,
+           (double)(record->tsc - base) / tsc_mhz);
+    for_each_arg(record, print_json_arg);
+    printf("}}%s\n", i + 1 < num_records ? "," : "");
+  }
+  printf("],\"displayTimeUnit\":\"ns\"}\n");
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "Usage: %s [-b] [-j] [-f tsc_mhz] [file]\n"
+          "  -b  Input is a raw array of TraceRecord, e.g. trace_buffers\n"
+          "      dumped from memory. By default it is a serial log with the\n"
+          "      TRC lines printed by trace_dump().\n"
+          "  -j  Print Chrome trace event JSON instead of text.\n"
+          "  -f  TSC frequency in MHz, used to convert the JSON timestamps to\n"
+          "      microseconds. Defaults to 1000.\n"
+          "Reads from stdin if no file is given.\n",
+          name);
+}
+
+int main(int argc, char **argv) {
+  bool binary = false;
+  bool json = false;
+  double tsc_mhz = 1000.0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "bjf:h")) != -1) {
+    switch (opt) {
+      case 'b':
+        binary = true;
+        break;
+      case 'j':
+        json = true;
+        break;
+      case 'f':
+        tsc_mhz = strtod(optarg, NULL);
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (tsc_mhz <= 0 || optind + 1 < argc) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  FILE *in = stdin;
+  if (optind < argc) {
+    in = fopen(argv[optind], binary ? "rb" : "r");
+    if (in == NULL) {
+      perror(argv[optind]);
+      return 1;
+    }
+  }
+  if (binary) {
+    read_binary(in);
+  } else {
+    read_log(in);
+  }
+  if (in != stdin) fclose(in);
+
+  // Records of different CPUs are merged by time.
+  qsort(records, num_records, sizeof(TraceRecord), compare_tsc);
+  if (json) {
+    print_json(tsc_mhz);
+  } else {
+    print_text();
+  }
+  free(records);
+  return 0;
+}
@@ -0,0 +1,78 @@
+#include "acpi.h"
+
+#include <stddef.h>
+
+#include "log.h"
+
+/** Physical address of the XSDT or RSDT. 0 if ACPI is unavailable. */
+static Phys root_table;
+/** Whether the root table is the XSDT, whose entries are 64-bit. */
+static bool root_is_xsdt;
+
+static bool is_valid_checksum(const void *table, size_t length) {
+  const uint8_t *bytes = table;
+  uint8_t sum = 0;
+  for (size_t i = 0; i < length; i++) {
+    sum += bytes[i];
+  }
+  return sum == 0;
+}
+
+static bool signature_equals(const char *a, const char *b, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    if (a[i] != b[i]) return false;
+  }
+  return true;
+}
+
+void acpi_init(Phys rsdp_phys) {
+  root_table = 0;
+  if (rsdp_phys == 0) {
+    LOG_WARN("ACPI RSDP is not available.\n");
+    return;
+  }
+
+  const AcpiRsdp *rsdp = (const AcpiRsdp *)phys2virt(rsdp_phys);
+  if (!signature_equals(rsdp->signature, "RSD PTR ", 8) ||
+      !is_valid_checksum(rsdp, offsetof(AcpiRsdp, length))) {
+    LOG_ERROR("Invalid ACPI RSDP.\n");
+    return;
+  }
+
+  if (rsdp->revision >= 2 && rsdp->xsdt_address != 0 &&
+      is_valid_checksum(rsdp, rsdp->length)) {
+    root_table = rsdp->xsdt_address;
+    root_is_xsdt = true;
+  } else {
+    root_table = rsdp->rsdt_address;
+    root_is_xsdt = false;
+  }
+
+  const AcpiSdtHeader *root = (const AcpiSdtHeader *)phys2virt(root_table);
+  if (!is_valid_checksum(root, root->length)) {
+    LOG_ERROR("Invalid ACPI root table.\n");
+    root_table = 0;
+  }
+}
+
+const AcpiSdtHeader *acpi_find_table(const char *signature) {
+  if (root_table == 0) return NULL;
+
+  const AcpiSdtHeader *root = (const AcpiSdtHeader *)phys2virt(root_table);
+  const uint8_t *entries = (const uint8_t *)(root + 1);
+  size_t entry_size = root_is_xsdt ? sizeof(uint64_t) : sizeof(uint32_t);
+  size_t num_entries = (root->length - sizeof(AcpiSdtHeader)) / entry_size;
+  for (size_t i = 0; i < num_entries; i++) {
+    // XSDT entries are not 8-byte aligned.
+    Phys table_phys = 0;
+    memcpy(&table_phys, entries + i * entry_size, entry_size);
+    const AcpiSdtHeader *table = (const AcpiSdtHeader *)phys2virt(table_phys);
+    if (!signature_equals(table->signature, signature, 4)) continue;
+    if (!is_valid_checksum(table, table->length)) {
+      LOG_ERROR("Invalid checksum of ACPI table %s.\n", signature);
+      return NULL;
+    }
+    return table;
+  }
+  return NULL;
+}
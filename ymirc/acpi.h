@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mem.h"
+
+/** Root System Description Pointer. */
+typedef struct {
+  char signature[8];
+  uint8_t checksum;
+  char oem_id[6];
+  uint8_t revision;
+  uint32_t rsdt_address;
+  // Fields below are valid since ACPI 2.0 (revision 2).
+  uint32_t length;
+  uint64_t xsdt_address;
+  uint8_t extended_checksum;
+  uint8_t reserved[3];
+} __attribute__((packed)) AcpiRsdp;
+
+/** Header common to all system description tables. */
+typedef struct {
+  char signature[4];
+  uint32_t length;
+  uint8_t revision;
+  uint8_t checksum;
+  char oem_id[6];
+  char oem_table_id[8];
+  uint32_t oem_revision;
+  uint32_t creator_id;
+  uint32_t creator_revision;
+} __attribute__((packed)) AcpiSdtHeader;
+
+/** Initialize ACPI table lookup from the physical address of the RSDP. Tables
+ * are unavailable if `rsdp` is 0 or invalid. */
+void acpi_init(Phys rsdp);
+
+/** Find a system description table by its 4-character signature. Returns NULL
+ * if the table is not found or its checksum is invalid. */
+const AcpiSdtHeader *acpi_find_table(const char *signature);
@@ -0,0 +1,58 @@
+#include "alloc_stats.h"
+
+#include <stddef.h>
+
+#include "bin_allocator.h"
+#include "log.h"
+
+static const page_allocator_ops_t *page_ops = NULL;
+
+void alloc_stats_init(const page_allocator_ops_t *ops) { page_ops = ops; }
+
+void alloc_stats_get_pages(PageAllocatorStats *out) {
+  if (page_ops == NULL) {
+    *out = (PageAllocatorStats){0};
+    return;
+  }
+  page_ops->get_stats(out);
+}
+
+static void dump_page_allocator(int level) {
+  PageAllocatorStats stats;
+  page_ops->get_stats(&stats);
+  log_printf(level, "Page allocator (frames):\n");
+  log_printf(level, "  total=%lu free=%lu used=%lu reserved=%lu peak=%lu\n",
+             stats.total_frames, stats.free_frames, stats.used_frames,
+             stats.reserved_frames, stats.high_water_frames);
+  log_printf(level, "  allocs=%lu frees=%lu failures=%lu slow-path=%lu\n",
+             stats.alloc_count, stats.free_count, stats.alloc_failures,
+             stats.slow_path_hits);
+  for (int order = 0; order < PAGE_ALLOCATOR_STAT_ORDERS; order++) {
+    if (stats.free_blocks[order] == 0) continue;
+    log_printf(level, "  free blocks of order %d: %lu\n", order,
+               stats.free_blocks[order]);
+  }
+}
+
+static void dump_bin_allocator(int level) {
+  BinAllocatorStats stats;
+  bin_get_stats(&stats);
+  log_printf(level, "Bin allocator:\n");
+  log_printf(level, "  large-live=%lu failures=%lu slow-path=%lu\n",
+             stats.large_live, stats.alloc_failures, stats.slow_path_hits);
+  for (size_t i = 0; i < BIN_SIZE_NUM; i++) {
+    const BinStats *bin = &stats.bins[i];
+    // Bins that were never used are left out.
+    if (bin->high_water_objects == 0) continue;
+    log_printf(level, "  bin %d: live=%lu in-slabs=%lu peak=%lu slabs=%lu\n",
+               bin->size, bin->live_objects, bin->slab_objects,
+               bin->high_water_objects, bin->num_slabs);
+  }
+}
+
+void alloc_stats_dump(int level) {
+  if (level < LOG_LEVEL || page_ops == NULL) return;
+  log_printf(level, "=== Allocator Stats ==========\n");
+  dump_page_allocator(level);
+  dump_bin_allocator(level);
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "page_allocator_if.h"
+
+/** Register the page allocator whose counters are reported. Until then,
+ * alloc_stats_dump() prints nothing. */
+void alloc_stats_init(const page_allocator_ops_t *ops);
+
+/** Get the counters of the registered page allocator. They are all zero until
+ * one is registered. */
+void alloc_stats_get_pages(PageAllocatorStats *out);
+
+/** Print the counters of the page allocator and the bin allocator at the given
+ * log level. Safe to call from a panic since no lock is taken. */
+void alloc_stats_dump(int level);
@@ -1,9 +1,13 @@
 #pragma once
 
+#include <stdint.h>
 #include <stdnoreturn.h>
 
 #include "page_allocator_if.h"
 
+/** Maximum number of CPUs. */
+#define MAX_CPUS 8
+
 /** Perform architecture-specific initialization. */
 void arch_init();
 
@@ -11,6 +15,16 @@ void arch_init();
  * creates two mappings: direct mapping and kernel text mapping. */
 void reconstruct_mapping(const page_allocator_ops_t *ops);
 
+/** Zero a page with the fastest method the CPU supports. The stores bypass the
+ * cache so that zeroing does not evict useful data. */
+void clear_page(void *page);
+
+/** Index of the running CPU, in [0, MAX_CPUS). */
+unsigned int cpu_id();
+
+/** Read the CPU's timestamp counter. */
+uint64_t read_timestamp();
+
 /** Enable interrupts. */
 void enable_intr();
 
@@ -0,0 +1,160 @@
+#define LOG_SUBSYSTEM LOG_SUBSYS_INTR
+
+#include "apic.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "arch.h"
+#include "asm.h"
+#include "bits.h"
+#include "cpuid.h"
+#include "log.h"
+
+/** Value of the timer divide register dividing the clock by 1. */
+#define TIMER_DIVIDE_BY_1 0b1011
+
+/** TSC cycles the one-shot timer is calibrated over. */
+#define CALIBRATION_CYCLES (1ULL << 24)
+
+/** Bit of the ICR asserting the interrupt. Must be set for fixed IPIs. */
+#define ICR_LEVEL_ASSERT 14
+/** Shift of the destination shorthand in the ICR. */
+#define ICR_SHORTHAND 18
+/** Shift of the destination in the ICR. */
+#define ICR_DEST 32
+
+/** Destination shorthands of the ICR. */
+typedef enum {
+  SHORTHAND_NONE = 0,
+  SHORTHAND_SELF = 1,
+  SHORTHAND_ALL = 2,
+  SHORTHAND_ALL_BUT_SELF = 3,
+} IcrShorthand;
+
+static bool enabled = false;
+static bool tsc_deadline = false;
+/** Timer ticks per TSC cycle in 32.32 fixed point. Used in one-shot mode. */
+static uint64_t ticks_per_cycle;
+
+static inline uint64_t read_apic(X2apicRegister reg) {
+  return read_msr((Msr)reg);
+}
+
+static inline void write_apic(X2apicRegister reg, uint64_t value) {
+  write_msr((Msr)reg, value);
+}
+
+static uint64_t lvt_timer(ApicTimerMode mode, bool masked) {
+  uint64_t lvt = APIC_TIMER_VECTOR | ((uint64_t)mode << APIC_LVT_TIMER_MODE);
+  if (masked) lvt |= tobit(APIC_LVT_MASKED);
+  return lvt;
+}
+
+/** Count timer ticks against the TSC. The timer is left stopped. */
+static void calibrate_timer() {
+  write_apic(X2APIC_LVT_TIMER, lvt_timer(APIC_TIMER_ONESHOT, true));
+  write_apic(X2APIC_TIMER_DIVIDE, TIMER_DIVIDE_BY_1);
+
+  uint64_t start = read_timestamp();
+  write_apic(X2APIC_TIMER_INITIAL, UINT32_MAX);
+  uint64_t now;
+  do {
+    now = read_timestamp();
+  } while (now - start < CALIBRATION_CYCLES);
+  uint64_t ticks = UINT32_MAX - read_apic(X2APIC_TIMER_CURRENT);
+  write_apic(X2APIC_TIMER_INITIAL, 0);
+
+  // The count is 32-bit, so the shift does not overflow.
+  ticks_per_cycle = (ticks << 32) / (now - start);
+}
+
+static void init_timer() {
+  CpuidStdFeatureInfoEcx ecx = {.value = cpuid(1, 0).ecx};
+  tsc_deadline = ecx.tsc_deadline;
+  if (tsc_deadline) {
+    write_apic(X2APIC_LVT_TIMER, lvt_timer(APIC_TIMER_TSC_DEADLINE, false));
+    LOG_INFO("APIC timer: TSC-deadline mode.\n");
+    return;
+  }
+
+  calibrate_timer();
+  write_apic(X2APIC_LVT_TIMER, lvt_timer(APIC_TIMER_ONESHOT, false));
+  LOG_INFO("APIC timer: one-shot mode, %lu ticks per 2^32 TSC cycles.\n",
+           ticks_per_cycle);
+}
+
+bool apic_init() {
+  CpuidStdFeatureInfoEcx ecx = {.value = cpuid(1, 0).ecx};
+  if (!ecx.x2apic) return false;
+
+  // The APIC has to be enabled before switching it to x2APIC mode.
+  uint64_t base = read_msr(MSR_APIC_BASE);
+  if (!isset(base, APIC_BASE_ENABLE)) {
+    base |= tobit(APIC_BASE_ENABLE);
+    write_msr(MSR_APIC_BASE, base);
+  }
+  write_msr(MSR_APIC_BASE, base | tobit(APIC_BASE_X2APIC));
+
+  // The PIC is left to the guest. NMIs still come through LINT1.
+  write_apic(X2APIC_LVT_LINT0, tobit(APIC_LVT_MASKED));
+  write_apic(X2APIC_LVT_ERROR, tobit(APIC_LVT_MASKED));
+  write_apic(X2APIC_TPR, 0);
+  write_apic(X2APIC_SVR, tobit(APIC_SVR_ENABLE) | APIC_SPURIOUS_VECTOR);
+
+  init_timer();
+  enabled = true;
+  LOG_INFO("Enabled x2APIC: ID=%d\n", apic_id());
+  return true;
+}
+
+bool apic_enabled() { return enabled; }
+
+uint32_t apic_id() { return (uint32_t)read_apic(X2APIC_ID); }
+
+void apic_eoi() { write_apic(X2APIC_EOI, 0); }
+
+bool apic_timer_uses_deadline() { return tsc_deadline; }
+
+void apic_timer_arm(uint64_t deadline) {
+  if (tsc_deadline) {
+    // 0 disarms the timer, so a deadline at 0 is moved to 1.
+    write_msr(MSR_TSC_DEADLINE, deadline == 0 ? 1 : deadline);
+    return;
+  }
+
+  uint64_t now = read_timestamp();
+  uint64_t ticks = 1;
+  if (deadline > now) {
+    ticks = (uint64_t)(((unsigned __int128)(deadline - now) *
+                        ticks_per_cycle) >> 32);
+    if (ticks == 0) ticks = 1;
+    if (ticks > UINT32_MAX) ticks = UINT32_MAX;
+  }
+  write_apic(X2APIC_TIMER_INITIAL, ticks);
+}
+
+void apic_timer_cancel() {
+  if (tsc_deadline) {
+    write_msr(MSR_TSC_DEADLINE, 0);
+  } else {
+    write_apic(X2APIC_TIMER_INITIAL, 0);
+  }
+}
+
+/** Write the ICR. In x2APIC mode it is a single MSR write, and there is no
+ * delivery status to wait for. */
+static void send_ipi(uint32_t dest, IcrShorthand shorthand, uint8_t vector) {
+  uint64_t icr = vector | tobit(ICR_LEVEL_ASSERT) |
+                 ((uint64_t)shorthand << ICR_SHORTHAND) |
+                 ((uint64_t)dest << ICR_DEST);
+  write_apic(X2APIC_ICR, icr);
+}
+
+void apic_send_ipi(uint32_t dest, uint8_t vector) {
+  send_ipi(dest, SHORTHAND_NONE, vector);
+}
+
+void apic_send_ipi_others(uint8_t vector) {
+  send_ipi(0, SHORTHAND_ALL_BUT_SELF, vector);
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Vector of the local APIC timer. */
+#define APIC_TIMER_VECTOR 0xF0
+/** Vector of spurious interrupts from the local APIC. */
+#define APIC_SPURIOUS_VECTOR 0xFF
+
+/** x2APIC registers. The xAPIC register at MMIO offset `off` is the MSR
+ * 0x800 + off / 16 in x2APIC mode. */
+typedef enum {
+  X2APIC_ID = 0x802,
+  X2APIC_VERSION = 0x803,
+  X2APIC_TPR = 0x808,
+  X2APIC_PPR = 0x80A,
+  X2APIC_EOI = 0x80B,
+  X2APIC_LDR = 0x80D,
+  X2APIC_SVR = 0x80F,
+  X2APIC_ISR0 = 0x810,
+  X2APIC_TMR0 = 0x818,
+  X2APIC_IRR0 = 0x820,
+  X2APIC_ESR = 0x828,
+  X2APIC_ICR = 0x830,
+  X2APIC_LVT_TIMER = 0x832,
+  X2APIC_LVT_THERMAL = 0x833,
+  X2APIC_LVT_PMC = 0x834,
+  X2APIC_LVT_LINT0 = 0x835,
+  X2APIC_LVT_LINT1 = 0x836,
+  X2APIC_LVT_ERROR = 0x837,
+  X2APIC_TIMER_INITIAL = 0x838,
+  X2APIC_TIMER_CURRENT = 0x839,
+  X2APIC_TIMER_DIVIDE = 0x83E,
+  X2APIC_SELF_IPI = 0x83F,
+} X2apicRegister;
+
+/** Range of the MSRs reserved for the x2APIC registers. */
+#define X2APIC_MSR_FIRST 0x800
+#define X2APIC_MSR_LAST 0x8FF
+
+/** Bit of the IA32_APIC_BASE MSR enabling the APIC. */
+#define APIC_BASE_ENABLE 11
+/** Bit of the IA32_APIC_BASE MSR selecting x2APIC mode. */
+#define APIC_BASE_X2APIC 10
+/** Bit of the IA32_APIC_BASE MSR telling that the CPU is the BSP. */
+#define APIC_BASE_BSP 8
+
+/** Bit of the SVR enabling the APIC in software. */
+#define APIC_SVR_ENABLE 8
+/** Bit of an LVT entry masking it. */
+#define APIC_LVT_MASKED 16
+/** Shift of the timer mode in the LVT timer entry. */
+#define APIC_LVT_TIMER_MODE 17
+
+/** Modes of the local APIC timer. */
+typedef enum {
+  APIC_TIMER_ONESHOT = 0,
+  APIC_TIMER_PERIODIC = 1,
+  APIC_TIMER_TSC_DEADLINE = 2,
+} ApicTimerMode;
+
+/** Enable the local APIC of the running CPU in x2APIC mode. LINT0 is masked
+ * so that the PIC cannot reach the CPU. Returns false, leaving the APIC
+ * untouched, if the CPU does not support x2APIC. */
+bool apic_init();
+
+/** Return true if apic_init() succeeded. */
+bool apic_enabled();
+
+/** x2APIC ID of the running CPU. */
+uint32_t apic_id();
+
+/** Notify the end of interrupt (EOI) to the local APIC. Every vector but
+ * APIC_SPURIOUS_VECTOR needs it. */
+void apic_eoi();
+
+/** Return true if the timer runs in TSC-deadline mode. Otherwise it runs in
+ * one-shot mode with a count calibrated against the TSC. */
+bool apic_timer_uses_deadline();
+
+/** Fire APIC_TIMER_VECTOR once when the TSC reaches `deadline`. A deadline in
+ * the past fires at once. Arming again replaces the previous deadline. In
+ * one-shot mode a far deadline is clamped to the longest count, so the timer
+ * may fire early and the handler has to check the TSC. */
+void apic_timer_arm(uint64_t deadline);
+
+/** Cancel the armed timer. */
+void apic_timer_cancel();
+
+/** Send a fixed IPI with `vector` to the CPU whose x2APIC ID is `dest`. */
+void apic_send_ipi(uint32_t dest, uint8_t vector);
+
+/** Send a fixed IPI with `vector` to all CPUs but the running one. */
+void apic_send_ipi_others(uint8_t vector);
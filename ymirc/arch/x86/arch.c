@@ -1,11 +1,35 @@
 #include "arch.h"
 
+#include <stdbool.h>
+
 #include "arch/x86/page.h"
+#include "cpuid.h"
 #include "gdt.h"
 #include "interrupt.h"
 #include "log.h"
+#include "mem.h"
+#include "memops.h"
+
+/** Size in bytes of the cache line zeroed by CLZERO. */
+#define CLZERO_LINE_SIZE 64
+
+/** How clear_page() zeroes memory. Chosen on first use. */
+typedef enum {
+  CLEAR_PAGE_UNKNOWN,
+  CLEAR_PAGE_CLZERO,
+  CLEAR_PAGE_MOVNTI,
+} ClearPageMethod;
+
+static ClearPageMethod clear_page_method = CLEAR_PAGE_UNKNOWN;
 
 void arch_init() {
+  const MemRoutines *routines = memops_select();
+  mem_set_routines(routines);
+  LOG_INFO("Using %s for memcpy/memset.\n",
+           routines == &memops_fsrm   ? "FSRM"
+           : routines == &memops_erms ? "ERMS"
+                                      : "SSE2");
+
   gdt_init();
   LOG_INFO("Initialized GDT.\n");
   itr_init();
@@ -14,6 +38,41 @@ void arch_init() {
 
 void reconstruct_mapping(const page_allocator_ops_t *ops) { reconstruct(ops); }
 
+/** Check if the CPU supports CLZERO. */
+static bool has_clzero(void) {
+  if (cpuid(0x80000000, 0).eax < 0x80000008) return false;
+  CpuidExtFeatureIdEbx ebx = {.value = cpuid(0x80000008, 0).ebx};
+  return ebx.clzero;
+}
+
+void clear_page(void *page) {
+  if (clear_page_method == CLEAR_PAGE_UNKNOWN) {
+    clear_page_method = has_clzero() ? CLEAR_PAGE_CLZERO : CLEAR_PAGE_MOVNTI;
+  }
+
+  uint8_t *p = page;
+  if (clear_page_method == CLEAR_PAGE_CLZERO) {
+    for (size_t i = 0; i < PAGE_SIZE; i += CLZERO_LINE_SIZE) {
+      __asm__ volatile("clzero" : : "a"(p + i) : "memory");
+    }
+  } else {
+    for (size_t i = 0; i < PAGE_SIZE; i += sizeof(uint64_t)) {
+      __asm__ volatile("movnti %1, (%0)" : : "r"(p + i), "r"(0ULL) : "memory");
+    }
+  }
+  // Both are weakly ordered. Make the zeroes visible before the page is used.
+  __asm__ volatile("sfence" : : : "memory");
+}
+
+// YmirC runs only on the BSP so far.
+unsigned int cpu_id() { return 0; }
+
+uint64_t read_timestamp() {
+  uint32_t lo, hi;
+  __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+  return ((uint64_t)hi << 32) | lo;
+}
+
 void enable_intr() { __asm__ volatile("sti"); }
 void disable_intr() { __asm__ volatile("cli"); }
 
@@ -114,6 +114,7 @@ typedef enum {
   MSR_SYSENTER_CS = 0x174,
   MSR_SYSENTER_ESP = 0x175,
   MSR_SYSENTER_EIP = 0x176,
+  MSR_TSC_DEADLINE = 0x6E0,
   MSR_EFER = 0xC0000080,
   MSR_STAR = 0xC0000081,
   MSR_LSTAR = 0xC0000082,
@@ -125,6 +126,7 @@ typedef enum {
   MSR_TSC_AUX = 0xC0000103,
   MSR_VM_CR = 0xC0010114,
   MSR_VM_HSAVE_PA = 0xC0010117,
+  MSR_AVIC_DOORBELL = 0xC001011B,
 } Msr;
 
 uint64_t read_msr(Msr msr);
@@ -159,3 +161,9 @@ SidtRet sidt();
 
 static inline void stgi() { __asm__ volatile("stgi"); }
 static inline void clgi() { __asm__ volatile("clgi"); }
+
+static inline FlagsRegister read_rflags() {
+  FlagsRegister rflags;
+  __asm__ volatile("pushfq; popq %0" : "=r"(rflags.value));
+  return rflags;
+}
@@ -33,7 +33,7 @@ typedef union {
     unsigned int x2apic : 1;
     unsigned int movbe : 1;
     unsigned int popcnt : 1;
-    unsigned int _reserved5 : 1;
+    unsigned int tsc_deadline : 1;
     unsigned int aes : 1;
     unsigned int xsave : 1;
     unsigned int osxsave : 1;
@@ -168,3 +168,62 @@ typedef union {
 
 static_assert(sizeof(CpuidExtFeatureEbx0) == 4,
               "Unexpected CpuidExtFeatureEbx0 size");
+
+/** CPUID Extended Feature Flags bitfield for EDX.
+ * Leaf=7, Sub-Leaf=0, */
+typedef union {
+  struct {
+    unsigned int _reserved1 : 4;
+    unsigned int fsrm : 1;
+    unsigned int _reserved2 : 27;
+  };
+  uint32_t value;
+} __attribute__((packed)) CpuidExtFeatureEdx0;
+
+static_assert(sizeof(CpuidExtFeatureEdx0) == 4,
+              "Unexpected CpuidExtFeatureEdx0 size");
+
+/** CPUID Extended Feature Identifiers bitfield for EBX.
+ * Leaf=0x8000_0008, Sub-Leaf=null, */
+typedef union {
+  struct {
+    unsigned int clzero : 1;
+    unsigned int instretcntmsr : 1;
+    unsigned int rstrfperrptrs : 1;
+    unsigned int _reserved1 : 29;
+  };
+  uint32_t value;
+} __attribute__((packed)) CpuidExtFeatureIdEbx;
+
+static_assert(sizeof(CpuidExtFeatureIdEbx) == 4,
+              "Unexpected CpuidExtFeatureIdEbx size");
+
+/** CPUID SVM Feature Identifiers bitfield for EDX.
+ * Leaf=0x8000_000A, Sub-Leaf=null, */
+typedef union {
+  struct {
+    unsigned int np : 1;
+    unsigned int lbr_virt : 1;
+    unsigned int svm_lock : 1;
+    unsigned int nrip_save : 1;
+    unsigned int tsc_rate_msr : 1;
+    unsigned int vmcb_clean : 1;
+    unsigned int flush_by_asid : 1;
+    unsigned int decode_assists : 1;
+    unsigned int _reserved1 : 2;
+    unsigned int pause_filter : 1;
+    unsigned int _reserved2 : 1;
+    unsigned int pause_filter_threshold : 1;
+    unsigned int avic : 1;
+    unsigned int _reserved3 : 1;
+    unsigned int vmsave_virt : 1;
+    unsigned int vgif : 1;
+    unsigned int gmet : 1;
+    unsigned int x2avic : 1;
+    unsigned int _reserved4 : 13;
+  };
+  uint32_t value;
+} __attribute__((packed)) CpuidSvmFeatureEdx;
+
+static_assert(sizeof(CpuidSvmFeatureEdx) == 4,
+              "Unexpected CpuidSvmFeatureEdx size");
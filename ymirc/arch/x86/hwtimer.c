@@ -0,0 +1,70 @@
+#define LOG_SUBSYSTEM LOG_SUBSYS_INTR
+
+#include "hwtimer.h"
+
+#include "apic.h"
+#include "arch.h"
+#include "interrupt.h"
+#include "irq.h"
+#include "log.h"
+#include "pit.h"
+#include "timer.h"
+
+static uint64_t tsc_hz;
+/** Longest delay channel 0 of the PIT can count, in TSC cycles. */
+static uint64_t pit_max_delay;
+
+static void apic_program(uint64_t deadline) {
+  if (deadline == TIMER_NO_DEADLINE) {
+    apic_timer_cancel();
+  } else {
+    apic_timer_arm(deadline);
+  }
+}
+
+static void pit_program(uint64_t deadline) {
+  if (deadline == TIMER_NO_DEADLINE) {
+    pit_stop();
+    return;
+  }
+
+  uint64_t now = read_timestamp();
+  uint64_t delay = deadline > now ? deadline - now : 0;
+  // A further deadline fires early, and the wheel programs the rest.
+  if (delay > pit_max_delay) delay = pit_max_delay;
+  uint64_t count = delay * PIT_HZ / tsc_hz;
+  pit_oneshot(count == 0 ? 1 : count);
+}
+
+static void apic_timer_handler(Context *ctx) {
+  (void)ctx;
+  timer_run(read_timestamp());
+  apic_eoi();
+}
+
+static void pit_handler(Context *ctx) {
+  (void)ctx;
+  timer_run(read_timestamp());
+  irq_eoi(irq_timer);
+}
+
+void hwtimer_init() {
+  tsc_hz = pit_calibrate_tsc();
+  LOG_INFO("TSC frequency: %lu Hz\n", tsc_hz);
+
+  timer_init(read_timestamp());
+  if (irq_uses_apic()) {
+    register_handler(APIC_TIMER_VECTOR, apic_timer_handler);
+    timer_set_programfn(apic_program);
+    LOG_INFO("Timer wheel is driven by the LAPIC timer.\n");
+  } else {
+    pit_max_delay = UINT16_MAX * tsc_hz / PIT_HZ;
+    pit_stop();
+    register_handler(irq_timer + primary_vector_offset, pit_handler);
+    irq_unmask(irq_timer);
+    timer_set_programfn(pit_program);
+    LOG_INFO("Timer wheel is driven by the PIT.\n");
+  }
+}
+
+uint64_t tsc_frequency() { return tsc_hz; }
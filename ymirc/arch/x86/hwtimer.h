@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+/** Drive the timer wheel with a one-shot hardware timer programmed for the
+ * next deadline only: the LAPIC timer when host interrupts come through the
+ * local APIC, channel 0 of the PIT otherwise. Deadlines are in TSC cycles.
+ * irq_init() MUST be called before this function. */
+void hwtimer_init();
+
+/** TSC frequency in Hz, measured by hwtimer_init(). */
+uint64_t tsc_frequency();
@@ -1,32 +1,61 @@
+#define LOG_SUBSYSTEM LOG_SUBSYS_INTR
+
 #include "interrupt.h"
 
 #include <stdbool.h>
 #include <stddef.h>
 
+#include "apic.h"
 #include "arch.h"
 #include "idt.h"
 #include "isr.h"
 #include "log.h"
 #include "panic.h"
+#include "pic.h"
 
-#define MAX_SUBSCRIBER 10
+/** Number of subscriptions. A subscription to a range of vectors takes one
+ * per vector. */
+#define MAX_SUBSCRIPTIONS 64
 
-/* Subscriber to interrupts.*/
-typedef struct {
+/* Subscription of a callback to a vector. */
+typedef struct Subscriber {
   void *self;  // Context of the subscriber.
   SubscriberCallback callback;
-  bool in_use;
+  struct Subscriber *next;  // Next subscription to the same vector.
 } Subscriber;
 
-/** Subscriber to interrupts. */
-Subscriber subscribers[MAX_SUBSCRIBER] = {0};
+/** Pool of subscriptions, used from the front. */
+static Subscriber subscribers[MAX_SUBSCRIPTIONS];
+static size_t num_subscribers = 0;
+/** Chain of subscriptions of each vector. */
+static Subscriber *chains[MAX_NUM_GATES] = {0};
+
+/** Number of times each vector was dispatched on each CPU. */
+static uint64_t hit_counts[MAX_CPUS][MAX_NUM_GATES];
 
 /** Interrupt handlers. */
 static Handler handlers[MAX_NUM_GATES] = {0};
 
+/** Vectors reserved for exceptions. */
+#define NUM_EXCEPTIONS 32
+/** IRQ lines of the PIC pair and of the I/O APIC inputs the host uses. */
+#define NUM_IRQS 16u
+
 static char *exception_name(uint64_t vector);
 static void unhandled_handler(Context *ctx);
 
+/** Name of a vector above the IRQs. */
+static const char *apic_vector_name(uint64_t vector) {
+  switch (vector) {
+    case APIC_TIMER_VECTOR:
+      return "APIC timer";
+    case APIC_SPURIOUS_VECTOR:
+      return "APIC spurious";
+    default:
+      return "Unknown";
+  }
+}
+
 /** Initialize the IDT. */
 void itr_init() {
   for (int i = 0; i < MAX_NUM_GATES; i++) {
@@ -43,12 +72,11 @@ void itr_init() {
  * handler. */
 void itr_dispatch(Context *ctx) {
   uint64_t vector = ctx->vector;
+  hit_counts[cpu_id()][vector]++;
 
   // Notify subscribers.
-  for (size_t i = 0; i < MAX_SUBSCRIBER; i++) {
-    if (subscribers[i].in_use) {
-      subscribers[i].callback(subscribers[i].self, ctx);
-    }
+  for (Subscriber *sub = chains[vector]; sub != NULL; sub = sub->next) {
+    sub->callback(sub->self, ctx);
   }
 
   // Call the handler.
@@ -60,17 +88,49 @@ void register_handler(uint8_t vector, Handler handler) {
   handlers[vector] = handler;
 }
 
-void subscribe2interrupt(void *ctx, SubscriberCallback callback) {
-  for (size_t i = 0; i < MAX_SUBSCRIBER; i++) {
-    if (!subscribers[i].in_use) {
-      subscribers[i].callback = callback;
-      subscribers[i].self = ctx;
-      subscribers[i].in_use = true;
-      return;
-    }
+void subscribe2interrupt(void *ctx, SubscriberCallback callback,
+                         uint8_t first, uint8_t last) {
+  if (num_subscribers + (last - first + 1) > MAX_SUBSCRIPTIONS) {
+    panic("Subscribers to interrupt is full.");
   }
 
-  panic("Subscribers to interrupt is full.");
+  for (unsigned int vector = first; vector <= last; vector++) {
+    Subscriber *sub = &subscribers[num_subscribers++];
+    sub->self = ctx;
+    sub->callback = callback;
+    sub->next = chains[vector];
+    // Publish the subscription after it is filled in, since an interrupt may
+    // walk the chain at any time.
+    __atomic_store_n(&chains[vector], sub, __ATOMIC_RELEASE);
+  }
+}
+
+uint64_t itr_hit_count(uint8_t vector) {
+  uint64_t count = 0;
+  for (size_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+    count += __atomic_load_n(&hit_counts[cpu][vector], __ATOMIC_RELAXED);
+  }
+  return count;
+}
+
+void itr_dump_stats(int level) {
+  if (level < LOG_LEVEL) return;
+  log_printf(level, "=== Interrupt Stats ==========\n");
+  for (unsigned int vector = 0; vector < MAX_NUM_GATES; vector++) {
+    uint64_t count = itr_hit_count(vector);
+    if (count == 0) continue;
+    if (vector < NUM_EXCEPTIONS) {
+      log_printf(level, "vector %d (%s): %lu\n", (int)vector,
+                 exception_name(vector), count);
+    } else if (vector >= primary_vector_offset &&
+               vector < primary_vector_offset + NUM_IRQS) {
+      log_printf(level, "vector %d (IRQ %d): %lu\n", (int)vector,
+                 (int)(vector - primary_vector_offset), count);
+    } else {
+      log_printf(level, "vector %d (%s): %lu\n", (int)vector,
+                 apic_vector_name(vector), count);
+    }
+  }
 }
 
 static void unhandled_handler(Context *ctx) {
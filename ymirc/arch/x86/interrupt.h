@@ -18,6 +18,14 @@ void itr_dispatch(Context *ctx);
 /** Register interrupt handler. */
 void register_handler(uint8_t vector, Handler handler);
 
-/** Subscribe to interrupts. Subscribers are called when an interrupt is
- * triggered before the interrupt handler. */
-void subscribe2interrupt(void *ctx, SubscriberCallback callback);
+/** Subscribe to the vectors from `first` to `last`, inclusive. Subscribers are
+ * called when one of them is triggered, before the interrupt handler. */
+void subscribe2interrupt(void *ctx, SubscriberCallback callback,
+                         uint8_t first, uint8_t last);
+
+/** Number of times `vector` was dispatched, summed over all CPUs. */
+uint64_t itr_hit_count(uint8_t vector);
+
+/** Print the dispatch count of each vector that fired at the given log
+ * level. */
+void itr_dump_stats(int level);
@@ -0,0 +1,205 @@
+#define LOG_SUBSYSTEM LOG_SUBSYS_INTR
+
+#include "ioapic.h"
+
+#include <stddef.h>
+
+#include "acpi.h"
+#include "bits.h"
+#include "log.h"
+#include "mem.h"
+
+/** MADT structure types. */
+#define MADT_TYPE_IOAPIC 1
+#define MADT_TYPE_SOURCE_OVERRIDE 2
+
+/** Maximum number of I/O APICs kept from the MADT. */
+#define MAX_IOAPICS 4
+/** Number of ISA IRQs. */
+#define NUM_ISA_IRQS 16
+
+/** I/O APIC registers. */
+#define IOAPIC_REG_VERSION 0x01
+#define IOAPIC_REG_REDIRECTION 0x10
+
+/** Offsets of the index and data registers in the MMIO window. */
+#define IOREGSEL 0x00
+#define IOWIN 0x10
+
+/** Fields of the low half of a redirection entry. */
+#define REDIR_POLARITY_LOW 13
+#define REDIR_TRIGGER_LEVEL 15
+#define REDIR_MASKED 16
+/** Shift of the destination in the high half of a redirection entry. */
+#define REDIR_DEST 24
+
+/** Fields of the MPS INTI flags of an interrupt source override. */
+#define INTI_POLARITY_MASK 0b0011
+#define INTI_POLARITY_LOW 0b0011
+#define INTI_TRIGGER_MASK 0b1100
+#define INTI_TRIGGER_LEVEL 0b1100
+
+/** Multiple APIC Description Table. */
+typedef struct {
+  AcpiSdtHeader header;
+  uint32_t local_apic_address;
+  uint32_t flags;
+} __attribute__((packed)) AcpiMadt;
+
+/** Header common to MADT structures. */
+typedef struct {
+  uint8_t type;
+  uint8_t length;
+} __attribute__((packed)) MadtEntryHeader;
+
+/** I/O APIC Structure. */
+typedef struct {
+  MadtEntryHeader header;
+  uint8_t id;
+  uint8_t reserved;
+  uint32_t address;
+  uint32_t gsi_base;
+} __attribute__((packed)) MadtIoapic;
+
+/** Interrupt Source Override Structure. */
+typedef struct {
+  MadtEntryHeader header;
+  uint8_t bus;
+  uint8_t source;
+  uint32_t gsi;
+  uint16_t flags;
+} __attribute__((packed)) MadtSourceOverride;
+
+typedef struct {
+  volatile uint32_t *regs;
+  uint32_t gsi_base;
+  uint32_t num_inputs;
+} Ioapic;
+
+/** Where an ISA IRQ enters the I/O APICs. */
+typedef struct {
+  uint32_t gsi;
+  uint16_t flags;
+} IsaRoute;
+
+static Ioapic ioapics[MAX_IOAPICS];
+static size_t ioapic_count;
+static IsaRoute isa_routes[NUM_ISA_IRQS];
+
+static uint32_t read_reg(const Ioapic *ioapic, uint8_t reg) {
+  ioapic->regs[IOREGSEL / sizeof(uint32_t)] = reg;
+  return ioapic->regs[IOWIN / sizeof(uint32_t)];
+}
+
+static void write_reg(const Ioapic *ioapic, uint8_t reg, uint32_t value) {
+  ioapic->regs[IOREGSEL / sizeof(uint32_t)] = reg;
+  ioapic->regs[IOWIN / sizeof(uint32_t)] = value;
+}
+
+static void add_ioapic(const MadtIoapic *entry) {
+  if (ioapic_count >= MAX_IOAPICS) {
+    LOG_WARN("Too many I/O APICs in MADT.\n");
+    return;
+  }
+  Ioapic *ioapic = &ioapics[ioapic_count++];
+  ioapic->regs = (volatile uint32_t *)phys2virt(entry->address);
+  ioapic->gsi_base = entry->gsi_base;
+  uint32_t version = read_reg(ioapic, IOAPIC_REG_VERSION);
+  // Bits 16-23 hold the index of the last redirection entry.
+  ioapic->num_inputs = ((version >> 16) & 0xFF) + 1;
+}
+
+static void parse_madt(const AcpiMadt *madt) {
+  const uint8_t *entry = (const uint8_t *)(madt + 1);
+  const uint8_t *end = (const uint8_t *)madt + madt->header.length;
+  while (entry + sizeof(MadtEntryHeader) <= end) {
+    const MadtEntryHeader *header = (const MadtEntryHeader *)entry;
+    if (header->length == 0 || entry + header->length > end) break;
+
+    switch (header->type) {
+      case MADT_TYPE_IOAPIC:
+        add_ioapic((const MadtIoapic *)entry);
+        break;
+      case MADT_TYPE_SOURCE_OVERRIDE: {
+        const MadtSourceOverride *override =
+            (const MadtSourceOverride *)entry;
+        // Bus 0 is ISA.
+        if (override->bus != 0 || override->source >= NUM_ISA_IRQS) break;
+        isa_routes[override->source] =
+            (IsaRoute){override->gsi, override->flags};
+        break;
+      }
+      default:
+        break;
+    }
+    entry += header->length;
+  }
+}
+
+/** I/O APIC receiving the GSI, or NULL if there is none. */
+static const Ioapic *find_ioapic(uint32_t gsi) {
+  for (size_t i = 0; i < ioapic_count; i++) {
+    const Ioapic *ioapic = &ioapics[i];
+    if (gsi >= ioapic->gsi_base &&
+        gsi < ioapic->gsi_base + ioapic->num_inputs) {
+      return ioapic;
+    }
+  }
+  return NULL;
+}
+
+static void write_redirection(const Ioapic *ioapic, uint32_t gsi, uint32_t lo,
+                              uint32_t hi) {
+  uint8_t reg = IOAPIC_REG_REDIRECTION + (gsi - ioapic->gsi_base) * 2;
+  // Mask the entry while it is half written.
+  write_reg(ioapic, reg, tobit(REDIR_MASKED));
+  write_reg(ioapic, reg + 1, hi);
+  write_reg(ioapic, reg, lo);
+}
+
+bool ioapic_init() {
+  ioapic_count = 0;
+  for (int irq = 0; irq < NUM_ISA_IRQS; irq++) {
+    // ISA interrupts are active-high and edge-triggered unless overridden.
+    isa_routes[irq] = (IsaRoute){irq, 0};
+  }
+
+  const AcpiMadt *madt = (const AcpiMadt *)acpi_find_table("APIC");
+  if (madt == NULL) return false;
+  parse_madt(madt);
+
+  for (size_t i = 0; i < ioapic_count; i++) {
+    const Ioapic *ioapic = &ioapics[i];
+    for (uint32_t input = 0; input < ioapic->num_inputs; input++) {
+      write_redirection(ioapic, ioapic->gsi_base + input,
+                        tobit(REDIR_MASKED), 0);
+    }
+  }
+  LOG_INFO("Found %d I/O APIC(s).\n", (int)ioapic_count);
+  return ioapic_count != 0;
+}
+
+void ioapic_route(IrqLine irq, uint8_t vector, uint32_t dest) {
+  IsaRoute route = isa_routes[irq];
+  const Ioapic *ioapic = find_ioapic(route.gsi);
+  if (ioapic == NULL) {
+    LOG_ERROR("No I/O APIC receives GSI %d.\n", route.gsi);
+    return;
+  }
+
+  uint32_t lo = vector;
+  if ((route.flags & INTI_POLARITY_MASK) == INTI_POLARITY_LOW) {
+    lo |= tobit(REDIR_POLARITY_LOW);
+  }
+  if ((route.flags & INTI_TRIGGER_MASK) == INTI_TRIGGER_LEVEL) {
+    lo |= tobit(REDIR_TRIGGER_LEVEL);
+  }
+  write_redirection(ioapic, route.gsi, lo, dest << REDIR_DEST);
+}
+
+void ioapic_mask(IrqLine irq) {
+  IsaRoute route = isa_routes[irq];
+  const Ioapic *ioapic = find_ioapic(route.gsi);
+  if (ioapic == NULL) return;
+  write_redirection(ioapic, route.gsi, tobit(REDIR_MASKED), 0);
+}
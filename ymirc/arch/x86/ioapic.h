@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pic.h"
+
+/** Find the I/O APICs in the MADT and mask all of their inputs. Returns false
+ * if there is none. acpi_init() MUST be called before this function. */
+bool ioapic_init();
+
+/** Deliver the ISA IRQ to `vector` on the CPU whose APIC ID is `dest`, and
+ * unmask it. Interrupt source overrides in the MADT are applied. */
+void ioapic_route(IrqLine irq, uint8_t vector, uint32_t dest);
+
+/** Mask the ISA IRQ. */
+void ioapic_mask(IrqLine irq);
@@ -0,0 +1,49 @@
+#define LOG_SUBSYSTEM LOG_SUBSYS_INTR
+
+#include "irq.h"
+
+#include "apic.h"
+#include "arch.h"
+#include "interrupt.h"
+#include "ioapic.h"
+#include "log.h"
+
+static bool use_apic = false;
+
+/** Spurious interrupts need no EOI. They are only counted by the dispatcher. */
+static void spurious_handler(Context *ctx) { (void)ctx; }
+
+void irq_init() {
+  // Even when it is not used, the PIC is remapped so that a stray interrupt
+  // from it does not look like an exception.
+  pic_init();
+
+  disable_intr();
+  if (ioapic_init() && apic_init()) {
+    pic_mask_all();
+    register_handler(APIC_SPURIOUS_VECTOR, spurious_handler);
+    use_apic = true;
+    LOG_INFO("Host interrupts are delivered by the x2APIC.\n");
+  } else {
+    LOG_WARN("x2APIC or I/O APIC is unavailable. Falling back to the PIC.\n");
+  }
+  enable_intr();
+}
+
+bool irq_uses_apic() { return use_apic; }
+
+void irq_unmask(IrqLine irq) {
+  if (use_apic) {
+    ioapic_route(irq, primary_vector_offset + irq, apic_id());
+  } else {
+    unset_mask(irq);
+  }
+}
+
+void irq_eoi(IrqLine irq) {
+  if (use_apic) {
+    apic_eoi();
+  } else {
+    notify_eoi(irq);
+  }
+}
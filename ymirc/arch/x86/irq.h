@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "pic.h"
+
+/** Set up the interrupt controllers for the host. The x2APIC and the I/O APIC
+ * are used when both are available, and the PIC is masked and left to the
+ * guest. Otherwise the PIC delivers the host's interrupts. Either way, IRQ
+ * `irq` arrives at vector `primary_vector_offset + irq`. acpi_init() MUST be
+ * called before this function. */
+void irq_init();
+
+/** Return true if the host's interrupts come through the local APIC. */
+bool irq_uses_apic();
+
+/** Unmask the IRQ line. */
+void irq_unmask(IrqLine irq);
+
+/** Notify the end of interrupt of the IRQ line. */
+void irq_eoi(IrqLine irq);
@@ -43,6 +43,26 @@ __attribute__((naked)) void isr_common() {
   __asm__ volatile(
       "pushq %rsp\n\t"
       "popq %rdi\n\t"
+      // Save the SSE registers below the context. Handlers may clobber them,
+      // e.g. in memcpy() or in code the compiler vectorizes, while the
+      // interrupted code is using them.
+      "subq $0x100, %rsp\n\t"
+      "movdqu %xmm0, 0x00(%rsp)\n\t"
+      "movdqu %xmm1, 0x10(%rsp)\n\t"
+      "movdqu %xmm2, 0x20(%rsp)\n\t"
+      "movdqu %xmm3, 0x30(%rsp)\n\t"
+      "movdqu %xmm4, 0x40(%rsp)\n\t"
+      "movdqu %xmm5, 0x50(%rsp)\n\t"
+      "movdqu %xmm6, 0x60(%rsp)\n\t"
+      "movdqu %xmm7, 0x70(%rsp)\n\t"
+      "movdqu %xmm8, 0x80(%rsp)\n\t"
+      "movdqu %xmm9, 0x90(%rsp)\n\t"
+      "movdqu %xmm10, 0xA0(%rsp)\n\t"
+      "movdqu %xmm11, 0xB0(%rsp)\n\t"
+      "movdqu %xmm12, 0xC0(%rsp)\n\t"
+      "movdqu %xmm13, 0xD0(%rsp)\n\t"
+      "movdqu %xmm14, 0xE0(%rsp)\n\t"
+      "movdqu %xmm15, 0xF0(%rsp)\n\t"
       // Align stack to 16 bytes.
       "pushq %rsp\n\t"
       "pushq (%rsp)\n\t"
@@ -50,7 +70,25 @@ __attribute__((naked)) void isr_common() {
       // Call the dispatcher.
       "call itr_dispatch\n\t"
       // Restore the stack.
-      "movq 8(%rsp), %rsp");
+      "movq 8(%rsp), %rsp\n\t"
+      // Restore the SSE registers.
+      "movdqu 0x00(%rsp), %xmm0\n\t"
+      "movdqu 0x10(%rsp), %xmm1\n\t"
+      "movdqu 0x20(%rsp), %xmm2\n\t"
+      "movdqu 0x30(%rsp), %xmm3\n\t"
+      "movdqu 0x40(%rsp), %xmm4\n\t"
+      "movdqu 0x50(%rsp), %xmm5\n\t"
+      "movdqu 0x60(%rsp), %xmm6\n\t"
+      "movdqu 0x70(%rsp), %xmm7\n\t"
+      "movdqu 0x80(%rsp), %xmm8\n\t"
+      "movdqu 0x90(%rsp), %xmm9\n\t"
+      "movdqu 0xA0(%rsp), %xmm10\n\t"
+      "movdqu 0xB0(%rsp), %xmm11\n\t"
+      "movdqu 0xC0(%rsp), %xmm12\n\t"
+      "movdqu 0xD0(%rsp), %xmm13\n\t"
+      "movdqu 0xE0(%rsp), %xmm14\n\t"
+      "movdqu 0xF0(%rsp), %xmm15\n\t"
+      "addq $0x100, %rsp");
 
   // Remove general-purpose registers, error code, and vector from the stack.
   __asm__ volatile(
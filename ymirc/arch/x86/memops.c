@@ -0,0 +1,201 @@
+#include "memops.h"
+
+#include <stdint.h>
+
+#include "cpuid.h"
+
+/** Without FSRM, REP MOVSB/STOSB has a startup cost that only pays off for
+ * larger sizes. */
+#define ERMS_THRESHOLD 256
+/** Bytes moved by one iteration of the SSE2 loops. */
+#define SSE2_BLOCK 64
+
+// The SSE2 loops use only xmm0-xmm3. The guest's xmm0-xmm7 are saved and
+// restored around VMRUN, so they do not touch the guest's state. The loops
+// may also be interrupted: isr_common saves the SSE registers, so a handler
+// calling memcpy() does not corrupt the interrupted copy. AVX is not used
+// since the upper halves of the ymm registers are saved by neither.
+
+static inline void rep_movsb(void *dest, const void *src, size_t n) {
+  __asm__ volatile("rep movsb" : "+D"(dest), "+S"(src), "+c"(n) : : "memory");
+}
+
+static inline void rep_stosb(void *s, unsigned char c, size_t n) {
+  __asm__ volatile("rep stosb" : "+D"(s), "+c"(n) : "a"(c) : "memory");
+}
+
+/** Copy whole SSE2_BLOCKs. If `nt` is true, the stores bypass the cache and
+ * `dest` MUST be 16-byte aligned. */
+static void copy_sse2_blocks(unsigned char *dest, const unsigned char *src,
+                             size_t num_blocks, bool nt) {
+  if (nt) {
+    __asm__ volatile(
+        "1:\n\t"
+        "prefetchnta 256(%1)\n\t"
+        "movdqu (%1), %%xmm0\n\t"
+        "movdqu 16(%1), %%xmm1\n\t"
+        "movdqu 32(%1), %%xmm2\n\t"
+        "movdqu 48(%1), %%xmm3\n\t"
+        "movntdq %%xmm0, (%0)\n\t"
+        "movntdq %%xmm1, 16(%0)\n\t"
+        "movntdq %%xmm2, 32(%0)\n\t"
+        "movntdq %%xmm3, 48(%0)\n\t"
+        "add $64, %0\n\t"
+        "add $64, %1\n\t"
+        "dec %2\n\t"
+        "jnz 1b\n\t"
+        // Non-temporal stores are weakly ordered.
+        "sfence"
+        : "+r"(dest), "+r"(src), "+r"(num_blocks)
+        :
+        : "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+  } else {
+    __asm__ volatile(
+        "1:\n\t"
+        "movdqu (%1), %%xmm0\n\t"
+        "movdqu 16(%1), %%xmm1\n\t"
+        "movdqu 32(%1), %%xmm2\n\t"
+        "movdqu 48(%1), %%xmm3\n\t"
+        "movdqu %%xmm0, (%0)\n\t"
+        "movdqu %%xmm1, 16(%0)\n\t"
+        "movdqu %%xmm2, 32(%0)\n\t"
+        "movdqu %%xmm3, 48(%0)\n\t"
+        "add $64, %0\n\t"
+        "add $64, %1\n\t"
+        "dec %2\n\t"
+        "jnz 1b"
+        : "+r"(dest), "+r"(src), "+r"(num_blocks)
+        :
+        : "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+  }
+}
+
+/** Fill whole SSE2_BLOCKs with non-temporal stores. `s` MUST be 16-byte
+ * aligned. */
+static void set_nt_blocks(unsigned char *s, unsigned char c,
+                          size_t num_blocks) {
+  uint64_t pattern[2] __attribute__((aligned(16)));
+  pattern[0] = pattern[1] = 0x0101010101010101ULL * c;
+  __asm__ volatile(
+      "movdqa (%2), %%xmm0\n\t"
+      "1:\n\t"
+      "movntdq %%xmm0, (%0)\n\t"
+      "movntdq %%xmm0, 16(%0)\n\t"
+      "movntdq %%xmm0, 32(%0)\n\t"
+      "movntdq %%xmm0, 48(%0)\n\t"
+      "add $64, %0\n\t"
+      "dec %1\n\t"
+      "jnz 1b\n\t"
+      "sfence"
+      : "+r"(s), "+r"(num_blocks)
+      : "r"(pattern)
+      : "memory", "xmm0");
+}
+
+/** Bytes to skip until `p` is 16-byte aligned. */
+static inline size_t head_to_align(const void *p) {
+  return (16 - ((uintptr_t)p & 15)) & 15;
+}
+
+/** Copy so large that the destination would evict most of the cache. It is
+ * usually not read soon after, such as the guest image. */
+static void copy_nt(void *dest, const void *src, size_t n) {
+  unsigned char *d = dest;
+  const unsigned char *s = src;
+  size_t head = head_to_align(d);
+  mem_word_routines.copy(d, s, head);
+  d += head;
+  s += head;
+  n -= head;
+  copy_sse2_blocks(d, s, n / SSE2_BLOCK, true);
+  size_t done = n / SSE2_BLOCK * SSE2_BLOCK;
+  mem_word_routines.copy(d + done, s + done, n - done);
+}
+
+static void set_nt(void *s, int c, size_t n) {
+  unsigned char *p = s;
+  size_t head = head_to_align(p);
+  mem_word_routines.set(p, c, head);
+  p += head;
+  n -= head;
+  set_nt_blocks(p, (unsigned char)c, n / SSE2_BLOCK);
+  size_t done = n / SSE2_BLOCK * SSE2_BLOCK;
+  mem_word_routines.set(p + done, c, n - done);
+}
+
+static void *copy_fsrm(void *dest, const void *src, size_t n) {
+  if (n >= MEMOPS_NT_THRESHOLD) {
+    copy_nt(dest, src, n);
+  } else {
+    rep_movsb(dest, src, n);
+  }
+  return dest;
+}
+
+static void *set_fsrm(void *s, int c, size_t n) {
+  if (n >= MEMOPS_NT_THRESHOLD) {
+    set_nt(s, c, n);
+  } else {
+    rep_stosb(s, (unsigned char)c, n);
+  }
+  return s;
+}
+
+static void *copy_erms(void *dest, const void *src, size_t n) {
+  if (n >= MEMOPS_NT_THRESHOLD) {
+    copy_nt(dest, src, n);
+  } else if (n >= ERMS_THRESHOLD) {
+    rep_movsb(dest, src, n);
+  } else {
+    mem_word_routines.copy(dest, src, n);
+  }
+  return dest;
+}
+
+static void *set_erms(void *s, int c, size_t n) {
+  if (n >= MEMOPS_NT_THRESHOLD) {
+    set_nt(s, c, n);
+  } else if (n >= ERMS_THRESHOLD) {
+    rep_stosb(s, (unsigned char)c, n);
+  } else {
+    mem_word_routines.set(s, c, n);
+  }
+  return s;
+}
+
+static void *copy_sse2(void *dest, const void *src, size_t n) {
+  if (n >= MEMOPS_NT_THRESHOLD) {
+    copy_nt(dest, src, n);
+  } else if (n >= SSE2_BLOCK) {
+    copy_sse2_blocks(dest, src, n / SSE2_BLOCK, false);
+    size_t done = n / SSE2_BLOCK * SSE2_BLOCK;
+    mem_word_routines.copy((unsigned char *)dest + done,
+                           (const unsigned char *)src + done, n - done);
+  } else {
+    mem_word_routines.copy(dest, src, n);
+  }
+  return dest;
+}
+
+static void *set_sse2(void *s, int c, size_t n) {
+  if (n >= MEMOPS_NT_THRESHOLD) {
+    set_nt(s, c, n);
+  } else {
+    mem_word_routines.set(s, c, n);
+  }
+  return s;
+}
+
+const MemRoutines memops_fsrm = {.copy = copy_fsrm, .set = set_fsrm};
+const MemRoutines memops_erms = {.copy = copy_erms, .set = set_erms};
+const MemRoutines memops_sse2 = {.copy = copy_sse2, .set = set_sse2};
+
+const MemRoutines *memops_select(void) {
+  if (cpuid(0, 0).eax < 7) return &memops_sse2;
+  CpuidRegisters regs = cpuid(7, 0);
+  CpuidExtFeatureEbx0 ebx = {.value = regs.ebx};
+  CpuidExtFeatureEdx0 edx = {.value = regs.edx};
+  if (edx.fsrm) return &memops_fsrm;
+  if (ebx.erms) return &memops_erms;
+  return &memops_sse2;
+}
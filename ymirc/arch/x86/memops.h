@@ -0,0 +1,16 @@
+#pragma once
+
+#include "mem.h"
+
+/** Copies and fills of at least this many bytes use non-temporal stores. */
+#define MEMOPS_NT_THRESHOLD (256 * 1024)
+
+/** Routines for CPUs with Fast Short REP MOVSB. */
+extern const MemRoutines memops_fsrm;
+/** Routines for CPUs with Enhanced REP MOVSB/STOSB. */
+extern const MemRoutines memops_erms;
+/** Routines that need only SSE2, which every x86-64 CPU has. */
+extern const MemRoutines memops_sse2;
+
+/** Pick the fastest routines the CPU supports. */
+const MemRoutines *memops_select(void);
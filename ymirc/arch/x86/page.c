@@ -59,13 +59,10 @@ typedef struct {
 static const page_allocator_ops_t *pa;
 
 static PageTable *allocate_table() {
-  PageTable *table_addr = pa->alloc_aligned_pages(1, PAGE_SIZE);
+  PageTable *table_addr = pa->alloc_zeroed_pages(1);
   if (!table_addr) {
     panic("Failed to allocate memory for the page table.");
   }
-  for (uint64_t i = 0; i < NUM_TABLE_ENTRIES; i++) {
-    table_addr->entries[i].value = 0;
-  }
   return table_addr;
 }
 
@@ -70,6 +70,12 @@ static inline uint16_t data_port(IrqLine irq) {
   return is_primary(irq) ? primary_data_port : secondary_data_port;
 }
 
+void pic_mask_all() {
+  // OCW1
+  outb(0xFF, primary_data_port);
+  outb(0xFF, secondary_data_port);
+}
+
 void set_mask(IrqLine irq) {
   // OCW1
   uint16_t port = data_port(irq);
@@ -39,6 +39,9 @@ static inline int delta(IrqLine irq) { return is_primary(irq) ? irq : irq - 8; }
  * PIC. */
 void pic_init();
 
+/** Mask all IRQ lines. */
+void pic_mask_all();
+
 /** Mask the given IRQ line. */
 void set_mask(IrqLine irq);
 
@@ -0,0 +1,52 @@
+#include "pit.h"
+
+#include <stdint.h>
+#include <sys/io.h>
+
+#include "arch.h"
+
+static const uint16_t channel0_port = 0x40;
+static const uint16_t channel2_port = 0x42;
+static const uint16_t command_port = 0x43;
+/** NMI status and control port. It gates channel 2 and shows its output. */
+static const uint16_t nmi_sc_port = 0x61;
+
+/** Control words: channel, low then high byte access, and mode 0. */
+#define CONTROL_CHANNEL0_MODE0 0x30
+#define CONTROL_CHANNEL2_MODE0 0xB0
+
+/** Bits of the NMI status and control port. */
+#define NMI_SC_GATE2 0x01
+#define NMI_SC_SPEAKER 0x02
+#define NMI_SC_OUT2 0x20
+
+/** PIT ticks the TSC is measured over, about 10 ms. */
+#define CALIBRATION_TICKS (PIT_HZ / 100)
+
+uint64_t pit_calibrate_tsc() {
+  uint8_t nmi_sc = inb(nmi_sc_port);
+  // Open the gate of channel 2 with the speaker off.
+  outb((nmi_sc & ~NMI_SC_SPEAKER) | NMI_SC_GATE2, nmi_sc_port);
+
+  outb(CONTROL_CHANNEL2_MODE0, command_port);
+  outb(CALIBRATION_TICKS & 0xFF, channel2_port);
+  outb(CALIBRATION_TICKS >> 8, channel2_port);
+  uint64_t start = read_timestamp();
+  // OUT2 goes high at the terminal count.
+  while ((inb(nmi_sc_port) & NMI_SC_OUT2) == 0);
+  uint64_t end = read_timestamp();
+
+  outb(nmi_sc, nmi_sc_port);
+  return (end - start) * PIT_HZ / CALIBRATION_TICKS;
+}
+
+void pit_oneshot(uint16_t count) {
+  outb(CONTROL_CHANNEL0_MODE0, command_port);
+  outb(count & 0xFF, channel0_port);
+  outb(count >> 8, channel0_port);
+}
+
+void pit_stop() {
+  // A control word stops the counter until a count is written.
+  outb(CONTROL_CHANNEL0_MODE0, command_port);
+}
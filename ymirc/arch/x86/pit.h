@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+
+/** Input clock of the PIT in Hz. */
+#define PIT_HZ 1193182
+
+/** Measure the TSC frequency in Hz with channel 2 of the PIT. */
+uint64_t pit_calibrate_tsc();
+
+/** Raise IRQ0 once after `count` PIT ticks, using channel 0 in mode 0. A count
+ * of 0 stands for 65536. */
+void pit_oneshot(uint16_t count);
+
+/** Stop channel 0 without raising IRQ0. */
+void pit_stop();
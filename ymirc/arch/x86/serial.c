@@ -3,6 +3,8 @@
 #include <stdint.h>
 #include <sys/io.h>
 
+#include "arch.h"
+#include "asm.h"
 #include "bits.h"
 #include "panic.h"
 
@@ -38,33 +40,51 @@ static const int sr __attribute__((unused)) = 7;
 
 static const int divisor_latch_numerator = 115200;
 
-/** Write a single byte to the serial console. */
-static void write_byte(uint8_t byte, uint16_t addr) {
-  // Wait for the transmitter holding register to be empty
-  while (!isset_8(inb(addr + lsr), 5)) {
-    __asm__ __volatile__("rep; nop");
-  }
-  outb(byte, addr);
+/** FCR: enable and clear both FIFOs, interrupt at 14 received bytes. */
+#define FCR_ENABLE_FIFO 0xC7
+/** LSR bits. */
+#define LSR_DATA_READY 0
+#define LSR_THR_EMPTY 5
+
+/** Disable interrupts and take the lock, so that the serial interrupt does
+ * not see the rings half updated. Returns whether interrupts were enabled. */
+static bool lock_serial(Serial *serial) {
+  bool intr = read_rflags().ief;
+  disable_intr();
+  spin_lock(&serial->lock);
+  return intr;
 }
 
-void write_byte_com1(uint8_t byte) { write_byte(byte, COM1); }
-void write_byte_com2(uint8_t byte) { write_byte(byte, COM2); }
-void write_byte_com3(uint8_t byte) { write_byte(byte, COM3); }
+static void unlock_serial(Serial *serial, bool intr) {
+  spin_unlock(&serial->lock);
+  if (intr) enable_intr();
+}
 
-/** Read a byte from Rx buffer. If Rx buffer is empty, return -1. */
-static int try_read_byte(uint16_t addr) {
-  // Check if Rx buffer is not empty.
-  if (!isset_8(inb(addr + lsr), 0)) {
-    return -1;
-  }
+static inline uint32_t tx_count(const Serial *serial) {
+  return serial->tx_head - serial->tx_tail;
+}
 
-  // read char from the receiver buffer.
-  return inb(addr);
+/** Move bytes from the Tx ring to the FIFO if it is empty. The lock MUST be
+ * held. */
+static void pump_tx(Serial *serial) {
+  if (tx_count(serial) == 0) return;
+  if (!isset_8(inb(serial->addr + lsr), LSR_THR_EMPTY)) return;
+  for (int i = 0; i < SERIAL_FIFO_SIZE && tx_count(serial) > 0; i++) {
+    outb(serial->tx_buf[serial->tx_tail++ % SERIAL_TX_RING_SIZE],
+         serial->addr + txr);
+  }
 }
 
-int try_read_byte_com1() { return try_read_byte(COM1); }
-int try_read_byte_com2() { return try_read_byte(COM2); }
-int try_read_byte_com3() { return try_read_byte(COM3); }
+/** Move received bytes to the Rx ring. Bytes that do not fit are dropped.
+ * The lock MUST be held. */
+static void pump_rx(Serial *serial) {
+  while (isset_8(inb(serial->addr + lsr), LSR_DATA_READY)) {
+    uint8_t c = inb(serial->addr + rxr);
+    if (serial->rx_head - serial->rx_tail < SERIAL_RX_RING_SIZE) {
+      serial->rx_buf[serial->rx_head++ % SERIAL_RX_RING_SIZE] = c;
+    }
+  }
+}
 
 void serial_init(Serial *serial, SerialPort port, uint32_t baud) {
   switch (port) {
@@ -80,10 +100,14 @@ void serial_init(Serial *serial, SerialPort port, uint32_t baud) {
     default:
       panic("Unsupported serial port.");
   }
+  serial->intr_enabled = false;
+  serial->lock = (Spinlock)SPINLOCK_INIT;
+  serial->tx_head = serial->tx_tail = 0;
+  serial->rx_head = serial->rx_tail = 0;
 
-  outb(0x3, serial->addr + lcr);  // 8 bits, no parity, 1 stop bit
-  outb(0x0, serial->addr + ier);  // Disable interrupts
-  outb(0x0, serial->addr + fcr);  // Disable FIFO
+  outb(0x3, serial->addr + lcr);              // 8 bits, no parity, 1 stop bit
+  outb(0x0, serial->addr + ier);              // Disable interrupts
+  outb(FCR_ENABLE_FIFO, serial->addr + fcr);  // Enable FIFO
 
   // Set baud rate
   int divisor = divisor_latch_numerator / baud;
@@ -92,36 +116,66 @@ void serial_init(Serial *serial, SerialPort port, uint32_t baud) {
   outb(divisor & 0xFF, serial->addr + dll);         // Set divisor low byte
   outb((divisor >> 8) & 0xFF, serial->addr + dlh);  // Set divisor high byte
   outb(c & 0b01111111, serial->addr + lcr);         // Disable DLAB
+}
 
-  // Set write-function
-  switch (serial->addr) {
-    case COM1:
-      serial->write_fn = write_byte_com1;
-      break;
-    case COM2:
-      serial->write_fn = write_byte_com2;
-      break;
-    case COM3:
-      serial->write_fn = write_byte_com3;
-      break;
+size_t serial_write_nonblocking(Serial *serial, const uint8_t *buf,
+                                size_t len) {
+  bool intr = lock_serial(serial);
+  size_t queued = 0;
+  while (queued < len && tx_count(serial) < SERIAL_TX_RING_SIZE) {
+    serial->tx_buf[serial->tx_head++ % SERIAL_TX_RING_SIZE] = buf[queued++];
   }
+  // Start the transmission if the FIFO is idle. The Tx-empty interrupt
+  // continues it.
+  pump_tx(serial);
+  unlock_serial(serial, intr);
+  return queued;
+}
 
-  // Set read-function
-  switch (serial->addr) {
-    case COM1:
-      serial->read_fn = try_read_byte_com1;
-      break;
-    case COM2:
-      serial->read_fn = try_read_byte_com2;
-      break;
-    case COM3:
-      serial->read_fn = try_read_byte_com3;
-      break;
+void serial_flush(Serial *serial) {
+  bool intr = lock_serial(serial);
+  while (tx_count(serial) > 0) {
+    pump_tx(serial);
+    __asm__ __volatile__("pause");
+  }
+  unlock_serial(serial, intr);
+}
+
+void serial_write(Serial *serial, uint8_t c) {
+  // The ring is full. Drain it by polling, since the interrupt may be blocked
+  // by the caller.
+  while (serial_write_nonblocking(serial, &c, 1) == 0) {
+    bool intr = lock_serial(serial);
+    pump_tx(serial);
+    unlock_serial(serial, intr);
+    __asm__ __volatile__("pause");
   }
+  if (!serial->intr_enabled) serial_flush(serial);
 }
 
-void enable_serial_interrupt(const Serial *serial) {
+int serial_read(Serial *serial) {
+  bool intr = lock_serial(serial);
+  pump_rx(serial);
+  int c = -1;
+  if (serial->rx_head != serial->rx_tail) {
+    c = serial->rx_buf[serial->rx_tail++ % SERIAL_RX_RING_SIZE];
+  }
+  unlock_serial(serial, intr);
+  return c;
+}
+
+void enable_serial_interrupt(Serial *serial) {
   uint8_t ie = inb(serial->addr + ier);
   ie |= 0b00000011;  // Rx-available, Tx-empty
   outb(ie, serial->addr + ier);
+  serial->intr_enabled = true;
+}
+
+void serial_handle_interrupt(Serial *serial) {
+  bool intr = lock_serial(serial);
+  // Reading IIR acknowledges a pending Tx-empty interrupt.
+  inb(serial->addr + iir);
+  pump_rx(serial);
+  pump_tx(serial);
+  unlock_serial(serial, intr);
 }
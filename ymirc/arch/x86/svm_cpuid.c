@@ -1,11 +1,18 @@
+#define LOG_SUBSYSTEM LOG_SUBSYS_CPUID
+
 #include "svm_cpuid.h"
 
 #include <stdint.h>
 
 #include "cpuid.h"
 #include "log.h"
+#include "svm_lapic.h"
 
-static const CpuidStdFeatureInfoEcx std_feature_info_ecx = {0};
+static const CpuidStdFeatureInfoEcx std_feature_info_ecx =
+    (CpuidStdFeatureInfoEcx){
+        .x2apic = 1,
+        .tsc_deadline = 1,
+    };
 static const CpuidStdFeatureInfoEdx std_feature_info_edx =
     (CpuidStdFeatureInfoEdx){
         .fpu = 1,
@@ -15,6 +22,7 @@ static const CpuidStdFeatureInfoEdx std_feature_info_edx =
         .msr = 1,
         .pae = 1,
         .cmpxchg8b = 1,
+        .apic = 1,
         .sysentersysexit = 1,
         .pge = 1,
         .cmov = 1,
@@ -71,7 +79,7 @@ static uint32_t get_ext_feature_info_edx(uint32_t orig) {
   feature_info.pae = 1;
   feature_info.mce = 0;
   feature_info.cmpxchg8b = 1;
-  feature_info.apic = 0;
+  feature_info.apic = 1;
   feature_info.mtrr = 0;
   feature_info.pge = 1;
   feature_info.mca = 0;
@@ -106,8 +114,9 @@ void handle_svm_cpuid_exit(SvmVcpu *vcpu) {
       CpuidRegisters orig_1 = cpuid(0x1, 0x0);
       setvalue_safely(&vmcb->rax,
                       orig_1.eax);  // Family, Model, Stepping Identifiers
+      // LocalApicId, LogicalProcessorCount, CLFlush
       setvalue(&regs->rbx,
-               orig_1.ebx);  // LocalApicId, LogicalProcessorCount, CLFlush
+               (orig_1.ebx & 0x00FFFFFF) | (uint32_t)SVM_LAPIC_ID << 24);
       setvalue(&regs->rcx, std_feature_info_ecx.value);
       setvalue(&regs->rdx, std_feature_info_edx.value);
       break;
@@ -1,10 +1,16 @@
+#define LOG_SUBSYSTEM LOG_SUBSYS_IOIO
+
 #include "svm_ioio.h"
 
 #include <stdint.h>
-#include <sys/io.h>
 
+#include "bits.h"
 #include "log.h"
+#include "pic.h"
 #include "serial.h"
+#include "svm_pci.h"
+#include "svm_pit.h"
+#include "trace.h"
 
 /** EXITINFO1 for IOIO Intercept */
 typedef union {
@@ -33,9 +39,22 @@ static void handle_pit_out(SvmVcpu *vcpu, IOIOInterceptInfo info);
 static void handle_pic_in(SvmVcpu *vcpu, IOIOInterceptInfo info);
 static void handle_pic_out(SvmVcpu *vcpu, IOIOInterceptInfo info);
 
+static unsigned int access_size(IOIOInterceptInfo info) {
+  return info.sz8 ? 1 : info.sz16 ? 2 : info.sz32 ? 4 : 0;
+}
+
 static void handle_ioio_in(SvmVcpu *vcpu, IOIOInterceptInfo info) {
   Vmcb *vmcb = vcpu->vmcb;
 
+  uint32_t value;
+  unsigned int size = access_size(info);
+  if (svm_pci_io_in(vcpu, info.port, size, &value)) {
+    // Narrow accesses only replace the low bytes of RAX.
+    uint64_t mask = size == 4 ? 0xFFFFFFFFFFFFFFFFULL : (1ULL << size * 8) - 1;
+    vmcb->rax = (vmcb->rax & ~mask) | value;
+    return;
+  }
+
   switch (info.port) {
     case 0x0020 ... 0x0021:
       handle_pic_in(vcpu, info);
@@ -66,10 +85,7 @@ static void handle_ioio_in(SvmVcpu *vcpu, IOIOInterceptInfo info) {
     case 0x03F8 ... 0x03FF:
       handle_serial_in(vcpu, info);
       break;
-    case 0xC000 ... 0xCFFF:  // Old PCI. Ignore.
-      break;
-    case 0x0CF8 ... 0x0CFF:  // PCI. Unimplemented.
-      vmcb->rax = 0;
+    case 0xC000 ... 0xCFFF:  // Old PCI, except the BARs. Ignore.
       break;
     default:
       LOG_ERROR("Unhandled I/O-in port: 0x%x\n", info.port);
@@ -78,6 +94,10 @@ static void handle_ioio_in(SvmVcpu *vcpu, IOIOInterceptInfo info) {
 }
 
 static void handle_ioio_out(SvmVcpu *vcpu, IOIOInterceptInfo info) {
+  unsigned int size = access_size(info);
+  uint32_t value = vcpu->vmcb->rax & (0xFFFFFFFFULL >> (32 - size * 8));
+  if (svm_pci_io_out(vcpu, info.port, size, value)) return;
+
   switch (info.port) {
     case 0x0020 ... 0x0021:
       handle_pic_out(vcpu, info);
@@ -100,8 +120,7 @@ static void handle_ioio_out(SvmVcpu *vcpu, IOIOInterceptInfo info) {
     case 0x03F8 ... 0x03FF:
       handle_serial_out(vcpu, info);
       break;
-    case 0xC000 ... 0xCFFF:  // Old PCI. Ignore.
-    case 0x0CF8 ... 0x0CFF:  // PCI. Unimplemented.
+    case 0xC000 ... 0xCFFF:  // Old PCI, except the BARs. Ignore.
       break;
     default:
       LOG_ERROR("Unhandled I/O-out port: 0x%x\n", info.port);
@@ -112,6 +131,7 @@ static void handle_ioio_out(SvmVcpu *vcpu, IOIOInterceptInfo info) {
 void handle_svm_ioio_exit(SvmVcpu *vcpu) {
   uint32_t exitinfo1 = (uint32_t)(vcpu->vmcb->exitinfo1 & 0xFFFFFFFF);
   IOIOInterceptInfo info = {.value = exitinfo1};
+  TRACEPOINT(ioio, info.port, info.type, access_size(info));
 
   // 0 = OUT instruction, 1 = IN instruction
   switch (info.type) {
@@ -126,109 +146,216 @@ void handle_svm_ioio_exit(SvmVcpu *vcpu) {
 
 // =============================================================================
 
+/** Serial register bits. */
+#define SERIAL_IER_RX_AVAILABLE 0x01
+#define SERIAL_IER_THR_EMPTY 0x02
+#define SERIAL_IIR_NO_INTERRUPT 0x01
+#define SERIAL_IIR_THR_EMPTY 0x02
+#define SERIAL_IIR_RX_AVAILABLE 0x04
+#define SERIAL_IIR_FIFO_ENABLED 0xC0
+#define SERIAL_FCR_ENABLE_FIFO 0x01
+#define SERIAL_FCR_CLEAR_RX 0x02
+#define SERIAL_LCR_DLAB 0x80
+#define SERIAL_LSR_DATA_READY 0x01
+#define SERIAL_LSR_THR_EMPTY 0x20
+#define SERIAL_LSR_TRANSMITTER_EMPTY 0x40
+#define SERIAL_MCR_OUT2 0x08
+#define SERIAL_MCR_LOOPBACK 0x10
+#define SERIAL_MSR_CTS 0x10
+#define SERIAL_MSR_DSR 0x20
+#define SERIAL_MSR_DCD 0x80
+
+static inline uint8_t rx_fifo_count(const SvmIoioGuestState *state) {
+  return state->rx_head - state->rx_tail;
+}
+
+/** Interrupt the guest's serial port would assert, as reported by IIR. */
+static uint8_t serial_pending_intr(const SvmIoioGuestState *state) {
+  if ((state->ier & SERIAL_IER_RX_AVAILABLE) && rx_fifo_count(state) > 0) {
+    return SERIAL_IIR_RX_AVAILABLE;
+  }
+  if ((state->ier & SERIAL_IER_THR_EMPTY) && state->thre_pending) {
+    return SERIAL_IIR_THR_EMPTY;
+  }
+  return SERIAL_IIR_NO_INTERRUPT;
+}
+
+/** Recompute the virtual IRQ4 line and mark IRQ4 pending on a rising edge.
+ * MCR.OUT2 gates the line as on a PC. */
+static void update_serial_irq(SvmVcpu *vcpu) {
+  SvmIoioGuestState *state = &vcpu->guest_ioio_state;
+  bool line = serial_pending_intr(state) != SERIAL_IIR_NO_INTERRUPT &&
+              (state->mcr & SERIAL_MCR_OUT2);
+  if (line && !state->serial_irq_line) {
+    vcpu->pending_irq |= tobit_16(irq_serial1);
+  }
+  state->serial_irq_line = line;
+}
+
+void svm_ioio_serial_poll_rx(SvmVcpu *vcpu) {
+#ifndef GUEST_CONSOLE_HVC
+  SvmIoioGuestState *state = &vcpu->guest_ioio_state;
+  while (rx_fifo_count(state) < SVM_SERIAL_RX_FIFO_SIZE) {
+    int c = serial_read(vcpu->serial);
+    if (c == -1) break;
+    state->rx_fifo[state->rx_head++ % SVM_SERIAL_RX_FIFO_SIZE] = c;
+  }
+#endif
+  update_serial_irq(vcpu);
+}
+
+static uint8_t serial_modem_status(const SvmIoioGuestState *state) {
+  if (state->mcr & SERIAL_MCR_LOOPBACK) {
+    // DTR, RTS, OUT1 and OUT2 loop back to DSR, CTS, RI and DCD.
+    uint8_t mcr = state->mcr;
+    return ((mcr & 0x01) << 5) | ((mcr & 0x02) << 3) | ((mcr & 0x04) << 4) |
+           ((mcr & 0x08) << 4);
+  }
+  return SERIAL_MSR_DCD | SERIAL_MSR_DSR | SERIAL_MSR_CTS;
+}
+
 static void handle_serial_in(SvmVcpu *vcpu, IOIOInterceptInfo info) {
   Vmcb *vmcb = vcpu->vmcb;
+  SvmIoioGuestState *state = &vcpu->guest_ioio_state;
+  bool dlab = state->lcr & SERIAL_LCR_DLAB;
 
   switch (info.port) {
-    // Receive buffer.
+    // Receive buffer (DLAB=0) / Divisor Latch Low Register (DLAB=1).
     case 0x3F8:
-      vmcb->rax = inb(info.port);  // pass-through
+      if (dlab) {
+        vmcb->rax = state->dll;
+      } else if (rx_fifo_count(state) > 0) {
+        vmcb->rax = state->rx_fifo[state->rx_tail++ % SVM_SERIAL_RX_FIFO_SIZE];
+        // Refill from the Rx ring.
+        svm_ioio_serial_poll_rx(vcpu);
+      } else {
+        vmcb->rax = 0;
+      }
       break;
-    // Interrupt Enable Register (DLAB=1) / Divisor Latch High Register
-    // (DLAB=0)
+    // Interrupt Enable Register (DLAB=0) / Divisor Latch High Register
+    // (DLAB=1)
     case 0x3F9:
-      vmcb->rax = vcpu->guest_ioio_state.ier;
+      vmcb->rax = dlab ? state->dlh : state->ier;
       break;
     // Interrupt Identification Register.
-    case 0x3FA:
-      vmcb->rax = inb(info.port);  // pass-through
-      break;
+    case 0x3FA: {
+      uint8_t intr = serial_pending_intr(state);
+      // Reading IIR clears the THR empty interrupt it reports.
+      if (intr == SERIAL_IIR_THR_EMPTY) state->thre_pending = false;
+      if (state->fcr & SERIAL_FCR_ENABLE_FIFO) intr |= SERIAL_IIR_FIFO_ENABLED;
+      vmcb->rax = intr;
+      break;
+    }
     // Line Control Register (MSB is DLAB).
     case 0x3FB:
-      vmcb->rax = 0x00;
+      vmcb->rax = state->lcr;
       break;
     // Modem Control Register.
     case 0x3FC:
-      vmcb->rax = vcpu->guest_ioio_state.mcr;
+      vmcb->rax = state->mcr;
       break;
-    // Line Status Register.
+    // Line Status Register. Written bytes go to YmirC's Tx ring at once, so
+    // the transmitter is always empty.
     case 0x3FD:
-      vmcb->rax = inb(info.port);  // pass-through
+      vmcb->rax = SERIAL_LSR_THR_EMPTY | SERIAL_LSR_TRANSMITTER_EMPTY |
+                  (rx_fifo_count(state) > 0 ? SERIAL_LSR_DATA_READY : 0);
       break;
     // Modem Status Register.
     case 0x3FE:
-      vmcb->rax = inb(info.port);  // pass-through
+      vmcb->rax = serial_modem_status(state);
       break;
     // Scratch Register.
     case 0x3FF:
-      vmcb->rax = 0x00;  // 8250
+      vmcb->rax = state->scr;
       break;
     default:
       LOG_ERROR("Unsupported I/O-in to the first serial port: 0x%x\n",
                 info.port);
       svm_vcpu_abort(vcpu);
   }
+  update_serial_irq(vcpu);
 }
 
 static void handle_serial_out(SvmVcpu *vcpu, IOIOInterceptInfo info) {
   Vmcb *vmcb = vcpu->vmcb;
+  SvmIoioGuestState *state = &vcpu->guest_ioio_state;
+  bool dlab = state->lcr & SERIAL_LCR_DLAB;
+  uint8_t value = (uint8_t)(vmcb->rax & 0xFF);
 
   switch (info.port) {
-    // Transmit buffer.
+    // Transmit buffer (DLAB=0) / Divisor Latch Low Register (DLAB=1).
     case 0x3F8:
-      serial_write(vcpu->serial, (uint8_t)(vmcb->rax & 0xFF));
+      if (dlab) {
+        state->dll = value;
+      } else {
+        serial_write(vcpu->serial, value);
+        // THR is empty again right away.
+        state->thre_pending = true;
+      }
       break;
-    // Interrupt Enable Register.
+    // Interrupt Enable Register (DLAB=0) / Divisor Latch High Register
+    // (DLAB=1).
     case 0x3F9:
-      vcpu->guest_ioio_state.ier = (uint8_t)(vmcb->rax & 0xFF);
+      if (dlab) {
+        state->dlh = value;
+        break;
+      }
+      // Enabling the THR empty interrupt with an empty THR raises it.
+      if (!(state->ier & SERIAL_IER_THR_EMPTY) &&
+          (value & SERIAL_IER_THR_EMPTY)) {
+        state->thre_pending = true;
+      }
+      state->ier = value & 0x0F;
       break;
     // FIFO control registers.
     case 0x3FA:
-      // ignore
+      state->fcr = value;
+      if (value & SERIAL_FCR_CLEAR_RX) state->rx_tail = state->rx_head;
       break;
-    // Line Control Register (MSB is DLAB).
+    // Line Control Register (MSB is DLAB). YmirC owns the line settings.
     case 0x3FB:
-      // ignore
+      state->lcr = value;
       break;
     // Modem Control Register.
     case 0x3FC:
-      vcpu->guest_ioio_state.mcr = (uint8_t)(vmcb->rax & 0xFF);
+      state->mcr = value;
       break;
     // Scratch Register.
     case 0x3FF:
-      // ignore
+      state->scr = value;
       break;
     default:
       LOG_ERROR("Unsupported I/O-out to the first serial port: 0x%x\n",
                 info.port);
       svm_vcpu_abort(vcpu);
   }
+  update_serial_irq(vcpu);
 }
 
 static void handle_pit_in(SvmVcpu *vcpu, IOIOInterceptInfo info) {
   Vmcb *vmcb = vcpu->vmcb;
 
-  // Pass-through.
-  if (info.sz8) {
-    vmcb->rax = inb(info.port);
-  } else if (info.sz16) {
-    vmcb->rax = inw(info.port);
-  } else if (info.sz32) {
-    vmcb->rax = inl(info.port);
+  if (!info.sz8) {
+    int size = info.sz16 ? 16 : 32;
+    LOG_ERROR("Unsupported I/O-in size to PIT: size=%d, port=0x%x\n", size,
+              info.port);
+    svm_vcpu_abort(vcpu);
   }
+
+  vmcb->rax = svm_pit_in(vcpu, info.port);
 }
 
 static void handle_pit_out(SvmVcpu *vcpu, IOIOInterceptInfo info) {
   Vmcb *vmcb = vcpu->vmcb;
 
-  // Pass-through.
-  if (info.sz8) {
-    outb((uint8_t)(vmcb->rax & 0xFF), info.port);
-  } else if (info.sz16) {
-    outw((uint16_t)(vmcb->rax & 0xFFFF), info.port);
-  } else if (info.sz32) {
-    outl((uint32_t)(vmcb->rax & 0xFFFFFFFF), info.port);
+  if (!info.sz8) {
+    int size = info.sz16 ? 16 : 32;
+    LOG_ERROR("Unsupported I/O-out size to PIT: size=%d, port=0x%x\n", size,
+              info.port);
+    svm_vcpu_abort(vcpu);
   }
+
+  svm_pit_out(vcpu, info.port, (uint8_t)(vmcb->rax & 0xFF));
 }
 
 static void handle_pic_in(SvmVcpu *vcpu, IOIOInterceptInfo info) {
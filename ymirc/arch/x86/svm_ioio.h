@@ -5,3 +5,8 @@
 /** Handle #VMEXIT caused by IOIO instructions.
  * Note that this function does not increment the RIP. */
 void handle_svm_ioio_exit(SvmVcpu *vcpu);
+
+/** Move bytes from YmirC's Rx ring to the virtual Rx FIFO of the guest's
+ * first serial port, and raise IRQ4 if the guest enabled the interrupt. With
+ * GUEST_CONSOLE=hvc, input goes to the virtio console instead. */
+void svm_ioio_serial_poll_rx(SvmVcpu *vcpu);
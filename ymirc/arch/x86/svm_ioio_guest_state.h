@@ -1,7 +1,11 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
+/** Depth of the guest's virtual Rx FIFO, as on a 16550A. */
+#define SVM_SERIAL_RX_FIFO_SIZE 16
+
 typedef enum {
   SVM_PIC_INIT_PHASE_UNINITIALIZED,
   SVM_PIC_INIT_PHASE_PHASE1,
@@ -15,6 +19,20 @@ typedef struct {
   /** Serial port register values. */
   uint8_t ier;  // Interrupt Enable Register.
   uint8_t mcr;  // Modem Control Register.
+  uint8_t lcr;  // Line Control Register.
+  uint8_t fcr;  // FIFO Control Register.
+  uint8_t scr;  // Scratch Register.
+  uint8_t dll;  // Divisor Latch Low Byte.
+  uint8_t dlh;  // Divisor Latch High Byte.
+  /** Virtual Rx FIFO, fed from YmirC's Rx ring. */
+  uint8_t rx_fifo[SVM_SERIAL_RX_FIFO_SIZE];
+  uint8_t rx_head;
+  uint8_t rx_tail;
+  /** THR empty interrupt is pending until IIR reports it or THR is
+   * written. */
+  bool thre_pending;
+  /** Level of the virtual IRQ4 line. IRQ4 is raised on its rising edge. */
+  bool serial_irq_line;
 
   /** 8259 Programmable Interrupt Controller. */
   uint8_t primary_mask;           // Mask of the primary PIC.
@@ -0,0 +1,581 @@
+#define LOG_SUBSYSTEM LOG_SUBSYS_MSR
+
+#include "svm_lapic.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "apic.h"
+#include "arch.h"
+#include "arena.h"
+#include "asm.h"
+#include "bits.h"
+#include "cpuid.h"
+#include "log.h"
+#include "mem.h"
+#include "panic.h"
+#include "timer.h"
+
+/** Physical address of the APIC registers in xAPIC mode. */
+#define APIC_BASE_ADDRESS 0xFEE00000ULL
+
+/** Version 0x14 of an integrated APIC, with the LVT entries up to error. */
+#define APIC_VERSION (0x14 | (SVM_LAPIC_NUM_LVT - 1) << 16)
+
+/** Writable bits of the registers. */
+#define SVR_MASK 0x11FF
+#define LVT_TIMER_MASK 0x710FF
+#define LVT_LINT_MASK 0x1A7FF
+#define LVT_MASK 0x107FF
+#define DIVIDE_CONFIG_MASK 0xB
+
+/** Fields of an LVT entry. */
+#define LVT_VECTOR_MASK 0xFF
+#define LVT_DELIVERY_MODE_SHIFT 8
+#define LVT_DELIVERY_MODE_MASK 0x700
+#define LVT_TIMER_MODE_MASK (0b11 << APIC_LVT_TIMER_MODE)
+
+/** Delivery modes of LVT entries and of the ICR. */
+#define DELIVERY_FIXED 0
+#define DELIVERY_NMI 4
+#define DELIVERY_EXTINT 7
+
+/** Fields of the ICR. */
+#define ICR_VECTOR_MASK 0xFF
+#define ICR_DELIVERY_MODE_SHIFT 8
+#define ICR_DEST_LOGICAL 11
+#define ICR_SHORTHAND_SHIFT 18
+#define ICR_DEST_SHIFT 32
+
+/** Destination shorthands of the ICR. */
+#define SHORTHAND_NONE 0
+#define SHORTHAND_SELF 1
+#define SHORTHAND_ALL 2
+#define SHORTHAND_ALL_BUT_SELF 3
+
+/** Vectors below 16 are reserved and never requested. */
+#define FIRST_VALID_VECTOR 16
+
+/** Registers are 16 bytes apart in the register page. */
+#define REG_STRIDE (16 / sizeof(uint32_t))
+/** Register holding the high half of the ICR in the register page. */
+#define ICR_HIGH (X2APIC_ICR + 1)
+
+/** Fields of an entry of the AVIC physical APIC ID table. */
+#define AVIC_PHYSICAL_HOST_ID_MASK 0xFFFULL
+#define AVIC_PHYSICAL_RUNNING 62
+#define AVIC_PHYSICAL_VALID 63
+/** Bit of an entry of the AVIC logical APIC ID table. */
+#define AVIC_LOGICAL_VALID 31
+/** Reason of AVIC_INCOMPLETE_IPI in EXITINFO2[63:32]: the IPI is in the IRR
+ * but the target is not running. */
+#define AVIC_IPI_TARGET_NOT_RUNNING 1
+
+static inline SvmLapicState *lapic_of(SvmVcpu *vcpu) {
+  return &vcpu->lapic_state;
+}
+
+static uint32_t *reg(SvmLapicState *lapic, uint32_t msr) {
+  return &lapic->regs[(msr - X2APIC_MSR_FIRST) * REG_STRIDE];
+}
+
+static bool software_enabled(SvmLapicState *lapic) {
+  return isset(*reg(lapic, X2APIC_SVR), APIC_SVR_ENABLE);
+}
+
+/** Whether `vector` is set in the ISR, TMR or IRR starting at `base`. */
+static bool test_vector(SvmLapicState *lapic, uint32_t base, uint8_t vector) {
+  return isset(*reg(lapic, base + vector / 32), vector % 32);
+}
+
+static void set_vector(SvmLapicState *lapic, uint32_t base, uint8_t vector) {
+  *reg(lapic, base + vector / 32) |= (uint32_t)tobit(vector % 32);
+}
+
+static void clear_vector(SvmLapicState *lapic, uint32_t base,
+                         uint8_t vector) {
+  *reg(lapic, base + vector / 32) &= ~(uint32_t)tobit(vector % 32);
+}
+
+/** Highest vector set in the ISR, TMR or IRR starting at `base`, or -1. */
+static int highest_vector(SvmLapicState *lapic, uint32_t base) {
+  for (int i = SVM_LAPIC_VECTOR_WORDS - 1; i >= 0; i--) {
+    uint32_t word = *reg(lapic, base + i);
+    if (word != 0) return i * 32 + 31 - __builtin_clz(word);
+  }
+  return -1;
+}
+
+/** Processor Priority Register. */
+static uint32_t processor_priority(SvmLapicState *lapic) {
+  int isrv = highest_vector(lapic, X2APIC_ISR0);
+  uint32_t isr_class = isrv < 0 ? 0 : isrv & 0xF0;
+  uint32_t tpr = *reg(lapic, X2APIC_TPR);
+  return (tpr & 0xF0) >= isr_class ? tpr : isr_class;
+}
+
+/** Keep the PPR in the register page up to date after the TPR or the ISR
+ * changed, since AVIC lets the guest read it from there. */
+static void update_ppr(SvmLapicState *lapic) {
+  *reg(lapic, X2APIC_PPR) = processor_priority(lapic);
+}
+
+/** Logical Destination Register, derived from the ID in x2APIC mode. */
+static uint32_t logical_destination() {
+  return ((SVM_LAPIC_ID >> 4) << 16) | (1 << (SVM_LAPIC_ID & 0xF));
+}
+
+/** Ring the doorbell of the CPU the guest runs on, so that AVIC takes a new
+ * request at once. The request is taken on the next VMRUN anyway if the
+ * guest is not running, or if it runs on this CPU, which is in the host
+ * now. */
+static void ring_doorbell(SvmLapicState *lapic) {
+  uint64_t entry = lapic->physical_table[SVM_LAPIC_ID];
+  if (!isset(entry, AVIC_PHYSICAL_RUNNING)) return;
+
+  uint32_t host_id = entry & AVIC_PHYSICAL_HOST_ID_MASK;
+  if (host_id != apic_id()) write_msr(MSR_AVIC_DOORBELL, host_id);
+}
+
+/** Request a fixed interrupt. It is dropped while the APIC is software
+ * disabled. */
+static void request(SvmLapicState *lapic, uint8_t vector) {
+  if (!software_enabled(lapic) || vector < FIRST_VALID_VECTOR) return;
+  set_vector(lapic, X2APIC_IRR0, vector);
+  if (lapic->avic) ring_doorbell(lapic);
+}
+
+// =============================================================================
+// Timer
+
+static ApicTimerMode timer_mode(SvmLapicState *lapic) {
+  return (*reg(lapic, X2APIC_LVT_TIMER) & LVT_TIMER_MODE_MASK) >>
+         APIC_LVT_TIMER_MODE;
+}
+
+/** The timer counts TSC cycles through the divider. Returns the shift that
+ * divides them. */
+static unsigned int divide_shift(SvmLapicState *lapic) {
+  uint32_t divide_config = *reg(lapic, X2APIC_TIMER_DIVIDE);
+  uint32_t value = ((divide_config & 0x8) >> 1) | (divide_config & 0x3);
+  return value == 0b111 ? 0 : value + 1;
+}
+
+/** Current Count Register. */
+static uint32_t current_count(SvmLapicState *lapic) {
+  uint32_t initial_count = *reg(lapic, X2APIC_TIMER_INITIAL);
+  if (timer_mode(lapic) == APIC_TIMER_TSC_DEADLINE) return 0;
+  if (initial_count == 0) return 0;
+
+  uint64_t elapsed =
+      (read_timestamp() - lapic->timer_start) >> divide_shift(lapic);
+  if (timer_mode(lapic) == APIC_TIMER_PERIODIC) {
+    return initial_count - elapsed % initial_count;
+  }
+  return elapsed >= initial_count ? 0 : initial_count - elapsed;
+}
+
+/** Arm the timer for the period after the last one, in one-shot and periodic
+ * modes. Missed periods are coalesced into one interrupt. */
+static void schedule_count(SvmLapicState *lapic, uint64_t now) {
+  uint64_t period = (uint64_t)*reg(lapic, X2APIC_TIMER_INITIAL)
+                    << divide_shift(lapic);
+  uint64_t passed = (now - lapic->timer_start) / period;
+  if (timer_mode(lapic) == APIC_TIMER_ONESHOT) {
+    if (lapic->timer_periods != 0) return;
+    lapic->timer_periods = 1;
+  } else {
+    lapic->timer_periods =
+        (passed > lapic->timer_periods ? passed : lapic->timer_periods) + 1;
+  }
+  timer_arm(&lapic->timer,
+            lapic->timer_start + lapic->timer_periods * period);
+}
+
+static void timer_expired(void *ctx, uint64_t now) {
+  SvmVcpu *vcpu = (SvmVcpu *)ctx;
+  SvmLapicState *lapic = lapic_of(vcpu);
+  uint32_t lvt = *reg(lapic, X2APIC_LVT_TIMER);
+
+  if (!isset(lvt, APIC_LVT_MASKED)) request(lapic, lvt & LVT_VECTOR_MASK);
+  switch (timer_mode(lapic)) {
+    case APIC_TIMER_TSC_DEADLINE:
+      lapic->tsc_deadline = 0;
+      break;
+    case APIC_TIMER_PERIODIC:
+      schedule_count(lapic, now);
+      break;
+    default:
+      break;
+  }
+}
+
+static void stop_timer(SvmLapicState *lapic) {
+  timer_cancel(&lapic->timer);
+  *reg(lapic, X2APIC_TIMER_INITIAL) = 0;
+  lapic->tsc_deadline = 0;
+}
+
+static void write_initial_count(SvmLapicState *lapic, uint32_t count) {
+  // The register is ignored in TSC-deadline mode.
+  if (timer_mode(lapic) == APIC_TIMER_TSC_DEADLINE) return;
+
+  timer_cancel(&lapic->timer);
+  *reg(lapic, X2APIC_TIMER_INITIAL) = count;
+  if (count == 0) return;
+  lapic->timer_start = read_timestamp();
+  lapic->timer_periods = 0;
+  schedule_count(lapic, lapic->timer_start);
+}
+
+static void write_tsc_deadline(SvmVcpu *vcpu, uint64_t deadline) {
+  SvmLapicState *lapic = lapic_of(vcpu);
+  // The MSR is ignored outside TSC-deadline mode.
+  if (timer_mode(lapic) != APIC_TIMER_TSC_DEADLINE) return;
+
+  lapic->tsc_deadline = deadline;
+  if (deadline == 0) {
+    timer_cancel(&lapic->timer);
+  } else {
+    // The guest TSC runs ahead of the host TSC by the offset.
+    timer_arm(&lapic->timer, deadline - vcpu->vmcb->tsc_offset);
+  }
+}
+
+static void write_lvt_timer(SvmLapicState *lapic, uint32_t value) {
+  uint32_t *lvt = reg(lapic, X2APIC_LVT_TIMER);
+  uint32_t old_mode = *lvt & LVT_TIMER_MODE_MASK;
+  *lvt = value & LVT_TIMER_MASK;
+  if (!software_enabled(lapic)) *lvt |= tobit(APIC_LVT_MASKED);
+  // Switching the mode disarms the timer.
+  if ((*lvt & LVT_TIMER_MODE_MASK) != old_mode) stop_timer(lapic);
+}
+
+// =============================================================================
+// Register accesses
+
+static void write_svr(SvmLapicState *lapic, uint32_t value) {
+  *reg(lapic, X2APIC_SVR) = value & SVR_MASK;
+  if (software_enabled(lapic)) return;
+  // Software disabling masks all LVT entries.
+  for (int i = 0; i < SVM_LAPIC_NUM_LVT; i++) {
+    *reg(lapic, X2APIC_LVT_TIMER + i) |= tobit(APIC_LVT_MASKED);
+  }
+}
+
+static void write_eoi(SvmLapicState *lapic) {
+  int vector = highest_vector(lapic, X2APIC_ISR0);
+  if (vector >= 0) clear_vector(lapic, X2APIC_ISR0, vector);
+  update_ppr(lapic);
+}
+
+/** Whether the ICR destination includes this CPU. */
+static bool icr_targets_self(uint64_t icr) {
+  uint32_t dest = icr >> ICR_DEST_SHIFT;
+  switch ((icr >> ICR_SHORTHAND_SHIFT) & 0b11) {
+    case SHORTHAND_SELF:
+    case SHORTHAND_ALL:
+      return true;
+    case SHORTHAND_ALL_BUT_SELF:
+      return false;
+    default:
+      break;
+  }
+  if (dest == UINT32_MAX) return true;  // Broadcast.
+  if (!isset(icr, ICR_DEST_LOGICAL)) return dest == SVM_LAPIC_ID;
+  // Logical destination: the cluster in the high half and a bitmap in the low
+  // half.
+  uint32_t ldr = logical_destination();
+  return (dest >> 16) == (ldr >> 16) && (dest & ldr & 0xFFFF) != 0;
+}
+
+static void write_icr(SvmVcpu *vcpu, uint64_t value) {
+  SvmLapicState *lapic = lapic_of(vcpu);
+  *reg(lapic, X2APIC_ICR) = value;
+  *reg(lapic, ICR_HIGH) = value >> 32;
+  // There is no other CPU, so only IPIs to self are delivered.
+  if (!icr_targets_self(value)) return;
+
+  uint32_t mode = (value >> ICR_DELIVERY_MODE_SHIFT) & 0b111;
+  if (mode == DELIVERY_FIXED) {
+    request(lapic, value & ICR_VECTOR_MASK);
+  } else {
+    LOG_WARN("Unsupported IPI to self: ICR=0x%x\n", value);
+  }
+}
+
+static bool read_register(SvmVcpu *vcpu, uint32_t msr, uint64_t *value) {
+  SvmLapicState *lapic = lapic_of(vcpu);
+
+  switch (msr) {
+    case X2APIC_ID:
+    case X2APIC_VERSION:
+    case X2APIC_TPR:
+    case X2APIC_PPR:
+    case X2APIC_LDR:
+    case X2APIC_SVR:
+    case X2APIC_ISR0 ... X2APIC_ISR0 + SVM_LAPIC_VECTOR_WORDS - 1:
+    case X2APIC_TMR0 ... X2APIC_TMR0 + SVM_LAPIC_VECTOR_WORDS - 1:
+    case X2APIC_IRR0 ... X2APIC_IRR0 + SVM_LAPIC_VECTOR_WORDS - 1:
+    case X2APIC_ESR:
+    case X2APIC_LVT_TIMER ... X2APIC_LVT_ERROR:
+    case X2APIC_TIMER_INITIAL:
+    case X2APIC_TIMER_DIVIDE:
+      *value = *reg(lapic, msr);
+      break;
+    case X2APIC_ICR:
+      *value = concat_64(*reg(lapic, ICR_HIGH), *reg(lapic, X2APIC_ICR));
+      break;
+    case X2APIC_TIMER_CURRENT:
+      *value = current_count(lapic);
+      break;
+    default:
+      return false;
+  }
+  return true;
+}
+
+static bool write_register(SvmVcpu *vcpu, uint32_t msr, uint64_t value) {
+  SvmLapicState *lapic = lapic_of(vcpu);
+
+  switch (msr) {
+    case X2APIC_TPR:
+      *reg(lapic, X2APIC_TPR) = value & 0xFF;
+      update_ppr(lapic);
+      break;
+    case X2APIC_EOI:
+      write_eoi(lapic);
+      break;
+    case X2APIC_SVR:
+      write_svr(lapic, value);
+      break;
+    case X2APIC_ESR:
+      break;
+    case X2APIC_ICR:
+      write_icr(vcpu, value);
+      break;
+    case X2APIC_LVT_TIMER:
+      write_lvt_timer(lapic, value);
+      break;
+    case X2APIC_LVT_THERMAL ... X2APIC_LVT_ERROR: {
+      uint32_t *lvt = reg(lapic, msr);
+      bool lint = msr == X2APIC_LVT_LINT0 || msr == X2APIC_LVT_LINT1;
+      *lvt = value & (lint ? LVT_LINT_MASK : LVT_MASK);
+      if (!software_enabled(lapic)) *lvt |= tobit(APIC_LVT_MASKED);
+      break;
+    }
+    case X2APIC_TIMER_INITIAL:
+      write_initial_count(lapic, value);
+      break;
+    case X2APIC_TIMER_DIVIDE:
+      *reg(lapic, X2APIC_TIMER_DIVIDE) = value & DIVIDE_CONFIG_MASK;
+      break;
+    case X2APIC_SELF_IPI:
+      request(lapic, value & ICR_VECTOR_MASK);
+      break;
+    default:
+      return false;
+  }
+  return true;
+}
+
+// =============================================================================
+// AVIC
+
+/** x2APIC registers whose reads AVIC serves from the register page. The
+ * current count is left out since it is not in the page. */
+static const uint32_t avic_read_registers[] = {
+    X2APIC_ID,
+    X2APIC_VERSION,
+    X2APIC_TPR,
+    X2APIC_PPR,
+    X2APIC_LDR,
+    X2APIC_SVR,
+    X2APIC_ESR,
+    X2APIC_ICR,
+    X2APIC_LVT_TIMER,
+    X2APIC_LVT_THERMAL,
+    X2APIC_LVT_PMC,
+    X2APIC_LVT_LINT0,
+    X2APIC_LVT_LINT1,
+    X2APIC_LVT_ERROR,
+    X2APIC_TIMER_INITIAL,
+    X2APIC_TIMER_DIVIDE,
+};
+
+/** x2APIC registers whose writes AVIC handles by itself. Writes to the other
+ * registers have side effects on the timer or the LVT, and stay intercepted
+ * as MSR exits. So AVIC_NOACCEL never happens. */
+static const uint32_t avic_write_registers[] = {
+    X2APIC_TPR,
+    X2APIC_EOI,
+    X2APIC_ICR,
+    X2APIC_SELF_IPI,
+};
+
+/** The guest's APIC is in x2APIC mode, which only x2AVIC accelerates. The
+ * host's APIC ID is needed for the physical APIC ID table and the
+ * doorbell. */
+static bool avic_supported() {
+  CpuidSvmFeatureEdx features = {.value = cpuid(0x8000000A, 0).edx};
+  return features.avic && features.x2avic && apic_enabled();
+}
+
+/** Let the guest read or write the MSR without #VMEXIT. */
+static void pass_through_msr(Vmcb *vmcb, uint32_t msr, bool write) {
+  // MSRs 0 to 0x1FFF come first in the MSRPM, with two bits each: read, then
+  // write.
+  uint8_t *msrpm = (uint8_t *)phys2virt(vmcb->msrpm_base_pa);
+  unsigned int bit = msr * 2 + (write ? 1 : 0);
+  msrpm[bit / 8] &= ~tobit_8(bit % 8);
+}
+
+static void setup_avic(SvmVcpu *vcpu, Arena *arena) {
+  SvmLapicState *lapic = lapic_of(vcpu);
+  Vmcb *vmcb = vcpu->vmcb;
+
+  lapic->physical_table = arena_alloc_pages(arena, 1);
+  lapic->logical_table = arena_alloc_pages(arena, 1);
+  if (!lapic->physical_table || !lapic->logical_table) {
+    panic("Failed to allocate memory for AVIC tables.");
+  }
+  // The guest always runs on this CPU, so its entry stays running.
+  lapic->physical_table[SVM_LAPIC_ID] =
+      (apic_id() & AVIC_PHYSICAL_HOST_ID_MASK) |
+      virt2phys((Virt)lapic->regs) | tobit(AVIC_PHYSICAL_RUNNING) |
+      tobit(AVIC_PHYSICAL_VALID);
+  // The logical ID is a bitmap with the bit of the entry in flat mode.
+  lapic->logical_table[__builtin_ctz(logical_destination())] =
+      SVM_LAPIC_ID | tobit(AVIC_LOGICAL_VALID);
+
+  vmcb->avic_apic_bar = APIC_BASE_ADDRESS;
+  vmcb->avic_backing_page = virt2phys((Virt)lapic->regs);
+  vmcb->avic_logical_table = virt2phys((Virt)lapic->logical_table);
+  // Bits 7:0 are the highest index of the physical APIC ID table.
+  vmcb->avic_physical_table =
+      virt2phys((Virt)lapic->physical_table) | SVM_LAPIC_ID;
+  vmcb->avic_enable = 1;
+  vmcb->x2avic_enable = 1;
+
+  size_t num_reads = sizeof(avic_read_registers) / sizeof(uint32_t);
+  for (size_t i = 0; i < num_reads; i++) {
+    pass_through_msr(vmcb, avic_read_registers[i], false);
+  }
+  for (int i = 0; i < SVM_LAPIC_VECTOR_WORDS; i++) {
+    pass_through_msr(vmcb, X2APIC_ISR0 + i, false);
+    pass_through_msr(vmcb, X2APIC_TMR0 + i, false);
+    pass_through_msr(vmcb, X2APIC_IRR0 + i, false);
+  }
+  size_t num_writes = sizeof(avic_write_registers) / sizeof(uint32_t);
+  for (size_t i = 0; i < num_writes; i++) {
+    pass_through_msr(vmcb, avic_write_registers[i], true);
+  }
+  lapic->avic = true;
+}
+
+// =============================================================================
+// Public
+
+void svm_lapic_setup(SvmVcpu *vcpu, Arena *arena) {
+  SvmLapicState *lapic = lapic_of(vcpu);
+  *lapic = (SvmLapicState){0};
+  lapic->regs = arena_alloc_pages(arena, 1);
+  if (!lapic->regs) {
+    panic("Failed to allocate memory for x2APIC registers.");
+  }
+
+  *reg(lapic, X2APIC_ID) = SVM_LAPIC_ID;
+  *reg(lapic, X2APIC_VERSION) = APIC_VERSION;
+  *reg(lapic, X2APIC_LDR) = logical_destination();
+  *reg(lapic, X2APIC_SVR) = tobit(APIC_SVR_ENABLE) | APIC_SPURIOUS_VECTOR;
+  for (int i = 0; i < SVM_LAPIC_NUM_LVT; i++) {
+    *reg(lapic, X2APIC_LVT_TIMER + i) = tobit(APIC_LVT_MASKED);
+  }
+  // Virtual wire mode: the PIC is connected through LINT0 and NMIs through
+  // LINT1.
+  *reg(lapic, X2APIC_LVT_LINT0) = DELIVERY_EXTINT << LVT_DELIVERY_MODE_SHIFT;
+  *reg(lapic, X2APIC_LVT_LINT1) = DELIVERY_NMI << LVT_DELIVERY_MODE_SHIFT;
+
+  if (avic_supported()) {
+    setup_avic(vcpu, arena);
+    LOG_INFO("Guest's x2APIC is accelerated by AVIC.\n");
+  } else {
+    LOG_INFO("AVIC is unavailable. Guest's x2APIC is emulated.\n");
+  }
+}
+
+void svm_lapic_init(SvmVcpu *vcpu) {
+  SvmLapicState *lapic = lapic_of(vcpu);
+  timer_setup(&lapic->timer, timer_expired, vcpu);
+}
+
+bool svm_lapic_rdmsr(SvmVcpu *vcpu, uint32_t msr, uint64_t *value) {
+  switch (msr) {
+    case MSR_APIC_BASE:
+      *value = APIC_BASE_ADDRESS | tobit(APIC_BASE_ENABLE) |
+               tobit(APIC_BASE_X2APIC) | tobit(APIC_BASE_BSP);
+      return true;
+    case MSR_TSC_DEADLINE:
+      *value = lapic_of(vcpu)->tsc_deadline;
+      return true;
+    default:
+      return read_register(vcpu, msr, value);
+  }
+}
+
+bool svm_lapic_wrmsr(SvmVcpu *vcpu, uint32_t msr, uint64_t value) {
+  switch (msr) {
+    case MSR_APIC_BASE:
+      // The APIC stays in x2APIC mode at the usual address.
+      if ((value & ~tobit(APIC_BASE_BSP)) !=
+          (APIC_BASE_ADDRESS | tobit(APIC_BASE_ENABLE) |
+           tobit(APIC_BASE_X2APIC))) {
+        LOG_WARN("Ignored write to IA32_APIC_BASE: 0x%x\n", value);
+      }
+      return true;
+    case MSR_TSC_DEADLINE:
+      write_tsc_deadline(vcpu, value);
+      return true;
+    default:
+      return write_register(vcpu, msr, value);
+  }
+}
+
+int svm_lapic_pending_vector(SvmVcpu *vcpu) {
+  SvmLapicState *lapic = lapic_of(vcpu);
+  int vector = highest_vector(lapic, X2APIC_IRR0);
+  if (vector < 0) return -1;
+  if ((vector & 0xF0) <= (processor_priority(lapic) & 0xF0)) return -1;
+  return vector;
+}
+
+void svm_lapic_accept(SvmVcpu *vcpu, uint8_t vector) {
+  SvmLapicState *lapic = lapic_of(vcpu);
+  clear_vector(lapic, X2APIC_IRR0, vector);
+  set_vector(lapic, X2APIC_ISR0, vector);
+  update_ppr(lapic);
+}
+
+void svm_lapic_cancel(SvmVcpu *vcpu, uint8_t vector) {
+  SvmLapicState *lapic = lapic_of(vcpu);
+  if (!test_vector(lapic, X2APIC_ISR0, vector)) return;
+  clear_vector(lapic, X2APIC_ISR0, vector);
+  set_vector(lapic, X2APIC_IRR0, vector);
+  update_ppr(lapic);
+}
+
+bool svm_lapic_extint_enabled(SvmVcpu *vcpu) {
+  uint32_t lint0 = *reg(lapic_of(vcpu), X2APIC_LVT_LINT0);
+  return !isset(lint0, APIC_LVT_MASKED) &&
+         (lint0 & LVT_DELIVERY_MODE_MASK) >> LVT_DELIVERY_MODE_SHIFT ==
+             DELIVERY_EXTINT;
+}
+
+void handle_svm_avic_incomplete_ipi_exit(SvmVcpu *vcpu) {
+  Vmcb *vmcb = vcpu->vmcb;
+  // The IPI is in the IRR already and is taken on the next VMRUN.
+  if (vmcb->exitinfo2 >> 32 == AVIC_IPI_TARGET_NOT_RUNNING) return;
+  // EXITINFO1 is the value written to the ICR. AVIC does not deliver
+  // broadcasts and IPIs other than fixed ones, so they are emulated.
+  write_icr(vcpu, vmcb->exitinfo1);
+}
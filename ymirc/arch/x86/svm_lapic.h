@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "svm_vcpu.h"
+
+/** x2APIC ID of the guest's only CPU. */
+#define SVM_LAPIC_ID 0
+
+/** Reset the guest's virtual x2APIC to the state firmware hands over: x2APIC
+ * mode, software enabled, and LINT0 in ExtINT mode so that the PIC still
+ * reaches the CPU. The register page is allocated from `arena`. If the CPU
+ * supports x2AVIC, it is set up in the VMCB so that the guest accesses most
+ * registers and takes interrupts without #VMEXIT. It MUST be called after the
+ * MSRPM is set up. */
+void svm_lapic_setup(SvmVcpu *vcpu, Arena *arena);
+
+/** Prepare the timer of the guest's x2APIC. The timer is backed by the timer
+ * wheel, so the vCPU MUST NOT move after this call. */
+void svm_lapic_init(SvmVcpu *vcpu);
+
+/** Emulate RDMSR of an x2APIC register or of IA32_TSC_DEADLINE. Returns false
+ * if `msr` is not one of them. */
+bool svm_lapic_rdmsr(SvmVcpu *vcpu, uint32_t msr, uint64_t *value);
+
+/** Emulate WRMSR of an x2APIC register or of IA32_TSC_DEADLINE. Returns false
+ * if `msr` is not one of them. */
+bool svm_lapic_wrmsr(SvmVcpu *vcpu, uint32_t msr, uint64_t value);
+
+/** Highest requested vector the processor priority lets through, or -1. With
+ * AVIC, the CPU delivers it by itself on VMRUN. */
+int svm_lapic_pending_vector(SvmVcpu *vcpu);
+
+/** Move `vector` from the IRR to the ISR when it is injected. Only used
+ * without AVIC. */
+void svm_lapic_accept(SvmVcpu *vcpu, uint8_t vector);
+
+/** Move `vector` back to the IRR when the guest did not take it. */
+void svm_lapic_cancel(SvmVcpu *vcpu, uint8_t vector);
+
+/** Whether the PIC can interrupt the guest through LINT0. */
+bool svm_lapic_extint_enabled(SvmVcpu *vcpu);
+
+/** Handle AVIC_INCOMPLETE_IPI: an IPI the guest sent through the ICR that
+ * AVIC could not deliver. */
+void handle_svm_avic_incomplete_ipi_exit(SvmVcpu *vcpu);
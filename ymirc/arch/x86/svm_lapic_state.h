@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "timer.h"
+
+/** Number of 32-bit registers making up the ISR, TMR and IRR. */
+#define SVM_LAPIC_VECTOR_WORDS 8
+/** LVT entries: timer, thermal, performance counter, LINT0, LINT1 and
+ * error. */
+#define SVM_LAPIC_NUM_LVT 6
+
+/** State of the guest's virtual x2APIC. */
+typedef struct {
+  /** Registers in the layout of the xAPIC MMIO page: the register of the MSR
+   * 0x800 + n is at offset n * 16. It is the backing page of AVIC, which the
+   * CPU reads and updates while the guest runs. */
+  uint32_t *regs;
+  /** Whether the guest's APIC is accelerated by AVIC. */
+  bool avic;
+  /** AVIC physical APIC ID table, indexed by the guest's APIC ID. */
+  uint64_t *physical_table;
+  /** AVIC logical APIC ID table, indexed by the guest's logical APIC ID. */
+  uint32_t *logical_table;
+
+  /** TSC when the initial count was written. */
+  uint64_t timer_start;
+  /** Periods of the timer since `timer_start`, up to the one `timer` is
+   * armed for. */
+  uint64_t timer_periods;
+  /** Guest TSC the timer is armed for in TSC-deadline mode. 0 if disarmed. */
+  uint64_t tsc_deadline;
+  /** Expires when the LVT timer interrupt is due. */
+  Timer timer;
+} SvmLapicState;
@@ -1,10 +1,14 @@
+#define LOG_SUBSYSTEM LOG_SUBSYS_MSR
+
 #include "svm_msr.h"
 
 #include <stdint.h>
 
+#include "apic.h"
 #include "asm.h"
 #include "bits.h"
 #include "log.h"
+#include "svm_lapic.h"
 
 /** Set a 32-bit value to the given 64-bit without modifying the upper
  * 32-bits. Note: Parameter `reg` must be aligned. */
@@ -36,8 +40,16 @@ static void handle_rdmsr(SvmVcpu *vcpu) {
 
   switch (regs->rcx) {
     case MSR_APIC_BASE:
-      set_ret_val(vcpu, UINT64_MAX);  // disable APIC in Linux kernel.
+    case MSR_TSC_DEADLINE:
+    case X2APIC_MSR_FIRST ... X2APIC_MSR_LAST: {
+      uint64_t value;
+      if (!svm_lapic_rdmsr(vcpu, regs->rcx, &value)) {
+        LOG_ERROR("Unhandled RDMSR of x2APIC: 0x%x\n", regs->rcx);
+        svm_vcpu_abort(vcpu);
+      }
+      set_ret_val(vcpu, value);
       break;
+    }
     case MSR_EFER:
       set_ret_val(vcpu, vmcb->efer);
       break;
@@ -53,6 +65,14 @@ static void handle_wrmsr(SvmVcpu *vcpu) {
   uint64_t value = concat_64(regs->rdx, vmcb->rax);
 
   switch (regs->rcx) {
+    case MSR_APIC_BASE:
+    case MSR_TSC_DEADLINE:
+    case X2APIC_MSR_FIRST ... X2APIC_MSR_LAST:
+      if (!svm_lapic_wrmsr(vcpu, regs->rcx, value)) {
+        LOG_ERROR("Unhandled WRMSR of x2APIC: 0x%x\n", regs->rcx);
+        svm_vcpu_abort(vcpu);
+      }
+      break;
     case MSR_SYSENTER_CS:
       vmcb->sysenter_cs = value;  // Unused on host, no restore needed
       break;
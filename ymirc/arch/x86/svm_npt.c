@@ -1,3 +1,5 @@
+#define LOG_SUBSYSTEM LOG_SUBSYS_NPT
+
 #include "svm_npt.h"
 
 #include <stdint.h>
@@ -48,21 +50,16 @@ typedef struct {
 #define MASK(width) ((1ULL << (width)) - 1)
 #define PHYS_MASK (MASK(51) << ENTRY_PHYS)
 
-static const page_allocator_ops_t *pa;
-
-static PageTable *allocate_table() {
-  PageTable *table_addr = pa->alloc_aligned_pages(1, PAGE_SIZE);
+static PageTable *allocate_table(Arena *arena) {
+  PageTable *table_addr = arena_alloc_pages(arena, 1);
   if (!table_addr) {
     panic("Failed to allocate memory for the page table.");
   }
-  for (uint64_t i = 0; i < NUM_TABLE_ENTRIES; i++) {
-    table_addr->entries[i].value = 0;
-  }
   return table_addr;
 }
 
-static void initialize_table_reference_entry(Entry *entry) {
-  PageTable *lowertbl = allocate_table();
+static void initialize_table_reference_entry(Entry *entry, Arena *arena) {
+  PageTable *lowertbl = allocate_table(arena);
   set_masked_bits(&entry->value, 1, tobit(ENTRY_PRESENT));
   set_masked_bits(&entry->value, 1, tobit(ENTRY_RW));
   set_masked_bits(&entry->value, 1, tobit(ENTRY_US));
@@ -101,16 +98,16 @@ static Entry *get_entry_address(Phys gpa, Phys tbl_paddr, TableLevel level) {
 
 /** Maps the given 2MiB host physical memory to the guest physical memory.
  * Caller must flush TLB. */
-static void map2m(Phys gpa, Phys hpa, PageTable *lv4tbl) {
+static void map2m(Phys gpa, Phys hpa, PageTable *lv4tbl, Arena *arena) {
   uint64_t lv4index = (gpa >> lv4_shift) & index_mask;
   Entry *lv4ent = &lv4tbl->entries[lv4index];
   if (!isset(lv4ent->value, ENTRY_PRESENT)) {
-    initialize_table_reference_entry(lv4ent);
+    initialize_table_reference_entry(lv4ent, arena);
   }
 
   Entry *lv3ent = get_entry_address(gpa, lv4ent->value & PHYS_MASK, level3);
   if (!isset(lv3ent->value, ENTRY_PRESENT)) {
-    initialize_table_reference_entry(lv3ent);
+    initialize_table_reference_entry(lv3ent, arena);
   }
 
   Entry *lv2ent = get_entry_address(gpa, lv3ent->value & PHYS_MASK, level2);
@@ -120,21 +117,19 @@ static void map2m(Phys gpa, Phys hpa, PageTable *lv4tbl) {
   initialize_page_reference_entry(lv2ent, hpa);
 }
 
-Phys init_npt(Phys guest_start, Phys host_start, size_t size,
-              const page_allocator_ops_t *pa_ops) {
-  if (pa_ops == NULL) {
-    panic("Page allocator ops must be set for SVM NPT initializing.");
+Phys init_npt(Phys guest_start, Phys host_start, size_t size, Arena *arena) {
+  if (arena == NULL) {
+    panic("Arena must be set for SVM NPT initializing.");
   }
-  pa = pa_ops;
 
   // Allocate Level4 table.
-  PageTable *lv4tbl = allocate_table();
+  PageTable *lv4tbl = allocate_table(arena);
   LOG_DEBUG("NPT level4 Table @ %p\n", lv4tbl);
 
   // 2MiB mapping.
   for (size_t i = 0; i < size / PAGE_SIZE_2MB; i++) {
     map2m(guest_start + PAGE_SIZE_2MB * i, host_start + PAGE_SIZE_2MB * i,
-          lv4tbl);
+          lv4tbl, arena);
   }
 
   return virt2phys((uintptr_t)lv4tbl);
@@ -1,12 +1,11 @@
 #pragma once
 
+#include "arena.h"
 #include "mem.h"
-#include "page_allocator_if.h"
 
 /**
- * Init guest NPT.
+ * Init guest NPT. Tables are allocated from `arena`.
  *
  * @return Physical address of Page-Map Leve-4 Table.
  */
-Phys init_npt(Phys guest_start, Phys host_start, size_t size,
-              const page_allocator_ops_t *pa_ops);
+Phys init_npt(Phys guest_start, Phys host_start, size_t size, Arena *arena);
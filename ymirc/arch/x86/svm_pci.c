@@ -0,0 +1,180 @@
+#define LOG_SUBSYSTEM LOG_SUBSYS_IOIO
+
+#include "svm_pci.h"
+
+#include "log.h"
+#include "mem.h"
+#include "svm_virtio_console.h"
+
+/** Configuration mechanism #1 ports. */
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+
+/** CONFIG_ADDRESS fields. */
+#define CONFIG_ADDRESS_ENABLE (1U << 31)
+#define CONFIG_ADDRESS_BUS(addr) (((addr) >> 16) & 0xFF)
+#define CONFIG_ADDRESS_DEVICE(addr) (((addr) >> 11) & 0x1F)
+#define CONFIG_ADDRESS_FUNCTION(addr) (((addr) >> 8) & 0x7)
+#define CONFIG_ADDRESS_REGISTER(addr) ((addr) & 0xFC)
+
+/** Configuration space registers. */
+#define PCI_VENDOR_ID 0x00
+#define PCI_DEVICE_ID 0x02
+#define PCI_COMMAND 0x04
+#define PCI_REVISION_ID 0x08
+#define PCI_CLASS_PROG 0x09
+#define PCI_CLASS_DEVICE 0x0A
+#define PCI_HEADER_TYPE 0x0E
+#define PCI_BAR0 0x10
+#define PCI_SUBSYSTEM_VENDOR_ID 0x2C
+#define PCI_SUBSYSTEM_ID 0x2E
+#define PCI_INTERRUPT_LINE 0x3C
+#define PCI_INTERRUPT_PIN 0x3D
+
+#define PCI_COMMAND_IO 0x1
+#define PCI_BAR_IO 0x1
+
+/** I/O address assigned to the BAR of the virtio console at boot. The guest
+ * may move it. */
+#define VIRTIO_CONSOLE_IO_BASE 0xC000
+
+static void set8(SvmPciFunction *fn, uint8_t reg, uint8_t value) {
+  fn->config[reg] = value;
+}
+
+static void set16(SvmPciFunction *fn, uint8_t reg, uint16_t value) {
+  memcpy(&fn->config[reg], &value, sizeof(value));
+}
+
+static void set32(SvmPciFunction *fn, uint8_t reg, uint32_t value) {
+  memcpy(&fn->config[reg], &value, sizeof(value));
+}
+
+static void set_wmask32(SvmPciFunction *fn, uint8_t reg, uint32_t mask) {
+  memcpy(&fn->wmask[reg], &mask, sizeof(mask));
+}
+
+static uint32_t get32(const SvmPciFunction *fn, uint8_t reg) {
+  uint32_t value;
+  memcpy(&value, &fn->config[reg], sizeof(value));
+  return value;
+}
+
+void svm_pci_init(SvmPciState *pci) {
+  memset(pci, 0, sizeof(*pci));
+
+  // Linux only trusts configuration mechanism #1 if bus 0 has a host bridge.
+  SvmPciFunction *bridge = &pci->functions[SVM_PCI_HOST_BRIDGE];
+  bridge->device = 0;
+  set16(bridge, PCI_VENDOR_ID, 0x1B36);
+  set16(bridge, PCI_DEVICE_ID, 0x0008);
+  set16(bridge, PCI_CLASS_DEVICE, 0x0600);
+
+  SvmPciFunction *console = &pci->functions[SVM_PCI_VIRTIO_CONSOLE];
+  console->device = 1;
+  set16(console, PCI_VENDOR_ID, VIRTIO_PCI_VENDOR_ID);
+  set16(console, PCI_DEVICE_ID, VIRTIO_CONSOLE_PCI_DEVICE_ID);
+  set16(console, PCI_COMMAND, PCI_COMMAND_IO);
+  set16(console, PCI_CLASS_DEVICE, 0x0780);
+  set32(console, PCI_BAR0, VIRTIO_CONSOLE_IO_BASE | PCI_BAR_IO);
+  // Legacy drivers take the device type from the subsystem ID.
+  set16(console, PCI_SUBSYSTEM_VENDOR_ID, VIRTIO_PCI_VENDOR_ID);
+  set16(console, PCI_SUBSYSTEM_ID, VIRTIO_ID_CONSOLE);
+  set8(console, PCI_INTERRUPT_LINE, VIRTIO_CONSOLE_IRQ);
+  set8(console, PCI_INTERRUPT_PIN, 1);  // INTA#
+
+  console->wmask[PCI_COMMAND] = PCI_COMMAND_IO;
+  // Sizing the BAR reads back the size, since the low bits are fixed.
+  set_wmask32(console, PCI_BAR0, ~(uint32_t)(VIRTIO_CONSOLE_IO_SIZE - 1));
+  console->wmask[PCI_INTERRUPT_LINE] = 0xFF;
+}
+
+/** Function selected by CONFIG_ADDRESS, or NULL if there is none. */
+static SvmPciFunction *selected_function(SvmPciState *pci) {
+  uint32_t addr = pci->config_address;
+  if (!(addr & CONFIG_ADDRESS_ENABLE) || CONFIG_ADDRESS_BUS(addr) != 0 ||
+      CONFIG_ADDRESS_FUNCTION(addr) != 0) {
+    return NULL;
+  }
+  for (size_t i = 0; i < SVM_PCI_NUM_FUNCTIONS; i++) {
+    if (pci->functions[i].device == CONFIG_ADDRESS_DEVICE(addr)) {
+      return &pci->functions[i];
+    }
+  }
+  return NULL;
+}
+
+/** Base port of the I/O BAR0 of `fn`, or 0 if its decoding is disabled. */
+static uint16_t io_base(const SvmPciFunction *fn) {
+  if (!(fn->config[PCI_COMMAND] & PCI_COMMAND_IO)) return 0;
+  uint32_t bar = get32(fn, PCI_BAR0);
+  if (!(bar & PCI_BAR_IO)) return 0;
+  return bar & ~(uint32_t)(VIRTIO_CONSOLE_IO_SIZE - 1) & 0xFFFF;
+}
+
+bool svm_pci_io_in(SvmVcpu *vcpu, uint16_t port, unsigned int size,
+                   uint32_t *value) {
+  SvmPciState *pci = &vcpu->pci_state;
+
+  if (port == PCI_CONFIG_ADDRESS && size == 4) {
+    *value = pci->config_address;
+    return true;
+  }
+  if (PCI_CONFIG_DATA <= port && port < PCI_CONFIG_DATA + 4) {
+    SvmPciFunction *fn = selected_function(pci);
+    size_t reg = CONFIG_ADDRESS_REGISTER(pci->config_address) +
+                 (port - PCI_CONFIG_DATA);
+    // Absent functions read as all ones.
+    *value = 0xFFFFFFFF >> (32 - size * 8);
+    if (fn != NULL && reg + size <= SVM_PCI_CONFIG_SIZE) {
+      *value = 0;
+      memcpy(value, &fn->config[reg], size);
+    }
+    return true;
+  }
+  if (PCI_CONFIG_ADDRESS <= port && port < PCI_CONFIG_DATA) {
+    // Only 32-bit accesses select mechanism #1.
+    *value = 0;
+    return true;
+  }
+
+  uint16_t base = io_base(&pci->functions[SVM_PCI_VIRTIO_CONSOLE]);
+  if (base != 0 && base <= port && port < base + VIRTIO_CONSOLE_IO_SIZE) {
+    *value = svm_virtio_console_in(vcpu, port - base, size);
+    return true;
+  }
+  return false;
+}
+
+bool svm_pci_io_out(SvmVcpu *vcpu, uint16_t port, unsigned int size,
+                    uint32_t value) {
+  SvmPciState *pci = &vcpu->pci_state;
+
+  if (port == PCI_CONFIG_ADDRESS && size == 4) {
+    pci->config_address = value;
+    return true;
+  }
+  if (PCI_CONFIG_DATA <= port && port < PCI_CONFIG_DATA + 4) {
+    SvmPciFunction *fn = selected_function(pci);
+    if (fn == NULL) return true;
+    size_t reg = CONFIG_ADDRESS_REGISTER(pci->config_address) +
+                 (port - PCI_CONFIG_DATA);
+    for (size_t i = 0; i < size && reg + i < SVM_PCI_CONFIG_SIZE; i++) {
+      uint8_t byte = (value >> (i * 8)) & 0xFF;
+      uint8_t mask = fn->wmask[reg + i];
+      fn->config[reg + i] = (fn->config[reg + i] & ~mask) | (byte & mask);
+    }
+    return true;
+  }
+  if (PCI_CONFIG_ADDRESS <= port && port < PCI_CONFIG_DATA) {
+    // Byte writes probe for mechanism #2, which is not supported.
+    return true;
+  }
+
+  uint16_t base = io_base(&pci->functions[SVM_PCI_VIRTIO_CONSOLE]);
+  if (base != 0 && base <= port && port < base + VIRTIO_CONSOLE_IO_SIZE) {
+    svm_virtio_console_out(vcpu, port - base, size, value);
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "svm_pci_state.h"
+#include "svm_vcpu.h"
+
+/** Indices of the emulated functions in SvmPciState. */
+#define SVM_PCI_HOST_BRIDGE 0
+#define SVM_PCI_VIRTIO_CONSOLE 1
+
+/** Set up the configuration space of the emulated functions: a host bridge
+ * at 00:00.0 and a legacy virtio console at 00:01.0. */
+void svm_pci_init(SvmPciState *pci);
+
+/** Handle an IN of `size` bytes from `port` if it is a PCI configuration port
+ * or in an I/O BAR. Returns false if the port is not PCI's. */
+bool svm_pci_io_in(SvmVcpu *vcpu, uint16_t port, unsigned int size,
+                   uint32_t *value);
+
+/** Handle an OUT of `size` bytes to `port` if it is a PCI configuration port
+ * or in an I/O BAR. Returns false if the port is not PCI's. */
+bool svm_pci_io_out(SvmVcpu *vcpu, uint16_t port, unsigned int size,
+                    uint32_t value);
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+
+/** Number of emulated PCI functions: the host bridge and the virtio console. */
+#define SVM_PCI_NUM_FUNCTIONS 2
+/** Size of the configuration space of a function. */
+#define SVM_PCI_CONFIG_SIZE 256
+/** Number of virtqueues of the virtio console: receiveq and transmitq. */
+#define VIRTIO_CONSOLE_NUM_QUEUES 2
+
+/** Configuration space of an emulated PCI function on bus 0. */
+typedef struct {
+  /** Device number on bus 0. */
+  uint8_t device;
+  /** Register values. */
+  uint8_t config[SVM_PCI_CONFIG_SIZE];
+  /** Bits of `config` the guest can write. */
+  uint8_t wmask[SVM_PCI_CONFIG_SIZE];
+} SvmPciFunction;
+
+/** Legacy virtqueue as set up by the driver. */
+typedef struct {
+  /** Guest page frame number of the vring. 0 if not set up. */
+  uint32_t pfn;
+  /** Index of the next available entry to process. */
+  uint16_t last_avail;
+} VirtioQueue;
+
+/** Register state of the virtio console. */
+typedef struct {
+  uint32_t guest_features;
+  uint16_t queue_select;
+  uint8_t status;
+  /** ISR status. Bit 0 is set while the interrupt is pending. */
+  uint8_t isr;
+  VirtioQueue queues[VIRTIO_CONSOLE_NUM_QUEUES];
+} VirtioConsoleState;
+
+/** Emulated PCI bus of the guest. */
+typedef struct {
+  /** CONFIG_ADDRESS register at 0xCF8. */
+  uint32_t config_address;
+  SvmPciFunction functions[SVM_PCI_NUM_FUNCTIONS];
+  VirtioConsoleState console;
+} SvmPciState;
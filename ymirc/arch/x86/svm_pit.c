@@ -0,0 +1,275 @@
+#define LOG_SUBSYSTEM LOG_SUBSYS_IOIO
+
+#include "svm_pit.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "arch.h"
+#include "bits.h"
+#include "hwtimer.h"
+#include "log.h"
+#include "pic.h"
+#include "pit.h"
+#include "timer.h"
+
+/** Fields of the control word. */
+#define CONTROL_CHANNEL_SHIFT 6
+#define CONTROL_ACCESS_SHIFT 4
+#define CONTROL_MODE_SHIFT 1
+#define CONTROL_BCD 0x01
+/** Channel field selecting the read-back command. */
+#define CONTROL_READ_BACK 3
+/** Bits of the read-back command. They are cleared to latch. */
+#define READ_BACK_NO_COUNT 0x20
+#define READ_BACK_NO_STATUS 0x10
+/** Bit of the read-back command selecting channel 0. */
+#define READ_BACK_CHANNEL0 1
+
+/** Access mode of the counter latch command. */
+#define ACCESS_LATCH 0
+#define ACCESS_LOW 1
+#define ACCESS_HIGH 2
+#define ACCESS_WORD 3
+
+/** Bit of the status byte showing the output. */
+#define STATUS_OUT 7
+
+/** Fractional bits of the TSC cycles per PIT tick. */
+#define TSC_PER_TICK_SHIFT 24
+
+/** PIT ticks per TSC cycle in 32.32 fixed point. */
+static uint64_t ticks_per_tsc;
+/** TSC cycles per PIT tick, with TSC_PER_TICK_SHIFT fractional bits. */
+static uint64_t tsc_per_tick;
+
+static uint64_t tsc_to_ticks(uint64_t cycles) {
+  return ((unsigned __int128)cycles * ticks_per_tsc) >> 32;
+}
+
+/** Round up so that the count has surely been reached at the returned TSC. */
+static uint64_t ticks_to_tsc(uint64_t ticks) {
+  unsigned __int128 cycles = (unsigned __int128)ticks * tsc_per_tick;
+  return (cycles + (1ULL << TSC_PER_TICK_SHIFT) - 1) >> TSC_PER_TICK_SHIFT;
+}
+
+static uint64_t initial_count(const SvmPitChannel *channel) {
+  return channel->reload == 0 ? 0x10000 : channel->reload;
+}
+
+static uint64_t elapsed_ticks(const SvmPitChannel *channel, uint64_t now) {
+  return now > channel->start ? tsc_to_ticks(now - channel->start) : 0;
+}
+
+static bool is_periodic(const SvmPitChannel *channel) {
+  return channel->mode == 2 || channel->mode == 3;
+}
+
+/** Current value of the counting element. */
+static uint16_t read_count(const SvmPitChannel *channel, uint64_t now) {
+  if (!channel->counting) return channel->reload;
+
+  uint64_t count = initial_count(channel);
+  uint64_t elapsed = elapsed_ticks(channel, now);
+  switch (channel->mode) {
+    case 2:
+      return count - elapsed % count;
+    case 3:
+      // Counts down by two, twice per period.
+      return count - (2 * elapsed) % count;
+    default:
+      // The counter wraps around and goes on after the terminal count.
+      return (uint16_t)(count - elapsed);
+  }
+}
+
+static bool read_out(const SvmPitChannel *channel, uint64_t now) {
+  if (!channel->counting) return channel->mode != 0;
+
+  uint64_t count = initial_count(channel);
+  uint64_t elapsed = elapsed_ticks(channel, now);
+  switch (channel->mode) {
+    case 0:
+      return elapsed >= count;
+    case 1:
+      return elapsed < count;
+    case 2:
+      return elapsed % count != 0 || elapsed == 0;
+    case 3:
+      return elapsed % count < (count + 1) / 2;
+    default:
+      return elapsed != count;
+  }
+}
+
+/** Arm the timer for the next terminal count of channel 0 after the
+ * `periods`-th one. */
+static void schedule_irq(SvmPitState *pit, uint64_t now) {
+  SvmPitChannel *channel = &pit->channels[0];
+  uint64_t count = initial_count(channel);
+
+  if (!channel->counting) {
+    timer_cancel(&pit->timer);
+    return;
+  }
+  if (is_periodic(channel)) {
+    // Missed periods are coalesced into one IRQ.
+    uint64_t passed = elapsed_ticks(channel, now) / count;
+    pit->periods = (passed > pit->periods ? passed : pit->periods) + 1;
+  } else if (channel->mode == 0 || channel->mode == 4) {
+    // One terminal count only.
+    if (pit->periods != 0) return;
+    pit->periods = 1;
+  } else {
+    // Modes 1 and 5 are triggered by the gate, which channel 0 does not have.
+    return;
+  }
+  timer_arm(&pit->timer, channel->start + ticks_to_tsc(pit->periods * count));
+}
+
+static void terminal_count(void *ctx, uint64_t now) {
+  SvmVcpu *vcpu = (SvmVcpu *)ctx;
+  vcpu->pending_irq |= tobit_16(irq_timer);
+  if (is_periodic(&vcpu->pit_state.channels[0])) {
+    schedule_irq(&vcpu->pit_state, now);
+  }
+}
+
+void svm_pit_init(SvmVcpu *vcpu) {
+  uint64_t tsc_hz = tsc_frequency();
+  ticks_per_tsc = ((uint64_t)PIT_HZ << 32) / tsc_hz;
+  tsc_per_tick = (tsc_hz << TSC_PER_TICK_SHIFT) / PIT_HZ;
+
+  SvmPitState *pit = &vcpu->pit_state;
+  *pit = (SvmPitState){0};
+  timer_setup(&pit->timer, terminal_count, vcpu);
+}
+
+static void latch_count(SvmPitChannel *channel, uint64_t now) {
+  // Only the first latch command counts until the latch is read.
+  if (channel->count_latched) return;
+  channel->latch = read_count(channel, now);
+  channel->count_latched = true;
+  channel->read_high_next = false;
+}
+
+static void latch_status(SvmPitChannel *channel, uint64_t now) {
+  if (channel->status_latched) return;
+  channel->status = (read_out(channel, now) << STATUS_OUT) |
+                    (channel->access << CONTROL_ACCESS_SHIFT) |
+                    (channel->mode << CONTROL_MODE_SHIFT);
+  channel->status_latched = true;
+}
+
+static void write_control(SvmPitState *pit, uint8_t value, uint64_t now) {
+  int select = value >> CONTROL_CHANNEL_SHIFT;
+  if (select == CONTROL_READ_BACK) {
+    for (int i = 0; i < SVM_PIT_NUM_CHANNELS; i++) {
+      if (!isset_8(value, READ_BACK_CHANNEL0 + i)) continue;
+      if (!(value & READ_BACK_NO_COUNT)) latch_count(&pit->channels[i], now);
+      if (!(value & READ_BACK_NO_STATUS)) {
+        latch_status(&pit->channels[i], now);
+      }
+    }
+    return;
+  }
+
+  SvmPitChannel *channel = &pit->channels[select];
+  uint8_t access = (value >> CONTROL_ACCESS_SHIFT) & 0b11;
+  if (access == ACCESS_LATCH) {
+    latch_count(channel, now);
+    return;
+  }
+  if (value & CONTROL_BCD) {
+    LOG_WARN("BCD counting of the PIT is unsupported.\n");
+  }
+
+  uint8_t mode = (value >> CONTROL_MODE_SHIFT) & 0b111;
+  // Modes 6 and 7 are aliases of 2 and 3.
+  channel->mode = mode > 5 ? mode - 4 : mode;
+  channel->access = access;
+  channel->write_high_next = false;
+  channel->read_high_next = false;
+  channel->count_latched = false;
+  // A control word stops the counter until a count is written.
+  channel->counting = false;
+  if (select == 0) timer_cancel(&pit->timer);
+}
+
+static void load_count(SvmPitState *pit, int index, uint16_t count,
+                       uint64_t now) {
+  SvmPitChannel *channel = &pit->channels[index];
+  channel->reload = count;
+  channel->counting = true;
+  channel->start = now;
+  if (index == 0) {
+    pit->periods = 0;
+    schedule_irq(pit, now);
+  }
+}
+
+static void write_counter(SvmPitState *pit, int index, uint8_t value,
+                          uint64_t now) {
+  SvmPitChannel *channel = &pit->channels[index];
+  switch (channel->access) {
+    case ACCESS_LOW:
+      load_count(pit, index, value, now);
+      break;
+    case ACCESS_HIGH:
+      load_count(pit, index, value << 8, now);
+      break;
+    default:
+      if (!channel->write_high_next) {
+        channel->write_low = value;
+        channel->write_high_next = true;
+      } else {
+        channel->write_high_next = false;
+        load_count(pit, index, channel->write_low | value << 8, now);
+      }
+      break;
+  }
+}
+
+static uint8_t read_counter(SvmPitChannel *channel, uint64_t now) {
+  if (channel->status_latched) {
+    channel->status_latched = false;
+    return channel->status;
+  }
+
+  uint16_t count =
+      channel->count_latched ? channel->latch : read_count(channel, now);
+  bool high;
+  switch (channel->access) {
+    case ACCESS_LOW:
+      high = false;
+      channel->count_latched = false;
+      break;
+    case ACCESS_HIGH:
+      high = true;
+      channel->count_latched = false;
+      break;
+    default:
+      high = channel->read_high_next;
+      channel->read_high_next = !high;
+      if (high) channel->count_latched = false;
+      break;
+  }
+  return high ? count >> 8 : count & 0xFF;
+}
+
+uint8_t svm_pit_in(SvmVcpu *vcpu, uint16_t port) {
+  int index = port - SVM_PIT_PORT_BASE;
+  // The control word register is write-only.
+  if (index >= SVM_PIT_NUM_CHANNELS) return 0xFF;
+  return read_counter(&vcpu->pit_state.channels[index], read_timestamp());
+}
+
+void svm_pit_out(SvmVcpu *vcpu, uint16_t port, uint8_t value) {
+  SvmPitState *pit = &vcpu->pit_state;
+  uint64_t now = read_timestamp();
+  if (port == SVM_PIT_PORT_CONTROL) {
+    write_control(pit, value, now);
+  } else if (port - SVM_PIT_PORT_BASE < SVM_PIT_NUM_CHANNELS) {
+    write_counter(pit, port - SVM_PIT_PORT_BASE, value, now);
+  }
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "svm_vcpu.h"
+
+/** I/O ports of the 8254: three counters and the control word register. */
+#define SVM_PIT_PORT_BASE 0x40
+#define SVM_PIT_PORT_CONTROL 0x43
+
+/** Reset the guest's virtual PIT. IRQ0 is raised through the timer wheel, so
+ * the vCPU MUST NOT move after this call. */
+void svm_pit_init(SvmVcpu *vcpu);
+
+/** Read a counter of the virtual PIT. */
+uint8_t svm_pit_in(SvmVcpu *vcpu, uint16_t port);
+
+/** Write a counter or the control word register of the virtual PIT. */
+void svm_pit_out(SvmVcpu *vcpu, uint16_t port, uint8_t value);
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "timer.h"
+
+/** Number of counters of the 8254. */
+#define SVM_PIT_NUM_CHANNELS 3
+
+/** Counter of the guest's virtual 8254. The count is derived from the TSC
+ * when it is read, so the counter costs nothing while it runs. */
+typedef struct {
+  /** Operating mode, 0 to 5. */
+  uint8_t mode;
+  /** Access mode: 1 for the low byte, 2 for the high byte, 3 for both. */
+  uint8_t access;
+  /** Initial count. 0 stands for 65536. */
+  uint16_t reload;
+  /** Low byte written first in the low then high byte access. */
+  uint8_t write_low;
+  bool write_high_next;
+  bool read_high_next;
+  /** Count latched by the counter latch command. */
+  uint16_t latch;
+  bool count_latched;
+  /** Status latched by the read-back command. */
+  uint8_t status;
+  bool status_latched;
+  /** Whether an initial count is loaded. */
+  bool counting;
+  /** TSC when the initial count was loaded. */
+  uint64_t start;
+} SvmPitChannel;
+
+/** Virtual 8254 Programmable Interval Timer of the guest. */
+typedef struct {
+  SvmPitChannel channels[SVM_PIT_NUM_CHANNELS];
+  /** Expires at the next terminal count of channel 0, which raises IRQ0. */
+  Timer timer;
+  /** Terminal counts of channel 0 since its count was loaded, up to the one
+   * the timer is armed for. */
+  uint64_t periods;
+} SvmPitState;
@@ -2,6 +2,7 @@
 
 #include "arch.h"
 #include "asm.h"
+#include "bin_allocator.h"
 #include "bits.h"
 #include "gdt.h"
 #include "interrupt.h"
@@ -13,9 +14,18 @@
 #include "svm_asm.h"
 #include "svm_cpuid.h"
 #include "svm_ioio.h"
+#include "svm_lapic.h"
 #include "svm_msr.h"
+#include "svm_pci.h"
+#include "svm_pit.h"
 #include "svm_vmcb.h"
+#include "svm_virtio_console.h"
 #include "svm_vmmc.h"
+#include "trace.h"
+
+/** Fields of EVENTINJ and EXITINTINFO. */
+#define EVENT_TYPE_INTR (0 << 8)
+#define EVENT_VALID 31
 
 /** segment attributes are stored as 12-bit values formed by the concatenation
  * of bits 55:52 and 47:40 from the original 64-bit (in-memory) segment
@@ -33,6 +43,9 @@
 #define SEGMENT_GRANULARITY_MASK 0x1ULL << 11
 #define SEGMENT_RESERVED_MASK 0xFULL << 12
 
+/** Characters of the log written per idle iteration. */
+#define LOG_DRAIN_IDLE 16
+
 static void setup_vmcb_seg(Vmcb *vmcb) {
   // CS
   uint64_t cs_attrib = 0;
@@ -86,63 +99,67 @@ static void setup_vmcb_seg(Vmcb *vmcb) {
 }
 
 /** Configure intercepts for all MSR read and write instructions. */
-static void setup_vmcb_msr(SvmVcpu *vcpu, const page_allocator_ops_t *pa_ops) {
+static void setup_vmcb_msr(SvmVcpu *vcpu, Arena *arena) {
   Vmcb *vmcb = vcpu->vmcb;
-  void *msrpm = pa_ops->alloc_aligned_pages(2, PAGE_SIZE);
+  void *msrpm = arena_alloc_pages(arena, 2);
+  if (!msrpm) {
+    panic("Failed to allocate memory for MSRPM.");
+  }
   memset(msrpm, 0xFF, PAGE_SIZE * 2);
   vmcb->msrpm_base_pa = virt2phys((Virt)msrpm);
   vmcb->intercept_msr_prot = 1;
 }
 
-static void unmask_iopm_bit(uint8_t *iopm, size_t target_bit) {
-  size_t index = target_bit / 8;
-  size_t pos = target_bit % 8;
-  iopm[index] &= ~tobit_8(pos);
-}
-
 /** Configure intercepts for all IOIO instructions. */
-static void setup_vmcb_ioio(SvmVcpu *vcpu, const page_allocator_ops_t *pa_ops) {
+static void setup_vmcb_ioio(SvmVcpu *vcpu, Arena *arena) {
   Vmcb *vmcb = vcpu->vmcb;
-  void *iopm = pa_ops->alloc_aligned_pages(3, PAGE_SIZE);
+  void *iopm = arena_alloc_pages(arena, 3);
+  if (!iopm) {
+    panic("Failed to allocate memory for IOPM.");
+  }
   memset(iopm, 0xFF, PAGE_SIZE * 3);
 
-  // PIT: Programmable Interval Timer
-  for (int i = 0x40; i < 0x48; i++) {
-    unmask_iopm_bit(iopm, i);
-  }
+  // The PIT is emulated on top of YmirC's timer wheel, so that the guest
+  // takes no exit for ticks it did not ask for.
 
-  // Serial 8250
-  unmask_iopm_bit(iopm, 0x03F8);
-  unmask_iopm_bit(iopm, 0x03FD);
-  unmask_iopm_bit(iopm, 0x03FE);
+  // Serial 8250 is fully emulated on top of YmirC's Tx and Rx rings, so all
+  // of its ports stay intercepted.
 
   vmcb->iopm_base_pa = virt2phys((Virt)iopm);
   vmcb->intercept_ioio_prot = 1;
 }
 
 SvmVcpu svm_vcpu_new(uint16_t asid, Serial *serial) {
-  return (SvmVcpu){
+  SvmVcpu vcpu = {
       .id = 0,
       .asid = asid,
       .serial = serial,
       .guest_ioio_state = svm_ioio_guest_state_new(),
   };
+  svm_pci_init(&vcpu.pci_state);
+  return vcpu;
 }
 
-void svm_vcpu_virtualize(SvmVcpu *vcpu, const page_allocator_ops_t *pa_ops) {
-  // Write to VM_HSAVE_PA MSR.
-  void *hsave = pa_ops->alloc(PAGE_SIZE);
-  if (!hsave) {
-    panic("Failed to allocate memory for saving host state.");
+void svm_vcpu_virtualize(SvmVcpu *vcpu, const page_allocator_ops_t *pa_ops,
+                         Arena *arena) {
+  vcpu->pa_ops = pa_ops;
+
+  // Write to VM_HSAVE_PA MSR. The host save area belongs to the physical CPU
+  // and outlives the VM, so it does not come from the arena and is reused
+  // by later VMs.
+  if (read_msr(MSR_VM_HSAVE_PA) == 0) {
+    void *hsave = pa_ops->alloc(PAGE_SIZE);
+    if (!hsave) {
+      panic("Failed to allocate memory for saving host state.");
+    }
+    write_msr(MSR_VM_HSAVE_PA, virt2phys((uintptr_t)hsave));
   }
-  write_msr(MSR_VM_HSAVE_PA, virt2phys((uintptr_t)hsave));
 
   // Allocate VMCB region.
-  void *vmcb = pa_ops->alloc_aligned_pages(1, PAGE_SIZE);
+  void *vmcb = arena_alloc_pages(arena, 1);
   if (!vmcb) {
     panic("Failed to allocate memory for VMCB.");
   }
-  memset(vmcb, 0, PAGE_SIZE);
   vcpu->vmcb = vmcb;
   vcpu->vmcb_phys = virt2phys((uintptr_t)vmcb);
 
@@ -153,7 +170,7 @@ void svm_vcpu_virtualize(SvmVcpu *vcpu, const page_allocator_ops_t *pa_ops) {
 }
 
 /** Set up VMCB for a logical processor. */
-static void setup_vmcb(SvmVcpu *vcpu, const page_allocator_ops_t *pa_ops) {
+static void setup_vmcb(SvmVcpu *vcpu, Arena *arena) {
   Vmcb *vmcb = vcpu->vmcb;
 
   // Interrupt
@@ -200,28 +217,54 @@ static void setup_vmcb(SvmVcpu *vcpu, const page_allocator_ops_t *pa_ops) {
   vmcb->rip = LINUX_LAYOUT_KERNEL_BASE;
 
   // MSR
-  setup_vmcb_msr(vcpu, pa_ops);
+  setup_vmcb_msr(vcpu, arena);
+
+  // x2APIC, accelerated by AVIC if available. Its registers are MSRs.
+  svm_lapic_setup(vcpu, arena);
 
   // IOIO
-  setup_vmcb_ioio(vcpu, pa_ops);
+  setup_vmcb_ioio(vcpu, arena);
 }
 
-void svm_vcpu_setup_guest_state(SvmVcpu *vcpu,
-                                const page_allocator_ops_t *pa_ops) {
-  setup_vmcb(vcpu, pa_ops);
+void svm_vcpu_setup_guest_state(SvmVcpu *vcpu, Arena *arena) {
+  setup_vmcb(vcpu, arena);
   vcpu->guest_regs.rsi = LINUX_LAYOUT_BOOTPARAM;
 }
 
-void svm_vcpu_set_npt(SvmVcpu *vcpu, Phys n_cr3, void *host_start) {
+void svm_vcpu_set_npt(SvmVcpu *vcpu, Phys n_cr3, void *host_start,
+                      size_t size) {
   vcpu->vmcb->n_cr3 = n_cr3;
   vcpu->guest_base = virt2phys((uintptr_t)host_start);
+  vcpu->guest_start = host_start;
+  vcpu->guest_size = size;
+}
+
+void *svm_vcpu_guest_ptr(SvmVcpu *vcpu, uint64_t gpa, size_t len) {
+  if (gpa > vcpu->guest_size || len > vcpu->guest_size - gpa) return NULL;
+  return vcpu->guest_start + gpa;
+}
+
+/** Inject the highest priority interrupt requested from the guest's x2APIC
+ * if any. */
+static bool inject_lapic_intr(SvmVcpu *vcpu) {
+  int vector = svm_lapic_pending_vector(vcpu);
+  if (vector < 0) return false;
+  // AVIC delivers it from the IRR by itself.
+  if (vcpu->lapic_state.avic) return true;
+
+  svm_lapic_accept(vcpu, vector);
+  vcpu->vmcb->v_irq = 1;
+  vcpu->vmcb->v_intr_vector = vector;
+  vcpu->lapic_injected = true;
+
+  TRACEPOINT(inject_lapic, vector);
+  return true;
 }
 
-/** Inject external interrupt to the guest if possible. Returns true if the
- * interrupt is injected, otherwise false. It's the totally YmirC's
+/** Inject an IRQ of the guest's PIC if possible. It's the totally YmirC's
  * responsibility to send an EOI to the PIC because YmirC blocks EOI commands
  * from the guest. */
-static bool inject_ext_intr(SvmVcpu *vcpu) {
+static bool inject_pic_intr(SvmVcpu *vcpu) {
   bool is_secondary_masked =
       isset_16(vcpu->guest_ioio_state.primary_mask, irq_secondary);
   SvmIoioGuestState *guest_state = &vcpu->guest_ioio_state;
@@ -230,10 +273,10 @@ static bool inject_ext_intr(SvmVcpu *vcpu) {
   if (vcpu->pending_irq == 0) return false;
   // PIC is not initialized.
   if (guest_state->primary_phase != SVM_PIC_INIT_PHASE_INITED) return false;
-
-  // Guest is blocking interrupts.
-  FlagsRegister rflags = {.value = vcpu->vmcb->rflags};
-  if (!rflags.ief) return false;
+  // PIC is disconnected from the CPU by the x2APIC.
+  if (!svm_lapic_extint_enabled(vcpu)) return false;
+  // An event injected right after STI or MOV SS would break the shadow.
+  if (vcpu->lapic_state.avic && vcpu->vmcb->interrupt_shadow) return false;
 
   // Iterate all possible IRQs and inject one if possible.
   for (int i = 0; i < 16; i++) {
@@ -249,11 +292,20 @@ static bool inject_ext_intr(SvmVcpu *vcpu) {
                          : isset_8(guest_state->secondary_mask, delta(i));
     if (is_masked) continue;
 
-    // Inject the interrupt.
-    vcpu->vmcb->v_irq = 1;
-    vcpu->vmcb->v_intr_vector = is_primary(i)
-                                    ? delta(i) + guest_state->primary_base
-                                    : delta(i) + guest_state->secondary_base;
+    // Inject the interrupt. V_IRQ is ignored while AVIC is enabled, so the
+    // interrupt is injected as an event then. IF is set, so the guest takes
+    // it right on VMRUN.
+    uint8_t vector = is_primary(i) ? delta(i) + guest_state->primary_base
+                                   : delta(i) + guest_state->secondary_base;
+    if (vcpu->lapic_state.avic) {
+      vcpu->vmcb->eventinj = vector | EVENT_TYPE_INTR | tobit(EVENT_VALID);
+    } else {
+      vcpu->vmcb->v_irq = 1;
+      vcpu->vmcb->v_intr_vector = vector;
+    }
+    vcpu->lapic_injected = false;
+
+    TRACEPOINT(inject_ext_intr, i, vector);
 
     // Clear the pending IRQ.
     vcpu->pending_irq &= ~irq_bit;
@@ -265,6 +317,43 @@ static bool inject_ext_intr(SvmVcpu *vcpu) {
   return false;
 }
 
+/** Inject external interrupt to the guest if possible. Returns true if an
+ * interrupt is injected, otherwise false. Interrupts from the x2APIC take
+ * precedence over the PIC, which is wired to its LINT0. */
+static bool inject_ext_intr(SvmVcpu *vcpu) {
+  // An event is delivered on the next VMRUN.
+  if (isset(vcpu->vmcb->eventinj, EVENT_VALID)) return true;
+
+  // Guest is blocking interrupts.
+  FlagsRegister rflags = {.value = vcpu->vmcb->rflags};
+  if (!rflags.ief) return false;
+
+  // The last injected interrupt has not been taken yet.
+  if (vcpu->vmcb->v_irq == 1) return true;
+
+  return inject_lapic_intr(vcpu) || inject_pic_intr(vcpu);
+}
+
+/** Inject again the event whose delivery was interrupted by the #VMEXIT. */
+static void reinject_interrupted_event(Vmcb *vmcb) {
+  vmcb->eventinj = 0;
+  // EXITINTINFO has the same format as EVENTINJ.
+  if (isset(vmcb->exitintinfo, EVENT_VALID)) vmcb->eventinj = vmcb->exitintinfo;
+}
+
+/** Take back the injected interrupt the guest has not taken yet, so that it
+ * is injected again later. */
+static void cancel_ext_intr(SvmVcpu *vcpu) {
+  if (vcpu->vmcb->v_irq == 0) return;
+
+  if (vcpu->lapic_injected) {
+    svm_lapic_cancel(vcpu, vcpu->vmcb->v_intr_vector);
+  } else {
+    vcpu->pending_irq |= tobit_16(vcpu->last_injected_irq);
+  }
+  vcpu->vmcb->v_irq = 0;
+}
+
 static void print_guest_state(SvmVcpu *vcpu) {
   LOG_ERROR("=== vCPU Information ===\n");
   LOG_ERROR("[Guest State]\n");
@@ -324,27 +413,39 @@ static inline void load_segment_registers() {
       : "di");
 }
 
+/** Hand serial input that may have arrived to the guest's console, hvc0 or
+ * ttyS0. */
+static void poll_console_rx(SvmVcpu *vcpu) {
+  svm_virtio_console_poll_rx(vcpu);
+  svm_ioio_serial_poll_rx(vcpu);
+}
+
 /** Handle the #VMEXIT. */
 static void handle_exit(SvmVcpu *vcpu) {
+  TRACEPOINT(vmexit, vcpu->vmcb->exitcode, vcpu->vmcb->exitinfo1,
+             vcpu->vmcb->exitinfo2, vcpu->vmcb->rip);
+
   // Reset TLB control setting.
   vcpu->vmcb->tlb_control = 0x0;
 
+  reinject_interrupted_event(vcpu->vmcb);
+
   // Load FS, GS.
   load_segment_registers();
 
   switch (vcpu->vmcb->exitcode) {
     case SVM_EXIT_CODE_INTR:
       // If a physical interrupt occurs before the virtual interrupt is
-      // consumed, set the virtual interrupt back to the pending IRQ.
-      if (vcpu->vmcb->v_irq == 1) {
-        vcpu->pending_irq |= tobit_16(vcpu->last_injected_irq);
-      }
+      // consumed, set the virtual interrupt back to pending.
+      cancel_ext_intr(vcpu);
 
       // Consume the interrupt by YmirC. At the same time, interrupt subscriber
       // sets the peinding IRQ.
       stgi();
       clgi();
 
+      poll_console_rx(vcpu);
+
       // Give the external interrupt to guest.
       inject_ext_intr(vcpu);
       break;
@@ -353,9 +454,32 @@ static void handle_exit(SvmVcpu *vcpu) {
       step_next_inst(vcpu->vmcb);
       break;
     case SVM_EXIT_CODE_HLT:
-      while (!inject_ext_intr(vcpu)) {
+      for (;;) {
+        // The serial interrupt is taken by YmirC while the guest is idle, so
+        // its input is picked up here.
+        poll_console_rx(vcpu);
+        if (inject_ext_intr(vcpu)) break;
+        uint16_t pending_irq = vcpu->pending_irq;
+        int pending_vector = svm_lapic_pending_vector(vcpu);
+
         stgi();
-        __asm__ volatile("hlt");
+        // Spend idle time on background work one unit at a time, so that
+        // interrupts are taken in between. Halt once there is nothing left.
+        // The bin caches are drained last, so that their slabs are returned
+        // to the page allocator while the CPU is idle.
+        if (!log_drain(LOG_DRAIN_IDLE) && !vcpu->pa_ops->do_idle_work() &&
+            !bin_drain_caches()) {
+          // An interrupt taken during the idle work may have requested one for
+          // the guest. Check with interrupts disabled, and let the STI shadow
+          // cover HLT so that nothing is taken between the check and the halt.
+          disable_intr();
+          if (vcpu->pending_irq == pending_irq &&
+              svm_lapic_pending_vector(vcpu) == pending_vector) {
+            __asm__ volatile("sti; hlt");
+          } else {
+            enable_intr();
+          }
+        }
         clgi();
       }
       step_next_inst(vcpu->vmcb);
@@ -368,11 +492,18 @@ static void handle_exit(SvmVcpu *vcpu) {
     case SVM_EXIT_CODE_MSR:
       handle_svm_msr_exit(vcpu);
       step_next_inst(vcpu->vmcb);
+      // EOIs and IPIs to self may let an x2APIC interrupt through.
+      inject_ext_intr(vcpu);
       break;
     case SVM_EXIT_CODE_VMMCALL:
       handle_svm_vmmcall_exit(vcpu);
       step_next_inst(vcpu->vmcb);
       break;
+    case SVM_EXIT_CODE_AVIC_INCOMPLETE_IPI:
+      // Trap-like: RIP is past the WRMSR already.
+      handle_svm_avic_incomplete_ipi_exit(vcpu);
+      inject_ext_intr(vcpu);
+      break;
     default:
       print_exit_info(vcpu);
       svm_vcpu_abort(vcpu);
@@ -382,20 +513,28 @@ static void handle_exit(SvmVcpu *vcpu) {
 /** Callback function for interrupts. This function is to "share" IRQs between
  * YmirC and the guest. This function is called before YmirC's interrupt handler
  * and mark the incoming IRQ as pending. After that, YmirC's interrupt handler
- * consumes the IRQ and send EOI to the PIC. */
+ * consumes the IRQ and send EOI to the PIC. It is subscribed to the PIC's
+ * vectors only. */
 void intr_subscriber_callback(void *self, Context *ctx) {
   SvmVcpu *vcpu = (SvmVcpu *)self;
-  uint64_t vector = ctx->vector;
-  uint64_t offset = primary_vector_offset;
-
-  if (offset <= vector && vector < offset + 16) {
-    vcpu->pending_irq |= tobit_16(vector - offset);
-  }
+  vcpu->pending_irq |= tobit_16(ctx->vector - primary_vector_offset);
 }
 
 void svm_vcpu_loop(SvmVcpu *vcpu) {
+  // The vCPU stays here from now on, so its timers can be armed.
+  svm_pit_init(vcpu);
+  svm_lapic_init(vcpu);
+
   // Subscribe to interrupts.
-  subscribe2interrupt(vcpu, intr_subscriber_callback);
+  // Subscribe to the PIC's IRQs. The timer and serial IRQs are not shared:
+  // YmirC owns the PIT and the UART, and raises the guest's IRQ0 and IRQ4 from
+  // its virtual devices.
+  subscribe2interrupt(vcpu, intr_subscriber_callback,
+                      primary_vector_offset + irq_timer + 1,
+                      primary_vector_offset + irq_serial1 - 1);
+  subscribe2interrupt(vcpu, intr_subscriber_callback,
+                      primary_vector_offset + irq_serial1 + 1,
+                      primary_vector_offset + 15);
 
   // Start endless VMRUN / #VMEXIT loop.
   while (1) {
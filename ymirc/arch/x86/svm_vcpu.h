@@ -1,14 +1,19 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdnoreturn.h>
 
+#include "arena.h"
 #include "mem.h"
 #include "page_allocator_if.h"
 #include "serial.h"
 #include "svm_common.h"
 #include "svm_ioio_guest_state.h"
+#include "svm_lapic_state.h"
+#include "svm_pci_state.h"
+#include "svm_pit_state.h"
 #include "svm_vmcb.h"
 
 typedef struct {
@@ -24,29 +29,50 @@ typedef struct {
   GuestRegisters guest_regs;
   /** Host physical address where the guest is mapped. */
   Phys guest_base;
+  /** Host virtual address where the guest is mapped. */
+  uint8_t *guest_start;
+  /** Size of the guest memory in bytes. */
+  size_t guest_size;
   /** Pointer to host's serial object. */
   Serial *serial;
   /** Saved guest IOIO state. */
   SvmIoioGuestState guest_ioio_state;
+  /** Emulated PCI bus and its devices. */
+  SvmPciState pci_state;
+  /** Virtual PIT. */
+  SvmPitState pit_state;
+  /** Virtual x2APIC. */
+  SvmLapicState lapic_state;
   /** Pending IRQ. */
   uint16_t pending_irq;
   /** Last injected IRQ. */
   uint8_t last_injected_irq;
+  /** Whether the last injected interrupt came from the x2APIC rather than the
+   * PIC. */
+  bool lapic_injected;
+  /** Page allocator used for the vCPU. */
+  const page_allocator_ops_t *pa_ops;
 } SvmVcpu;
 
 /** Create a new virtual CPU. This function does not virtualize the CPU. You
  * MUST call `virtualize` to put the CPU to enable SVM. */
 SvmVcpu svm_vcpu_new(uint16_t asid, Serial *serial);
 
-/** Enable SVM extensions. */
-void svm_vcpu_virtualize(SvmVcpu *vcpu, const page_allocator_ops_t *pa_ops);
+/** Enable SVM extensions. The VMCB is allocated from `arena`. */
+void svm_vcpu_virtualize(SvmVcpu *vcpu, const page_allocator_ops_t *pa_ops,
+                         Arena *arena);
 
-/** Set up guest state. */
-void svm_vcpu_setup_guest_state(SvmVcpu *vcpu,
-                                const page_allocator_ops_t *pa_ops);
+/** Set up guest state. The permission maps are allocated from `arena`. */
+void svm_vcpu_setup_guest_state(SvmVcpu *vcpu, Arena *arena);
 
-/** Set NPT related values. */
-void svm_vcpu_set_npt(SvmVcpu *vcpu, Phys n_cr3, void *host_start);
+/** Set NPT related values. The guest memory of `size` bytes is mapped at
+ * `host_start`. */
+void svm_vcpu_set_npt(SvmVcpu *vcpu, Phys n_cr3, void *host_start,
+                      size_t size);
+
+/** Host pointer to `len` bytes of the guest memory at guest physical address
+ * `gpa`. Returns NULL if the range is not in the guest memory. */
+void *svm_vcpu_guest_ptr(SvmVcpu *vcpu, uint64_t gpa, size_t len);
 
 /** Start executing vCPU. */
 void svm_vcpu_loop(SvmVcpu *vcpu);
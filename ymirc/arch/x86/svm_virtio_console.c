@@ -0,0 +1,262 @@
+#define LOG_SUBSYSTEM LOG_SUBSYS_IOIO
+
+#include "svm_virtio_console.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "bits.h"
+#include "log.h"
+#include "mem.h"
+#include "serial.h"
+
+/** Legacy virtio PCI header in the I/O BAR. */
+#define VIRTIO_PCI_HOST_FEATURES 0x00
+#define VIRTIO_PCI_GUEST_FEATURES 0x04
+#define VIRTIO_PCI_QUEUE_PFN 0x08
+#define VIRTIO_PCI_QUEUE_NUM 0x0C
+#define VIRTIO_PCI_QUEUE_SEL 0x0E
+#define VIRTIO_PCI_QUEUE_NOTIFY 0x10
+#define VIRTIO_PCI_STATUS 0x12
+#define VIRTIO_PCI_ISR 0x13
+/** Device config follows the header since MSI-X is not offered. */
+#define VIRTIO_PCI_CONFIG 0x14
+
+#define VIRTIO_STATUS_DRIVER_OK 0x4
+/** Legacy vrings are laid out with this alignment. */
+#define VIRTIO_PCI_VRING_ALIGN 4096
+#define VIRTIO_PCI_QUEUE_ADDR_SHIFT 12
+
+#define VRING_DESC_F_NEXT 1
+#define VRING_DESC_F_WRITE 2
+#define VRING_AVAIL_F_NO_INTERRUPT 1
+
+/** Entries of each virtqueue. */
+#define QUEUE_SIZE 64
+#define QUEUE_RX 0
+#define QUEUE_TX 1
+
+/** Console config: 80x25, one port, no emergency write. */
+static const uint8_t console_config[VIRTIO_CONSOLE_IO_SIZE -
+                                    VIRTIO_PCI_CONFIG] = {80, 0, 25, 0, 1};
+
+typedef struct {
+  uint64_t addr;
+  uint32_t len;
+  uint16_t flags;
+  uint16_t next;
+} __attribute__((packed)) VringDesc;
+
+typedef struct {
+  uint16_t flags;
+  uint16_t idx;
+  uint16_t ring[QUEUE_SIZE];
+} __attribute__((packed)) VringAvail;
+
+typedef struct {
+  uint32_t id;
+  uint32_t len;
+} __attribute__((packed)) VringUsedElem;
+
+typedef struct {
+  uint16_t flags;
+  uint16_t idx;
+  VringUsedElem ring[QUEUE_SIZE];
+} __attribute__((packed)) VringUsed;
+
+/** Pointers into the guest's vring of a queue. */
+typedef struct {
+  VringDesc *desc;
+  VringAvail *avail;
+  VringUsed *used;
+} Vring;
+
+/** Map the vring of `queue`. Returns false if it is not set up or does not
+ * fit in the guest memory. */
+static bool map_vring(SvmVcpu *vcpu, const VirtioQueue *queue, Vring *vring) {
+  if (queue->pfn == 0) return false;
+  uint64_t base = (uint64_t)queue->pfn << VIRTIO_PCI_QUEUE_ADDR_SHIFT;
+  // The avail ring has a trailing used_event field.
+  size_t used_offset =
+      (sizeof(VringDesc) * QUEUE_SIZE + sizeof(VringAvail) + sizeof(uint16_t) +
+       VIRTIO_PCI_VRING_ALIGN - 1) &
+      ~(size_t)(VIRTIO_PCI_VRING_ALIGN - 1);
+  uint8_t *ring = svm_vcpu_guest_ptr(vcpu, base,
+                                     used_offset + sizeof(VringUsed) + 2);
+  if (ring == NULL) return false;
+
+  vring->desc = (VringDesc *)ring;
+  vring->avail = (VringAvail *)(ring + sizeof(VringDesc) * QUEUE_SIZE);
+  vring->used = (VringUsed *)(ring + used_offset);
+  return true;
+}
+
+static void raise_irq(SvmVcpu *vcpu, const Vring *vring) {
+  if (vring->avail->flags & VRING_AVAIL_F_NO_INTERRUPT) return;
+  vcpu->pci_state.console.isr |= 1;
+  vcpu->pending_irq |= tobit_16(VIRTIO_CONSOLE_IRQ);
+}
+
+static void push_used(Vring *vring, uint16_t head, uint32_t len) {
+  VringUsedElem *elem = &vring->used->ring[vring->used->idx % QUEUE_SIZE];
+  elem->id = head;
+  elem->len = len;
+  // The entry MUST be visible before the index.
+  __atomic_store_n(&vring->used->idx, vring->used->idx + 1, __ATOMIC_RELEASE);
+}
+
+/** Write the output buffers of the transmitq to the serial port. */
+static void process_tx(SvmVcpu *vcpu) {
+  VirtioQueue *queue = &vcpu->pci_state.console.queues[QUEUE_TX];
+  Vring vring;
+  if (!map_vring(vcpu, queue, &vring)) return;
+
+  bool used = false;
+  uint16_t avail_idx = __atomic_load_n(&vring.avail->idx, __ATOMIC_ACQUIRE);
+  while (queue->last_avail != avail_idx) {
+    uint16_t head = vring.avail->ring[queue->last_avail % QUEUE_SIZE];
+    uint16_t index = head;
+    // Bound the walk so that a looping chain cannot hang the VMM.
+    for (int n = 0; n < QUEUE_SIZE && index < QUEUE_SIZE; n++) {
+      const VringDesc *desc = &vring.desc[index];
+      const uint8_t *buf = svm_vcpu_guest_ptr(vcpu, desc->addr, desc->len);
+      if (buf != NULL && !(desc->flags & VRING_DESC_F_WRITE)) {
+        size_t written = 0;
+        while (written < desc->len) {
+          written += serial_write_nonblocking(vcpu->serial, buf + written,
+                                              desc->len - written);
+          // The Tx ring is full. Wait for room byte by byte.
+          if (written < desc->len) serial_write(vcpu->serial, buf[written++]);
+        }
+      }
+      if (!(desc->flags & VRING_DESC_F_NEXT)) break;
+      index = desc->next;
+    }
+    push_used(&vring, head, 0);
+    queue->last_avail++;
+    used = true;
+  }
+  if (used) raise_irq(vcpu, &vring);
+}
+
+void svm_virtio_console_poll_rx(SvmVcpu *vcpu) {
+#ifdef GUEST_CONSOLE_HVC
+  VirtioConsoleState *console = &vcpu->pci_state.console;
+  if (!(console->status & VIRTIO_STATUS_DRIVER_OK)) return;
+  VirtioQueue *queue = &console->queues[QUEUE_RX];
+  Vring vring;
+  if (!map_vring(vcpu, queue, &vring)) return;
+
+  bool used = false;
+  uint16_t avail_idx = __atomic_load_n(&vring.avail->idx, __ATOMIC_ACQUIRE);
+  while (queue->last_avail != avail_idx) {
+    uint16_t head = vring.avail->ring[queue->last_avail % QUEUE_SIZE];
+    // The console driver posts a single writable buffer per entry.
+    VringDesc *desc = head < QUEUE_SIZE ? &vring.desc[head] : NULL;
+    uint8_t *buf = desc ? svm_vcpu_guest_ptr(vcpu, desc->addr, desc->len)
+                        : NULL;
+    uint32_t len = 0;
+    // An invalid buffer is returned empty without taking input from the ring.
+    if (buf != NULL && (desc->flags & VRING_DESC_F_WRITE) && desc->len > 0) {
+      int c;
+      while (len < desc->len && (c = serial_read(vcpu->serial)) != -1) {
+        buf[len++] = c;
+      }
+      // No input. The buffer stays posted for the next one.
+      if (len == 0) break;
+    }
+    push_used(&vring, head, len);
+    queue->last_avail++;
+    used = true;
+  }
+  if (used) raise_irq(vcpu, &vring);
+#else
+  (void)vcpu;
+#endif
+}
+
+static void reset(VirtioConsoleState *console) {
+  memset(console, 0, sizeof(*console));
+}
+
+uint32_t svm_virtio_console_in(SvmVcpu *vcpu, uint16_t offset,
+                               unsigned int size) {
+  VirtioConsoleState *console = &vcpu->pci_state.console;
+
+  if (offset >= VIRTIO_PCI_CONFIG) {
+    uint32_t value = 0;
+    size_t avail = VIRTIO_CONSOLE_IO_SIZE - offset;
+    memcpy(&value, &console_config[offset - VIRTIO_PCI_CONFIG],
+           size < avail ? size : avail);
+    return value;
+  }
+
+  switch (offset) {
+    case VIRTIO_PCI_HOST_FEATURES:
+      // No features. A single port is enough for hvc0.
+      return 0;
+    case VIRTIO_PCI_GUEST_FEATURES:
+      return console->guest_features;
+    case VIRTIO_PCI_QUEUE_PFN:
+      return console->queue_select < VIRTIO_CONSOLE_NUM_QUEUES
+                 ? console->queues[console->queue_select].pfn
+                 : 0;
+    case VIRTIO_PCI_QUEUE_NUM:
+      // 0 tells the driver that the queue does not exist.
+      return console->queue_select < VIRTIO_CONSOLE_NUM_QUEUES ? QUEUE_SIZE
+                                                               : 0;
+    case VIRTIO_PCI_QUEUE_SEL:
+      return console->queue_select;
+    case VIRTIO_PCI_STATUS:
+      return console->status;
+    case VIRTIO_PCI_ISR: {
+      // Reading the ISR acknowledges the interrupt.
+      uint8_t isr = console->isr;
+      console->isr = 0;
+      return isr;
+    }
+    default:
+      LOG_WARN("Unsupported virtio-console read: offset=0x%x\n", offset);
+      return 0;
+  }
+}
+
+void svm_virtio_console_out(SvmVcpu *vcpu, uint16_t offset, unsigned int size,
+                            uint32_t value) {
+  VirtioConsoleState *console = &vcpu->pci_state.console;
+  (void)size;
+
+  switch (offset) {
+    case VIRTIO_PCI_GUEST_FEATURES:
+      console->guest_features = value;
+      break;
+    case VIRTIO_PCI_QUEUE_PFN:
+      if (console->queue_select < VIRTIO_CONSOLE_NUM_QUEUES) {
+        VirtioQueue *queue = &console->queues[console->queue_select];
+        queue->pfn = value;
+        queue->last_avail = 0;
+      }
+      break;
+    case VIRTIO_PCI_QUEUE_SEL:
+      console->queue_select = value;
+      break;
+    case VIRTIO_PCI_QUEUE_NOTIFY:
+      if (value == QUEUE_TX) {
+        process_tx(vcpu);
+      } else if (value == QUEUE_RX) {
+        svm_virtio_console_poll_rx(vcpu);
+      }
+      break;
+    case VIRTIO_PCI_STATUS:
+      // Writing 0 resets the device.
+      if ((value & 0xFF) == 0) {
+        reset(console);
+      } else {
+        console->status = value;
+      }
+      break;
+    default:
+      LOG_WARN("Unsupported virtio-console write: offset=0x%x\n", offset);
+      break;
+  }
+}
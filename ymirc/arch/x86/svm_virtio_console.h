@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "svm_vcpu.h"
+
+/** PCI IDs of a legacy (transitional) virtio console. */
+#define VIRTIO_PCI_VENDOR_ID 0x1AF4
+#define VIRTIO_CONSOLE_PCI_DEVICE_ID 0x1003
+#define VIRTIO_ID_CONSOLE 3
+
+/** IRQ of the virtio console on the guest's PIC. */
+#define VIRTIO_CONSOLE_IRQ 5
+/** Size of the I/O BAR: the legacy virtio header and the console config. */
+#define VIRTIO_CONSOLE_IO_SIZE 32
+
+/** Read a register of the legacy virtio header or the console config at
+ * `offset` in the I/O BAR. */
+uint32_t svm_virtio_console_in(SvmVcpu *vcpu, uint16_t offset,
+                               unsigned int size);
+
+/** Write a register at `offset` in the I/O BAR. A notify of the transmitq
+ * writes all queued output to the serial Tx ring at once. */
+void svm_virtio_console_out(SvmVcpu *vcpu, uint16_t offset, unsigned int size,
+                            uint32_t value);
+
+/** Move received serial input into the receiveq. Does nothing unless YmirC
+ * is built with GUEST_CONSOLE=hvc, since input belongs to the 8250
+ * otherwise. */
+void svm_virtio_console_poll_rx(SvmVcpu *vcpu);
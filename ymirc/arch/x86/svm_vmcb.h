@@ -95,7 +95,9 @@ typedef struct {
   unsigned int v_ign_tpr : 1;       /* 20 */
   unsigned int reserved060_21 : 3;  /* 23-21 */
   unsigned int v_intr_masking : 1;  /* 24 */
-  unsigned int reserved060_25 : 7;  /* 31-25 */
+  unsigned int reserved060_25 : 5;  /* 29-25 */
+  unsigned int x2avic_enable : 1;   /* 30 */
+  unsigned int avic_enable : 1;     /* 31 */
   unsigned int v_intr_vector : 8;   /* 39-32 */
   unsigned int reserved060_40 : 24; /* 63-40 */
   /* 0x068 */
@@ -110,7 +112,7 @@ typedef struct {
   unsigned int np_enable : 1; /* 0 */
   uint64_t reserved090 : 63;  /* 63-1 */
   /* 0x098 */
-  uint32_t reserved09[2]; /* 0x098 */
+  uint64_t avic_apic_bar; /* 0x098 */
   uint32_t reserved0a[2]; /* 0x0A0 */
   uint64_t eventinj;      /* 0x0A8 */
   uint64_t n_cr3;         /* 0x0B0 */
@@ -121,8 +123,10 @@ typedef struct {
   uint32_t reserved0c[2];              /* 0x0C0 */
   uint64_t nrip;                       /* 0x0C8 */
   uint8_t guest_instruction_bytes[16]; /* 0x0D0 */
-  uint32_t reserved0e[4];              /* 0x0E0 */
-  uint32_t reserved0f[4];              /* 0x0F0 */
+  uint64_t avic_backing_page;          /* 0x0E0 */
+  uint32_t reserved0e[2];              /* 0x0E8 */
+  uint64_t avic_logical_table;         /* 0x0F0 */
+  uint64_t avic_physical_table;        /* 0x0F8 */
   uint32_t reserved1[64];              /* 0x100 */
   uint32_t reserved2[64];              /* 0x200 */
   uint32_t reserved3[64];              /* 0x300 */
@@ -359,5 +363,7 @@ typedef enum {
   SVM_EXIT_CODE_BUSLOCK = 0xA5,
   SVM_EXIT_CODE_IDLE_HLT = 0xA6,
   SVM_EXIT_CODE_NPF = 0x400,
+  SVM_EXIT_CODE_AVIC_INCOMPLETE_IPI = 0x401,
+  SVM_EXIT_CODE_AVIC_NOACCEL = 0x402,
   SVM_EXIT_CODE_INVALID = -1,
 } SvmExitCode;
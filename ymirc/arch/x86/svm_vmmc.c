@@ -1,6 +1,11 @@
+#define LOG_SUBSYSTEM LOG_SUBSYS_VMMC
+
 #include "svm_vmmc.h"
 
+#include "alloc_stats.h"
+#include "interrupt.h"
 #include "log.h"
+#include "trace.h"
 
 /**
  * ASCII art from https://patorjk.com/software/taag/
@@ -16,6 +21,17 @@ static const char *logo =
 
 typedef enum {
   VMMCALL_NR_HELLO = 0,
+  /** Dump the allocator stats to the log. The free and used frames of the
+   * page allocator are returned in RAX and RBX. */
+  VMMCALL_NR_ALLOC_STATS = 1,
+  /** Enable the tracepoints whose bits are set in RBX. */
+  VMMCALL_NR_TRACE_MASK = 2,
+  /** Dump the trace rings to the log. */
+  VMMCALL_NR_TRACE_DUMP = 3,
+  /** Set the log level of the subsystem in RBX to RCX. */
+  VMMCALL_NR_LOG_LEVEL = 4,
+  /** Dump the interrupt counters to the log. */
+  VMMCALL_NR_INTR_STATS = 5,
 } VmmcallNr;
 
 static void vmmc_hello() {
@@ -23,13 +39,49 @@ static void vmmc_hello() {
   LOG_INFO("This OS is hypervisored by YmirC.\n");
 }
 
+static void vmmc_alloc_stats(SvmVcpu *vcpu) {
+  alloc_stats_dump(LOG_LEVEL_INFO);
+  PageAllocatorStats stats;
+  alloc_stats_get_pages(&stats);
+  vcpu->vmcb->rax = stats.free_frames;
+  vcpu->guest_regs.rbx = stats.used_frames;
+}
+
+static void vmmc_log_level(uint64_t subsystem, uint64_t level) {
+  if (!log_set_level(subsystem, level)) {
+    LOG_ERROR("Invalid log level: subsystem=%lu level=%lu\n", subsystem,
+              level);
+    return;
+  }
+  LOG_INFO("Log level of %s set to %lu.\n", log_subsystem_name(subsystem),
+           level);
+}
+
 void handle_svm_vmmcall_exit(SvmVcpu *vcpu) {
   uint64_t rax = vcpu->vmcb->rax;
+  uint64_t rbx = vcpu->guest_regs.rbx;
+  TRACEPOINT(vmmcall, rax, rbx);
 
   switch (rax) {
     case VMMCALL_NR_HELLO:
       vmmc_hello();
       break;
+    case VMMCALL_NR_ALLOC_STATS:
+      vmmc_alloc_stats(vcpu);
+      break;
+    case VMMCALL_NR_TRACE_MASK:
+      trace_set_mask(rbx);
+      LOG_INFO("Trace mask set to 0x%x.\n", rbx);
+      break;
+    case VMMCALL_NR_TRACE_DUMP:
+      trace_dump();
+      break;
+    case VMMCALL_NR_LOG_LEVEL:
+      vmmc_log_level(rbx, vcpu->guest_regs.rcx);
+      break;
+    case VMMCALL_NR_INTR_STATS:
+      itr_dump_stats(LOG_LEVEL_INFO);
+      break;
     default:
       LOG_ERROR("Unhandled VMCALL: nr=%d\n", rax);
   }
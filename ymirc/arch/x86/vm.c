@@ -11,6 +11,7 @@
 #include "linux.h"
 #include "log.h"
 #include "mem.h"
+#include "numa.h"
 #include "panic.h"
 #include "svm_npt.h"
 
@@ -19,8 +20,18 @@
 static_assert(GUEST_MEMORY_SIZE % PAGE_SIZE_2MB == 0,
               "Guest memory size must be a multiple of 2MiB.");
 
-/** cmdline */
+/** Pages of the first arena chunk of a VM. It holds the VMCB (1 page), the
+ * MSRPM (2), the IOPM (3), the NPT tables (3 for the guest memory), the x2APIC
+ * register page (1) and the AVIC physical and logical APIC ID tables (2). */
+#define VM_ARENA_PAGES 16
+
+/** cmdline. With GUEST_CONSOLE=hvc, the console is the virtio console and
+ * the 8250 is only used for early messages. */
+#ifdef GUEST_CONSOLE_HVC
+#define KERNEL_CMDLINE "console=hvc0 earlyprintk=serial nokaslr"
+#else
 #define KERNEL_CMDLINE "console=ttyS0 earlyprintk=serial nokaslr"
+#endif
 #define KERNEL_CMDLINE_LEN (sizeof(KERNEL_CMDLINE) - 1)
 
 /** Length of out must be 12. */
@@ -75,12 +86,27 @@ Vm vm_new(Serial *serial) {
 }
 
 void vm_init(Vm *vm, const page_allocator_ops_t *pa_ops) {
+  vm->pa_ops = pa_ops;
+  if (!arena_init(&vm->arena, pa_ops, VM_ARENA_PAGES)) {
+    LOG_ERROR("Failed to allocate memory for the VM arena.\n");
+    vm->error = VM_ERROR_OUT_OF_MEMORY;
+    return;
+  }
+
   // Initialize vCPU.
-  svm_vcpu_virtualize(&vm->svmvcpu, pa_ops);
+  svm_vcpu_virtualize(&vm->svmvcpu, pa_ops, &vm->arena);
   LOG_INFO("vCPU #%d is created.\n", vm->svmvcpu.id);
 
   // Setup guest state.
-  svm_vcpu_setup_guest_state(&vm->svmvcpu, pa_ops);
+  svm_vcpu_setup_guest_state(&vm->svmvcpu, &vm->arena);
+}
+
+void vm_destroy(Vm *vm) {
+  arena_destroy(&vm->arena);
+  if (vm->guest_mem) {
+    vm->pa_ops->free(vm->guest_mem);
+    vm->guest_mem = NULL;
+  }
 }
 
 void vm_loop(Vm *vm) {
@@ -162,24 +188,33 @@ static void load_kernel(Vm *vm, const void *kernel, size_t kernel_size,
   LOG_INFO("Guest kernel code offset: 0x%x\n", code_offset);
 }
 
+/** NUMA node of the running CPU. */
+static int current_numa_node(void) {
+  // Fn0000_0001_EBX[31:24]: Initial local APIC ID
+  CpuidRegisters regs = cpuid(0x1, 0);
+  return numa_node_of_apic(regs.ebx >> 24);
+}
+
 void setup_guest_memory(Vm *vm, const void *guest_image,
                         size_t guest_image_size, const void *initrd,
                         size_t initrd_size,
                         const page_allocator_ops_t *pa_ops) {
-  // Allocate guest memory.
-  vm->guest_mem =
-      pa_ops->alloc_aligned_pages(GUEST_MEMORY_SIZE / PAGE_SIZE, PAGE_SIZE_2MB);
+  // Allocate guest memory on the node of the CPU that runs the vCPU.
+  vm->guest_mem = pa_ops->alloc_on_node(GUEST_MEMORY_SIZE / PAGE_SIZE,
+                                        PAGE_SIZE_2MB, current_numa_node());
   if (!vm->guest_mem) {
-    panic("Failed to allocate guest memory.");
+    LOG_ERROR("Failed to allocate guest memory.\n");
+    vm->error = VM_ERROR_OUT_OF_MEMORY;
+    return;
   }
 
   // Load kernel
   load_kernel(vm, guest_image, guest_image_size, initrd, initrd_size);
 
   // Create simple NPT mapping.
-  Phys n_cr3 =
-      init_npt(0, virt2phys((Virt)vm->guest_mem), GUEST_MEMORY_SIZE, pa_ops);
-  svm_vcpu_set_npt(&vm->svmvcpu, n_cr3, vm->guest_mem);
+  Phys n_cr3 = init_npt(0, virt2phys((Virt)vm->guest_mem), GUEST_MEMORY_SIZE,
+                        &vm->arena);
+  svm_vcpu_set_npt(&vm->svmvcpu, n_cr3, vm->guest_mem, GUEST_MEMORY_SIZE);
   LOG_INFO("Guet memory is mapped: HVA=%p (size=0x%x)\n", vm->guest_mem,
            GUEST_MEMORY_SIZE);
 }
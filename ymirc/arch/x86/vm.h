@@ -2,6 +2,7 @@
 
 #include <stdint.h>
 
+#include "arena.h"
 #include "page_allocator_if.h"
 #include "serial.h"
 #include "svm_vcpu.h"
@@ -20,19 +21,27 @@ typedef struct {
   VirtualizeType vtype;
   SvmVcpu svmvcpu;
   void *guest_mem;
+  /** Control structures of the VM such as the VMCB and the NPT tables. */
+  Arena arena;
+  /** Page allocator that backs the guest memory and the arena. */
+  const page_allocator_ops_t *pa_ops;
 } Vm;
 
 /** Create a new virtual machine instance. You MUST initialize the VM before
  * using it. */
 Vm vm_new(Serial *serial);
 
-/** Initialize the virtual machine, enabling SVM extensions. */
+/** Initialize the virtual machine, enabling SVM extensions. Sets `error` if
+ * it fails. */
 void vm_init(Vm *vm, const page_allocator_ops_t *pa_ops);
 
+/** Release all memory of the virtual machine. The VM MUST NOT be running. */
+void vm_destroy(Vm *vm);
+
 /** Kick off the virtual machine. */
 void vm_loop(Vm *vm);
 
-/** Setup guest memory. */
+/** Setup guest memory. Sets `error` if it fails. */
 void setup_guest_memory(Vm *vm, const void *guest_image,
                         size_t guest_image_size, const void *initrd,
                         size_t initrd_size, const page_allocator_ops_t *pa_ops);
@@ -0,0 +1,62 @@
+#define LOG_SUBSYSTEM LOG_SUBSYS_ALLOC
+
+#include "arena.h"
+
+#include <stdint.h>
+
+#include "log.h"
+#include "mem.h"
+
+static bool add_chunk(Arena *arena, size_t num_pages) {
+  if (arena->num_chunks >= ARENA_MAX_CHUNKS) {
+    LOG_ERROR("Arena: too many chunks.\n");
+    return false;
+  }
+  // The page allocator zeroes them, from its pool of pages zeroed while idle
+  // where it can.
+  void *base = arena->pa->alloc_zeroed_pages(num_pages);
+  if (base == NULL) return false;
+  arena->chunks[arena->num_chunks++] = (ArenaChunk){base, num_pages};
+  arena->used = 0;
+  return true;
+}
+
+bool arena_init(Arena *arena, const page_allocator_ops_t *pa,
+                size_t num_pages) {
+  *arena = (Arena){.pa = pa};
+  return add_chunk(arena, num_pages);
+}
+
+void *arena_alloc_pages(Arena *arena, size_t num_pages) {
+  if (num_pages == 0 || arena->num_chunks == 0) return NULL;
+
+  ArenaChunk *chunk = &arena->chunks[arena->num_chunks - 1];
+  if (chunk->num_pages - arena->used < num_pages) {
+    // The rest of the current chunk is left unused.
+    size_t next = chunk->num_pages * 2;
+    if (next < num_pages) next = num_pages;
+    if (!add_chunk(arena, next)) return NULL;
+    chunk = &arena->chunks[arena->num_chunks - 1];
+  }
+
+  // Chunks are zero-filled when taken, and pages are never handed out twice.
+  uint8_t *pages = (uint8_t *)chunk->base + arena->used * PAGE_SIZE;
+  arena->used += num_pages;
+  return pages;
+}
+
+void arena_destroy(Arena *arena) {
+  for (size_t i = 0; i < arena->num_chunks; i++) {
+    arena->pa->free(arena->chunks[i].base);
+  }
+  arena->num_chunks = 0;
+  arena->used = 0;
+}
+
+size_t arena_num_pages(const Arena *arena) {
+  size_t num_pages = 0;
+  for (size_t i = 0; i < arena->num_chunks; i++) {
+    num_pages += arena->chunks[i].num_pages;
+  }
+  return num_pages;
+}
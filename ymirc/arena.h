@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "page_allocator_if.h"
+
+/** Maximum number of chunks an arena grows to. */
+#define ARENA_MAX_CHUNKS 8
+
+/** Contiguous pages taken from the page allocator. */
+typedef struct {
+  void *base;
+  size_t num_pages;
+} ArenaChunk;
+
+/** Bump allocator of pages that are released all at once. It takes a chunk of
+ * contiguous pages up front and hands out pages from it in order. When the
+ * chunk runs out, a new one twice as large is taken. */
+typedef struct {
+  const page_allocator_ops_t *pa;
+  ArenaChunk chunks[ARENA_MAX_CHUNKS];
+  size_t num_chunks;
+  /** Pages handed out from the last chunk. */
+  size_t used;
+} Arena;
+
+/** Initialize the arena with a first chunk of `num_pages` pages. Returns false
+ * if the pages cannot be allocated. */
+bool arena_init(Arena *arena, const page_allocator_ops_t *pa,
+                size_t num_pages);
+
+/** Allocate `num_pages` zero-filled, page-aligned pages. Returns NULL if no
+ * memory is left. */
+void *arena_alloc_pages(Arena *arena, size_t num_pages);
+
+/** Release every page of the arena to the page allocator. The arena can be
+ * initialized again afterwards. */
+void arena_destroy(Arena *arena);
+
+/** Number of pages the arena holds from the page allocator. */
+size_t arena_num_pages(const Arena *arena);
@@ -0,0 +1,85 @@
+#include "arena.h"
+
+#include <assert.h>
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+#include "mem.h"
+
+#define STUB_PAGE_CAP 32
+static alignas(PAGE_SIZE) uint8_t pages[STUB_PAGE_CAP][PAGE_SIZE];
+static size_t index = 0;
+static void *freed[STUB_PAGE_CAP];
+static size_t num_freed = 0;
+
+static void *stub_alloc_aligned_pages(size_t num_pages, size_t align_size) {
+  (void)align_size;
+  if (index + num_pages > STUB_PAGE_CAP) return NULL;
+  void *ret = pages[index];
+  index += num_pages;
+  return ret;
+}
+
+static void *stub_alloc_zeroed_pages(size_t num_pages) {
+  void *ret = stub_alloc_aligned_pages(num_pages, PAGE_SIZE);
+  if (ret != NULL) memset(ret, 0, num_pages * PAGE_SIZE);
+  return ret;
+}
+
+static void stub_free(void *ptr) { freed[num_freed++] = ptr; }
+
+static const page_allocator_ops_t stub_pa = {
+    .alloc_aligned_pages = stub_alloc_aligned_pages,
+    .alloc_zeroed_pages = stub_alloc_zeroed_pages,
+    .free = stub_free,
+};
+
+void log_output(char c) { putchar(c); }
+void log_no_output(char c) { (void)c; }
+
+int main() {
+  log_set_writefn(log_output);
+
+  Arena arena;
+  memset(pages, 0xAA, sizeof(pages));
+  assert(arena_init(&arena, &stub_pa, 4));
+
+  // Pages are handed out in order and zero-filled. The whole chunk is zeroed
+  // when it is taken, and nothing else is touched.
+  assert(arena_alloc_pages(&arena, 1) == pages[0]);
+  assert(arena_alloc_pages(&arena, 2) == pages[1]);
+  for (size_t i = 0; i < 2 * PAGE_SIZE; i++) assert(pages[1][i] == 0);
+  assert(pages[3][0] == 0 && pages[4][0] == 0xAA);
+  assert(arena_alloc_pages(&arena, 0) == NULL);
+
+  // A request that does not fit takes a new chunk twice as large.
+  assert(arena_alloc_pages(&arena, 2) == pages[4]);
+  assert(arena_alloc_pages(&arena, 6) == pages[6]);
+  assert(arena_num_pages(&arena) == 12);
+  // A request larger than the doubled chunk gets a chunk of its own size.
+  assert(arena_alloc_pages(&arena, 17) == pages[12]);
+  assert(arena_num_pages(&arena) == 29);
+  // No memory is left for the next chunk.
+  assert(arena_alloc_pages(&arena, 1) == NULL);
+
+  // Everything is released at once.
+  arena_destroy(&arena);
+  assert(num_freed == 3);
+  assert(freed[0] == pages[0]);
+  assert(freed[1] == pages[4]);
+  assert(freed[2] == pages[12]);
+  assert(arena_num_pages(&arena) == 0);
+  assert(arena_alloc_pages(&arena, 1) == NULL);
+
+  // The arena can be reused.
+  index = 0;
+  assert(arena_init(&arena, &stub_pa, 1));
+  assert(arena_alloc_pages(&arena, 1) == pages[0]);
+
+  puts("PASS");
+
+  return 0;
+}
@@ -1,23 +1,138 @@
+#define LOG_SUBSYSTEM LOG_SUBSYS_ALLOC
+
 #include "bin_allocator.h"
 
 #include <stdint.h>
 
+#include "arch.h"
 #include "log.h"
 #include "mem.h"
 #include "panic.h"
+#include "spinlock.h"
+
+/** Size classes are 16 to 128 bytes in steps of 16, then 4 classes for each
+ * doubling up to 256KiB. The gap between neighboring classes is at most 25%,
+ * so that is the most an object wastes. */
+#define BIN_MIN_SIZE 16
+#define BIN_SMALL_MAX 128
+#define BIN_SMALL_NUM (BIN_SMALL_MAX / BIN_MIN_SIZE)
+#define BIN_CLASSES_PER_DOUBLING 4
+#define BIN_MAX_SIZE (256 * 1024)
+_Static_assert(BIN_SMALL_NUM + 11 * BIN_CLASSES_PER_DOUBLING == BIN_SIZE_NUM,
+               "Classes must cover up to BIN_MAX_SIZE.");
+
+/** Objects larger than a page are carved from spans of contiguous pages. A
+ * span is the smallest one that wastes at most 1/8 of its size. */
+#define SPAN_MAX_PAGES (BIN_MAX_SIZE / PAGE_SIZE)
+#define SPAN_MAX_WASTE 8
+
+static unsigned int bin_sizes[BIN_SIZE_NUM];
+/** Number of pages of a span for each class. */
+static uint8_t span_pages[BIN_SIZE_NUM];
+
+/** Page frame number of a slab. 0 means none since frame 0 is never handed
+ * out by the page allocator. */
+typedef uint32_t SlabFrame;
+#define NO_SLAB 0
+
+/** Offset in a slab meaning the end of the free list. */
+#define NO_OBJECT UINT32_MAX
+
+/** Descriptor of a span split into objects of a single bin. Every page of the
+ * span has one. Only the one of the first page is used, and the others point
+ * back to it. */
+typedef struct {
+  /** Offset of the first free object in the span, or NO_OBJECT. Each free
+   * object holds the offset of the next one. */
+  uint32_t free_offset;
+  /** Number of objects handed out. */
+  uint16_t live;
+  /** Bin index plus one. 0 means the page is not a slab. */
+  uint8_t bin;
+  /** Number of pages from the first page of the span. */
+  uint8_t tail;
+  /** Neighbors in the list of slabs of the bin that have free objects. */
+  SlabFrame prev;
+  SlabFrame next;
+} SlabDesc;
+
+/** Slab descriptors are kept in a side table indexed by page frame number, so
+ * objects can fill the whole page. The table is a 3-level radix tree of 9 bits
+ * each, which covers the direct mapping. Tables are never freed. */
+#define RADIX_BITS 9
+#define RADIX_ENTRIES (1ULL << RADIX_BITS)
+#define RADIX_MASK (RADIX_ENTRIES - 1)
+#define RADIX_LEAF_PAGES (RADIX_ENTRIES * sizeof(SlabDesc) / PAGE_SIZE)
+#define MAX_SLAB_FRAME (1ULL << (RADIX_BITS * 3))
+_Static_assert(MAX_SLAB_FRAME * PAGE_SIZE >= DIRECT_MAP_SIZE,
+               "Slab table must cover the direct mapping.");
+
+static SlabDesc** radix_root[RADIX_ENTRIES];
+
+/** Head of the list of slabs with free objects for each bin. */
+static SlabFrame partial_slabs[BIN_SIZE_NUM];
+
+/** Slab usage of a bin. Updated with the depot lock held. */
+typedef struct {
+  uint64_t slab_objects;
+  uint64_t high_water_objects;
+  uint64_t num_slabs;
+} SlabCounters;
+
+static SlabCounters slab_counters[BIN_SIZE_NUM];
+
+/** Number of objects a magazine holds. */
+#define MAGAZINE_SIZE 32
+/** Number of objects moved from the slabs to a magazine at once. */
+#define MAGAZINE_BATCH (MAGAZINE_SIZE / 2)
+/** Number of full magazines the depot keeps for each bin. Objects beyond that
+ * go back to the slabs, so that empty slabs can be released. */
+#define DEPOT_MAX_FULL 4
 
-/** Metadata of free chunk. */
-typedef struct _chunk_meta_node {
-  struct _chunk_meta_node* next;
-} chunk_meta_node_t;
+/** Stack of free objects of a bin. */
+typedef struct _magazine {
+  struct _magazine* next;
+  size_t count;
+  void* rounds[MAGAZINE_SIZE];
+} Magazine;
 
-#define BIN_SIZE_NUM 7
+/** Magazines of a CPU for a bin. `previous` is swapped in when `loaded` runs
+ * out or fills up, so that alternating alloc/free at a magazine boundary does
+ * not go to the depot every time. Either can be NULL. */
+typedef struct {
+  Magazine* loaded;
+  Magazine* previous;
+} MagazinePair;
 
-/** The largest bin size must be smaller than a 4KiB page size. */
-static const unsigned int bin_sizes[] = {0x20,  0x40,  0x80, 0x100,
-                                         0x200, 0x400, 0x800};
+/** Per-CPU caches in front of the depot. Only the owning CPU touches them, so
+ * they need neither locks nor atomics. Interrupt handlers MUST NOT allocate
+ * from the bin allocator since they could interrupt an update. */
+typedef struct {
+  MagazinePair bins[BIN_SIZE_NUM];
+  /** Counters of the CPU. Frees are counted by the CPU that frees, so only
+   * the sum over all CPUs is meaningful. */
+  uint64_t allocs[BIN_SIZE_NUM];
+  uint64_t frees[BIN_SIZE_NUM];
+  uint64_t large_allocs;
+  uint64_t large_frees;
+  uint64_t alloc_failures;
+  uint64_t slow_path_hits;
+} __attribute__((aligned(64))) CpuCache;
 
-static chunk_meta_node_t* list_heads[BIN_SIZE_NUM];
+static CpuCache cpu_caches[MAX_CPUS];
+
+/** Full magazines shared by all CPUs for each bin. */
+typedef struct {
+  Magazine* full;
+  size_t num_full;
+} Depot;
+
+static Depot depots[BIN_SIZE_NUM];
+/** Unused magazines. */
+static Magazine* free_magazines;
+
+/** Protects the depots, the unused magazines, the slabs and the slab table. */
+static Spinlock depot_lock = SPINLOCK_INIT;
 
 static const page_allocator_ops_t* pa;
 
@@ -27,105 +142,432 @@ void init_bin_allocator(const page_allocator_ops_t* ops) {
     panic("BinAllocator: page allocator ops is NULL");
   }
   pa = ops;
+
+  for (int i = 0; i < BIN_SIZE_NUM; i++) {
+    if (i < BIN_SMALL_NUM) {
+      bin_sizes[i] = (i + 1) * BIN_MIN_SIZE;
+    } else {
+      int doubling = (i - BIN_SMALL_NUM) / BIN_CLASSES_PER_DOUBLING;
+      int step = (i - BIN_SMALL_NUM) % BIN_CLASSES_PER_DOUBLING + 1;
+      unsigned int base = BIN_SMALL_MAX << doubling;
+      bin_sizes[i] = base + step * (base / BIN_CLASSES_PER_DOUBLING);
+    }
+
+    unsigned int pages = (bin_sizes[i] + PAGE_SIZE - 1) / PAGE_SIZE;
+    while (pages < SPAN_MAX_PAGES &&
+           (pages * PAGE_SIZE) % bin_sizes[i] >
+               pages * PAGE_SIZE / SPAN_MAX_WASTE) {
+      pages++;
+    }
+    span_pages[i] = pages;
+  }
 }
 
-static void push(chunk_meta_node_t* node, size_t bin_index) {
-  if (list_heads[bin_index]) {
-    node->next = list_heads[bin_index];
-    list_heads[bin_index] = node;
-  } else {
-    node->next = NULL;
-    list_heads[bin_index] = node;
+static inline SlabFrame ptr2frame(const void* ptr) {
+  return virt2phys((Virt)ptr) / PAGE_SIZE;
+}
+
+static inline uint8_t* frame2page(SlabFrame frame) {
+  return (uint8_t*)phys2virt((Phys)frame * PAGE_SIZE);
+}
+
+/** Look up the descriptor of `frame`. If `create` is true, missing tables are
+ * allocated. Returns NULL if there is no descriptor. */
+static SlabDesc* find_desc(SlabFrame frame, bool create) {
+  if (frame >= MAX_SLAB_FRAME) return NULL;
+  size_t i = (frame >> (RADIX_BITS * 2)) & RADIX_MASK;
+  size_t j = (frame >> RADIX_BITS) & RADIX_MASK;
+  size_t k = frame & RADIX_MASK;
+
+  if (radix_root[i] == NULL) {
+    if (!create) return NULL;
+    radix_root[i] = pa->alloc_zeroed_pages(1);
+    if (radix_root[i] == NULL) return NULL;
   }
+  SlabDesc** middle = radix_root[i];
+  if (middle[j] == NULL) {
+    if (!create) return NULL;
+    middle[j] = pa->alloc_zeroed_pages(RADIX_LEAF_PAGES);
+    if (middle[j] == NULL) return NULL;
+  }
+  return &middle[j][k];
+}
+
+static inline SlabDesc* desc_of(SlabFrame frame) {
+  return find_desc(frame, false);
+}
+
+static void push_partial(size_t bin_index, SlabFrame frame, SlabDesc* desc) {
+  desc->prev = NO_SLAB;
+  desc->next = partial_slabs[bin_index];
+  if (desc->next != NO_SLAB) desc_of(desc->next)->prev = frame;
+  partial_slabs[bin_index] = frame;
 }
 
-static chunk_meta_node_t* pop(size_t bin_index) {
-  if (list_heads[bin_index]) {
-    chunk_meta_node_t* first = list_heads[bin_index];
-    list_heads[bin_index] = first->next;
-    return first;
+static void remove_partial(size_t bin_index, SlabDesc* desc) {
+  if (desc->prev != NO_SLAB) {
+    desc_of(desc->prev)->next = desc->next;
   } else {
-    panic("BinAllocator: pop from empty list");
+    partial_slabs[bin_index] = desc->next;
   }
+  if (desc->next != NO_SLAB) desc_of(desc->next)->prev = desc->prev;
 }
 
-/**
+/** Split a new span into objects of the bin.
  * @return 0 on success, -1 on failure.
  */
 static int init_bin_page(size_t bin_index) {
-  void* new_page = pa->alloc(PAGE_SIZE);
-  if (!new_page) {
+  unsigned int num_pages = span_pages[bin_index];
+  void* new_span = pa->alloc(num_pages * PAGE_SIZE);
+  if (!new_span) {
     return -1;
   }
+  SlabFrame frame = ptr2frame(new_span);
+  for (unsigned int i = 0; i < num_pages; i++) {
+    SlabDesc* desc = find_desc(frame + i, true);
+    if (desc == NULL) {
+      for (unsigned int j = 0; j < i; j++) desc_of(frame + j)->bin = 0;
+      pa->free(new_span);
+      return -1;
+    }
+    *desc = (SlabDesc){.bin = bin_index + 1, .tail = i};
+  }
 
   unsigned int bin_size = bin_sizes[bin_index];
-  int i = PAGE_SIZE / bin_size - 1;
-  for (; i >= 0; i--) {
-    chunk_meta_node_t* chunk =
-        (chunk_meta_node_t*)((uint8_t*)new_page + i * bin_size);
-    push(chunk, bin_index);
+  uint32_t next = NO_OBJECT;
+  for (int i = num_pages * PAGE_SIZE / bin_size - 1; i >= 0; i--) {
+    uint32_t* chunk = (uint32_t*)((uint8_t*)new_span + i * bin_size);
+    *chunk = next;
+    next = i * bin_size;
   }
+  SlabDesc* desc = desc_of(frame);
+  desc->free_offset = next;
+  push_partial(bin_index, frame, desc);
+  slab_counters[bin_index].num_slabs++;
 
   return 0;
 }
 
 static void* alloc_from_bin(size_t bin_index) {
-  if (!list_heads[bin_index]) {
+  if (partial_slabs[bin_index] == NO_SLAB) {
     if (init_bin_page(bin_index) != 0) {
       return NULL;
     }
   }
-  return (void*)pop(bin_index);
+
+  SlabFrame frame = partial_slabs[bin_index];
+  SlabDesc* desc = desc_of(frame);
+  uint8_t* object = frame2page(frame) + desc->free_offset;
+  desc->free_offset = *(uint32_t*)object;
+  desc->live++;
+  if (desc->free_offset == NO_OBJECT) remove_partial(bin_index, desc);
+
+  SlabCounters* counters = &slab_counters[bin_index];
+  counters->slab_objects++;
+  if (counters->slab_objects > counters->high_water_objects) {
+    counters->high_water_objects = counters->slab_objects;
+  }
+  return object;
 }
 
-static void free_to_bin(size_t bin_index, void* ptr) {
-  push((chunk_meta_node_t*)ptr, bin_index);
+/** Return the object to its slab. An empty slab is given back to the page
+ * allocator unless it would be the only one of the bin with free objects,
+ * which avoids taking and releasing a span on every alloc/free pair. A slab
+ * of a single object goes from full to empty at once, so it is checked too. */
+static void free_to_bin(SlabFrame frame, SlabDesc* desc, void* ptr) {
+  size_t bin_index = desc->bin - 1;
+  bool was_full = desc->free_offset == NO_OBJECT;
+  *(uint32_t*)ptr = desc->free_offset;
+  desc->free_offset = (uint8_t*)ptr - frame2page(frame);
+  desc->live--;
+  slab_counters[bin_index].slab_objects--;
+
+  if (desc->live == 0) {
+    bool only_partial = was_full ? partial_slabs[bin_index] == NO_SLAB
+                                 : desc->prev == NO_SLAB &&
+                                       desc->next == NO_SLAB;
+    if (!only_partial) {
+      if (!was_full) remove_partial(bin_index, desc);
+      for (unsigned int i = 0; i < span_pages[bin_index]; i++) {
+        desc_of(frame + i)->bin = 0;
+      }
+      pa->free(frame2page(frame));
+      slab_counters[bin_index].num_slabs--;
+      return;
+    }
+  }
+  if (was_full) push_partial(bin_index, frame, desc);
+}
+
+/** Take an unused magazine. The depot lock MUST be held. */
+static Magazine* new_magazine(void) {
+  if (free_magazines == NULL) {
+    uint8_t* page = pa->alloc_zeroed_pages(1);
+    if (page == NULL) return NULL;
+    for (size_t i = 0; i + sizeof(Magazine) <= PAGE_SIZE;
+         i += sizeof(Magazine)) {
+      Magazine* magazine = (Magazine*)(page + i);
+      magazine->next = free_magazines;
+      free_magazines = magazine;
+    }
+  }
+  Magazine* magazine = free_magazines;
+  free_magazines = magazine->next;
+  magazine->count = 0;
+  return magazine;
+}
+
+/** The depot lock MUST be held. */
+static void put_magazine(Magazine* magazine) {
+  magazine->next = free_magazines;
+  free_magazines = magazine;
 }
 
-/**
- * @return -1 if not found.
+/** Find the slab that holds `ptr`. Returns NULL if `ptr` is not in a slab. */
+static SlabDesc* slab_of(const void* ptr, SlabFrame* frame) {
+  *frame = ptr2frame(ptr);
+  SlabDesc* desc = desc_of(*frame);
+  if (desc == NULL || desc->bin == 0) return NULL;
+  *frame -= desc->tail;
+  return desc_of(*frame);
+}
+
+/** Move up to MAGAZINE_BATCH objects from the slabs to the magazine. A new
+ * slab is made only if there is no free object at all. The depot lock MUST be
+ * held. */
+static void fill_from_slabs(size_t bin_index, Magazine* magazine) {
+  void* objects[MAGAZINE_BATCH];
+  size_t count = 0;
+  while (count < MAGAZINE_BATCH) {
+    if (count > 0 && partial_slabs[bin_index] == NO_SLAB) break;
+    void* object = alloc_from_bin(bin_index);
+    if (object == NULL) break;
+    objects[count++] = object;
+  }
+  // The last one pushed is handed out first. Reverse them so that objects are
+  // handed out in the order the slab gave them.
+  for (size_t i = 0; i < count; i++) {
+    magazine->rounds[magazine->count++] = objects[count - 1 - i];
+  }
+}
+
+/** Return all objects of the magazine to their slabs. The depot lock MUST be
+ * held. */
+static void flush_to_slabs(Magazine* magazine) {
+  while (magazine->count > 0) {
+    void* object = magazine->rounds[--magazine->count];
+    SlabFrame frame;
+    SlabDesc* desc = slab_of(object, &frame);
+    free_to_bin(frame, desc, object);
+  }
+}
+
+static inline CpuCache* local_cache(void) {
+  unsigned int cpu = cpu_id();
+  if (cpu >= MAX_CPUS) {
+    panic("BinAllocator: CPU ID exceeds MAX_CPUS");
+  }
+  return &cpu_caches[cpu];
+}
+
+static inline MagazinePair* magazines_of(size_t bin_index) {
+  return &local_cache()->bins[bin_index];
+}
+
+static void* cache_alloc(size_t bin_index) {
+  MagazinePair* mags = magazines_of(bin_index);
+  if (mags->loaded != NULL && mags->loaded->count > 0) {
+    return mags->loaded->rounds[--mags->loaded->count];
+  }
+  if (mags->previous != NULL && mags->previous->count > 0) {
+    Magazine* tmp = mags->loaded;
+    mags->loaded = mags->previous;
+    mags->previous = tmp;
+    return mags->loaded->rounds[--mags->loaded->count];
+  }
+
+  // Both magazines are empty. Swap in a full one from the depot, or fill one
+  // from the slabs.
+  local_cache()->slow_path_hits++;
+  void* object = NULL;
+  spin_lock(&depot_lock);
+  Depot* depot = &depots[bin_index];
+  if (depot->full != NULL) {
+    if (mags->previous != NULL) put_magazine(mags->previous);
+    mags->previous = mags->loaded;
+    mags->loaded = depot->full;
+    depot->full = mags->loaded->next;
+    depot->num_full--;
+  } else {
+    if (mags->loaded == NULL) mags->loaded = new_magazine();
+    if (mags->loaded == NULL) {
+      object = alloc_from_bin(bin_index);
+      spin_unlock(&depot_lock);
+      return object;
+    }
+    fill_from_slabs(bin_index, mags->loaded);
+  }
+  if (mags->loaded->count > 0) {
+    object = mags->loaded->rounds[--mags->loaded->count];
+  }
+  spin_unlock(&depot_lock);
+  return object;
+}
+
+static void cache_free(size_t bin_index, void* ptr) {
+  MagazinePair* mags = magazines_of(bin_index);
+  if (mags->loaded != NULL && mags->loaded->count < MAGAZINE_SIZE) {
+    mags->loaded->rounds[mags->loaded->count++] = ptr;
+    return;
+  }
+  if (mags->previous != NULL && mags->previous->count < MAGAZINE_SIZE) {
+    Magazine* tmp = mags->loaded;
+    mags->loaded = mags->previous;
+    mags->previous = tmp;
+    mags->loaded->rounds[mags->loaded->count++] = ptr;
+    return;
+  }
+
+  // Both magazines are full. Hand `previous` to the depot and start an empty
+  // one.
+  local_cache()->slow_path_hits++;
+  spin_lock(&depot_lock);
+  Magazine* empty = new_magazine();
+  if (empty == NULL) {
+    SlabFrame frame;
+    SlabDesc* desc = slab_of(ptr, &frame);
+    free_to_bin(frame, desc, ptr);
+    spin_unlock(&depot_lock);
+    return;
+  }
+  if (mags->previous != NULL) {
+    Depot* depot = &depots[bin_index];
+    if (depot->num_full < DEPOT_MAX_FULL) {
+      mags->previous->next = depot->full;
+      depot->full = mags->previous;
+      depot->num_full++;
+    } else {
+      flush_to_slabs(mags->previous);
+      put_magazine(mags->previous);
+    }
+  }
+  mags->previous = mags->loaded;
+  mags->loaded = empty;
+  mags->loaded->rounds[mags->loaded->count++] = ptr;
+  spin_unlock(&depot_lock);
+}
+
+/** Return the objects cached by the running CPU and the depot to the slabs,
+ * releasing the slabs that become empty. */
+bool bin_drain_caches(void) {
+  bool drained = false;
+  spin_lock(&depot_lock);
+  for (size_t i = 0; i < BIN_SIZE_NUM; i++) {
+    MagazinePair* mags = magazines_of(i);
+    Magazine* cached[] = {mags->loaded, mags->previous};
+    for (size_t j = 0; j < sizeof(cached) / sizeof(cached[0]); j++) {
+      if (cached[j] == NULL) continue;
+      drained = true;
+      flush_to_slabs(cached[j]);
+      put_magazine(cached[j]);
+    }
+    mags->loaded = NULL;
+    mags->previous = NULL;
+
+    Depot* depot = &depots[i];
+    while (depot->full != NULL) {
+      Magazine* magazine = depot->full;
+      depot->full = magazine->next;
+      drained = true;
+      flush_to_slabs(magazine);
+      put_magazine(magazine);
+    }
+    depot->num_full = 0;
+  }
+  spin_unlock(&depot_lock);
+  return drained;
+}
+
+/** Class of the smallest bin that fits `size`, in constant time.
+ * @return -1 if `size` is larger than any bin.
  */
 static int bin_index(size_t size) {
-  for (int i = 0; i < BIN_SIZE_NUM; i++) {
-    if (size <= bin_sizes[i]) {
-      return i;
-    }
+  if (size <= BIN_SMALL_MAX) {
+    return size == 0 ? 0 : (size - 1) / BIN_MIN_SIZE;
+  }
+  if (size > BIN_MAX_SIZE) {
+    return -1;
   }
-  return -1;
+  // Above BIN_SMALL_MAX, the top bit picks the doubling and the next two bits
+  // pick the class within it.
+  size_t last = size - 1;
+  int msb = 63 - __builtin_clzll(last);
+  int doubling = msb - __builtin_ctz(BIN_SMALL_MAX);
+  int step = (last >> (msb - 2)) & (BIN_CLASSES_PER_DOUBLING - 1);
+  return BIN_SMALL_NUM + doubling * BIN_CLASSES_PER_DOUBLING + step;
 }
 
 void* bin_alloc(size_t n) {
+  CpuCache* cache = local_cache();
   int index = bin_index(n);
   if (index >= 0) {
-    return alloc_from_bin(index);
+    void* ptr = cache_alloc(index);
+    if (!ptr) {
+      cache->alloc_failures++;
+      return NULL;
+    }
+    cache->allocs[index]++;
+    return ptr;
   } else {
-    // Requested size exceeds a 4KiB page size.
+    // Requested size exceeds the largest bin.
     void* ptr = pa->alloc(n);
     if (!ptr) {
+      cache->alloc_failures++;
       return NULL;
     }
+    cache->large_allocs++;
     return ptr;
   }
 }
 
-/** Determines whether `addr` is properly aligned for allocation into a bin of
- * size `bin_size`, assuming a 4KiB chunk base. */
-static bool is_aligned_to_bin(uintptr_t addr, unsigned int bin_size) {
-  uint64_t offset = addr % PAGE_SIZE;
-  return offset % bin_size == 0;
+/** Free memory allocated by bin_alloc(). The bin is looked up from the slab
+ * table, and pages that are not slabs go back to the page allocator. The slab
+ * of a live object does not change, so the lookup needs no lock. */
+void bin_free(void* ptr) {
+  if (ptr == NULL) return;
+  SlabFrame frame;
+  SlabDesc* desc = slab_of(ptr, &frame);
+  if (desc == NULL) {
+    pa->free(ptr);
+    local_cache()->large_frees++;
+    return;
+  }
+
+  size_t offset = (uint8_t*)ptr - frame2page(frame);
+  if (offset % bin_sizes[desc->bin - 1] != 0 || desc->live == 0) {
+    LOG_ERROR("BinAllocator: invalid pointer passed to free: %p\n", ptr);
+    return;
+  }
+  local_cache()->frees[desc->bin - 1]++;
+  cache_free(desc->bin - 1, ptr);
 }
 
-// FIXME: Size should not be passed.
-// FIXME: Check if ptr is valid.
-void bin_free(void* ptr, size_t n) {
-  int index = bin_index(n);
-  if (index >= 0) {
-    if (!is_aligned_to_bin((uintptr_t)ptr, bin_sizes[index])) {
-      LOG_ERROR("BinAllocator: invalid pointer passed tgo free");
-      return;
+void bin_get_stats(BinAllocatorStats* stats) {
+  *stats = (BinAllocatorStats){0};
+  for (size_t i = 0; i < BIN_SIZE_NUM; i++) {
+    BinStats* bin = &stats->bins[i];
+    bin->size = bin_sizes[i];
+    bin->slab_objects = slab_counters[i].slab_objects;
+    bin->high_water_objects = slab_counters[i].high_water_objects;
+    bin->num_slabs = slab_counters[i].num_slabs;
+  }
+  for (size_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+    const CpuCache* cache = &cpu_caches[cpu];
+    for (size_t i = 0; i < BIN_SIZE_NUM; i++) {
+      stats->bins[i].live_objects += cache->allocs[i] - cache->frees[i];
     }
-    free_to_bin(index, ptr);
-  } else {
-    pa->free(ptr, n);
+    stats->large_live += cache->large_allocs - cache->large_frees;
+    stats->alloc_failures += cache->alloc_failures;
+    stats->slow_path_hits += cache->slow_path_hits;
   }
 }
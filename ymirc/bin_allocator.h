@@ -1,7 +1,42 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "page_allocator_if.h"
 
+/** Number of size classes. */
+#define BIN_SIZE_NUM 52
+
+typedef struct {
+  /** Object size of the bin in bytes. */
+  unsigned int size;
+  /** Objects handed out by bin_alloc() and not freed yet. */
+  uint64_t live_objects;
+  /** Objects taken out of the slabs, including those cached in magazines. */
+  uint64_t slab_objects;
+  /** Highest value slab_objects has reached. */
+  uint64_t high_water_objects;
+  /** Number of slabs of the bin. */
+  uint64_t num_slabs;
+} BinStats;
+
+typedef struct {
+  BinStats bins[BIN_SIZE_NUM];
+  /** Allocations larger than the largest bin that are not freed yet. */
+  uint64_t large_live;
+  /** Allocations that returned NULL. */
+  uint64_t alloc_failures;
+  /** Allocations and frees that missed the per-CPU magazines. */
+  uint64_t slow_path_hits;
+} BinAllocatorStats;
+
 void init_bin_allocator(const page_allocator_ops_t* ops);
 void* bin_alloc(size_t n);
-void bin_free(void* ptr, size_t n);
+void bin_free(void* ptr);
+/** Return the objects cached by the running CPU and the depot to the slabs.
+ * Called when the CPU is idle. Returns true if any object was cached. */
+bool bin_drain_caches(void);
+/** Copy the counters to `stats`. Takes no lock, so that it can be called from
+ * a panic. The result may be slightly off while other CPUs allocate. */
+void bin_get_stats(BinAllocatorStats* stats);
@@ -1,54 +1,172 @@
+#define _DEFAULT_SOURCE
+
 #include "bin_allocator.h"
 
 #include <assert.h>
-#include <stdalign.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <sys/mman.h>
 
 #include "log.h"
 #include "mem.h"
 #include "page_allocator_if.h"
 
-#define STUB_PAGE_CAP 16
-static alignas(PAGE_SIZE) uint8_t arena[STUB_PAGE_CAP][PAGE_SIZE];
+/** Slab descriptors are indexed by physical frame, so the stub pages are
+ * backed at a low address that the slab table covers. */
+#define BASE 0x40000000ULL
+#define STUB_PAGE_CAP 288
+#define STUB_TABLE_PAGES 16
+
+static uint8_t (*arena)[PAGE_SIZE] = (void *)BASE;
+static uint8_t *tables = (uint8_t *)BASE + STUB_PAGE_CAP * PAGE_SIZE;
 static int index = 0;
+static int table_index = 0;
+static void *last_freed = NULL;
+static int num_freed = 0;
 
 static void *stub_alloc_page(size_t n) {
   void *ret = arena[index];
   index += (n + PAGE_SIZE - 1) / PAGE_SIZE;
+  assert(index <= STUB_PAGE_CAP);
   return ret;
 }
 
-static void stub_free_page(void *ptr, size_t n) {
-  // do nothing
-  (void)ptr;
-  (void)n;
+static void stub_free_page(void *ptr) {
+  last_freed = ptr;
+  num_freed++;
+}
+
+/** Tables of the slab descriptors come from a separate area, so that they do
+ * not shift the pages used for objects. */
+static void *stub_alloc_zeroed_pages(size_t num_pages) {
+  void *ret = tables + table_index * PAGE_SIZE;
+  table_index += num_pages;
+  assert(table_index <= STUB_TABLE_PAGES);
+  return ret;
 }
 
 static const page_allocator_ops_t stub_pa = {
     .alloc = stub_alloc_page,
     .free = stub_free_page,
     .alloc_aligned_pages = NULL,
+    .alloc_zeroed_pages = stub_alloc_zeroed_pages,
 };
 
 void log_output(char c) { putchar(c); }
+void log_no_output(char c) { (void)c; }
 
 int main() {
   log_set_writefn(log_output);
 
+  void *mem = mmap(arena, (STUB_PAGE_CAP + STUB_TABLE_PAGES) * PAGE_SIZE,
+                   PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+  assert(mem == arena);
+
   init_bin_allocator(&stub_pa);
 
   assert(bin_alloc(0x4) == arena[0] + 0x0);
+  assert(bin_alloc(0x4) == arena[0] + 0x10);
   assert(bin_alloc(0x4) == arena[0] + 0x20);
-  assert(bin_alloc(0x4) == arena[0] + 0x40);
-  bin_free(arena[0] + 0x20, 0x4);
-  assert(bin_alloc(0x4) == arena[0] + 0x20);
+  bin_free(arena[0] + 0x10);
+  assert(bin_alloc(0x4) == arena[0] + 0x10);
   assert(bin_alloc(0x800) == arena[1] + 0x0);
   assert(bin_alloc(0x800) == arena[1] + 0x800);
   assert(bin_alloc(0x800) == arena[2] + 0x0);
-  assert(bin_alloc(0x1500) == arena[3] + 0x0);
-  assert(bin_alloc(0x40) == arena[5] + 0x0);
+
+  // 2.25KiB objects use the 2.5KiB class, three to a 2-page span.
+  assert(bin_alloc(0x900) == arena[3] + 0x0);
+  assert(bin_alloc(0x900) == arena[3] + 0xA00);
+  assert(bin_alloc(0x900) == arena[3] + 0x1400);
+  assert(bin_alloc(0x900) == arena[5] + 0x0);
+
+  // 6KiB objects, two to a 3-page span. The second one starts in the middle
+  // of a page.
+  assert(bin_alloc(0x1500) == arena[7] + 0x0);
+  assert(bin_alloc(0x1500) == arena[8] + 0x800);
+  bin_free(arena[8] + 0x800);
+  assert(bin_alloc(0x1500) == arena[8] + 0x800);
+
+  // 256KiB is the largest class. Larger ones go to the page allocator.
+  assert(bin_alloc(0x40000) == arena[10] + 0x0);
+  assert(bin_alloc(0x40001) == arena[74] + 0x0);
+  bin_free(arena[74]);
+  assert(last_freed == arena[74]);
+
+  // Classes between 128 and 256 bytes are 32 bytes apart.
+  assert(bin_alloc(0x70) == arena[139] + 0x0);
+  assert(bin_alloc(0x70) == arena[139] + 0x70);
+  assert(bin_alloc(0x81) == arena[140] + 0x0);
+  assert(bin_alloc(0xA0) == arena[140] + 0xA0);
+
+  // Freed objects stay in the CPU's magazines until they are drained. Then a
+  // slab that becomes empty is released while the bin has another slab with
+  // free objects.
+  last_freed = NULL;
+  bin_free(arena[2]);
+  bin_free(arena[1] + 0x800);
+  bin_free(arena[1]);
+  assert(last_freed == NULL);
+  assert(bin_alloc(0x800) == arena[1]);
+  bin_free(arena[1]);
+  assert(bin_drain_caches());
+  assert(last_freed == arena[2]);
+  // Nothing is left to drain.
+  assert(!bin_drain_caches());
+  // The kept slab serves the next allocations.
+  uint8_t *first = bin_alloc(0x800);
+  uint8_t *second = bin_alloc(0x800);
+  assert(first == arena[1] || first == arena[1] + 0x800);
+  assert(second == arena[1] || second == arena[1] + 0x800);
+  assert(first != second);
+
+  // Many frees fill magazines, which go to the depot and come back in LIFO
+  // order.
+  void *objects[100];
+  for (int i = 0; i < 100; i++) {
+    objects[i] = bin_alloc(0x10);
+    assert(objects[i] != NULL);
+  }
+  for (int i = 0; i < 100; i++) bin_free(objects[i]);
+  for (int i = 99; i >= 0; i--) assert(bin_alloc(0x10) == objects[i]);
+  for (int i = 0; i < 100; i++) bin_free(objects[i]);
+
+  // Freeing into a full slab makes it available again.
+  bin_free(arena[3] + 0xA00);
+  assert(bin_alloc(0x900) == arena[3] + 0xA00);
+
+  BinAllocatorStats stats;
+  bin_get_stats(&stats);
+  assert(stats.bins[0].size == 16 && stats.bins[0].live_objects == 3);
+  assert(stats.bins[0].high_water_objects >= 100);
+  assert(stats.large_live == 0 && stats.alloc_failures == 0);
+  assert(stats.slow_path_hits > 0);
+
+  // Pointers that are not at an object are rejected.
+  log_set_writefn(log_no_output);
+  last_freed = NULL;
+  bin_free(arena[0] + 0x8);
+  bin_free(arena[8]);
+  assert(last_freed == NULL);
+  bin_free(arena[150]);  // Not a slab: passed to the page allocator.
+  assert(last_freed == arena[150]);
+  log_set_writefn(log_output);
+
+  // Slabs of the 256KiB class hold a single object, so they go from full to
+  // empty at once. All but one are given back once the caches are drained.
+  uint8_t *large[2];
+  for (int i = 0; i < 2; i++) {
+    large[i] = bin_alloc(0x3C000);
+    assert(large[i] != NULL);
+  }
+  bin_free(arena[10]);
+  for (int i = 0; i < 2; i++) bin_free(large[i]);
+  num_freed = 0;
+  assert(bin_drain_caches());
+  assert(num_freed == 2);
+  bin_get_stats(&stats);
+  assert(stats.bins[BIN_SIZE_NUM - 1].num_slabs == 1);
 
   puts("PASS");
 
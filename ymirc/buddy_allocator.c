@@ -0,0 +1,609 @@
+#define LOG_SUBSYSTEM LOG_SUBSYS_ALLOC
+
+#include "buddy_allocator.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "bits.h"
+#include "log.h"
+#include "mem.h"
+#include "page_allocator.h"
+#include "panic.h"
+#include "zeroed_page_pool.h"
+
+/** Maximum physical memory size in bytes that can be managed by this allocator.
+ * Memory above it is not reachable through the direct mapping. */
+#define MAX_PHYSICAL_SIZE DIRECT_MAP_SIZE
+/** Single unit of bitmap line. */
+typedef uint64_t MapLineType;
+/** Bits per map line. */
+#define BITS_PER_MAPLINE (sizeof(MapLineType) * 8)  // 64 bits
+
+/** Order of a 2MiB block. A block of order N spans 2^N frames. */
+#define ORDER_2MB 9
+/** Order of a 1GiB block. */
+#define ORDER_1GB 18
+/** Largest block order. */
+#define MAX_ORDER ORDER_1GB
+/** Number of free lists. */
+#define NUM_ORDERS (MAX_ORDER + 1)
+_Static_assert(NUM_ORDERS == PAGE_ALLOCATOR_STAT_ORDERS,
+               "Stats must have a counter for each order.");
+
+/** Number of 2MiB blocks set aside for the huge page pool at init. */
+#ifndef BUDDY_HUGE_POOL_2MB
+#define BUDDY_HUGE_POOL_2MB 16
+#endif
+/** Number of 1GiB blocks set aside for the huge page pool at init. */
+#ifndef BUDDY_HUGE_POOL_1GB
+#define BUDDY_HUGE_POOL_1GB 0
+#endif
+/** The huge page pool never takes more than 1/N of the usable memory. */
+#define HUGE_POOL_MAX_SHARE 8
+
+/** Value returned by the search functions when nothing is found. */
+#define NOT_FOUND UINT64_MAX
+
+typedef uint64_t FrameId;
+
+/** Frame ID that terminates a free list. Frame 0 is never managed. */
+#define NO_FRAME 0
+
+/** Header stored in the first frame of every free block. Links are frame IDs
+ * rather than pointers because the direct mapping moves when the page tables
+ * are reconstructed. */
+typedef struct {
+  FrameId next;
+  FrameId prev;
+  uint64_t order;
+} FreeBlock;
+
+/** Doubly linked list of blocks of one order. */
+typedef struct {
+  FrameId head;
+  uint64_t count;
+} FreeList;
+
+/** Free lists indexed by order. */
+static FreeList free_lists[NUM_ORDERS];
+/** Bit N is set iff free_lists[N] is not empty. */
+static uint32_t nonempty_orders;
+/** Physical address of the bitmap. A set bit means the frame is the first
+ * frame of a free block. It is carved out of usable memory at init. */
+static Phys free_heads_base;
+/** Physical address of the extent bitmap. A set bit means the frame is the
+ * first frame of an allocation or of a pooled huge block. An allocation ends
+ * at the next frame that starts an allocation or a free block. */
+static Phys alloc_heads_base;
+/** Frame ID that bit 0 of the bitmaps describes. */
+static FrameId bitmap_base;
+
+/** Reserved huge blocks. These are allocated from the buddy point of view and
+ * do not take part in coalescing until they are released. */
+typedef struct {
+  FreeList list;
+  uint64_t order;
+  uint64_t target;
+} HugePool;
+
+static HugePool pool_2mb = {.order = ORDER_2MB};
+static HugePool pool_1gb = {.order = ORDER_1GB};
+/** Pages zeroed ahead of time. */
+static ZeroedPagePool zeroed_pool;
+/** Counters reported by get_stats(). The frame counts other than the total
+ * are derived from the free lists and the pools when they are read. */
+static PageAllocatorStats stats;
+/** Frames on the free lists. */
+static uint64_t free_list_frames;
+
+/** First frame ID. Frame ID 0 is reserved. */
+static FrameId frame_begin = 1;
+/** First frame ID that is not managed by this allocator. */
+static FrameId frame_end;
+
+/** Region handed to the free lists at init. Sorted by frame. */
+typedef struct {
+  FrameId frame;
+  uint64_t num_frames;
+} UsableRegion;
+
+/** Maximum number of usable regions. If this limit is exceeded, the system will
+ * panic. */
+#define MAX_USABLE_REGIONS 1024
+
+static UsableRegion usable_regions[MAX_USABLE_REGIONS];
+static size_t usable_region_count;
+
+static inline FrameId phys2frame(Phys phys) { return phys / PAGE_SIZE; }
+static inline Phys frame2phys(FrameId frame) { return frame * PAGE_SIZE; }
+
+static inline FreeBlock *block_at(FrameId frame) {
+  return (FreeBlock *)phys2virt(frame2phys(frame));
+}
+
+static inline uint64_t order_frames(uint64_t order) { return 1ULL << order; }
+
+/** Smallest order whose block holds `num_frames` frames. */
+static inline uint64_t order_for(uint64_t num_frames) {
+  if (num_frames <= 1) return 0;
+  return 64 - __builtin_clzll(num_frames - 1);
+}
+
+/** The bitmaps are accessed through the current mapping since they move when
+ * the page tables are reconstructed. */
+static inline MapLineType *bitmap_at(Phys base) {
+  return (MapLineType *)phys2virt(base);
+}
+
+static inline bool test_frame(Phys base, FrameId frame) {
+  if (frame < bitmap_base || frame >= frame_end) return false;
+  uint64_t bit = frame - bitmap_base;
+  return isset(bitmap_at(base)[bit / BITS_PER_MAPLINE], bit % BITS_PER_MAPLINE);
+}
+
+static inline void set_frame(Phys base, FrameId frame, bool value) {
+  uint64_t bit = frame - bitmap_base;
+  if (value) {
+    bitmap_at(base)[bit / BITS_PER_MAPLINE] |= tobit(bit % BITS_PER_MAPLINE);
+  } else {
+    bitmap_at(base)[bit / BITS_PER_MAPLINE] &= ~tobit(bit % BITS_PER_MAPLINE);
+  }
+}
+
+static inline bool is_free_head(FrameId frame) {
+  return test_frame(free_heads_base, frame);
+}
+
+static inline void set_free_head(FrameId frame, bool head) {
+  set_frame(free_heads_base, frame, head);
+}
+
+static inline bool is_alloc_head(FrameId frame) {
+  return test_frame(alloc_heads_base, frame);
+}
+
+static inline void set_alloc_head(FrameId frame, bool head) {
+  set_frame(alloc_heads_base, frame, head);
+}
+
+static void list_push(FreeList *list, FrameId frame, uint64_t order) {
+  FreeBlock *block = block_at(frame);
+  block->next = list->head;
+  block->prev = NO_FRAME;
+  block->order = order;
+  if (list->head != NO_FRAME) block_at(list->head)->prev = frame;
+  list->head = frame;
+  list->count++;
+}
+
+static void list_remove(FreeList *list, FrameId frame) {
+  FreeBlock *block = block_at(frame);
+  if (block->prev != NO_FRAME) {
+    block_at(block->prev)->next = block->next;
+  } else {
+    list->head = block->next;
+  }
+  if (block->next != NO_FRAME) block_at(block->next)->prev = block->prev;
+  list->count--;
+}
+
+static FrameId list_pop(FreeList *list) {
+  FrameId frame = list->head;
+  if (frame != NO_FRAME) list_remove(list, frame);
+  return frame;
+}
+
+/** Put a block on the free list of its order without coalescing. */
+static void push_free(FrameId frame, uint64_t order) {
+  list_push(&free_lists[order], frame, order);
+  free_list_frames += order_frames(order);
+  nonempty_orders |= (uint32_t)tobit(order);
+  set_free_head(frame, true);
+}
+
+static void remove_free(FrameId frame, uint64_t order) {
+  list_remove(&free_lists[order], frame);
+  free_list_frames -= order_frames(order);
+  if (free_lists[order].head == NO_FRAME) {
+    nonempty_orders &= ~(uint32_t)tobit(order);
+  }
+  set_free_head(frame, false);
+}
+
+/** Free a naturally aligned block, merging it with its buddy as long as the
+ * buddy is a free block of the same order. */
+static void insert_free(FrameId frame, uint64_t order) {
+  while (order < MAX_ORDER) {
+    FrameId buddy = frame ^ order_frames(order);
+    if (!is_free_head(buddy) || block_at(buddy)->order != order) {
+      break;
+    }
+    remove_free(buddy, order);
+    if (buddy < frame) frame = buddy;
+    order++;
+  }
+  push_free(frame, order);
+}
+
+/** Free an arbitrary range by splitting it into the largest naturally aligned
+ * blocks that fit. */
+static void free_range(FrameId frame, uint64_t num_frames) {
+  while (num_frames > 0) {
+    uint64_t order = frame == 0 ? MAX_ORDER : __builtin_ctzll(frame);
+    if (order > MAX_ORDER) order = MAX_ORDER;
+    while (order_frames(order) > num_frames) order--;
+    insert_free(frame, order);
+    frame += order_frames(order);
+    num_frames -= order_frames(order);
+  }
+}
+
+/** Take a block of the given order, splitting a larger one if needed. */
+static FrameId alloc_block(uint64_t order) {
+  if (order > MAX_ORDER) return NOT_FOUND;
+  uint32_t candidates = nonempty_orders & ~(uint32_t)(tobit(order) - 1);
+  if (candidates == 0) return NOT_FOUND;
+
+  uint64_t found = __builtin_ctz(candidates);
+  FrameId frame = free_lists[found].head;
+  remove_free(frame, found);
+  // Return the upper halves to the free lists.
+  while (found > order) {
+    found--;
+    push_free(frame + order_frames(found), found);
+  }
+  return frame;
+}
+
+/** Release every block in the pool to the free lists. */
+static void drain_pool(HugePool *pool) {
+  FrameId frame;
+  while ((frame = list_pop(&pool->list)) != NO_FRAME) {
+    set_alloc_head(frame, false);
+    insert_free(frame, pool->order);
+  }
+}
+
+/** Fill the pool up to its target. Stops early if memory runs out. */
+static void fill_pool(HugePool *pool, uint64_t target) {
+  pool->target = target;
+  while (pool->list.count < pool->target) {
+    FrameId frame = alloc_block(pool->order);
+    if (frame == NOT_FOUND) break;
+    set_alloc_head(frame, true);
+    list_push(&pool->list, frame, pool->order);
+  }
+}
+
+/** Pool that holds blocks of exactly `num_frames` frames, if any. */
+static HugePool *pool_for(uint64_t num_frames) {
+  if (num_frames == order_frames(ORDER_2MB)) return &pool_2mb;
+  if (num_frames == order_frames(ORDER_1GB)) return &pool_1gb;
+  return NULL;
+}
+
+/** Frames held by the huge page pools. They are free from the user's point of
+ * view. */
+static uint64_t pooled_frames(void) {
+  return pool_2mb.list.count * order_frames(pool_2mb.order) +
+         pool_1gb.list.count * order_frames(pool_1gb.order);
+}
+
+static void count_alloc(FrameId frame) {
+  if (frame == NOT_FOUND) {
+    stats.alloc_failures++;
+    return;
+  }
+  stats.alloc_count++;
+  uint64_t used = stats.total_frames - free_list_frames - pooled_frames();
+  if (used > stats.high_water_frames) stats.high_water_frames = used;
+}
+
+/** Allocate `num_frames` frames whose first frame is a multiple of
+ * `align_frame`. */
+static FrameId alloc_frames(uint64_t num_frames, uint64_t align_frame) {
+  if (num_frames == 0) return NOT_FOUND;
+
+  // Naturally aligned huge blocks come straight from the pool.
+  HugePool *pool = pool_for(num_frames);
+  if (pool != NULL && num_frames % align_frame == 0 && pool->list.count > 0) {
+    return list_pop(&pool->list);
+  }
+
+  // A power-of-two alignment is met by the natural alignment of a block.
+  // Otherwise, over-allocate and cut the aligned range out.
+  uint64_t order = order_for(num_frames);
+  bool pow2_align = (align_frame & (align_frame - 1)) == 0;
+  if (pow2_align) {
+    uint64_t align_order = order_for(align_frame);
+    if (align_order > order) order = align_order;
+  } else {
+    order = order_for(num_frames + align_frame - 1);
+  }
+  if (order > MAX_ORDER) return NOT_FOUND;
+
+  // Splitting a larger block is the slow path.
+  if ((nonempty_orders & tobit(order)) == 0) stats.slow_path_hits++;
+  FrameId block = alloc_block(order);
+  if (block == NOT_FOUND) {
+    // Memory is short. Give the huge pages back and retry.
+    if (pool_2mb.list.count == 0 && pool_1gb.list.count == 0) {
+      return NOT_FOUND;
+    }
+    LOG_WARN("Releasing the huge page pool under memory pressure.\n");
+    drain_pool(&pool_2mb);
+    drain_pool(&pool_1gb);
+    pool_2mb.target = 0;
+    pool_1gb.target = 0;
+    block = alloc_block(order);
+    if (block == NOT_FOUND) return NOT_FOUND;
+  }
+
+  FrameId block_end = block + order_frames(order);
+  FrameId frame = (block + align_frame - 1) / align_frame * align_frame;
+  free_range(block, frame - block);
+  free_range(frame + num_frames, block_end - (frame + num_frames));
+  set_alloc_head(frame, true);
+  return frame;
+}
+
+static void add_usable_region(FrameId frame, uint64_t num_frames) {
+  // Extend the last region if the descriptors are contiguous.
+  if (usable_region_count > 0) {
+    UsableRegion *last = &usable_regions[usable_region_count - 1];
+    if (last->frame + last->num_frames == frame) {
+      last->num_frames += num_frames;
+      return;
+    }
+  }
+  if (usable_region_count >= MAX_USABLE_REGIONS) {
+    panic("The count of usable memory region exceeds the limit.");
+  }
+  usable_regions[usable_region_count++] = (UsableRegion){frame, num_frames};
+}
+
+/** Sort the usable regions by frame. The memory map is usually sorted
+ * already, so the insertion sort is close to linear. */
+static void sort_usable_regions(void) {
+  for (size_t i = 1; i < usable_region_count; i++) {
+    UsableRegion region = usable_regions[i];
+    size_t j = i;
+    for (; j > 0 && usable_regions[j - 1].frame > region.frame; j--) {
+      usable_regions[j] = usable_regions[j - 1];
+    }
+    usable_regions[j] = region;
+  }
+}
+
+/** Find the usable region containing `frame`. Returns NULL if the frame is not
+ * managed by this allocator. */
+static const UsableRegion *find_usable_region(FrameId frame) {
+  size_t low = 0;
+  size_t high = usable_region_count;
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    const UsableRegion *region = &usable_regions[mid];
+    if (region->frame + region->num_frames <= frame) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  if (low < usable_region_count && usable_regions[low].frame <= frame) {
+    return &usable_regions[low];
+  }
+  return NULL;
+}
+
+/** Find the end of the allocation starting at `frame`: the first frame in
+ * (frame, limit) that starts an allocation or a free block. Returns `limit` if
+ * there is none. */
+static FrameId find_extent_end(FrameId frame, FrameId limit) {
+  const MapLineType *free_heads = bitmap_at(free_heads_base);
+  const MapLineType *alloc_heads = bitmap_at(alloc_heads_base);
+  frame++;
+  while (frame < limit) {
+    uint64_t bit = frame - bitmap_base;
+    uint64_t bit_index = bit % BITS_PER_MAPLINE;
+    uint64_t i = bit / BITS_PER_MAPLINE;
+    FrameId line_start = frame - bit_index;
+    MapLineType line =
+        (free_heads[i] | alloc_heads[i]) & ~(tobit(bit_index) - 1);
+    if (line != 0) {
+      FrameId found = line_start + __builtin_ctzll(line);
+      return found < limit ? found : limit;
+    }
+    frame = line_start + BITS_PER_MAPLINE;
+  }
+  return limit;
+}
+
+/** Hand a usable range to the free lists. */
+static void add_free_range(FrameId frame, FrameId end) {
+  if (frame >= end) return;
+  add_usable_region(frame, end - frame);
+  free_range(frame, end - frame);
+}
+
+/** Initialize the allocator.
+ * The bitmap is sized from the highest usable descriptor and placed in usable
+ * memory described by the map.
+ * This function MUST be called before the direct mapping w/ offset 0x0 is
+ * unmapped. */
+void buddy_allocator_init(MemoryMap *map) {
+  Phys avail_begin = MAX_PHYSICAL_SIZE;
+  Phys avail_end = 0;
+
+  for (uint64_t i = 0; i < NUM_ORDERS; i++) {
+    free_lists[i] = (FreeList){NO_FRAME, 0};
+  }
+  nonempty_orders = 0;
+  free_list_frames = 0;
+  stats = (PageAllocatorStats){0};
+  pool_2mb.list = (FreeList){NO_FRAME, 0};
+  pool_1gb.list = (FreeList){NO_FRAME, 0};
+  usable_region_count = 0;
+  zeroed_pool.count = 0;
+
+  // Find the range the bitmap has to cover.
+  for (uint64_t i = 0; i < map->map_size / map->descriptor_size; i++) {
+    EFI_MEMORY_DESCRIPTOR *desc =
+        (EFI_MEMORY_DESCRIPTOR *)((uint8_t *)map->descriptors +
+                                  i * map->descriptor_size);
+    if (!is_usable_memory(desc)) continue;
+
+    Phys start = desc->PhysicalStart;
+    Phys end = start + desc->NumberOfPages * PAGE_SIZE;
+    if (start < frame2phys(frame_begin)) start = frame2phys(frame_begin);
+    if (end > MAX_PHYSICAL_SIZE) end = MAX_PHYSICAL_SIZE;
+    if (start >= end) continue;
+    if (start < avail_begin) avail_begin = start;
+    if (end > avail_end) avail_end = end;
+  }
+  if (avail_end == 0) {
+    panic("No usable memory found in the memory map.");
+  }
+  bitmap_base = phys2frame(avail_begin) / BITS_PER_MAPLINE * BITS_PER_MAPLINE;
+  frame_end = phys2frame(avail_end);
+
+  uint64_t num_lines =
+      (frame_end - bitmap_base + BITS_PER_MAPLINE - 1) / BITS_PER_MAPLINE;
+  uint64_t num_pages =
+      (2 * num_lines * sizeof(MapLineType) + PAGE_SIZE - 1) / PAGE_SIZE;
+  free_heads_base = find_metadata_pages(map, num_pages, avail_end);
+  if (free_heads_base == 0) {
+    panic("No memory for the buddy allocator bitmap.");
+  }
+  alloc_heads_base = free_heads_base + num_lines * sizeof(MapLineType);
+  memset(bitmap_at(free_heads_base), 0, num_pages * PAGE_SIZE);
+  FrameId metadata_begin = phys2frame(free_heads_base);
+  FrameId metadata_end = metadata_begin + num_pages;
+
+  uint64_t usable_frames = 0;
+  for (uint64_t i = 0; i < map->map_size / map->descriptor_size; i++) {
+    EFI_MEMORY_DESCRIPTOR *desc =
+        (EFI_MEMORY_DESCRIPTOR *)((uint8_t *)map->descriptors +
+                                  i * map->descriptor_size);
+    if (!is_usable_memory(desc)) continue;
+
+    FrameId start = phys2frame(desc->PhysicalStart);
+    FrameId end = start + desc->NumberOfPages;
+    if (start < frame_begin) start = frame_begin;
+    if (end > frame_end) end = frame_end;
+    if (start >= end) continue;
+
+    // Leave out the bitmap.
+    if (start < metadata_end && metadata_begin < end) {
+      add_free_range(start, metadata_begin);
+      add_free_range(metadata_end, end);
+      usable_frames += end - start - num_pages;
+    } else {
+      add_free_range(start, end);
+      usable_frames += end - start;
+    }
+  }
+  sort_usable_regions();
+
+  // Set aside huge pages while memory is not yet fragmented.
+  uint64_t budget = usable_frames / HUGE_POOL_MAX_SHARE;
+  uint64_t num_1gb = budget / order_frames(ORDER_1GB);
+  if (num_1gb > BUDDY_HUGE_POOL_1GB) num_1gb = BUDDY_HUGE_POOL_1GB;
+  fill_pool(&pool_1gb, num_1gb);
+  budget -= pool_1gb.list.count * order_frames(ORDER_1GB);
+  uint64_t num_2mb = budget / order_frames(ORDER_2MB);
+  if (num_2mb > BUDDY_HUGE_POOL_2MB) num_2mb = BUDDY_HUGE_POOL_2MB;
+  fill_pool(&pool_2mb, num_2mb);
+
+  stats.total_frames = usable_frames + num_pages;
+  stats.reserved_frames = frame_end - frame_begin - stats.total_frames;
+  stats.high_water_frames = num_pages;
+}
+
+static void *alloc(size_t n) {
+  size_t num_frames = (n + PAGE_SIZE - 1) / PAGE_SIZE;
+  FrameId frame = alloc_frames(num_frames, 1);
+  count_alloc(frame);
+  if (frame == NOT_FOUND) return NULL;
+  return (void *)phys2virt(frame2phys(frame));
+}
+
+/** Free the allocation starting at `ptr`. Its length is looked up from the
+ * extent bitmap. */
+static void free(void *ptr) {
+  Virt start_frame_vaddr = (Virt)ptr & ~PAGE_MASK;
+  FrameId frame = phys2frame(virt2phys(start_frame_vaddr));
+  const UsableRegion *region = find_usable_region(frame);
+  if (region == NULL) {
+    panic("Attempting to free memory not managed by the buddy allocator.");
+    return;
+  }
+  if (!is_alloc_head(frame)) {
+    panic("Attempting to free memory that is not allocated.");
+    return;
+  }
+
+  // Allocations never cross the end of a usable region.
+  FrameId end = find_extent_end(frame, region->frame + region->num_frames);
+  uint64_t num_frames = end - frame;
+  stats.free_count++;
+  HugePool *pool = pool_for(num_frames);
+  if (pool != NULL && frame % num_frames == 0 &&
+      pool->list.count < pool->target) {
+    list_push(&pool->list, frame, pool->order);
+    return;
+  }
+  set_alloc_head(frame, false);
+  free_range(frame, num_frames);
+}
+
+/** Allocate physically contiguous and aligned pages. */
+static void *alloc_aligned_pages(size_t num_pages, size_t align_size) {
+  if (align_size % PAGE_SIZE != 0) {
+    LOG_ERROR("Invalid alignment size: 0x%x\n", align_size);
+    return NULL;
+  }
+  size_t align_frame = (align_size + PAGE_SIZE - 1) / PAGE_SIZE;
+  if (align_frame == 0) align_frame = 1;
+  FrameId frame = alloc_frames(num_pages, align_frame);
+  count_alloc(frame);
+  if (frame == NOT_FOUND) return NULL;
+  return (void *)phys2virt(frame2phys(frame));
+}
+
+/** The free lists are not split per node, so the node is only a hint that this
+ * backend ignores. */
+static void *alloc_on_node(size_t num_pages, size_t align_size, int node) {
+  (void)node;
+  return alloc_aligned_pages(num_pages, align_size);
+}
+
+static void *alloc_zeroed_pages(size_t num_pages) {
+  return zeroed_page_pool_alloc(&zeroed_pool, &buddy_ops, num_pages);
+}
+
+static bool do_idle_work(void) {
+  return zeroed_page_pool_refill(&zeroed_pool, &buddy_ops);
+}
+
+/** Blocks in the huge page pools are counted as free blocks of their order. */
+static void get_stats(PageAllocatorStats *out) {
+  *out = stats;
+  out->free_frames = free_list_frames + pooled_frames();
+  out->used_frames = stats.total_frames - out->free_frames;
+  for (uint64_t order = 0; order < NUM_ORDERS; order++) {
+    out->free_blocks[order] = free_lists[order].count;
+  }
+  out->free_blocks[pool_2mb.order] += pool_2mb.list.count;
+  out->free_blocks[pool_1gb.order] += pool_1gb.list.count;
+}
+
+const page_allocator_ops_t buddy_ops = {
+    .alloc = alloc,
+    .free = free,
+    .alloc_aligned_pages = alloc_aligned_pages,
+    .alloc_on_node = alloc_on_node,
+    .alloc_zeroed_pages = alloc_zeroed_pages,
+    .do_idle_work = do_idle_work,
+    .get_stats = get_stats,
+};
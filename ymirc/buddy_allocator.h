@@ -0,0 +1,8 @@
+#pragma once
+
+#include "../surtrc/def.h"
+
+void buddy_allocator_init(MemoryMap *map);
+
+#include "page_allocator_if.h"
+extern const page_allocator_ops_t buddy_ops;
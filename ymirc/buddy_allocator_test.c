@@ -0,0 +1,116 @@
+#define _DEFAULT_SOURCE
+
+#include "buddy_allocator.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "log.h"
+#include "mem.h"
+
+/** The buddy allocator keeps its free lists inside free pages, so the
+ * "physical" memory described by the map must be backed at the same host
+ * address. */
+#define BASE 0x40000000ULL
+#define REGION_SIZE 0x4000000ULL  // 64MiB
+/** The allocator bitmaps take two more pages at the top of the region. */
+#define METADATA_SIZE (2 * PAGE_SIZE)
+#define BACKED_SIZE (REGION_SIZE + METADATA_SIZE)
+
+void log_output(char c) { putchar(c); }
+void log_no_output(char c) { (void)c; }
+
+MemoryMap* create_memory_map(void) {
+  MemoryMap* map = malloc(sizeof(MemoryMap));
+  map->descriptor_size = sizeof(EFI_MEMORY_DESCRIPTOR);
+  map->map_size = map->descriptor_size * 2;
+  map->descriptors = malloc(map->map_size);
+  map->descriptors[0] = (EFI_MEMORY_DESCRIPTOR){
+      .Type = EfiConventionalMemory,
+      .PhysicalStart = BASE,
+      .NumberOfPages = BACKED_SIZE / PAGE_SIZE,
+  };
+  map->descriptors[1] = (EFI_MEMORY_DESCRIPTOR){
+      .Type = EfiReservedMemoryType,
+      .PhysicalStart = BASE + BACKED_SIZE,
+      .NumberOfPages = 0x10,
+  };
+  return map;
+}
+
+static void* at(uint64_t offset) { return (void*)(BASE + offset); }
+
+int main() {
+  log_set_writefn(log_output);
+
+  void* mem = mmap(at(0), BACKED_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+  assert(mem == at(0));
+
+  MemoryMap* map = create_memory_map();
+  buddy_allocator_init(map);
+
+  // Blocks in the huge page pool count as free.
+  PageAllocatorStats stats;
+  buddy_ops.get_stats(&stats);
+  assert(stats.total_frames == BACKED_SIZE / PAGE_SIZE);
+  assert(stats.used_frames == METADATA_SIZE / PAGE_SIZE);
+  assert(stats.free_blocks[9] == 4);
+
+  // The first 8MiB (1/8 of the memory) is set aside as four 2MiB huge pages.
+  void* p1 = buddy_ops.alloc(0x1000);
+  void* p2 = buddy_ops.alloc(0x1000);
+  assert(p1 == at(0x800000));
+  assert(p2 == at(0x801000));
+  buddy_ops.free(p1);
+  buddy_ops.free(p2);
+  // Freed frames coalesce back into the block they were split from.
+  assert(buddy_ops.alloc(0x1000) == at(0x800000));
+  buddy_ops.free(at(0x800000));
+
+  // The unused tail of a block is returned to the free lists.
+  assert(buddy_ops.alloc(0x3000) == at(0x800000));
+  assert(buddy_ops.alloc(0x1000) == at(0x803000));
+  // Freeing an allocation leaves the adjacent one alone.
+  buddy_ops.free(at(0x800000));
+  void* four = buddy_ops.alloc(0x4000);
+  assert(four != at(0x800000));
+  buddy_ops.free(four);
+  buddy_ops.free(at(0x803000));
+  assert(buddy_ops.alloc(0x4000) == at(0x800000));
+  buddy_ops.free(at(0x800000));
+
+  // 2MiB pages come from the pool, and go back to it when freed.
+  void* huge = buddy_ops.alloc_aligned_pages(0x200, PAGE_SIZE_2MB);
+  assert(huge >= at(0) && huge < at(0x800000));
+  assert((uintptr_t)huge % PAGE_SIZE_2MB == 0);
+  buddy_ops.free(huge);
+  assert(buddy_ops.alloc_aligned_pages(0x200, PAGE_SIZE_2MB) == huge);
+  buddy_ops.free(huge);
+
+  // Large aligned blocks.
+  assert(buddy_ops.alloc_aligned_pages(0x2000, 0x2000000) == at(0x2000000));
+
+  // 24MiB does not fit without the pool. The pool is released and coalesced.
+  log_set_writefn(log_no_output);
+  assert(buddy_ops.alloc(0x1800000) == at(0));
+  log_set_writefn(log_output);
+  assert(buddy_ops.alloc(REGION_SIZE) == NULL);
+
+  // Alignment that is not a power of two.
+  void* odd = buddy_ops.alloc_aligned_pages(1, 0x3000);
+  assert(odd != NULL && (uintptr_t)odd % 0x3000 == 0);
+  assert(odd >= at(0x1800000) && odd < at(0x2000000));
+
+  log_set_writefn(log_no_output);
+  // align size must be multiple of page size.
+  assert(buddy_ops.alloc_aligned_pages(1, 0x1100) == NULL);
+  log_set_writefn(log_output);
+
+  puts("PASS");
+
+  return 0;
+}
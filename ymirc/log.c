@@ -1,26 +1,222 @@
 #include "log.h"
 
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 
+#include "arch.h"
+#include "mem.h"
+#include "spinlock.h"
+
 static LogWriteFn log_write_fn = NULL;
+static LogTimestampFn log_timestamp_fn = NULL;
+
+uint8_t log_levels[LOG_SUBSYS_NUM] = {
+    [0 ... LOG_SUBSYS_NUM - 1] = LOG_LEVEL,
+};
+
+static const char *subsystem_names[LOG_SUBSYS_NUM] = {
+    [LOG_SUBSYS_CORE] = "core", [LOG_SUBSYS_ALLOC] = "alloc",
+    [LOG_SUBSYS_NPT] = "npt",   [LOG_SUBSYS_IOIO] = "ioio",
+    [LOG_SUBSYS_MSR] = "msr",   [LOG_SUBSYS_CPUID] = "cpuid",
+    [LOG_SUBSYS_INTR] = "intr", [LOG_SUBSYS_VMMC] = "vmmc",
+};
 
 void log_set_writefn(LogWriteFn fn) { log_write_fn = fn; }
 
-static void write_char(char c) {
-  if (log_write_fn) {
+void log_set_timestampfn(LogTimestampFn fn) { log_timestamp_fn = fn; }
+
+bool log_set_level(uint64_t subsystem, uint64_t level) {
+  if (subsystem >= LOG_SUBSYS_NUM || level > LOG_LEVEL_NONE) return false;
+  __atomic_store_n(&log_levels[subsystem], level, __ATOMIC_RELAXED);
+  return true;
+}
+
+const char *log_subsystem_name(uint64_t subsystem) {
+  return subsystem < LOG_SUBSYS_NUM ? subsystem_names[subsystem] : NULL;
+}
+
+/** Header of a record in a ring. Records are 8-byte aligned and never wrap
+ * around the end of the ring. The space left at the end is filled with an
+ * empty record instead. */
+typedef struct {
+  /** Size of the record in bytes, including the header. */
+  uint16_t size;
+  /** Number of characters that follow the header. */
+  uint16_t len;
+  /** Set by the producer once the data is written. */
+  uint8_t ready;
+  uint8_t _reserved[3];
+} RecordHeader;
+
+#define RECORD_ALIGN sizeof(RecordHeader)
+
+/** Ring of formatted records of a CPU. Producers on the CPU, including
+ * interrupt handlers that interrupt another producer, reserve space by
+ * advancing `head` with a CAS. The single drainer advances `tail`. Consumed
+ * space is zeroed, so that a header that is not written yet reads as not
+ * ready. */
+typedef struct {
+  uint8_t buf[LOG_RING_SIZE];
+  uint64_t head;
+  uint64_t tail;
+  /** Bytes of the record at `tail` already written out. Drainer only. */
+  size_t drained;
+  /** Records dropped because the ring was full. */
+  uint64_t dropped;
+} __attribute__((aligned(64))) LogRing;
+
+static LogRing rings[MAX_CPUS];
+static bool deferred = false;
+/** Held while draining the rings. */
+static Spinlock drain_lock = SPINLOCK_INIT;
+
+static inline RecordHeader *header_at(LogRing *ring, uint64_t pos) {
+  return (RecordHeader *)&ring->buf[pos % LOG_RING_SIZE];
+}
+
+/** Copy a record into the ring. Returns false if it does not fit. */
+static bool ring_push(LogRing *ring, const char *data, size_t len) {
+  size_t need = (sizeof(RecordHeader) + len + RECORD_ALIGN - 1) /
+                RECORD_ALIGN * RECORD_ALIGN;
+  uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+  uint64_t start;
+  size_t pad;
+  do {
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    size_t room = LOG_RING_SIZE - head % LOG_RING_SIZE;
+    pad = room < need ? room : 0;
+    if (head + pad + need - tail > LOG_RING_SIZE) {
+      __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+      return false;
+    }
+    start = head + pad;
+  } while (!__atomic_compare_exchange_n(&ring->head, &head, start + need,
+                                        true, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED));
+
+  if (pad > 0) {
+    RecordHeader *header = header_at(ring, head);
+    header->size = pad;
+    header->len = 0;
+    __atomic_store_n(&header->ready, 1, __ATOMIC_RELEASE);
+  }
+  RecordHeader *header = header_at(ring, start);
+  header->size = need;
+  header->len = len;
+  memcpy(header + 1, data, len);
+  __atomic_store_n(&header->ready, 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+/** Write up to `budget` characters from the ring. Returns the number of
+ * characters written. The drain lock MUST be held. */
+static size_t ring_drain(LogRing *ring, size_t budget) {
+  size_t written = 0;
+  uint64_t tail = ring->tail;
+  while (tail != __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+    RecordHeader *header = header_at(ring, tail);
+    if (!__atomic_load_n(&header->ready, __ATOMIC_ACQUIRE)) break;
+
+    const char *data = (const char *)(header + 1);
+    while (ring->drained < header->len) {
+      if (written == budget) return written;
+      log_write_fn(data[ring->drained++]);
+      written++;
+    }
+    size_t size = header->size;
+    ring->drained = 0;
+    memset(header, 0, size);
+    tail += size;
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+  }
+  return written;
+}
+
+/** Drain the rings of all CPUs. Returns true if characters are left. */
+static bool drain_rings(size_t budget) {
+  for (size_t cpu = 0; cpu < MAX_CPUS && budget > 0; cpu++) {
+    budget -= ring_drain(&rings[cpu], budget);
+  }
+  for (size_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+    LogRing *ring = &rings[cpu];
+    if (ring->tail != __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool log_drain(size_t max_chars) {
+  if (log_write_fn == NULL || !spin_trylock(&drain_lock)) return false;
+  bool left = drain_rings(max_chars);
+  spin_unlock(&drain_lock);
+  return left;
+}
+
+static void report_dropped(void) {
+  for (size_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+    uint64_t dropped = __atomic_exchange_n(&rings[cpu].dropped, 0,
+                                           __ATOMIC_RELAXED);
+    if (dropped > 0) {
+      log_printf(LOG_LEVEL_WARN, "%lu log records of CPU %d were dropped.\n",
+                 dropped, (int)cpu);
+    }
+  }
+}
+
+void log_flush(void) {
+  // Without deferred mode, records are already written out. Not taking the
+  // lock then keeps this safe to call from a panic.
+  if (log_write_fn == NULL || !__atomic_load_n(&deferred, __ATOMIC_ACQUIRE)) {
+    return;
+  }
+  spin_lock(&drain_lock);
+  drain_rings(SIZE_MAX);
+  // The report goes into the ring that was just drained, so that it is not
+  // dropped again.
+  report_dropped();
+  drain_rings(SIZE_MAX);
+  spin_unlock(&drain_lock);
+}
+
+bool log_is_deferred(void) {
+  return __atomic_load_n(&deferred, __ATOMIC_ACQUIRE);
+}
+
+void log_set_deferred(bool enable) {
+  __atomic_store_n(&deferred, enable, __ATOMIC_RELEASE);
+  if (enable || log_write_fn == NULL) return;
+
+  // Records are printed without the lock, since the drainer may be the code
+  // a panic interrupted.
+  drain_rings(SIZE_MAX);
+  report_dropped();
+}
+
+/** Record being formatted in deferred mode. NULL means writing directly. */
+typedef struct {
+  char data[LOG_RECORD_MAX];
+  size_t len;
+} LogRecord;
+
+static void write_char(LogRecord *rec, char c) {
+  if (rec != NULL) {
+    // Longer records are truncated.
+    if (rec->len < LOG_RECORD_MAX) rec->data[rec->len++] = c;
+  } else if (log_write_fn) {
     log_write_fn(c);
   }
 }
 
-static void write_string(const char *str) {
+static void write_string(LogRecord *rec, const char *str) {
   while (*str) {
-    write_char(*str++);
+    write_char(rec, *str++);
   }
 }
 
-static void write_int(int val) {
+static void write_int(LogRecord *rec, int val) {
   char buf[12];  // Enough for 32-bit integer
   int i = 0;
   int negative = 0;
@@ -40,28 +236,42 @@ static void write_int(int val) {
   }
 
   while (i--) {
-    write_char(buf[i]);
+    write_char(rec, buf[i]);
+  }
+}
+
+static void write_uint(LogRecord *rec, uint64_t val) {
+  char buf[20];  // Enough for 64-bit integer
+  int i = 0;
+
+  do {
+    buf[i++] = (val % 10) + '0';
+    val /= 10;
+  } while (val > 0);
+
+  while (i--) {
+    write_char(rec, buf[i]);
   }
 }
 
 // TODO: support negative hex values
 // TODO: strip leading zeros
-static void write_hex(uint64_t value) {
+static void write_hex(LogRecord *rec, uint64_t value) {
   const char *hex = "0123456789ABCDEF";
   // 64 bits = 4 bits x 16
   for (int i = 15; i >= 0; i--) {
-    write_char(hex[(value >> (i * 4)) & 0xF]);
+    write_char(rec, hex[(value >> (i * 4)) & 0xF]);
   }
 }
 
-static void write_ptr(void *ptr) {
+static void write_ptr(LogRecord *rec, void *ptr) {
   const char *hex = "0123456789ABCDEF";
   uintptr_t value = (uint64_t)ptr;
 
-  write_char('0');
-  write_char('x');
+  write_char(rec, '0');
+  write_char(rec, 'x');
   for (int i = sizeof(uintptr_t) * 2 - 1; i >= 0; i--) {
-    write_char(hex[(value >> (i * 4)) & 0xF]);
+    write_char(rec, hex[(value >> (i * 4)) & 0xF]);
   }
 }
 
@@ -70,6 +280,13 @@ void log_printf(int level, const char *fmt, ...) {
     return;
   }
 
+  LogRecord record;
+  LogRecord *rec = NULL;
+  if (__atomic_load_n(&deferred, __ATOMIC_ACQUIRE)) {
+    record.len = 0;
+    rec = &record;
+  }
+
   const char *level_str = NULL;
   switch (level) {
     case LOG_LEVEL_DEBUG:
@@ -90,7 +307,12 @@ void log_printf(int level, const char *fmt, ...) {
       break;
   }
 
-  write_string(level_str);
+  if (log_timestamp_fn != NULL) {
+    write_char(rec, '[');
+    write_uint(rec, log_timestamp_fn());
+    write_string(rec, "] ");
+  }
+  write_string(rec, level_str);
 
   va_list args;
   va_start(args, fmt);
@@ -101,36 +323,50 @@ void log_printf(int level, const char *fmt, ...) {
       switch (fmt[i]) {
         case 'd': {
           int val = va_arg(args, int);
-          write_int(val);
+          write_int(rec, val);
           break;
         }
+        case 'l':
+          // Only %lu is supported. It takes a 64-bit unsigned integer.
+          if (fmt[i + 1] == 'u') {
+            i++;
+            write_uint(rec, va_arg(args, uint64_t));
+          } else {
+            write_char(rec, '%');
+            write_char(rec, 'l');
+          }
+          break;
         case 'x': {
           uint64_t val = va_arg(args, uint64_t);
-          write_hex(val);
+          write_hex(rec, val);
           break;
         }
         case 'p': {
           void *ptr = va_arg(args, void *);
-          write_ptr(ptr);
+          write_ptr(rec, ptr);
           break;
         }
         case 's': {
           const char *str = va_arg(args, const char *);
-          write_string(str);
+          write_string(rec, str);
           break;
         }
         case '%':
-          write_char('%');
+          write_char(rec, '%');
           break;
         default:
-          write_char('%');
-          write_char(fmt[i]);
+          write_char(rec, '%');
+          write_char(rec, fmt[i]);
           break;
       }
     } else {
-      write_char(fmt[i]);
+      write_char(rec, fmt[i]);
     }
   }
 
   va_end(args);
+
+  if (rec != NULL) {
+    ring_push(&rings[cpu_id()], rec->data, rec->len);
+  }
 }
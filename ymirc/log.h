@@ -1,6 +1,10 @@
 #ifndef LOG_H
 #define LOG_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #define LOG_LEVEL_DEBUG 0
 #define LOG_LEVEL_INFO 1
 #define LOG_LEVEL_WARN 2
@@ -11,31 +15,112 @@
 #define LOG_LEVEL LOG_LEVEL_DEBUG
 #endif
 
+/** Size in bytes of the log ring of each CPU. */
+#define LOG_RING_SIZE 16384
+/** Longest record in deferred mode. Longer ones are truncated. */
+#define LOG_RECORD_MAX 256
+
+/** Subsystems with their own runtime log level. A source file selects its
+ * subsystem by defining LOG_SUBSYSTEM before any #include. */
+typedef enum {
+  LOG_SUBSYS_CORE,
+  LOG_SUBSYS_ALLOC,
+  LOG_SUBSYS_NPT,
+  LOG_SUBSYS_IOIO,
+  LOG_SUBSYS_MSR,
+  LOG_SUBSYS_CPUID,
+  LOG_SUBSYS_INTR,
+  LOG_SUBSYS_VMMC,
+  LOG_SUBSYS_NUM,
+} LogSubsystem;
+
+#ifndef LOG_SUBSYSTEM
+#define LOG_SUBSYSTEM LOG_SUBSYS_CORE
+#endif
+
 typedef void (*LogWriteFn)(char c);
+typedef uint64_t (*LogTimestampFn)(void);
 
 void log_set_writefn(LogWriteFn write_fn);
 void log_printf(int level, const char *fmt, ...);
 
+/** Prefix each record with the value returned by `timestamp_fn`, e.g. the
+ * TSC. The timestamp is taken when the record is formatted, so it is exact in
+ * deferred mode too. NULL disables the prefix. */
+void log_set_timestampfn(LogTimestampFn timestamp_fn);
+
+/** Minimum level printed for each subsystem. Starts at LOG_LEVEL. */
+extern uint8_t log_levels[LOG_SUBSYS_NUM];
+
+/** Set the minimum level printed for `subsystem`. Levels below LOG_LEVEL are
+ * compiled out and stay silent. Returns false if an argument is invalid. */
+bool log_set_level(uint64_t subsystem, uint64_t level);
+
+/** Name of `subsystem`, or NULL if it is invalid. */
+const char *log_subsystem_name(uint64_t subsystem);
+
+static inline bool log_enabled(LogSubsystem subsystem, int level) {
+  return level >= __atomic_load_n(&log_levels[subsystem], __ATOMIC_RELAXED);
+}
+
+/** In deferred mode, log_printf() formats the record into a ring of the
+ * running CPU and returns without touching the write function. The rings are
+ * written out by log_drain() and log_flush(). Disabling it writes out what is
+ * left without waiting for the drainer, so it is safe to call from a panic. */
+void log_set_deferred(bool enable);
+
+/** Whether deferred mode is enabled. */
+bool log_is_deferred(void);
+
+/** Write at most `max_chars` characters from the rings. Does nothing if
+ * another drain is in progress. Returns true if characters are left. */
+bool log_drain(size_t max_chars);
+
+/** Write out all records in the rings, waiting for another drain if any. MUST
+ * NOT be called from an interrupt handler. Does nothing when deferred mode is
+ * disabled. */
+void log_flush(void);
+
 #if LOG_LEVEL <= LOG_LEVEL_DEBUG
-#define LOG_DEBUG(fmt, ...) log_printf(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#define LOG_DEBUG(fmt, ...)                            \
+  do {                                                 \
+    if (log_enabled(LOG_SUBSYSTEM, LOG_LEVEL_DEBUG)) { \
+      log_printf(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__); \
+    }                                                  \
+  } while (0)
 #else
 #define LOG_DEBUG(fmt, ...) ((void)0)
 #endif
 
 #if LOG_LEVEL <= LOG_LEVEL_INFO
-#define LOG_INFO(fmt, ...) log_printf(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...)                            \
+  do {                                                \
+    if (log_enabled(LOG_SUBSYSTEM, LOG_LEVEL_INFO)) { \
+      log_printf(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__); \
+    }                                                 \
+  } while (0)
 #else
 #define LOG_INFO(fmt, ...) ((void)0)
 #endif
 
 #if LOG_LEVEL <= LOG_LEVEL_WARN
-#define LOG_WARN(fmt, ...) log_printf(LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#define LOG_WARN(fmt, ...)                            \
+  do {                                                \
+    if (log_enabled(LOG_SUBSYSTEM, LOG_LEVEL_WARN)) { \
+      log_printf(LOG_LEVEL_WARN, fmt, ##__VA_ARGS__); \
+    }                                                 \
+  } while (0)
 #else
 #define LOG_WARN(fmt, ...) ((void)0)
 #endif
 
 #if LOG_LEVEL <= LOG_LEVEL_ERROR
-#define LOG_ERROR(fmt, ...) log_printf(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#define LOG_ERROR(fmt, ...)                            \
+  do {                                                 \
+    if (log_enabled(LOG_SUBSYSTEM, LOG_LEVEL_ERROR)) { \
+      log_printf(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__); \
+    }                                                  \
+  } while (0)
 #else
 #define LOG_ERROR(fmt, ...) ((void)0)
 #endif
@@ -4,7 +4,7 @@
 #include <stdio.h>
 #include <string.h>
 
-static char log_buffer[1024];
+static char log_buffer[8192];
 static size_t log_index = 0;
 
 static void reset_buffer() {
@@ -19,6 +19,114 @@ static void test_log_writefn(char c) {
   }
 }
 
+static void test_deferred() {
+  log_set_deferred(true);
+
+  // Records wait in the ring until drained.
+  log_printf(LOG_LEVEL_INFO, "Deferred: %d\n", 1);
+  log_printf(LOG_LEVEL_INFO, "Deferred: %d\n", 2);
+  assert(log_index == 0);
+
+  // Partial drains resume in the middle of a record.
+  assert(log_drain(5));
+  assert(strcmp(log_buffer, "[INFO") == 0);
+  assert(log_drain(20));
+  assert(strcmp(log_buffer, "[INFO ] Deferred: 1\n[INFO") == 0);
+  assert(!log_drain(100));
+  assert(strcmp(log_buffer, "[INFO ] Deferred: 1\n[INFO ] Deferred: 2\n") ==
+         0);
+  assert(!log_drain(100));
+  reset_buffer();
+
+  // Long records are truncated.
+  char long_str[LOG_RECORD_MAX * 2];
+  memset(long_str, 'a', sizeof(long_str) - 1);
+  long_str[sizeof(long_str) - 1] = '\0';
+  log_printf(LOG_LEVEL_NONE, "%s", long_str);
+  log_flush();
+  assert(log_index == LOG_RECORD_MAX);
+  reset_buffer();
+
+  // Records that do not fit are dropped and reported by the flush. The ring
+  // wraps around several times.
+  int pushed = LOG_RING_SIZE / 8;
+  for (int i = 0; i < pushed; i++) {
+    log_printf(LOG_LEVEL_NONE, "%d\n", i % 10);
+  }
+  log_flush();
+  assert(log_index > 0 && log_index < (size_t)pushed * 2);
+  assert(strstr(log_buffer, "log records of CPU 0 were dropped.") != NULL);
+  reset_buffer();
+
+  // Records that do not fit at the end of the ring start over at its head.
+  const char *tail_str = long_str + sizeof(long_str) - 1 - 200;
+  for (int round = 0; round < 200; round++) {
+    log_printf(LOG_LEVEL_NONE, "Wrap %d: %s\n", round % 10, tail_str);
+    log_flush();
+    assert(strncmp(log_buffer, "Wrap ", 5) == 0);
+    assert(log_index == 8 + 200 + 1);
+    reset_buffer();
+  }
+
+  // Disabling deferred mode writes out what is left.
+  log_printf(LOG_LEVEL_WARN, "Last\n");
+  log_set_deferred(false);
+  assert(strcmp(log_buffer, "[WARN ] Last\n") == 0);
+  reset_buffer();
+  log_printf(LOG_LEVEL_WARN, "Direct\n");
+  assert(strcmp(log_buffer, "[WARN ] Direct\n") == 0);
+  reset_buffer();
+}
+
+static uint64_t fake_timestamp() { return 12345; }
+
+static void test_levels() {
+  // Each subsystem starts at LOG_LEVEL.
+  for (int i = 0; i < LOG_SUBSYS_NUM; i++) assert(log_levels[i] == LOG_LEVEL);
+
+  // The level of other subsystems does not matter.
+  assert(log_set_level(LOG_SUBSYS_CORE, LOG_LEVEL_WARN));
+  assert(log_set_level(LOG_SUBSYS_NPT, LOG_LEVEL_DEBUG));
+  LOG_INFO("core\n");
+  assert(log_index == 0);
+  LOG_WARN("core\n");
+  assert(strcmp(log_buffer, "[WARN ] core\n") == 0);
+  reset_buffer();
+
+  assert(log_set_level(LOG_SUBSYS_CORE, LOG_LEVEL_NONE));
+  LOG_ERROR("core\n");
+  assert(log_index == 0);
+
+#undef LOG_SUBSYSTEM
+#define LOG_SUBSYSTEM LOG_SUBSYS_NPT
+  LOG_DEBUG("npt\n");
+  assert(strcmp(log_buffer, "[DEBUG] npt\n") == 0);
+  reset_buffer();
+#undef LOG_SUBSYSTEM
+#define LOG_SUBSYSTEM LOG_SUBSYS_CORE
+
+  // Arguments of filtered records are not evaluated.
+  int evaluated = 0;
+  LOG_ERROR("%d\n", ++evaluated);
+  assert(evaluated == 0);
+
+  assert(!log_set_level(LOG_SUBSYS_NUM, LOG_LEVEL_INFO));
+  assert(!log_set_level(LOG_SUBSYS_CORE, LOG_LEVEL_NONE + 1));
+  assert(strcmp(log_subsystem_name(LOG_SUBSYS_VMMC), "vmmc") == 0);
+  assert(log_subsystem_name(LOG_SUBSYS_NUM) == NULL);
+
+  for (int i = 0; i < LOG_SUBSYS_NUM; i++) {
+    assert(log_set_level(i, LOG_LEVEL));
+  }
+
+  // Records are prefixed with the timestamp once a function is set.
+  log_set_timestampfn(fake_timestamp);
+  LOG_INFO("Stamped\n");
+  assert(strcmp(log_buffer, "[12345] [INFO ] Stamped\n") == 0);
+  reset_buffer();
+  log_set_timestampfn(NULL);
+}
+
 int main() {
   log_set_writefn(test_log_writefn);
 
@@ -39,6 +147,11 @@ int main() {
   assert(strcmp(log_buffer, "[DEBUG] Test message: 0x000000123456789A\n") == 0);
   reset_buffer();
 
+  log_printf(LOG_LEVEL_INFO, "Test message: %lu\n", 18446744073709551615ULL);
+  assert(strcmp(log_buffer, "[INFO ] Test message: 18446744073709551615\n") ==
+         0);
+  reset_buffer();
+
   log_printf(LOG_LEVEL_ERROR, "Test message: %s\n", "Hello");
   assert(strcmp(log_buffer, "[ERROR] Test message: Hello\n") == 0);
   reset_buffer();
@@ -47,6 +160,9 @@ int main() {
   assert(strcmp(log_buffer, "[ERROR] Test message: %\n") == 0);
   reset_buffer();
 
+  test_deferred();
+  test_levels();
+
   puts("PASS");
 
   return 0;
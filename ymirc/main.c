@@ -3,16 +3,21 @@
 #include <stdio.h>
 
 #include "../surtrc/def.h"
+#include "acpi.h"
+#include "alloc_stats.h"
 #include "arch.h"
 #include "bin_allocator.h"
+#include "buddy_allocator.h"
 #include "log.h"
+#include "numa.h"
 #include "page_allocator.h"
 #include "panic.h"
 #include "serial.h"
 
 #if defined(__x86_64__)
+#include "arch/x86/hwtimer.h"
 #include "arch/x86/interrupt.h"
-#include "arch/x86/pic.h"
+#include "arch/x86/irq.h"
 #include "arch/x86/vm.h"
 #endif
 
@@ -35,12 +40,26 @@ static int validate_boot_info(BootInfo *boot_info) {
   return 0;
 }
 
-static void serial_log_output(char c) { serial_write(&serial, c); }
+static void serial_log_output(char c) {
+  serial_write(&serial, c);
+  // Outside deferred mode, e.g. in a panic, records are written before
+  // log_printf() returns.
+  if (!log_is_deferred()) serial_flush(&serial);
+}
 
 #if defined(__x86_64__)
 static void blob_irq_handler(Context *ctx) {
-  uint16_t vector = ctx->vector - primary_vector_offset;
-  notify_eoi(vector);
+  irq_eoi(ctx->vector - primary_vector_offset);
+}
+
+/** Characters of the log queued per serial interrupt. They fill the FIFO on
+ * the next Tx-empty interrupt, which continues the drain. */
+#define LOG_DRAIN_PER_IRQ SERIAL_FIFO_SIZE
+
+static void serial_irq_handler(Context *ctx) {
+  serial_handle_interrupt(&serial);
+  log_drain(LOG_DRAIN_PER_IRQ);
+  blob_irq_handler(ctx);
 }
 #endif
 
@@ -50,6 +69,7 @@ void kernel_main(BootInfo *boot_info) {
 
   // Initialize logger
   log_set_writefn(serial_log_output);
+  log_set_timestampfn(read_timestamp);
   LOG_INFO("Booting YmirC...\n");
 
   // Validate the boot info
@@ -60,56 +80,83 @@ void kernel_main(BootInfo *boot_info) {
   // Copy boot_info into YmirC's stack since it becomes inaccessible soon.
   MemoryMap memory_map = boot_info->map;
   GuestInfo guest_info = boot_info->guest_info;
+  Phys acpi_rsdp = (Phys)boot_info->acpi_rsdp;
 
   // Perform architecture-specific initialization
   arch_init();
 
+  // Read the NUMA topology so that the page allocator can place memory.
+  acpi_init(acpi_rsdp);
+  numa_init();
+
   // Initialize page allocator
+#ifdef PAGE_ALLOCATOR_BUDDY
+  buddy_allocator_init(&memory_map);
+  const page_allocator_ops_t *page_ops = &buddy_ops;
+  LOG_INFO("Initialized buddy page allocator.\n");
+#else
   page_allocator_init(&memory_map);
+  const page_allocator_ops_t *page_ops = &pa_ops;
   LOG_INFO("Initialized page allocator.\n");
+#endif
 
   // Reconstruct memory mapping from the one provided by UEFI and SutrC.
   LOG_INFO("Reconstructing memory mapping...\n");
-  reconstruct_mapping(&pa_ops);
+  reconstruct_mapping(page_ops);
 
   // Initialize general allocator
-  init_bin_allocator(&pa_ops);
+  init_bin_allocator(page_ops);
+  alloc_stats_init(page_ops);
   LOG_INFO("Initialized general allocator.\n");
 
 #if defined(__x86_64__)
-  // Initialize PIC.
-  pic_init();
-  LOG_INFO("Initialized PIC.\n");
+  // Initialize interrupt controllers.
+  irq_init();
+  LOG_INFO("Initialized interrupt controllers.\n");
 
-  // Enable PIT.
-  register_handler(irq_timer + primary_vector_offset, blob_irq_handler);
-  unset_mask(irq_timer);
-  LOG_INFO("Enabled PIT.\n");
+  // Drive the timer wheel with a one-shot hardware timer.
+  hwtimer_init();
+  LOG_INFO("Initialized timers.\n");
 
   // Unmask serial interrupt.
-  register_handler(irq_serial1 + primary_vector_offset, blob_irq_handler);
-  unset_mask(irq_serial1);
+  register_handler(irq_serial1 + primary_vector_offset, serial_irq_handler);
+  irq_unmask(irq_serial1);
   enable_serial_interrupt(&serial);
 
+  // Log into the rings from now on. They are drained by the serial interrupt
+  // and while the CPU is idle.
+  log_set_deferred(true);
+  LOG_INFO("Enabled deferred logging.\n");
+
   // Create VM instance.
   Vm vm = vm_new(&serial);
   if (vm.error != VM_SUCESS) {
     LOG_ERROR("Failed to create VM instance.\n");
   } else {
     // Enable SVM extensions.
-    vm_init(&vm, &pa_ops);
-    LOG_INFO("Enabled SVM extensions.\n");
-
-    // Setup guest memory and load kernel.
-    void *guest_kernel = (void *)phys2virt((uintptr_t)guest_info.guest_image);
-    void *initrd = (void *)phys2virt((uintptr_t)guest_info.initrd_addr);
-    setup_guest_memory(&vm, guest_kernel, guest_info.guest_size, initrd,
-                       guest_info.initrd_size, &pa_ops);
-    LOG_INFO("Setup guest memory.\n");
-
-    // Launch
-    LOG_INFO("Starting the virtual machine...\n");
-    vm_loop(&vm);
+    vm_init(&vm, page_ops);
+    if (vm.error == VM_SUCESS) {
+      LOG_INFO("Enabled SVM extensions.\n");
+
+      // Setup guest memory and load kernel.
+      void *guest_kernel =
+          (void *)phys2virt((uintptr_t)guest_info.guest_image);
+      void *initrd = (void *)phys2virt((uintptr_t)guest_info.initrd_addr);
+      setup_guest_memory(&vm, guest_kernel, guest_info.guest_size, initrd,
+                         guest_info.initrd_size, page_ops);
+    }
+
+    if (vm.error != VM_SUCESS) {
+      // Give the memory back, so that it is not lost for good.
+      LOG_ERROR("Failed to set up the VM.\n");
+      vm_destroy(&vm);
+    } else {
+      LOG_INFO("Setup guest memory.\n");
+
+      // Launch
+      LOG_INFO("Starting the virtual machine...\n");
+      vm_loop(&vm);
+    }
   }
 #endif
 
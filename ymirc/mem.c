@@ -29,19 +29,59 @@ void set_mem_reconstructed(bool reconstructed) {
   mapping_reconstructed = reconstructed;
 }
 
-void *memcpy(void *dest, const void *src, size_t n) {
+/** 64-bit word that may be unaligned and alias any object. */
+typedef uint64_t __attribute__((may_alias, aligned(1))) Word;
+
+static void *copy_words(void *dest, const void *src, size_t n) {
   unsigned char *d = dest;
   const unsigned char *s = src;
+  for (; n >= sizeof(Word); n -= sizeof(Word)) {
+    *(Word *)d = *(const Word *)s;
+    d += sizeof(Word);
+    s += sizeof(Word);
+  }
   while (n--) {
     *d++ = *s++;
   }
   return dest;
 }
 
+static void *set_words(void *s, int c, size_t n) {
+  unsigned char *p = s;
+  Word pattern = 0x0101010101010101ULL * (unsigned char)c;
+  for (; n >= sizeof(Word); n -= sizeof(Word)) {
+    *(Word *)p = pattern;
+    p += sizeof(Word);
+  }
+  while (n--) {
+    *p++ = (unsigned char)c;
+  }
+  return s;
+}
+
+const MemRoutines mem_word_routines = {
+    .copy = copy_words,
+    .set = set_words,
+};
+
+static const MemRoutines *mem_routines = &mem_word_routines;
+
+void mem_set_routines(const MemRoutines *routines) { mem_routines = routines; }
+
+void *memcpy(void *dest, const void *src, size_t n) {
+  return mem_routines->copy(dest, src, n);
+}
+
+/** Compare a word at a time and find the differing byte only at the end. */
 int memcmp(const void *s1, const void *s2, size_t n) {
   const unsigned char *p1 = s1;
   const unsigned char *p2 = s2;
 
+  for (; n >= sizeof(Word); n -= sizeof(Word)) {
+    if (*(const Word *)p1 != *(const Word *)p2) break;
+    p1 += sizeof(Word);
+    p2 += sizeof(Word);
+  }
   while (n--) {
     if (*p1 != *p2) return (int)*p1 - (int)*p2;
     p1++;
@@ -52,9 +92,5 @@ int memcmp(const void *s1, const void *s2, size_t n) {
 }
 
 void *memset(void *s, int c, size_t n) {
-  unsigned char *p = s;
-  while (n--) {
-    *p++ = (unsigned char)c;
-  }
-  return s;
+  return mem_routines->set(s, c, n);
 }
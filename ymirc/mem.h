@@ -29,6 +29,21 @@ typedef uintptr_t Virt;
 Phys virt2phys(uintptr_t addr);
 Virt phys2virt(uintptr_t addr);
 void set_mem_reconstructed(bool reconstructed);
+
+/** Implementations behind memcpy() and memset(). */
+typedef struct {
+  void *(*copy)(void *dest, const void *src, size_t n);
+  void *(*set)(void *s, int c, size_t n);
+} MemRoutines;
+
+/** Portable routines that work a 64-bit word at a time. Used until
+ * mem_set_routines() is called. */
+extern const MemRoutines mem_word_routines;
+
+/** Replace the routines behind memcpy() and memset(). Called once at boot
+ * after the CPU features are known. */
+void mem_set_routines(const MemRoutines *routines);
+
 void *memcpy(void *dest, const void *src, size_t n);
 int memcmp(const void *s1, const void *s2, size_t n);
 void *memset(void *s, int c, size_t n);
@@ -0,0 +1,348 @@
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arch/x86/memops.h"
+#include "mem.h"
+
+/** mem.o defines memcpy() and friends, so they replace glibc's in this binary.
+ * glibc's own are looked up with dlsym(RTLD_NEXT). */
+
+#define MIN_SIZE 8ULL
+#define DEFAULT_MAX_SIZE (256ULL << 20)
+/** Sizes grow by this factor. The largest size is always run. */
+#define SIZE_STEP 4
+/** Warm runs repeat the operation until about this many bytes are moved. */
+#define WARM_BYTES (64ULL << 20)
+/** Cold runs flush the cache before each of this many operations. */
+#define COLD_REPS 16
+#define CACHE_LINE 64
+/** Offsets of the unaligned runs. They differ so that the source and the
+ * destination are misaligned to each other. */
+#define UNALIGNED_DST 1
+#define UNALIGNED_SRC 3
+
+typedef void *(*CopyFn)(void *dest, const void *src, size_t n);
+typedef void *(*SetFn)(void *s, int c, size_t n);
+typedef int (*CmpFn)(const void *s1, const void *s2, size_t n);
+
+/** Implementation under test. Operations it does not have are NULL. */
+typedef struct {
+  const char *name;
+  CopyFn copy;
+  SetFn set;
+  CmpFn cmp;
+} Impl;
+
+#define MAX_IMPLS 5
+static Impl impls[MAX_IMPLS];
+static size_t num_impls;
+
+typedef enum {
+  OP_COPY,
+  OP_SET,
+  OP_CMP,
+  NUM_OPS,
+} Op;
+
+static const char *op_names[NUM_OPS] = {"copy", "set", "cmp"};
+
+/** glibc's routines, used to set up buffers and check results. */
+static CopyFn libc_memcpy;
+static SetFn libc_memset;
+static CmpFn libc_memcmp;
+
+static unsigned char *src_buf;
+static unsigned char *dst_buf;
+/** Scratch area that the set runs check results against. */
+static unsigned char *ref_buf;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/** Cost of a pair of now_ns() calls, subtracted from single timed calls. */
+static uint64_t clock_overhead_ns;
+
+static void calibrate_clock(void) {
+  uint64_t best = UINT64_MAX;
+  for (int i = 0; i < 1000; i++) {
+    uint64_t start = now_ns();
+    uint64_t elapsed = now_ns() - start;
+    if (elapsed < best) best = elapsed;
+  }
+  clock_overhead_ns = best;
+}
+
+static void flush_range(const void *p, size_t n) {
+  uintptr_t line = (uintptr_t)p & ~(uintptr_t)(CACHE_LINE - 1);
+  for (; line < (uintptr_t)p + n; line += CACHE_LINE) {
+    __asm__ volatile("clflush (%0)" : : "r"(line) : "memory");
+  }
+  __asm__ volatile("mfence" : : : "memory");
+}
+
+/** Result of the compare runs. Kept global so that the calls are not
+ * optimized away. */
+static volatile int cmp_sink;
+
+static void run_op(const Impl *impl, Op op, unsigned char *dst,
+                   const unsigned char *src, size_t n) {
+  switch (op) {
+    case OP_COPY:
+      impl->copy(dst, src, n);
+      break;
+    case OP_SET:
+      impl->set(dst, 0x5A, n);
+      break;
+    case OP_CMP:
+      cmp_sink = impl->cmp(dst, src, n);
+      break;
+    default:
+      break;
+  }
+}
+
+static bool has_op(const Impl *impl, Op op) {
+  return (op == OP_COPY && impl->copy) || (op == OP_SET && impl->set) ||
+         (op == OP_CMP && impl->cmp);
+}
+
+/** Check the result of the last run_op(). The destination is reset by
+ * prepare() before each run. */
+static bool verify(Op op, const unsigned char *dst, const unsigned char *src,
+                   size_t n) {
+  switch (op) {
+    case OP_COPY:
+      return libc_memcmp(dst, src, n) == 0;
+    case OP_SET:
+      libc_memset(ref_buf, 0x5A, n);
+      return libc_memcmp(dst, ref_buf, n) == 0;
+    case OP_CMP:
+      return cmp_sink == 0;
+    default:
+      return false;
+  }
+}
+
+/** Reset the destination. Compare runs see equal buffers so that they scan
+ * the whole size. */
+static void prepare(Op op, unsigned char *dst, const unsigned char *src,
+                    size_t n) {
+  if (op == OP_CMP) {
+    libc_memcpy(dst, src, n);
+  } else {
+    libc_memset(dst, 0, n);
+  }
+}
+
+/** Measure one operation in GB/s. Returns a negative value if the result is
+ * wrong. */
+static double measure(const Impl *impl, Op op, size_t n, bool aligned,
+                      bool cold) {
+  unsigned char *dst = dst_buf + (aligned ? 0 : UNALIGNED_DST);
+  const unsigned char *src = src_buf + (aligned ? 0 : UNALIGNED_SRC);
+
+  prepare(op, dst, src, n);
+  uint64_t total_ns = 0;
+  uint64_t reps;
+  if (cold) {
+    reps = n >= (1ULL << 20) ? 1 : COLD_REPS;
+    for (uint64_t i = 0; i < reps; i++) {
+      flush_range(dst, n);
+      flush_range(src, n);
+      uint64_t start = now_ns();
+      run_op(impl, op, dst, src, n);
+      uint64_t elapsed = now_ns() - start;
+      if (elapsed > clock_overhead_ns) total_ns += elapsed - clock_overhead_ns;
+    }
+  } else {
+    reps = WARM_BYTES / n;
+    if (reps == 0) reps = 1;
+    run_op(impl, op, dst, src, n);
+    uint64_t start = now_ns();
+    for (uint64_t i = 0; i < reps; i++) run_op(impl, op, dst, src, n);
+    total_ns = now_ns() - start;
+  }
+
+  if (!verify(op, dst, src, n)) return -1.0;
+  if (total_ns == 0) total_ns = 1;
+  // Bytes per nanosecond is GB/s.
+  return (double)n * reps / total_ns;
+}
+
+static void print_size(size_t n) {
+  if (n >= (1ULL << 20)) {
+    printf("%6luMiB", (uint64_t)(n >> 20));
+  } else if (n >= (1ULL << 10)) {
+    printf("%6luKiB", (uint64_t)(n >> 10));
+  } else {
+    printf("%6luB  ", (uint64_t)n);
+  }
+}
+
+/** Print a table of GB/s with a row per size and a column per
+ * implementation. Returns false if any result was wrong. */
+static bool run_table(Op op, size_t max_size, bool aligned, bool cold) {
+  printf("== %s, %s, %s cache (GB/s) ==\n", op_names[op],
+         aligned ? "aligned" : "unaligned", cold ? "cold" : "warm");
+  printf("%9s", "size");
+  for (size_t i = 0; i < num_impls; i++) printf(" %9s", impls[i].name);
+  printf("\n");
+
+  bool ok = true;
+  for (size_t n = MIN_SIZE;; n = n * SIZE_STEP < max_size ? n * SIZE_STEP
+                                                           : max_size) {
+    print_size(n);
+    for (size_t i = 0; i < num_impls; i++) {
+      if (!has_op(&impls[i], op)) {
+        printf(" %9s", "-");
+        continue;
+      }
+      double gbps = measure(&impls[i], op, n, aligned, cold);
+      if (gbps < 0) {
+        printf(" %9s", "WRONG");
+        ok = false;
+      } else {
+        printf(" %9.2f", gbps);
+      }
+    }
+    printf("\n");
+    fflush(stdout);
+    if (n == max_size) break;
+  }
+  printf("\n");
+  return ok;
+}
+
+static void add_impl(Impl impl) { impls[num_impls++] = impl; }
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "Usage: %s [-o copy|set|cmp] [-i impl] [-m max_size] [-c|-w]\n"
+          "  -o  Run only the given operation.\n"
+          "  -i  Run only the given implementation: word, sse2, erms, fsrm\n"
+          "      or glibc.\n"
+          "  -m  Largest size in bytes. Sizes go up from 8 by a factor of 4.\n"
+          "  -c  Run only with a cold cache.\n"
+          "  -w  Run only with a warm cache.\n",
+          name);
+}
+
+int main(int argc, char **argv) {
+  const char *op_name = NULL;
+  const char *impl_name = NULL;
+  size_t max_size = DEFAULT_MAX_SIZE;
+  bool run_warm = true;
+  bool run_cold = true;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "o:i:m:cwh")) != -1) {
+    switch (opt) {
+      case 'o':
+        op_name = optarg;
+        break;
+      case 'i':
+        impl_name = optarg;
+        break;
+      case 'm':
+        max_size = strtoull(optarg, NULL, 0);
+        break;
+      case 'c':
+        run_warm = false;
+        break;
+      case 'w':
+        run_cold = false;
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (max_size < MIN_SIZE || (!run_warm && !run_cold)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  libc_memcpy = (CopyFn)dlsym(RTLD_NEXT, "memcpy");
+  libc_memset = (SetFn)dlsym(RTLD_NEXT, "memset");
+  libc_memcmp = (CmpFn)dlsym(RTLD_NEXT, "memcmp");
+  if (!libc_memcpy || !libc_memset || !libc_memcmp) {
+    fprintf(stderr, "Failed to find glibc's routines: %s\n", dlerror());
+    return 1;
+  }
+
+  Impl all[] = {
+      {"word", mem_word_routines.copy, mem_word_routines.set, memcmp},
+      {"sse2", memops_sse2.copy, memops_sse2.set, NULL},
+      {"erms", memops_erms.copy, memops_erms.set, NULL},
+      {"fsrm", memops_fsrm.copy, memops_fsrm.set, NULL},
+      {"glibc", libc_memcpy, libc_memset, libc_memcmp},
+  };
+  for (size_t i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+    if (impl_name == NULL || strcmp(impl_name, all[i].name) == 0) {
+      add_impl(all[i]);
+    }
+  }
+  if (num_impls == 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // Room for the unaligned offsets.
+  size_t buf_size = max_size + CACHE_LINE;
+  src_buf = mmap(NULL, buf_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  dst_buf = mmap(NULL, buf_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  ref_buf = mmap(NULL, buf_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (src_buf == MAP_FAILED || dst_buf == MAP_FAILED || ref_buf == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+  for (size_t i = 0; i < buf_size; i++) src_buf[i] = (i * 7 + 3) & 0xFF;
+  libc_memset(dst_buf, 0, buf_size);
+  libc_memset(ref_buf, 0, buf_size);
+  calibrate_clock();
+
+  const MemRoutines *selected = memops_select();
+  printf("YmirC would use %s on this CPU. The word column is mem.c's memcmp "
+         "for cmp.\n\n",
+         selected == &memops_fsrm   ? "fsrm"
+         : selected == &memops_erms ? "erms"
+                                    : "sse2");
+
+  bool found = false;
+  bool ok = true;
+  for (Op op = 0; op < NUM_OPS; op++) {
+    if (op_name != NULL && strcmp(op_name, op_names[op]) != 0) continue;
+    found = true;
+    for (int cold = 0; cold < 2; cold++) {
+      if (cold ? !run_cold : !run_warm) continue;
+      for (int aligned = 1; aligned >= 0; aligned--) {
+        ok &= run_table(op, max_size, aligned, cold);
+      }
+    }
+  }
+  if (!found) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (!ok) {
+    fprintf(stderr, "Some routines returned wrong results.\n");
+    return 1;
+  }
+
+  return 0;
+}
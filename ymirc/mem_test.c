@@ -0,0 +1,79 @@
+#include "mem.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "arch/x86/memops.h"
+
+/** Large enough to take the non-temporal path. */
+#define BUF_SIZE (MEMOPS_NT_THRESHOLD + 0x1000)
+
+static unsigned char *src;
+static unsigned char *dst;
+
+static const size_t sizes[] = {0,   1,   7,    8,    15,   63,
+                               64,  65,  255,  256,  4096, 4099,
+                               MEMOPS_NT_THRESHOLD, MEMOPS_NT_THRESHOLD + 77};
+
+/** Copy at every size and alignment, and check that nothing around the
+ * destination is touched. */
+static void test_copy(const MemRoutines *routines) {
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    for (size_t align = 0; align < 17; align += 3) {
+      size_t n = sizes[i];
+      for (size_t j = 0; j < BUF_SIZE; j++) dst[j] = 0xEE;
+      unsigned char *d = dst + 16 + align;
+      const unsigned char *s = src + (align * 5) % 16;
+      assert(routines->copy(d, s, n) == d);
+      for (size_t j = 0; j < n; j++) assert(d[j] == s[j]);
+      assert(d[-1] == 0xEE && d[n] == 0xEE);
+    }
+  }
+}
+
+static void test_set(const MemRoutines *routines) {
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    for (size_t align = 0; align < 17; align += 3) {
+      size_t n = sizes[i];
+      for (size_t j = 0; j < BUF_SIZE; j++) dst[j] = 0xEE;
+      unsigned char *d = dst + 16 + align;
+      assert(routines->set(d, 0x1A5, n) == d);
+      for (size_t j = 0; j < n; j++) assert(d[j] == 0xA5);
+      assert(d[-1] == 0xEE && d[n] == 0xEE);
+    }
+  }
+}
+
+static void test_memcmp(void) {
+  unsigned char a[40];
+  unsigned char b[40];
+  for (int i = 0; i < 40; i++) a[i] = b[i] = i;
+  assert(memcmp(a, b, 40) == 0);
+  // The first difference decides, even within a word.
+  b[13] = 0xFF;
+  b[14] = 0x00;
+  assert(memcmp(a, b, 40) < 0);
+  assert(memcmp(b, a, 40) > 0);
+  assert(memcmp(a, b, 13) == 0);
+  assert(memcmp(a + 37, b + 37, 3) == 0);
+}
+
+int main() {
+  src = malloc(BUF_SIZE);
+  dst = malloc(BUF_SIZE);
+  for (size_t i = 0; i < BUF_SIZE; i++) src[i] = (i * 7 + 3) & 0xFF;
+
+  const MemRoutines *all[] = {&mem_word_routines, &memops_sse2, &memops_erms,
+                              &memops_fsrm};
+  for (size_t i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+    test_copy(all[i]);
+    test_set(all[i]);
+  }
+  test_memcmp();
+
+  puts("PASS");
+
+  return 0;
+}
@@ -0,0 +1,245 @@
+#include "numa.h"
+
+#include <stdbool.h>
+
+#include "acpi.h"
+#include "bits.h"
+#include "log.h"
+
+/** SRAT structure types. */
+#define SRAT_TYPE_PROCESSOR_APIC 0
+#define SRAT_TYPE_MEMORY 1
+#define SRAT_TYPE_PROCESSOR_X2APIC 2
+
+/** Bit of the SRAT flags telling that the structure is enabled. */
+#define SRAT_FLAGS_ENABLED 0
+
+/** Maximum number of memory ranges kept from the SRAT. */
+#define MAX_NUMA_MEMORY_RANGES 64
+/** Maximum number of CPUs kept from the SRAT. */
+#define MAX_NUMA_CPUS 256
+
+/** System Resource Affinity Table. */
+typedef struct {
+  AcpiSdtHeader header;
+  uint32_t reserved1;
+  uint64_t reserved2;
+} __attribute__((packed)) AcpiSrat;
+
+/** Header common to SRAT structures. */
+typedef struct {
+  uint8_t type;
+  uint8_t length;
+} __attribute__((packed)) SratEntryHeader;
+
+/** Processor Local APIC/SAPIC Affinity Structure. */
+typedef struct {
+  SratEntryHeader header;
+  uint8_t proximity_domain_lo;
+  uint8_t apic_id;
+  uint32_t flags;
+  uint8_t sapic_eid;
+  uint8_t proximity_domain_hi[3];
+  uint32_t clock_domain;
+} __attribute__((packed)) SratProcessorApic;
+
+/** Memory Affinity Structure. */
+typedef struct {
+  SratEntryHeader header;
+  uint32_t proximity_domain;
+  uint16_t reserved1;
+  uint64_t base;
+  uint64_t length;
+  uint32_t reserved2;
+  uint32_t flags;
+  uint64_t reserved3;
+} __attribute__((packed)) SratMemory;
+
+/** Processor Local x2APIC Affinity Structure. */
+typedef struct {
+  SratEntryHeader header;
+  uint16_t reserved1;
+  uint32_t proximity_domain;
+  uint32_t x2apic_id;
+  uint32_t flags;
+  uint32_t clock_domain;
+  uint32_t reserved2;
+} __attribute__((packed)) SratProcessorX2apic;
+
+/** System Locality Information Table. */
+typedef struct {
+  AcpiSdtHeader header;
+  uint64_t num_localities;
+  uint8_t entries[];
+} __attribute__((packed)) AcpiSlit;
+
+typedef struct {
+  uint32_t apic_id;
+  int node;
+} NumaCpu;
+
+static int node_count = 1;
+/** Proximity domain of each node. */
+static uint32_t node_domains[MAX_NUMA_NODES];
+static uint8_t distances[MAX_NUMA_NODES][MAX_NUMA_NODES];
+/** Memory ranges sorted by base address. */
+static NumaMemoryRange ranges[MAX_NUMA_MEMORY_RANGES];
+static size_t range_count;
+static NumaCpu cpus[MAX_NUMA_CPUS];
+static size_t cpu_count;
+
+/** Node for the proximity domain. A new node is assigned on first use. */
+static int node_for_domain(uint32_t domain) {
+  for (int i = 0; i < node_count; i++) {
+    if (node_domains[i] == domain) return i;
+  }
+  if (node_count >= MAX_NUMA_NODES) {
+    LOG_WARN("Too many NUMA nodes. Domain %d is ignored.\n", domain);
+    return NUMA_NO_NODE;
+  }
+  node_domains[node_count] = domain;
+  return node_count++;
+}
+
+static void add_cpu(uint32_t apic_id, uint32_t domain) {
+  int node = node_for_domain(domain);
+  if (node == NUMA_NO_NODE) return;
+  if (cpu_count >= MAX_NUMA_CPUS) {
+    LOG_WARN("Too many CPUs in SRAT.\n");
+    return;
+  }
+  cpus[cpu_count++] = (NumaCpu){apic_id, node};
+}
+
+static void add_memory(Phys base, uint64_t length, uint32_t domain) {
+  int node = node_for_domain(domain);
+  if (node == NUMA_NO_NODE || length == 0) return;
+  if (range_count >= MAX_NUMA_MEMORY_RANGES) {
+    LOG_WARN("Too many memory ranges in SRAT.\n");
+    return;
+  }
+
+  // Keep the ranges sorted by base address.
+  size_t i = range_count;
+  for (; i > 0 && ranges[i - 1].base > base; i--) {
+    ranges[i] = ranges[i - 1];
+  }
+  ranges[i] = (NumaMemoryRange){base, length, node};
+  range_count++;
+}
+
+static void parse_srat(const AcpiSrat *srat) {
+  const uint8_t *entry = (const uint8_t *)(srat + 1);
+  const uint8_t *end = (const uint8_t *)srat + srat->header.length;
+  while (entry + sizeof(SratEntryHeader) <= end) {
+    const SratEntryHeader *header = (const SratEntryHeader *)entry;
+    if (header->length == 0 || entry + header->length > end) break;
+
+    switch (header->type) {
+      case SRAT_TYPE_PROCESSOR_APIC: {
+        const SratProcessorApic *cpu = (const SratProcessorApic *)entry;
+        if (!isset(cpu->flags, SRAT_FLAGS_ENABLED)) break;
+        uint32_t domain = cpu->proximity_domain_lo |
+                          (uint32_t)cpu->proximity_domain_hi[0] << 8 |
+                          (uint32_t)cpu->proximity_domain_hi[1] << 16 |
+                          (uint32_t)cpu->proximity_domain_hi[2] << 24;
+        add_cpu(cpu->apic_id, domain);
+        break;
+      }
+      case SRAT_TYPE_MEMORY: {
+        const SratMemory *memory = (const SratMemory *)entry;
+        if (!isset(memory->flags, SRAT_FLAGS_ENABLED)) break;
+        add_memory(memory->base, memory->length, memory->proximity_domain);
+        break;
+      }
+      case SRAT_TYPE_PROCESSOR_X2APIC: {
+        const SratProcessorX2apic *cpu = (const SratProcessorX2apic *)entry;
+        if (!isset(cpu->flags, SRAT_FLAGS_ENABLED)) break;
+        add_cpu(cpu->x2apic_id, cpu->proximity_domain);
+        break;
+      }
+      default:
+        break;
+    }
+    entry += header->length;
+  }
+}
+
+static void parse_slit(const AcpiSlit *slit) {
+  uint64_t n = slit->num_localities;
+  if (sizeof(AcpiSlit) + n * n > slit->header.length) {
+    LOG_ERROR("Invalid SLIT size.\n");
+    return;
+  }
+  for (int from = 0; from < node_count; from++) {
+    for (int to = 0; to < node_count; to++) {
+      uint64_t i = node_domains[from];
+      uint64_t j = node_domains[to];
+      if (i < n && j < n) distances[from][to] = slit->entries[i * n + j];
+    }
+  }
+}
+
+void numa_init(void) {
+  node_count = 0;
+  range_count = 0;
+  cpu_count = 0;
+
+  const AcpiSrat *srat = (const AcpiSrat *)acpi_find_table("SRAT");
+  if (srat != NULL) parse_srat(srat);
+  if (node_count == 0) {
+    // No topology information. Everything is on node 0.
+    node_domains[0] = 0;
+    node_count = 1;
+  }
+
+  for (int from = 0; from < MAX_NUMA_NODES; from++) {
+    for (int to = 0; to < MAX_NUMA_NODES; to++) {
+      distances[from][to] =
+          from == to ? NUMA_LOCAL_DISTANCE : NUMA_REMOTE_DISTANCE;
+    }
+  }
+  const AcpiSlit *slit = (const AcpiSlit *)acpi_find_table("SLIT");
+  if (slit != NULL) parse_slit(slit);
+
+  LOG_INFO("NUMA: %d node(s), %d memory range(s).\n", node_count,
+           (int)range_count);
+}
+
+int numa_node_count(void) { return node_count; }
+
+int numa_node_of_phys(Phys addr) {
+  size_t low = 0;
+  size_t high = range_count;
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (ranges[mid].base + ranges[mid].length <= addr) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  if (low < range_count && ranges[low].base <= addr) return ranges[low].node;
+  return NUMA_NO_NODE;
+}
+
+int numa_node_of_apic(uint32_t apic_id) {
+  for (size_t i = 0; i < cpu_count; i++) {
+    if (cpus[i].apic_id == apic_id) return cpus[i].node;
+  }
+  return 0;
+}
+
+uint8_t numa_distance(int from, int to) {
+  if (from < 0 || from >= node_count || to < 0 || to >= node_count) {
+    return UINT8_MAX;
+  }
+  return distances[from][to];
+}
+
+size_t numa_memory_range_count(void) { return range_count; }
+
+const NumaMemoryRange *numa_memory_range(size_t index) {
+  if (index >= range_count) return NULL;
+  return &ranges[index];
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mem.h"
+
+/** Maximum number of NUMA nodes. */
+#define MAX_NUMA_NODES 8
+
+/** Node ID meaning "no preference" or "unknown". */
+#define NUMA_NO_NODE (-1)
+
+/** Distance from a node to itself, as defined by the ACPI SLIT. */
+#define NUMA_LOCAL_DISTANCE 10
+/** Distance assumed between different nodes when there is no SLIT. */
+#define NUMA_REMOTE_DISTANCE 20
+
+/** Physical memory range that belongs to a node. */
+typedef struct {
+  Phys base;
+  uint64_t length;
+  int node;
+} NumaMemoryRange;
+
+/** Read the NUMA topology from the ACPI SRAT and SLIT. Without an SRAT, the
+ * system is treated as a single node that holds all memory and CPUs.
+ * acpi_init() MUST be called before this function. */
+void numa_init(void);
+
+/** Number of nodes. Nodes are numbered from 0. */
+int numa_node_count(void);
+
+/** Node that the physical address belongs to. Returns NUMA_NO_NODE if the
+ * address is not described by the SRAT. */
+int numa_node_of_phys(Phys addr);
+
+/** Node of the CPU with the given (x2)APIC ID. Returns 0 if unknown. */
+int numa_node_of_apic(uint32_t apic_id);
+
+/** Relative distance between two nodes. */
+uint8_t numa_distance(int from, int to);
+
+/** Number of memory ranges described by the SRAT. */
+size_t numa_memory_range_count(void);
+
+/** The `index`-th memory range, sorted by base address. */
+const NumaMemoryRange *numa_memory_range(size_t index);
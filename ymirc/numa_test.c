@@ -0,0 +1,267 @@
+#define _DEFAULT_SOURCE
+
+#include "numa.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "acpi.h"
+#include "log.h"
+#include "mem.h"
+#include "page_allocator.h"
+
+/** Memory handed to the page allocator is backed at the same host address.
+ * The SRAT splits it into two nodes of 3MiB. The extra page at the top holds
+ * the allocator bitmap and belongs to no node. */
+#define BASE 0x40000000ULL
+#define NODE_SIZE 0x300000ULL
+#define BACKED_SIZE (NODE_SIZE * 2 + PAGE_SIZE)
+
+void log_output(char c) { putchar(c); }
+void log_no_output(char c) { (void)c; }
+
+/** ACPI tables built by the test. Physical addresses are host addresses. */
+static struct {
+  AcpiRsdp rsdp;
+  struct {
+    AcpiSdtHeader header;
+    uint64_t entries[2];
+  } __attribute__((packed)) xsdt;
+  struct {
+    AcpiSdtHeader header;
+    uint8_t reserved[12];
+    uint8_t entries[16 * 3 + 40 * 2 + 24];
+  } __attribute__((packed)) srat;
+  struct {
+    AcpiSdtHeader header;
+    uint64_t num_localities;
+    uint8_t entries[4];
+  } __attribute__((packed)) slit;
+} __attribute__((packed)) tables;
+
+static uint8_t checksum(const void* table, size_t length) {
+  const uint8_t* bytes = table;
+  uint8_t sum = 0;
+  for (size_t i = 0; i < length; i++) sum += bytes[i];
+  return (uint8_t)-sum;
+}
+
+static void init_header(AcpiSdtHeader* header, const char* signature,
+                        uint32_t length) {
+  memcpy(header->signature, signature, 4);
+  header->length = length;
+  header->revision = 1;
+}
+
+static uint8_t* put_cpu(uint8_t* entry, uint8_t apic_id, uint8_t domain,
+                        bool enabled) {
+  entry[0] = 0;
+  entry[1] = 16;
+  entry[2] = domain;
+  entry[3] = apic_id;
+  entry[4] = enabled;
+  return entry + 16;
+}
+
+static uint8_t* put_x2apic_cpu(uint8_t* entry, uint32_t x2apic_id,
+                               uint32_t domain) {
+  entry[0] = 2;
+  entry[1] = 24;
+  memcpy(entry + 4, &domain, 4);
+  memcpy(entry + 8, &x2apic_id, 4);
+  entry[12] = 1;
+  return entry + 24;
+}
+
+static uint8_t* put_memory(uint8_t* entry, uint64_t base, uint64_t length,
+                           uint32_t domain) {
+  entry[0] = 1;
+  entry[1] = 40;
+  memcpy(entry + 2, &domain, 4);
+  memcpy(entry + 8, &base, 8);
+  memcpy(entry + 16, &length, 8);
+  entry[28] = 1;
+  return entry + 40;
+}
+
+/** Build tables for two nodes. Proximity domain 7 is listed first, so it
+ * becomes node 0. */
+static Phys build_tables(void) {
+  memset(&tables, 0, sizeof(tables));
+
+  uint8_t* entry = tables.srat.entries;
+  entry = put_cpu(entry, 0, 7, true);
+  entry = put_cpu(entry, 1, 3, true);
+  entry = put_cpu(entry, 2, 3, false);
+  entry = put_memory(entry, BASE + NODE_SIZE, NODE_SIZE, 3);
+  entry = put_memory(entry, BASE, NODE_SIZE, 7);
+  entry = put_x2apic_cpu(entry, 0x100, 3);
+  init_header(&tables.srat.header, "SRAT", sizeof(tables.srat));
+  tables.srat.header.checksum = checksum(&tables.srat, sizeof(tables.srat));
+
+  // Localities are proximity domains. Only 0 and 1 are described, so domain 3
+  // and 7 keep the default distances.
+  init_header(&tables.slit.header, "SLIT", sizeof(tables.slit));
+  tables.slit.num_localities = 2;
+  tables.slit.entries[0] = 10;
+  tables.slit.entries[1] = 15;
+  tables.slit.entries[2] = 15;
+  tables.slit.entries[3] = 10;
+  tables.slit.header.checksum = checksum(&tables.slit, sizeof(tables.slit));
+
+  init_header(&tables.xsdt.header, "XSDT", sizeof(tables.xsdt));
+  tables.xsdt.entries[0] = (Phys)&tables.srat;
+  tables.xsdt.entries[1] = (Phys)&tables.slit;
+  tables.xsdt.header.checksum = checksum(&tables.xsdt, sizeof(tables.xsdt));
+
+  memcpy(tables.rsdp.signature, "RSD PTR ", 8);
+  tables.rsdp.revision = 2;
+  tables.rsdp.length = sizeof(AcpiRsdp);
+  tables.rsdp.xsdt_address = (Phys)&tables.xsdt;
+  tables.rsdp.checksum = checksum(&tables.rsdp, offsetof(AcpiRsdp, length));
+  tables.rsdp.extended_checksum = checksum(&tables.rsdp, sizeof(AcpiRsdp));
+  return (Phys)&tables.rsdp;
+}
+
+static void* at(uint64_t offset) { return (void*)(BASE + offset); }
+
+static void test_no_acpi(void) {
+  log_set_writefn(log_no_output);
+  acpi_init(0);
+  numa_init();
+  log_set_writefn(log_output);
+
+  assert(acpi_find_table("SRAT") == NULL);
+  assert(numa_node_count() == 1);
+  assert(numa_memory_range_count() == 0);
+  assert(numa_node_of_apic(3) == 0);
+  assert(numa_node_of_phys(BASE) == NUMA_NO_NODE);
+  assert(numa_distance(0, 0) == NUMA_LOCAL_DISTANCE);
+  assert(numa_distance(0, 1) == UINT8_MAX);
+}
+
+static void test_srat(void) {
+  log_set_writefn(log_no_output);
+  acpi_init(build_tables());
+  numa_init();
+  log_set_writefn(log_output);
+
+  assert(acpi_find_table("SRAT") == &tables.srat.header);
+  assert(acpi_find_table("APIC") == NULL);
+
+  assert(numa_node_count() == 2);
+  assert(numa_node_of_apic(0) == 0);
+  assert(numa_node_of_apic(1) == 1);
+  assert(numa_node_of_apic(0x100) == 1);
+  // Disabled entries are ignored.
+  assert(numa_node_of_apic(2) == 0);
+
+  // Ranges are sorted by base address.
+  assert(numa_memory_range_count() == 2);
+  assert(numa_memory_range(0)->base == BASE);
+  assert(numa_memory_range(0)->node == 0);
+  assert(numa_memory_range(1)->base == BASE + NODE_SIZE);
+  assert(numa_memory_range(1)->node == 1);
+  assert(numa_memory_range(2) == NULL);
+  assert(numa_node_of_phys(BASE + NODE_SIZE - 1) == 0);
+  assert(numa_node_of_phys(BASE + NODE_SIZE) == 1);
+  assert(numa_node_of_phys(BASE + NODE_SIZE * 2) == NUMA_NO_NODE);
+  assert(numa_node_of_phys(BASE - 1) == NUMA_NO_NODE);
+
+  assert(numa_distance(0, 0) == NUMA_LOCAL_DISTANCE);
+  assert(numa_distance(0, 1) == NUMA_REMOTE_DISTANCE);
+}
+
+static void test_slit(void) {
+  // Same topology with proximity domains that the SLIT describes.
+  build_tables();
+  tables.srat.entries[2] = 0;
+  tables.srat.entries[16 + 2] = 1;
+  tables.srat.entries[16 * 3 + 2] = 1;
+  tables.srat.entries[16 * 3 + 40 + 2] = 0;
+  tables.srat.entries[16 * 3 + 40 * 2 + 4] = 1;
+  tables.srat.header.checksum = 0;
+  tables.srat.header.checksum = checksum(&tables.srat, sizeof(tables.srat));
+
+  log_set_writefn(log_no_output);
+  acpi_init((Phys)&tables.rsdp);
+  numa_init();
+  log_set_writefn(log_output);
+
+  assert(numa_node_count() == 2);
+  assert(numa_distance(0, 1) == 15);
+  assert(numa_distance(1, 1) == NUMA_LOCAL_DISTANCE);
+
+  // A broken checksum hides the table.
+  tables.slit.entries[1] = 30;
+  log_set_writefn(log_no_output);
+  numa_init();
+  log_set_writefn(log_output);
+  assert(numa_distance(0, 1) == NUMA_REMOTE_DISTANCE);
+}
+
+static void test_alloc_on_node(void) {
+  log_set_writefn(log_no_output);
+  acpi_init(build_tables());
+  numa_init();
+  log_set_writefn(log_output);
+
+  MemoryMap map = {
+      .descriptor_size = sizeof(EFI_MEMORY_DESCRIPTOR),
+      .map_size = sizeof(EFI_MEMORY_DESCRIPTOR),
+      .descriptors = &(EFI_MEMORY_DESCRIPTOR){
+          .Type = EfiConventionalMemory,
+          .PhysicalStart = BASE,
+          .NumberOfPages = BACKED_SIZE / PAGE_SIZE,
+      },
+  };
+  page_allocator_init(&map);
+
+  assert(pa_ops.alloc_on_node(1, PAGE_SIZE, 1) == at(NODE_SIZE));
+  assert(pa_ops.alloc_on_node(1, PAGE_SIZE, 0) == at(0));
+  // Unknown nodes behave like alloc_aligned_pages().
+  assert(pa_ops.alloc_on_node(1, PAGE_SIZE, NUMA_NO_NODE) == at(PAGE_SIZE));
+  pa_ops.free(at(0));
+  pa_ops.free(at(PAGE_SIZE));
+  pa_ops.free(at(NODE_SIZE));
+
+  // Alignment is kept within the node.
+  void* aligned = pa_ops.alloc_on_node(0x100, 0x200000, 1);
+  assert(aligned == at(NODE_SIZE + 0x100000));
+  pa_ops.free(aligned);
+
+  // A full node falls back to the nearest other node.
+  size_t node_pages = NODE_SIZE / PAGE_SIZE;
+  assert(pa_ops.alloc_on_node(node_pages, PAGE_SIZE, 1) == at(NODE_SIZE));
+  assert(pa_ops.alloc_on_node(1, PAGE_SIZE, 1) == at(0));
+  assert(pa_ops.alloc_on_node(node_pages, PAGE_SIZE, 0) == NULL);
+  pa_ops.free(at(NODE_SIZE));
+  pa_ops.free(at(0));
+  // Freed frames count toward their node again.
+  assert(pa_ops.alloc_on_node(node_pages, PAGE_SIZE, 1) == at(NODE_SIZE));
+  pa_ops.free(at(NODE_SIZE));
+
+  log_set_writefn(log_no_output);
+  assert(pa_ops.alloc_on_node(1, 0x1100, 0) == NULL);
+  log_set_writefn(log_output);
+}
+
+int main() {
+  log_set_writefn(log_output);
+
+  void* mem = mmap(at(0), BACKED_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+  assert(mem == at(0));
+
+  test_no_acpi();
+  test_srat();
+  test_slit();
+  test_alloc_on_node();
+
+  puts("PASS");
+
+  return 0;
+}
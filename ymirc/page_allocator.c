@@ -1,3 +1,5 @@
+#define LOG_SUBSYSTEM LOG_SUBSYS_ALLOC
+
 #include "page_allocator.h"
 
 #include <stdbool.h>
@@ -7,22 +9,34 @@
 #include "bits.h"
 #include "log.h"
 #include "mem.h"
+#include "numa.h"
 #include "panic.h"
+#include "zeroed_page_pool.h"
 
 /** Maximum physical memory size in bytes that can be managed by this allocator.
- */
-#define MAX_PHYSICAL_SIZE (128ULL * 1024 * 1024 * 1024)  // 128GiB
-/** Maximum page frame count. */
-#define FRAME_COUNT (MAX_PHYSICAL_SIZE / PAGE_SIZE)  // 32Mi frames
+ * Memory above it is not reachable through the direct mapping. */
+#define MAX_PHYSICAL_SIZE DIRECT_MAP_SIZE
 /** Single unit of bitmap line. */
 typedef uint64_t MapLineType;
 /** Bits per map line. */
 #define BITS_PER_MAPLINE (sizeof(MapLineType) * 8)  // 64 bits
-/** Number of map lines. */
-#define NUM_MAPLINES (FRAME_COUNT / BITS_PER_MAPLINE)  // 512Ki lines
 
-/** Bitmap. */
-static MapLineType bitmap[NUM_MAPLINES] = {0};
+/** Number of summary levels stacked on top of the bitmap. Bit N of a word at
+ * level L is set iff word N at level L-1 is fully used. */
+#define NUM_SUMMARY_LEVELS 2
+
+/** Physical address of the bitmap and its summaries indexed by level. Level 0
+ * is the bitmap itself, where a set bit means the frame is in use. They are
+ * carved out of usable memory at init and sized from the memory map. */
+static Phys level_base[NUM_SUMMARY_LEVELS + 1];
+/** Number of map lines at each level. */
+static uint64_t level_lines[NUM_SUMMARY_LEVELS + 1];
+
+/** Map line with all frames in use. */
+#define MAPLINE_FULL (~(MapLineType)0)
+
+/** Value returned by the search functions when nothing is found. */
+#define NOT_FOUND UINT64_MAX
 
 typedef uint64_t FrameId;
 
@@ -30,6 +44,28 @@ typedef uint64_t FrameId;
 static FrameId frame_begin = 1;
 /** First frame ID that is not managed by this allocator. */
 static FrameId frame_end;
+/** Frame ID that bit 0 of the bitmap describes. */
+static FrameId bitmap_base;
+/** Physical address of the extent bitmap. A set bit means the frame is the
+ * first frame of an allocation. Together with the bitmap, it gives the length
+ * of an allocation: it ends at the next unused frame or the next head. */
+static Phys heads_base;
+/** Physical address of the empty summary. Bit N is set iff map line N of the
+ * bitmap has no used frame, so that the ends of long free runs are found
+ * without scanning every line in between. */
+static Phys empty_base;
+/** Pages zeroed ahead of time. */
+static ZeroedPagePool zeroed_pool;
+/** Counters reported by get_stats(). Free blocks are the maximal runs of unused
+ * frames, counted by the order of the largest block that fits in each. They
+ * are kept up to date as runs are split and merged. Used frames are filled in
+ * when they are read. */
+static PageAllocatorStats stats;
+/** Unused frames in the SRAT memory ranges of each node. Nodes share the
+ * bitmap, so a node is searched by walking its ranges in it. These counts let
+ * alloc_on_node() skip a node that cannot hold the allocation without scanning
+ * its ranges. */
+static uint64_t node_free_frames[MAX_NUMA_NODES];
 
 /** Reserved region for UEFI firmware use. */
 typedef struct {
@@ -42,10 +78,20 @@ typedef struct {
  * Increase this value if more reserved regions are required. */
 #define MAX_UEFI_RESERVED_RESIONS 1024
 
+/** Reserved regions. Sorted by frame and merged at the end of init. */
 static UefiReservedRegion reserved_regions[MAX_UEFI_RESERVED_RESIONS];
 static size_t reserved_region_count;
 
 static void add_reserved_region(FrameId frame, uint64_t num_frames) {
+  // Consecutive reserved descriptors are common. Extend the last region so
+  // that maps with thousands of descriptors stay under the limit.
+  if (reserved_region_count > 0) {
+    UefiReservedRegion *last = &reserved_regions[reserved_region_count - 1];
+    if (last->frame + last->num_frames == frame) {
+      last->num_frames += num_frames;
+      return;
+    }
+  }
   if (reserved_region_count >= MAX_UEFI_RESERVED_RESIONS) {
     panic("The count of memory region reserved by UEFI exceeds the limit.");
   }
@@ -53,53 +99,327 @@ static void add_reserved_region(FrameId frame, uint64_t num_frames) {
       (UefiReservedRegion){frame, num_frames};
 }
 
+/** Sort the reserved regions and merge the ones that touch. The memory map is
+ * usually sorted already, so the insertion sort is close to linear. */
+static void sort_reserved_regions(void) {
+  for (size_t i = 1; i < reserved_region_count; i++) {
+    UefiReservedRegion region = reserved_regions[i];
+    size_t j = i;
+    for (; j > 0 && reserved_regions[j - 1].frame > region.frame; j--) {
+      reserved_regions[j] = reserved_regions[j - 1];
+    }
+    reserved_regions[j] = region;
+  }
+
+  if (reserved_region_count == 0) return;
+  size_t count = 1;
+  for (size_t i = 1; i < reserved_region_count; i++) {
+    UefiReservedRegion *last = &reserved_regions[count - 1];
+    FrameId last_end = last->frame + last->num_frames;
+    FrameId r_start = reserved_regions[i].frame;
+    FrameId r_end = r_start + reserved_regions[i].num_frames;
+    if (r_start <= last_end) {
+      if (r_end > last_end) last->num_frames = r_end - last->frame;
+    } else {
+      reserved_regions[count++] = reserved_regions[i];
+    }
+  }
+  reserved_region_count = count;
+}
+
+/** Index of the first reserved region that ends after `frame`. Returns
+ * `reserved_region_count` if there is none. */
+static size_t find_reserved(FrameId frame) {
+  size_t low = 0;
+  size_t high = reserved_region_count;
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    const UefiReservedRegion *region = &reserved_regions[mid];
+    if (region->frame + region->num_frames <= frame) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
 /** Checks whether the specified memory range overlaps with any region reserved
  * by UEFI. */
 static bool overlaps_reserved(FrameId frame, uint64_t num_frames) {
-  FrameId start = frame;
-  FrameId end = frame + num_frames;
-  for (uint64_t i = 0; i < reserved_region_count; i++) {
-    FrameId r_start = reserved_regions[i].frame;
-    FrameId r_end = r_start + reserved_regions[i].num_frames;
-    if (start < r_end && end > r_start) {
-      return true;
+  size_t i = find_reserved(frame);
+  return i < reserved_region_count &&
+         reserved_regions[i].frame < frame + num_frames;
+}
+
+/** Map lines at the given level. The bitmap is accessed through the current
+ * mapping since it moves when the page tables are reconstructed. */
+static inline MapLineType *level_map(int level) {
+  return (MapLineType *)phys2virt(level_base[level]);
+}
+
+static inline MapLineType *head_map(void) {
+  return (MapLineType *)phys2virt(heads_base);
+}
+
+static inline MapLineType *empty_map(void) {
+  return (MapLineType *)phys2virt(empty_base);
+}
+
+/** Mask of the bits below `nth` in a map line. */
+static inline MapLineType lower_mask(unsigned int nth) {
+  return tobit(nth) - 1;
+}
+
+/** Propagate the state of map lines [first, last] at `level` to the summary
+ * levels above it. */
+static void update_summary(int level, uint64_t first, uint64_t last) {
+  for (; level < NUM_SUMMARY_LEVELS; level++) {
+    MapLineType *lines = level_map(level);
+    MapLineType *upper = level_map(level + 1);
+    for (uint64_t i = first; i <= last; i++) {
+      uint64_t bit = tobit(i % BITS_PER_MAPLINE);
+      if (lines[i] == MAPLINE_FULL) {
+        upper[i / BITS_PER_MAPLINE] |= bit;
+      } else {
+        upper[i / BITS_PER_MAPLINE] &= ~bit;
+      }
     }
+    first /= BITS_PER_MAPLINE;
+    last /= BITS_PER_MAPLINE;
   }
-  return false;
 }
 
-typedef enum {
-  // Page frame is in use.
-  used,
-  // Page frame is unused.
-  unused,
-} FrameStatus;
+/** Set the status of frames [frame, frame + num_frames) a map line at a time
+ * and update the summaries. Frames outside the bitmap are ignored. */
+static void set_frames(FrameId frame, uint64_t num_frames, bool used) {
+  FrameId end = frame + num_frames;
+  if (frame < bitmap_base) frame = bitmap_base;
+  if (end > frame_end) end = frame_end;
+  if (frame >= end) return;
 
-static FrameStatus frame_status_at(FrameId frame) {
-  int line_index = frame / BITS_PER_MAPLINE;
-  int bit_index = frame % BITS_PER_MAPLINE;
-  return (bitmap[line_index] & tobit(bit_index)) ? used : unused;
+  MapLineType *bitmap = level_map(0);
+  MapLineType *empty = empty_map();
+  uint64_t first_bit = frame - bitmap_base;
+  uint64_t end_bit = end - bitmap_base;
+  uint64_t first_line = first_bit / BITS_PER_MAPLINE;
+  uint64_t last_line = (end_bit - 1) / BITS_PER_MAPLINE;
+  for (uint64_t i = first_line; i <= last_line; i++) {
+    MapLineType mask = MAPLINE_FULL;
+    if (i == first_line) mask &= ~lower_mask(first_bit % BITS_PER_MAPLINE);
+    if (i == last_line && end_bit % BITS_PER_MAPLINE != 0) {
+      mask &= lower_mask(end_bit % BITS_PER_MAPLINE);
+    }
+    if (used) {
+      bitmap[i] |= mask;
+    } else {
+      bitmap[i] &= ~mask;
+    }
+    if (bitmap[i] == 0) {
+      empty[i / BITS_PER_MAPLINE] |= tobit(i % BITS_PER_MAPLINE);
+    } else {
+      empty[i / BITS_PER_MAPLINE] &= ~tobit(i % BITS_PER_MAPLINE);
+    }
+  }
+  update_summary(0, first_line, last_line);
 }
 
-static void set_frame_status(FrameId frame, FrameStatus status) {
-  int line_index = frame / BITS_PER_MAPLINE;
-  int bit_index = frame % BITS_PER_MAPLINE;
-  if (status == used) {
-    bitmap[line_index] |= tobit(bit_index);
+static void set_head(FrameId frame, bool head) {
+  uint64_t bit = frame - bitmap_base;
+  if (head) {
+    head_map()[bit / BITS_PER_MAPLINE] |= tobit(bit % BITS_PER_MAPLINE);
   } else {
-    bitmap[line_index] &= ~tobit(bit_index);
+    head_map()[bit / BITS_PER_MAPLINE] &= ~tobit(bit % BITS_PER_MAPLINE);
   }
 }
 
+static bool is_head(FrameId frame) {
+  if (frame < bitmap_base || frame >= frame_end) return false;
+  uint64_t bit = frame - bitmap_base;
+  return isset(head_map()[bit / BITS_PER_MAPLINE], bit % BITS_PER_MAPLINE);
+}
+
 static void mark_allocated(FrameId frame, uint64_t num_frames) {
-  for (uint64_t i = 0; i < num_frames; i++) {
-    set_frame_status(frame + i, used);
-  }
+  set_frames(frame, num_frames, true);
 }
 
 static void mark_not_used(FrameId frame, uint64_t num_frames) {
-  for (uint64_t i = 0; i < num_frames; i++) {
-    set_frame_status(frame + i, unused);
+  set_frames(frame, num_frames, false);
+}
+
+/** Find the first clear bit at or after `pos` at the given level. A clear bit
+ * in a summary means the line below it has at least one unused frame, so the
+ * search descends one level per step instead of scanning every line. */
+static uint64_t find_clear_bit(int level, uint64_t pos) {
+  const MapLineType *lines = level_map(level);
+  uint64_t index = pos / BITS_PER_MAPLINE;
+  if (index >= level_lines[level]) return NOT_FOUND;
+
+  MapLineType line = lines[index] | lower_mask(pos % BITS_PER_MAPLINE);
+  if (line != MAPLINE_FULL) {
+    return index * BITS_PER_MAPLINE + __builtin_ctzll(~line);
+  }
+
+  // The rest of this line is used. Find the next line that is not full.
+  if (level == NUM_SUMMARY_LEVELS) {
+    for (index++; index < level_lines[level]; index++) {
+      if (lines[index] != MAPLINE_FULL) break;
+    }
+    if (index >= level_lines[level]) return NOT_FOUND;
+  } else {
+    index = find_clear_bit(level + 1, index + 1);
+    if (index == NOT_FOUND) return NOT_FOUND;
+  }
+  return index * BITS_PER_MAPLINE + __builtin_ctzll(~lines[index]);
+}
+
+/** Find the first unused frame in [frame, frame_end). */
+static FrameId find_unused(FrameId frame) {
+  if (frame < bitmap_base) frame = bitmap_base;
+  uint64_t found = find_clear_bit(0, frame - bitmap_base);
+  if (found == NOT_FOUND) return NOT_FOUND;
+  return bitmap_base + found < frame_end ? bitmap_base + found : NOT_FOUND;
+}
+
+/** Find the first map line at or after `index` that has a used frame.
+ * Returns the number of map lines if there is none. */
+static uint64_t next_used_line(uint64_t index) {
+  const MapLineType *empty = empty_map();
+  for (uint64_t i = index / BITS_PER_MAPLINE; i < level_lines[1]; i++) {
+    MapLineType line = ~empty[i];
+    if (i == index / BITS_PER_MAPLINE) {
+      line &= ~lower_mask(index % BITS_PER_MAPLINE);
+    }
+    if (line != 0) {
+      uint64_t found = i * BITS_PER_MAPLINE + __builtin_ctzll(line);
+      return found < level_lines[0] ? found : level_lines[0];
+    }
+  }
+  return level_lines[0];
+}
+
+/** Find the last map line before `index` that has a used frame. */
+static uint64_t prev_used_line(uint64_t index) {
+  const MapLineType *empty = empty_map();
+  while (index > 0) {
+    uint64_t i = (index - 1) / BITS_PER_MAPLINE;
+    MapLineType line =
+        ~empty[i] & (MAPLINE_FULL >> (63 - (index - 1) % BITS_PER_MAPLINE));
+    if (line != 0) {
+      return i * BITS_PER_MAPLINE + 63 - __builtin_clzll(line);
+    }
+    index = i * BITS_PER_MAPLINE;
+  }
+  return NOT_FOUND;
+}
+
+/** Find the first used frame in [frame, limit). Returns `limit` if all frames
+ * in the range are unused. Lines without a used frame are skipped through the
+ * empty summary. */
+static FrameId find_used(FrameId frame, FrameId limit) {
+  const MapLineType *bitmap = level_map(0);
+  while (frame < limit) {
+    uint64_t bit = frame - bitmap_base;
+    uint64_t bit_index = bit % BITS_PER_MAPLINE;
+    FrameId line_start = frame - bit_index;
+    MapLineType line = bitmap[bit / BITS_PER_MAPLINE] & ~lower_mask(bit_index);
+    if (line != 0) {
+      FrameId found = line_start + __builtin_ctzll(line);
+      return found < limit ? found : limit;
+    }
+    uint64_t next = next_used_line(bit / BITS_PER_MAPLINE + 1);
+    frame = bitmap_base + next * BITS_PER_MAPLINE;
+  }
+  return limit;
+}
+
+/** Find the first frame of the run of unused frames that ends at `frame`.
+ * Returns `frame` if the frame before it is used. */
+static FrameId find_run_start(FrameId frame) {
+  const MapLineType *bitmap = level_map(0);
+  uint64_t bit = frame - bitmap_base;
+  uint64_t index = bit / BITS_PER_MAPLINE;
+  if (bit % BITS_PER_MAPLINE != 0) {
+    MapLineType line = bitmap[index] & lower_mask(bit % BITS_PER_MAPLINE);
+    if (line != 0) {
+      return bitmap_base + (index + 1) * BITS_PER_MAPLINE -
+             __builtin_clzll(line);
+    }
+  }
+  index = prev_used_line(index);
+  if (index == NOT_FOUND) return bitmap_base;
+  return bitmap_base + (index + 1) * BITS_PER_MAPLINE -
+         __builtin_clzll(bitmap[index]);
+}
+
+/** Add or remove frames [start, end) in the unused frames of their nodes. */
+static void count_node_frames(FrameId start, FrameId end, bool add) {
+  for (size_t i = 0; i < numa_memory_range_count(); i++) {
+    const NumaMemoryRange *range = numa_memory_range(i);
+    FrameId begin = (range->base + PAGE_SIZE - 1) / PAGE_SIZE;
+    FrameId last = (range->base + range->length) / PAGE_SIZE;
+    if (begin < start) begin = start;
+    if (last > end) last = end;
+    if (begin >= last) continue;
+    if (add) {
+      node_free_frames[range->node] += last - begin;
+    } else {
+      node_free_frames[range->node] -= last - begin;
+    }
+  }
+}
+
+/** Add or remove the free run [start, end) in the free block counts. */
+static void count_free_run(FrameId start, FrameId end, bool add) {
+  if (start >= end) return;
+  uint64_t order = 63 - __builtin_clzll(end - start);
+  if (order >= PAGE_ALLOCATOR_STAT_ORDERS) {
+    order = PAGE_ALLOCATOR_STAT_ORDERS - 1;
+  }
+  if (add) {
+    stats.free_blocks[order]++;
+  } else {
+    stats.free_blocks[order]--;
+  }
+}
+
+/** Find the end of the allocation starting at `frame`: the first frame in
+ * (frame, limit) that is unused or starts another allocation. Returns `limit`
+ * if there is none. */
+static FrameId find_extent_end(FrameId frame, FrameId limit) {
+  const MapLineType *bitmap = level_map(0);
+  const MapLineType *heads = head_map();
+  frame++;
+  while (frame < limit) {
+    uint64_t bit = frame - bitmap_base;
+    uint64_t bit_index = bit % BITS_PER_MAPLINE;
+    uint64_t i = bit / BITS_PER_MAPLINE;
+    FrameId line_start = frame - bit_index;
+    MapLineType line = (heads[i] | ~bitmap[i]) & ~lower_mask(bit_index);
+    if (line != 0) {
+      FrameId found = line_start + __builtin_ctzll(line);
+      return found < limit ? found : limit;
+    }
+    frame = line_start + BITS_PER_MAPLINE;
+  }
+  return limit;
+}
+
+/** Find `num_frames` contiguous unused frames in [frame, limit) whose first
+ * frame is a multiple of `align_frame`. Used frames are skipped a run at a
+ * time. */
+static FrameId find_unused_range(FrameId frame, uint64_t num_frames,
+                                 uint64_t align_frame, FrameId limit) {
+  if (limit > frame_end) limit = frame_end;
+  while (1) {
+    frame = find_unused(frame);
+    if (frame == NOT_FOUND) return NOT_FOUND;
+    frame = (frame + align_frame - 1) / align_frame * align_frame;
+    if (frame + num_frames > limit) return NOT_FOUND;
+
+    FrameId used = find_used(frame, frame + num_frames);
+    if (used == frame + num_frames) return frame;
+    frame = used + 1;
   }
 }
 
@@ -111,82 +431,207 @@ static void mark_uefi_reserved(FrameId frame, uint64_t num_frames) {
 static inline FrameId phys2frame(Phys phys) { return phys / PAGE_SIZE; }
 static inline Phys frame2phys(FrameId frame) { return frame * PAGE_SIZE; }
 
-/** Check if the memory region described by the descriptor is usable for ymirc
- * kernel.
- * Note that these memory areas may contain crucial data for the kernel,
- * including page tables, stack, and GDT.
- * You MUST copy them before using the area. */
-static inline bool is_usable_memory(EFI_MEMORY_DESCRIPTOR *desc) {
-  return desc->Type == EfiConventionalMemory ||
-         desc->Type == EfiBootServicesCode;
+/** Find `num_pages` contiguous usable pages below `limit` for allocator
+ * metadata. The pages are taken from the top of the highest usable region that
+ * is large enough, which keeps low memory available for the common case. */
+Phys find_metadata_pages(MemoryMap *map, uint64_t num_pages, Phys limit) {
+  Phys found = 0;
+  for (uint64_t i = 0; i < map->map_size / map->descriptor_size; i++) {
+    EFI_MEMORY_DESCRIPTOR *desc =
+        (EFI_MEMORY_DESCRIPTOR *)((uint8_t *)map->descriptors +
+                                  i * map->descriptor_size);
+    if (!is_usable_memory(desc)) continue;
+
+    Phys start = desc->PhysicalStart;
+    Phys end = start + desc->NumberOfPages * PAGE_SIZE;
+    if (start < frame2phys(frame_begin)) start = frame2phys(frame_begin);
+    if (end > limit) end = limit;
+    if (start >= end || (end - start) / PAGE_SIZE < num_pages) continue;
+    if (end - num_pages * PAGE_SIZE > found) {
+      found = end - num_pages * PAGE_SIZE;
+    }
+  }
+  return found;
 }
 
 /** Initialize the allocator.
+ * The bitmap is sized from the highest usable descriptor and placed in usable
+ * memory described by the map.
  * This function MUST be called before the direct mapping w/ offset 0x0 is
  * unmapped. */
 void page_allocator_init(MemoryMap *map) {
   Phys phys_end = 0;
+  Phys avail_begin = MAX_PHYSICAL_SIZE;
   Phys avail_end = 0;
+  bool truncated = false;
+
+  // Find the range the bitmap has to cover.
   for (uint64_t i = 0; i < map->map_size / map->descriptor_size; i++) {
     EFI_MEMORY_DESCRIPTOR *desc =
         (EFI_MEMORY_DESCRIPTOR *)((uint8_t *)map->descriptors +
                                   i * map->descriptor_size);
+    if (!is_usable_memory(desc)) continue;
+
+    Phys start = desc->PhysicalStart;
+    Phys end = start + desc->NumberOfPages * PAGE_SIZE;
+    if (start < frame2phys(frame_begin)) start = frame2phys(frame_begin);
+    if (end > MAX_PHYSICAL_SIZE) {
+      truncated = true;
+      end = MAX_PHYSICAL_SIZE;
+    }
+    if (start >= end) continue;
+    if (start < avail_begin) avail_begin = start;
+    if (end > avail_end) avail_end = end;
+  }
+  if (avail_end == 0) {
+    panic("No usable memory found in the memory map.");
+  }
+  if (truncated) {
+    LOG_WARN("Memory above 0x%x is not managed by the page allocator.\n",
+             MAX_PHYSICAL_SIZE);
+  }
+  bitmap_base = phys2frame(avail_begin) / BITS_PER_MAPLINE * BITS_PER_MAPLINE;
+  frame_end = phys2frame(avail_end);
+
+  // Size each level and place them back to back.
+  uint64_t num_bits = frame_end - bitmap_base;
+  uint64_t total_lines = 0;
+  for (int level = 0; level <= NUM_SUMMARY_LEVELS; level++) {
+    level_lines[level] = (num_bits + BITS_PER_MAPLINE - 1) / BITS_PER_MAPLINE;
+    num_bits = level_lines[level];
+    total_lines += level_lines[level];
+  }
+  // The extent bitmap and the empty summary follow the summaries.
+  total_lines += level_lines[0] + level_lines[1];
+  uint64_t num_pages =
+      (total_lines * sizeof(MapLineType) + PAGE_SIZE - 1) / PAGE_SIZE;
+  Phys metadata = find_metadata_pages(map, num_pages, avail_end);
+  if (metadata == 0) {
+    panic("No memory for the page allocator bitmap.");
+  }
+  for (int level = 0; level <= NUM_SUMMARY_LEVELS; level++) {
+    level_base[level] = metadata;
+    metadata += level_lines[level] * sizeof(MapLineType);
+  }
+  heads_base = metadata;
+  empty_base = heads_base + level_lines[0] * sizeof(MapLineType);
+
+  // Frames not described by the memory map are never handed out. Setting every
+  // bit also marks the unused tail of each level as used.
+  memset(level_map(0), 0xFF, heads_base - level_base[0]);
+  memset(head_map(), 0, level_lines[0] * sizeof(MapLineType));
+  memset(empty_map(), 0, level_lines[1] * sizeof(MapLineType));
+  reserved_region_count = 0;
+  zeroed_pool.count = 0;
+  stats = (PageAllocatorStats){0};
+  memset(node_free_frames, 0, sizeof(node_free_frames));
+  for (uint64_t i = 0; i < map->map_size / map->descriptor_size; i++) {
+    EFI_MEMORY_DESCRIPTOR *desc =
+        (EFI_MEMORY_DESCRIPTOR *)((uint8_t *)map->descriptors +
+                                  i * map->descriptor_size);
+    Phys start = desc->PhysicalStart;
+    if (start >= MAX_PHYSICAL_SIZE) break;
     // Mark holes between regions as allocated (used).
-    if (phys_end < desc->PhysicalStart) {
-      if (desc->PhysicalStart >= MAX_PHYSICAL_SIZE) {
-        mark_uefi_reserved(phys2frame(phys_end),
-                           (MAX_PHYSICAL_SIZE - phys_end) / PAGE_SIZE);
-        break;
-      } else {
-        mark_uefi_reserved(phys2frame(phys_end),
-                           (desc->PhysicalStart - phys_end) / PAGE_SIZE);
-      }
+    if (phys_end < start) {
+      mark_uefi_reserved(phys2frame(phys_end), (start - phys_end) / PAGE_SIZE);
     }
-    phys_end = desc->PhysicalStart + desc->NumberOfPages * PAGE_SIZE;
+    phys_end = start + desc->NumberOfPages * PAGE_SIZE;
+    if (phys_end > MAX_PHYSICAL_SIZE) phys_end = MAX_PHYSICAL_SIZE;
     // Mark the region described by the descriptor as used or unused.
-    if (phys_end >= MAX_PHYSICAL_SIZE) {
-      // If the end address exceeds the maximum physical memory, mark up to the
-      // maximum as used.
-      mark_uefi_reserved(phys2frame(desc->PhysicalStart),
-                         (MAX_PHYSICAL_SIZE - desc->PhysicalStart) / PAGE_SIZE);
-      break;
-    } else if (is_usable_memory(desc)) {
-      avail_end = phys_end;
-      mark_not_used(phys2frame(desc->PhysicalStart), desc->NumberOfPages);
+    uint64_t num_frames = (phys_end - start) / PAGE_SIZE;
+    if (is_usable_memory(desc)) {
+      mark_not_used(phys2frame(start), num_frames);
+      FrameId first = phys2frame(start);
+      FrameId last = first + num_frames;
+      if (first < frame_begin) first = frame_begin;
+      if (last > frame_end) last = frame_end;
+      if (first < last) stats.total_frames += last - first;
     } else {
-      mark_uefi_reserved(phys2frame(desc->PhysicalStart), desc->NumberOfPages);
+      mark_uefi_reserved(phys2frame(start), num_frames);
     }
   }
-  frame_end = phys2frame(avail_end);
+  sort_reserved_regions();
+  // The bitmap is an allocation that is never freed.
+  mark_allocated(phys2frame(level_base[0]), num_pages);
+  set_head(phys2frame(level_base[0]), true);
+  stats.free_frames = stats.total_frames - num_pages;
+  stats.reserved_frames = frame_end - frame_begin - stats.total_frames;
+  stats.high_water_frames = num_pages;
+
+  // Count the free runs once. They are updated by allocations from now on.
+  FrameId frame = frame_begin;
+  while ((frame = find_unused(frame)) != NOT_FOUND) {
+    FrameId end = find_used(frame, frame_end);
+    count_free_run(frame, end, true);
+    count_node_frames(frame, end, true);
+    frame = end;
+  }
 }
 
-static void *alloc(size_t n) {
-  size_t num_frames = (n + PAGE_SIZE - 1) / PAGE_SIZE;
-  FrameId start_frame = frame_begin;
-  while (1) {
-    size_t i = 0;
-    for (; i < num_frames; i++) {
-      if (start_frame + i >= frame_end) return NULL;
-      if (frame_status_at(start_frame + i) == used) break;
-    }
-    if (i == num_frames) {
-      mark_allocated(start_frame, num_frames);
-      return (void *)phys2virt(frame2phys(start_frame));
-    }
-    start_frame += i + 1;
+/** Hand out `num_frames` frames found by find_unused_range(). */
+static void *take_frames(FrameId start_frame, uint64_t num_frames) {
+  if (start_frame == NOT_FOUND) {
+    stats.alloc_failures++;
+    return NULL;
   }
+  // Split the free run the allocation is carved out of.
+  FrameId end_frame = start_frame + num_frames;
+  FrameId run_start = find_run_start(start_frame);
+  FrameId run_end = find_used(end_frame, frame_end);
+  count_free_run(run_start, run_end, false);
+  count_free_run(run_start, start_frame, true);
+  count_free_run(end_frame, run_end, true);
+  count_node_frames(start_frame, end_frame, false);
+
+  mark_allocated(start_frame, num_frames);
+  set_head(start_frame, true);
+  stats.alloc_count++;
+  stats.free_frames -= num_frames;
+  uint64_t used = stats.total_frames - stats.free_frames;
+  if (used > stats.high_water_frames) stats.high_water_frames = used;
+  return (void *)phys2virt(frame2phys(start_frame));
 }
 
-// FIXME: Size should not be passed.
-static void free(void *ptr, size_t n) {
+static void *alloc(size_t n) {
   size_t num_frames = (n + PAGE_SIZE - 1) / PAGE_SIZE;
+  if (num_frames == 0) return NULL;
+  return take_frames(
+      find_unused_range(frame_begin, num_frames, 1, frame_end), num_frames);
+}
+
+/** Free the allocation starting at `ptr`. Its length is looked up from the
+ * extent bitmap. */
+static void free(void *ptr) {
   Virt start_frame_vaddr = (Virt)ptr & ~PAGE_MASK;
   FrameId start_frame = phys2frame(virt2phys(start_frame_vaddr));
-  if (overlaps_reserved(start_frame, num_frames)) {
+  if (overlaps_reserved(start_frame, 1)) {
     panic("Attempting to free memory reserved by UEFI firmware.");
     return;
   }
-  mark_not_used(start_frame, num_frames);
+  if (!is_head(start_frame)) {
+    panic("Attempting to free memory that is not allocated.");
+    return;
+  }
+
+  // Allocations never cross a reserved region.
+  FrameId limit = frame_end;
+  size_t i = find_reserved(start_frame);
+  if (i < reserved_region_count && reserved_regions[i].frame < limit) {
+    limit = reserved_regions[i].frame;
+  }
+  FrameId end = find_extent_end(start_frame, limit);
+  // Merge the freed frames with the free runs next to them.
+  FrameId run_start = find_run_start(start_frame);
+  FrameId run_end = find_used(end, frame_end);
+  count_free_run(run_start, start_frame, false);
+  count_free_run(end, run_end, false);
+  count_free_run(run_start, run_end, true);
+  count_node_frames(start_frame, end, true);
+
+  set_head(start_frame, false);
+  mark_not_used(start_frame, end - start_frame);
+  stats.free_count++;
+  stats.free_frames += end - start_frame;
 }
 
 /** Allocate physically contiguous and aligned pages. */
@@ -195,26 +640,89 @@ static void *alloc_aligned_pages(size_t num_pages, size_t align_size) {
     LOG_ERROR("Invalid alignment size: 0x%x\n", align_size);
     return NULL;
   }
-  size_t num_frames = num_pages;
   size_t align_frame = (align_size + PAGE_SIZE - 1) / PAGE_SIZE;
-  FrameId start_frame = align_frame;
-  while (1) {
-    size_t i = 0;
-    for (; i < num_frames; i++) {
-      if (start_frame + i >= frame_end) return NULL;
-      if (frame_status_at(start_frame + i) == used) break;
+  if (align_frame == 0) align_frame = 1;
+  if (num_pages == 0) return NULL;
+  return take_frames(
+      find_unused_range(frame_begin, num_pages, align_frame, frame_end),
+      num_pages);
+}
+
+/** Search the memory ranges of `node` for free frames. */
+static FrameId find_unused_range_on_node(int node, uint64_t num_frames,
+                                         uint64_t align_frame) {
+  for (size_t i = 0; i < numa_memory_range_count(); i++) {
+    const NumaMemoryRange *range = numa_memory_range(i);
+    if (range->node != node) continue;
+    FrameId begin = phys2frame(range->base + PAGE_SIZE - 1);
+    FrameId end = phys2frame(range->base + range->length);
+    if (begin < frame_begin) begin = frame_begin;
+    if (begin >= end) continue;
+    FrameId found = find_unused_range(begin, num_frames, align_frame, end);
+    if (found != NOT_FOUND) return found;
+  }
+  return NOT_FOUND;
+}
+
+/** Allocate physically contiguous and aligned pages, preferring memory of
+ * `node`. Nodes are tried in order of distance from `node`, then any memory,
+ * including memory not described by the SRAT. */
+static void *alloc_on_node(size_t num_pages, size_t align_size, int node) {
+  if (node < 0 || node >= numa_node_count()) {
+    return alloc_aligned_pages(num_pages, align_size);
+  }
+  if (align_size % PAGE_SIZE != 0) {
+    LOG_ERROR("Invalid alignment size: 0x%x\n", align_size);
+    return NULL;
+  }
+  size_t align_frame = align_size / PAGE_SIZE;
+  if (align_frame == 0) align_frame = 1;
+  if (num_pages == 0) return NULL;
+
+  // Visit nodes nearest first. Ties are broken by node ID.
+  bool tried[MAX_NUMA_NODES] = {false};
+  for (int n = 0; n < numa_node_count(); n++) {
+    int nearest = NUMA_NO_NODE;
+    for (int candidate = 0; candidate < numa_node_count(); candidate++) {
+      if (tried[candidate]) continue;
+      if (nearest == NUMA_NO_NODE || numa_distance(node, candidate) <
+                                         numa_distance(node, nearest)) {
+        nearest = candidate;
+      }
     }
-    if (i == num_frames) {
-      mark_allocated(start_frame, num_frames);
-      return (void *)phys2virt(frame2phys(start_frame));
+    tried[nearest] = true;
+    if (node_free_frames[nearest] < num_pages) continue;
+    FrameId found =
+        find_unused_range_on_node(nearest, num_pages, align_frame);
+    if (found != NOT_FOUND) {
+      // Memory of a remote node is the slow path.
+      if (nearest != node) stats.slow_path_hits++;
+      return take_frames(found, num_pages);
     }
-    start_frame += align_frame;
-    if (start_frame + num_frames >= frame_end) return NULL;
   }
+  stats.slow_path_hits++;
+  return alloc_aligned_pages(num_pages, align_size);
+}
+
+static void *alloc_zeroed_pages(size_t num_pages) {
+  return zeroed_page_pool_alloc(&zeroed_pool, &pa_ops, num_pages);
+}
+
+static bool do_idle_work(void) {
+  return zeroed_page_pool_refill(&zeroed_pool, &pa_ops);
+}
+
+static void get_stats(PageAllocatorStats *out) {
+  *out = stats;
+  out->used_frames = stats.total_frames - stats.free_frames;
 }
 
 const page_allocator_ops_t pa_ops = {
     .alloc = alloc,
     .free = free,
     .alloc_aligned_pages = alloc_aligned_pages,
+    .alloc_on_node = alloc_on_node,
+    .alloc_zeroed_pages = alloc_zeroed_pages,
+    .do_idle_work = do_idle_work,
+    .get_stats = get_stats,
 };
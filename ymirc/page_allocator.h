@@ -4,8 +4,22 @@
 #include <stddef.h>
 
 #include "../surtrc/def.h"
+#include "mem.h"
 
+/** Check if the memory region described by the descriptor is usable for ymirc
+ * kernel.
+ * Note that these memory areas may contain crucial data for the kernel,
+ * including page tables, stack, and GDT.
+ * You MUST copy them before using the area. */
+static inline bool is_usable_memory(EFI_MEMORY_DESCRIPTOR *desc) {
+  return desc->Type == EfiConventionalMemory ||
+         desc->Type == EfiBootServicesCode;
+}
+
+/** Initialize the page allocator with the usable memory in the map.
+ * numa_init() MUST be called before this function. */
 void page_allocator_init(MemoryMap *map);
+Phys find_metadata_pages(MemoryMap *map, uint64_t num_pages, Phys limit);
 
 #include "page_allocator_if.h"
 extern const page_allocator_ops_t pa_ops;
@@ -0,0 +1,621 @@
+#define _DEFAULT_SOURCE
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "buddy_allocator.h"
+#include "log.h"
+#include "mem.h"
+#include "page_allocator.h"
+
+/** Host address that backs "physical" memory. The allocators keep metadata in
+ * the memory they manage, so it has to be mapped at the address described by
+ * the memory map. Only the pages the allocators touch are populated. */
+#define BASE 0x1000000000ULL
+/** Upper bound of the memory size, below DIRECT_MAP_SIZE. */
+#define MAX_MEMORY_GIB 384
+
+#define DEFAULT_MEMORY_GIB 64
+#define DEFAULT_NUM_DESCRIPTORS 2048
+#define DEFAULT_NUM_OPS 200000
+#define DEFAULT_SEED 1
+
+/** Number of live allocations the mixed workload keeps around. */
+#define MIXED_MAX_LIVE 20000
+/** Number of VMs the VM workload keeps around. */
+#define VM_MAX_LIVE 32
+/** Guest memory of a VM, same as GUEST_MEMORY_SIZE. */
+#define VM_GUEST_PAGES (100 * 1024 * 1024 / PAGE_SIZE)
+/** Page table pages allocated for each VM. */
+#define VM_TABLE_PAGES 53
+/** Pages allocated for each VM and never freed, such as bin allocator pages. */
+#define VM_LEAKED_PAGES 8
+
+typedef enum {
+  OP_ALLOC,
+  OP_FREE,
+} OpKind;
+
+/** Single operation of an allocation trace. `align` is in pages. */
+typedef struct {
+  OpKind kind;
+  uint32_t id;
+  uint32_t pages;
+  uint32_t align;
+} TraceOp;
+
+typedef struct {
+  TraceOp *ops;
+  size_t count;
+  size_t capacity;
+  /** Largest allocation ID plus one. */
+  uint32_t num_ids;
+} Trace;
+
+typedef struct {
+  const char *name;
+  void (*init)(MemoryMap *map);
+  const page_allocator_ops_t *ops;
+} Backend;
+
+static const Backend backends[] = {
+    {"bitmap", page_allocator_init, &pa_ops},
+    {"buddy", buddy_allocator_init, &buddy_ops},
+};
+#define NUM_BACKENDS (sizeof(backends) / sizeof(backends[0]))
+
+typedef struct {
+  const char *name;
+  void (*generate)(Trace *trace, size_t num_ops);
+} Workload;
+
+static void log_stderr(char c) { fputc(c, stderr); }
+static void log_no_output(char c) { (void)c; }
+
+/* Random numbers ******************************************************/
+
+static uint64_t rng_state;
+
+/** xorshift64*. Traces depend only on the seed. */
+static uint64_t rng(void) {
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+/** Uniform random number in [low, high]. */
+static uint64_t rng_range(uint64_t low, uint64_t high) {
+  return low + rng() % (high - low + 1);
+}
+
+/* Memory map **********************************************************/
+
+/** Types of small descriptors, roughly in the proportion seen on firmware. */
+static const EFI_MEMORY_TYPE small_types[] = {
+    EfiConventionalMemory,  EfiConventionalMemory, EfiBootServicesCode,
+    EfiBootServicesData,    EfiBootServicesData,   EfiLoaderData,
+    EfiRuntimeServicesData, EfiRuntimeServicesCode, EfiACPIReclaimMemory,
+    EfiACPIMemoryNVS,       EfiReservedMemoryType,
+};
+#define NUM_SMALL_TYPES (sizeof(small_types) / sizeof(small_types[0]))
+/** Size of a hole between descriptors. */
+#define HOLE_PAGES 64
+
+/** Build a memory map of `num_descriptors` descriptors that covers `size`
+ * bytes from BASE. Most descriptors are small firmware regions between a few
+ * large conventional ones, with holes here and there. The last descriptor is
+ * always large and usable. */
+static MemoryMap *create_memory_map(uint64_t size, size_t num_descriptors) {
+  MemoryMap *map = malloc(sizeof(MemoryMap));
+  map->descriptor_size = sizeof(EFI_MEMORY_DESCRIPTOR);
+  map->descriptors = calloc(num_descriptors, sizeof(EFI_MEMORY_DESCRIPTOR));
+
+  size_t num_large = num_descriptors / 16 + 1;
+  uint64_t total_pages = size / PAGE_SIZE;
+  uint64_t small_pages = 0;
+  uint64_t *pages = calloc(num_descriptors, sizeof(uint64_t));
+  bool *large = calloc(num_descriptors, sizeof(bool));
+  bool *hole = calloc(num_descriptors, sizeof(bool));
+  large[num_descriptors - 1] = true;
+  for (size_t placed = 1; placed < num_large;) {
+    size_t i = rng_range(0, num_descriptors - 1);
+    if (large[i]) continue;
+    large[i] = true;
+    placed++;
+  }
+
+  // Small regions and holes take at most 1/8 of the memory.
+  uint64_t small_budget = total_pages / 8;
+  for (size_t i = 0; i < num_descriptors; i++) {
+    if (large[i]) continue;
+    pages[i] = rng_range(1, 256);
+    // Hole not described by the map in front of the descriptor.
+    hole[i] = rng() % 50 == 0;
+    small_pages += pages[i] + (hole[i] ? HOLE_PAGES : 0);
+  }
+  if (small_pages > small_budget) {
+    fprintf(stderr, "Too many descriptors for the memory size.\n");
+    exit(1);
+  }
+
+  // Spread the rest over the large regions.
+  uint64_t weights = 0;
+  for (size_t i = 0; i < num_descriptors; i++) {
+    if (!large[i]) continue;
+    pages[i] = rng_range(1, 16);
+    weights += pages[i];
+  }
+  uint64_t large_pages = total_pages - small_pages;
+  uint64_t assigned = 0;
+  for (size_t i = 0; i < num_descriptors; i++) {
+    if (!large[i]) continue;
+    pages[i] = pages[i] * large_pages / weights;
+    assigned += pages[i];
+  }
+  pages[num_descriptors - 1] += large_pages - assigned;
+
+  Phys addr = BASE;
+  for (size_t i = 0; i < num_descriptors; i++) {
+    EFI_MEMORY_TYPE type;
+    if (large[i]) {
+      type = i == num_descriptors - 1 || rng() % 8 != 0
+                 ? EfiConventionalMemory
+                 : EfiReservedMemoryType;
+    } else {
+      type = small_types[rng() % NUM_SMALL_TYPES];
+    }
+    if (hole[i]) addr += HOLE_PAGES * PAGE_SIZE;
+    map->descriptors[i] = (EFI_MEMORY_DESCRIPTOR){
+        .Type = type,
+        .PhysicalStart = addr,
+        .NumberOfPages = pages[i],
+    };
+    addr += pages[i] * PAGE_SIZE;
+  }
+  map->map_size = num_descriptors * map->descriptor_size;
+
+  free(pages);
+  free(large);
+  free(hole);
+  return map;
+}
+
+/* Traces **************************************************************/
+
+static void push_op(Trace *trace, TraceOp op) {
+  if (trace->count == trace->capacity) {
+    trace->capacity = trace->capacity ? trace->capacity * 2 : 1024;
+    trace->ops = realloc(trace->ops, trace->capacity * sizeof(TraceOp));
+  }
+  trace->ops[trace->count++] = op;
+  if (op.id >= trace->num_ids) trace->num_ids = op.id + 1;
+}
+
+static uint32_t push_alloc(Trace *trace, uint32_t pages, uint32_t align) {
+  uint32_t id = trace->num_ids;
+  push_op(trace, (TraceOp){OP_ALLOC, id, pages, align});
+  return id;
+}
+
+static void push_free(Trace *trace, uint32_t id) {
+  push_op(trace, (TraceOp){OP_FREE, id, 0, 0});
+}
+
+/** Short-lived allocations of mixed sizes: mostly single pages, some small
+ * runs, 2MiB pages and a few large buffers. */
+static void generate_mixed(Trace *trace, size_t num_ops) {
+  uint32_t *live = malloc(MIXED_MAX_LIVE * sizeof(uint32_t));
+  size_t num_live = 0;
+  while (trace->count < num_ops) {
+    bool alloc = num_live == 0 ||
+                 (num_live < MIXED_MAX_LIVE && rng() % 100 < 55);
+    if (!alloc) {
+      size_t i = rng() % num_live;
+      push_free(trace, live[i]);
+      live[i] = live[--num_live];
+      continue;
+    }
+
+    uint64_t kind = rng() % 100;
+    uint32_t pages = 1;
+    uint32_t align = 1;
+    if (kind >= 98) {
+      pages = rng_range(1024, 4096);
+    } else if (kind >= 90) {
+      pages = 512;
+      align = 512;
+    } else if (kind >= 70) {
+      pages = rng_range(2, 16);
+    }
+    live[num_live++] = push_alloc(trace, pages, align);
+  }
+  free(live);
+}
+
+/** VMs are created and destroyed while the pages the hypervisor keeps for
+ * itself pile up between them. */
+static void generate_vm(Trace *trace, size_t num_ops) {
+  const size_t ids_per_vm = 4 + VM_TABLE_PAGES;
+  uint32_t *vms = malloc(VM_MAX_LIVE * ids_per_vm * sizeof(uint32_t));
+  size_t num_vms = 0;
+  while (trace->count < num_ops) {
+    bool create =
+        num_vms == 0 || (num_vms < VM_MAX_LIVE && rng() % 100 < 60);
+    if (!create) {
+      size_t i = rng() % num_vms;
+      for (size_t j = 0; j < ids_per_vm; j++) {
+        push_free(trace, vms[i * ids_per_vm + j]);
+      }
+      num_vms--;
+      memcpy(&vms[i * ids_per_vm], &vms[num_vms * ids_per_vm],
+             ids_per_vm * sizeof(uint32_t));
+      continue;
+    }
+
+    uint32_t *ids = &vms[num_vms++ * ids_per_vm];
+    ids[0] = push_alloc(trace, 1, 1);  // VMCB
+    ids[1] = push_alloc(trace, 2, 1);  // MSRPM
+    ids[2] = push_alloc(trace, 3, 1);  // IOPM
+    ids[3] = push_alloc(trace, VM_GUEST_PAGES, 512);
+    for (size_t j = 0; j < VM_TABLE_PAGES; j++) {
+      ids[4 + j] = push_alloc(trace, 1, 1);
+    }
+    for (size_t j = 0; j < VM_LEAKED_PAGES; j++) {
+      push_alloc(trace, 1, 1);
+    }
+  }
+  free(vms);
+}
+
+static const Workload workloads[] = {
+    {"mixed", generate_mixed},
+    {"vm", generate_vm},
+};
+#define NUM_WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+/** Read a trace recorded as lines of "a <id> <pages> <align pages>" and
+ * "f <id>". Lines starting with '#' are ignored. */
+static bool read_trace(const char *path, Trace *trace) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    perror(path);
+    return false;
+  }
+  char line[128];
+  size_t lineno = 0;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    lineno++;
+    unsigned int id, pages, align;
+    if (line[0] == '#' || line[0] == '\n') continue;
+    if (sscanf(line, "a %u %u %u", &id, &pages, &align) == 3 && pages > 0 &&
+        align > 0) {
+      push_op(trace, (TraceOp){OP_ALLOC, id, pages, align});
+    } else if (sscanf(line, "f %u", &id) == 1) {
+      push_free(trace, id);
+    } else {
+      fprintf(stderr, "%s:%zu: invalid trace line\n", path, lineno);
+      fclose(file);
+      return false;
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+static bool write_trace(const char *path, const Trace *trace) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    perror(path);
+    return false;
+  }
+  for (size_t i = 0; i < trace->count; i++) {
+    const TraceOp *op = &trace->ops[i];
+    if (op->kind == OP_ALLOC) {
+      fprintf(file, "a %u %u %u\n", op->id, op->pages, op->align);
+    } else {
+      fprintf(file, "f %u\n", op->id);
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+/* Measurement *********************************************************/
+
+typedef struct {
+  uint64_t *samples;
+  size_t count;
+} Latencies;
+
+typedef struct {
+  Phys addr;
+  uint64_t pages;
+} Extent;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static int compare_extent(const void *a, const void *b) {
+  return compare_u64(&((const Extent *)a)->addr, &((const Extent *)b)->addr);
+}
+
+static void print_latencies(const char *name, Latencies *latencies) {
+  if (latencies->count == 0) {
+    printf("  %-5s latency: no samples\n", name);
+    return;
+  }
+  qsort(latencies->samples, latencies->count, sizeof(uint64_t), compare_u64);
+  const uint64_t *s = latencies->samples;
+  size_t n = latencies->count;
+  printf("  %-5s latency (ns): p50 %lu  p90 %lu  p99 %lu  p99.9 %lu  "
+         "max %lu\n",
+         name, s[n / 2], s[n * 90 / 100], s[n * 99 / 100], s[n * 999 / 1000],
+         s[n - 1]);
+}
+
+/** Free memory in pages. */
+typedef struct {
+  uint64_t total;
+  uint64_t largest;
+  uint64_t extents;
+  /** Number of free 2MiB-aligned 2MiB blocks, which can back a huge page. */
+  uint64_t blocks_2mb;
+} FreeSpace;
+
+/** Measure free memory as seen from the map and the live allocations.
+ * Allocator metadata and pooled pages count as free, so the numbers show the
+ * layout the allocator chose rather than its overhead. */
+static FreeSpace measure_free_space(const MemoryMap *map, void **ptrs,
+                                    const uint32_t *pages, uint32_t num_ids) {
+  Extent *live = malloc((num_ids + 1) * sizeof(Extent));
+  size_t num_live = 0;
+  for (uint32_t id = 0; id < num_ids; id++) {
+    if (ptrs[id] == NULL) continue;
+    live[num_live++] = (Extent){(Phys)ptrs[id], pages[id]};
+  }
+  qsort(live, num_live, sizeof(Extent), compare_extent);
+
+  FreeSpace space = {0};
+  size_t next = 0;
+  size_t num_descriptors = map->map_size / map->descriptor_size;
+  for (size_t i = 0; i < num_descriptors; i++) {
+    EFI_MEMORY_DESCRIPTOR *desc = &map->descriptors[i];
+    if (!is_usable_memory(desc)) continue;
+    // Contiguous usable descriptors form a single span.
+    Phys begin = desc->PhysicalStart;
+    Phys end = begin + desc->NumberOfPages * PAGE_SIZE;
+    while (i + 1 < num_descriptors &&
+           is_usable_memory(&map->descriptors[i + 1]) &&
+           map->descriptors[i + 1].PhysicalStart == end) {
+      i++;
+      end += map->descriptors[i].NumberOfPages * PAGE_SIZE;
+    }
+
+    Phys cur = begin;
+    while (cur < end) {
+      Phys free_end = end;
+      if (next < num_live && live[next].addr < end) free_end = live[next].addr;
+      if (free_end > cur) {
+        uint64_t free_pages = (free_end - cur) / PAGE_SIZE;
+        space.total += free_pages;
+        space.extents++;
+        if (free_pages > space.largest) space.largest = free_pages;
+        Phys aligned = (cur + PAGE_SIZE_2MB - 1) & ~(PAGE_SIZE_2MB - 1);
+        if (aligned < free_end) {
+          space.blocks_2mb += (free_end - aligned) / PAGE_SIZE_2MB;
+        }
+      }
+      if (free_end == end) break;
+      Phys live_end = live[next].addr + live[next].pages * PAGE_SIZE;
+      if (live_end > cur) cur = live_end;
+      next++;
+    }
+  }
+  free(live);
+  return space;
+}
+
+/** External fragmentation index: 1 - (largest free extent / total free). 0
+ * means all free memory is contiguous. */
+static double fragmentation_index(FreeSpace space) {
+  if (space.total == 0) return 0.0;
+  return 1.0 - (double)space.largest / space.total;
+}
+
+/** Replay the trace against a freshly initialized backend. */
+static void run(const Backend *backend, MemoryMap *map, const Trace *trace,
+                uint64_t memory_size) {
+  // Drop the pages touched by the previous run.
+  madvise((void *)BASE, memory_size, MADV_DONTNEED);
+
+  log_set_writefn(log_stderr);
+  backend->init(map);
+  // Allocators warn about memory pressure, which is expected here.
+  log_set_writefn(log_no_output);
+
+  const page_allocator_ops_t *ops = backend->ops;
+  void **ptrs = calloc(trace->num_ids, sizeof(void *));
+  uint32_t *pages = calloc(trace->num_ids, sizeof(uint32_t));
+  Latencies alloc_latencies = {malloc(trace->count * sizeof(uint64_t)), 0};
+  Latencies free_latencies = {malloc(trace->count * sizeof(uint64_t)), 0};
+  uint64_t failed = 0;
+  uint64_t total_ns = 0;
+
+  for (size_t i = 0; i < trace->count; i++) {
+    const TraceOp *op = &trace->ops[i];
+    if (op->kind == OP_ALLOC) {
+      if (ptrs[op->id] != NULL) continue;
+      uint64_t start = now_ns();
+      void *ptr = op->align > 1
+                      ? ops->alloc_aligned_pages(op->pages,
+                                                 op->align * PAGE_SIZE)
+                      : ops->alloc(op->pages * PAGE_SIZE);
+      uint64_t elapsed = now_ns() - start;
+      total_ns += elapsed;
+      alloc_latencies.samples[alloc_latencies.count++] = elapsed;
+      if (ptr == NULL) {
+        failed++;
+        continue;
+      }
+      ptrs[op->id] = ptr;
+      pages[op->id] = op->pages;
+    } else {
+      // Freeing a failed allocation is not an operation.
+      if (ptrs[op->id] == NULL) continue;
+      uint64_t start = now_ns();
+      ops->free(ptrs[op->id]);
+      uint64_t elapsed = now_ns() - start;
+      total_ns += elapsed;
+      free_latencies.samples[free_latencies.count++] = elapsed;
+      ptrs[op->id] = NULL;
+    }
+  }
+
+  size_t num_ops = alloc_latencies.count + free_latencies.count;
+  printf("  ops: %zu allocs (%lu failed), %zu frees, %.0f ops/s\n",
+         alloc_latencies.count, failed, free_latencies.count,
+         total_ns == 0 ? 0.0 : num_ops * 1e9 / total_ns);
+  print_latencies("alloc", &alloc_latencies);
+  print_latencies("free", &free_latencies);
+  // Firmware regions already split the memory, so show the index of the bare
+  // map next to the one after the replay.
+  FreeSpace space = measure_free_space(map, ptrs, pages, trace->num_ids);
+  FreeSpace bare = measure_free_space(map, ptrs, pages, 0);
+  uint64_t total_mib = space.total * PAGE_SIZE >> 20;
+  uint64_t largest_mib = space.largest * PAGE_SIZE >> 20;
+  printf("  free: %lu MiB in %lu extents, largest %lu MiB\n", total_mib,
+         space.extents, largest_mib);
+  printf("  fragmentation index: %.4f (%.4f with no allocations)\n",
+         fragmentation_index(space), fragmentation_index(bare));
+  printf("  free 2MiB blocks: %lu (%lu with no allocations)\n",
+         space.blocks_2mb, bare.blocks_2mb);
+
+  free(alloc_latencies.samples);
+  free(free_latencies.samples);
+  free(ptrs);
+  free(pages);
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "Usage: %s [-a bitmap|buddy] [-w mixed|vm] [-t trace] [-o trace]\n"
+          "          [-m GiB] [-d descriptors] [-n ops] [-s seed]\n"
+          "  -a  Run only the given allocator.\n"
+          "  -w  Run only the given synthetic workload.\n"
+          "  -t  Replay a recorded trace instead of the synthetic ones.\n"
+          "  -o  Write the synthetic trace selected by -w to a file.\n",
+          name);
+}
+
+int main(int argc, char **argv) {
+  const char *backend_name = NULL;
+  const char *workload_name = NULL;
+  const char *trace_path = NULL;
+  const char *output_path = NULL;
+  uint64_t memory_gib = DEFAULT_MEMORY_GIB;
+  size_t num_descriptors = DEFAULT_NUM_DESCRIPTORS;
+  size_t num_ops = DEFAULT_NUM_OPS;
+  uint64_t seed = DEFAULT_SEED;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "a:w:t:o:m:d:n:s:h")) != -1) {
+    switch (opt) {
+      case 'a':
+        backend_name = optarg;
+        break;
+      case 'w':
+        workload_name = optarg;
+        break;
+      case 't':
+        trace_path = optarg;
+        break;
+      case 'o':
+        output_path = optarg;
+        break;
+      case 'm':
+        memory_gib = strtoull(optarg, NULL, 0);
+        break;
+      case 'd':
+        num_descriptors = strtoull(optarg, NULL, 0);
+        break;
+      case 'n':
+        num_ops = strtoull(optarg, NULL, 0);
+        break;
+      case 's':
+        seed = strtoull(optarg, NULL, 0);
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (memory_gib == 0 || memory_gib > MAX_MEMORY_GIB || num_descriptors == 0 ||
+      (output_path != NULL && (workload_name == NULL || trace_path != NULL))) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  uint64_t memory_size = memory_gib << 30;
+  void *mem = mmap((void *)BASE, memory_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE |
+                       MAP_FIXED_NOREPLACE,
+                   -1, 0);
+  if (mem != (void *)BASE) {
+    perror("mmap");
+    return 1;
+  }
+
+  rng_state = seed ? seed : DEFAULT_SEED;
+  MemoryMap *map = create_memory_map(memory_size, num_descriptors);
+  printf("Memory: %lu GiB in %zu descriptors\n", memory_gib, num_descriptors);
+
+  bool found = false;
+  for (size_t w = 0; w < NUM_WORKLOADS + 1; w++) {
+    Trace trace = {0};
+    const char *name;
+    if (trace_path != NULL) {
+      if (w > 0) break;
+      if (!read_trace(trace_path, &trace)) return 1;
+      name = trace_path;
+    } else {
+      if (w == NUM_WORKLOADS) break;
+      name = workloads[w].name;
+      if (workload_name != NULL && strcmp(workload_name, name) != 0) continue;
+      workloads[w].generate(&trace, num_ops);
+      if (output_path != NULL && !write_trace(output_path, &trace)) return 1;
+    }
+    found = true;
+
+    for (size_t b = 0; b < NUM_BACKENDS; b++) {
+      if (backend_name != NULL && strcmp(backend_name, backends[b].name) != 0) {
+        continue;
+      }
+      printf("== %s / %s (%zu ops) ==\n", name, backends[b].name,
+             trace.count);
+      run(&backends[b], map, &trace, memory_size);
+    }
+    free(trace.ops);
+  }
+  if (!found) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  return 0;
+}
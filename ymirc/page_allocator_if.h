@@ -1,9 +1,47 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+
+/** Number of block orders in PageAllocatorStats. Order N is a block of 2^N
+ * frames, so the largest one is 1GiB. */
+#define PAGE_ALLOCATOR_STAT_ORDERS 19
+
+/** Counters of a page allocator. Frame counts cover the frames between the
+ * lowest and the highest usable frame. */
+typedef struct {
+  /** Frames that can be handed out, including the allocator metadata. */
+  uint64_t total_frames;
+  uint64_t free_frames;
+  uint64_t used_frames;
+  /** Frames in the managed range that are not usable memory. */
+  uint64_t reserved_frames;
+  /** Highest value used_frames has reached. */
+  uint64_t high_water_frames;
+  /** Number of free blocks of each order. */
+  uint64_t free_blocks[PAGE_ALLOCATOR_STAT_ORDERS];
+  uint64_t alloc_count;
+  uint64_t free_count;
+  /** Allocations that returned NULL. */
+  uint64_t alloc_failures;
+  /** Allocations that missed the fast path of the allocator. */
+  uint64_t slow_path_hits;
+} PageAllocatorStats;
 
 typedef struct {
   void *(*alloc)(size_t n);
-  void (*free)(void *ptr, size_t n);
+  void (*free)(void *ptr);
   void *(*alloc_aligned_pages)(size_t num_pages, size_t align_size);
+  /** Same as alloc_aligned_pages, but prefer memory local to the NUMA node.
+   * Falls back to the nearest node that has enough free memory. */
+  void *(*alloc_on_node)(size_t num_pages, size_t align_size, int node);
+  /** Allocate page-aligned pages filled with zero. */
+  void *(*alloc_zeroed_pages)(size_t num_pages);
+  /** Do a small unit of background work such as zeroing a page. Returns false
+   * if there is nothing left to do. Meant to be called while idle. */
+  bool (*do_idle_work)(void);
+  /** Copy the counters of the allocator to `stats`. Takes no lock, so that it
+   * can be called from a panic. */
+  void (*get_stats)(PageAllocatorStats *stats);
 } page_allocator_ops_t;
@@ -1,15 +1,26 @@
+#define _DEFAULT_SOURCE
+
 #include "page_allocator.h"
 
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 
 #include "log.h"
+#include "mem.h"
+#include "zeroed_page_pool.h"
+
+/** The allocator places its bitmap in memory described by the map, so the
+ * regions are backed at the same host address. Frame 0 is still described at
+ * 0x0 to check that it is never handed out. */
+#define BASE 0x40000000ULL
+#define BACKED_SIZE 0x601000ULL
 
 void log_output(char c) { putchar(c); }
 void log_no_output(char c) { (void)c; }
 
-MemoryMap* create_memory_map() {
+MemoryMap* create_memory_map(void) {
   MemoryMap* map = malloc(sizeof(MemoryMap));
   map->descriptor_size = sizeof(EFI_MEMORY_DESCRIPTOR);
   map->map_size = map->descriptor_size * 5;  // Example size
@@ -21,53 +32,198 @@ MemoryMap* create_memory_map() {
   };
   map->descriptors[1] = (EFI_MEMORY_DESCRIPTOR){
       .Type = EfiConventionalMemory,
-      .PhysicalStart = 0x1000,
+      .PhysicalStart = BASE + 0x1000,
       .NumberOfPages = 1,
   };
   map->descriptors[2] = (EFI_MEMORY_DESCRIPTOR){
       .Type = EfiConventionalMemory,
-      .PhysicalStart = 0x3000,
+      .PhysicalStart = BASE + 0x3000,
       .NumberOfPages = 1,
   };
   map->descriptors[3] = (EFI_MEMORY_DESCRIPTOR){
       .Type = EfiReservedMemoryType,
-      .PhysicalStart = 0x4000,
+      .PhysicalStart = BASE + 0x4000,
       .NumberOfPages = 1,
   };
   map->descriptors[4] = (EFI_MEMORY_DESCRIPTOR){
       .Type = EfiConventionalMemory,
-      .PhysicalStart = 0x5000,
+      .PhysicalStart = BASE + 0x5000,
       .NumberOfPages = 10,
   };
   return map;
 }
 
-int main() {
-  log_set_writefn(log_output);
+/** Memory map with regions spanning several bitmap lines. */
+MemoryMap* create_large_memory_map(void) {
+  MemoryMap* map = malloc(sizeof(MemoryMap));
+  map->descriptor_size = sizeof(EFI_MEMORY_DESCRIPTOR);
+  map->map_size = map->descriptor_size * 4;
+  map->descriptors = malloc(map->map_size);
+  map->descriptors[0] = (EFI_MEMORY_DESCRIPTOR){
+      .Type = EfiConventionalMemory,
+      .PhysicalStart = 0x0,
+      .NumberOfPages = 1,
+  };
+  map->descriptors[1] = (EFI_MEMORY_DESCRIPTOR){
+      .Type = EfiConventionalMemory,
+      .PhysicalStart = BASE + 0x1000,
+      .NumberOfPages = 0xFF,
+  };
+  map->descriptors[2] = (EFI_MEMORY_DESCRIPTOR){
+      .Type = EfiReservedMemoryType,
+      .PhysicalStart = BASE + 0x100000,
+      .NumberOfPages = 0x100,
+  };
+  // One extra page at the top holds the allocator bitmap.
+  map->descriptors[3] = (EFI_MEMORY_DESCRIPTOR){
+      .Type = EfiConventionalMemory,
+      .PhysicalStart = BASE + 0x200000,
+      .NumberOfPages = 0x401,
+  };
+  return map;
+}
+
+static void* at(uint64_t offset) { return (void*)(BASE + offset); }
+
+static void test_small_map(void) {
   MemoryMap* map = create_memory_map();
   page_allocator_init(map);
 
-  assert(pa_ops.alloc(0x1000) == (void*)0x1000);  // Frame ID 0 is reserved.
-  assert(pa_ops.alloc(0x1000) == (void*)0x3000);
-  assert(pa_ops.alloc(0x1000) == (void*)0x5000);
-  pa_ops.free((void*)0x1000, 0x1000);
-  assert(pa_ops.alloc(0x1000) == (void*)0x1000);
-  pa_ops.free((void*)0x1000, 0x1000);
-  pa_ops.free((void*)0x3000, 0x1000);
-  pa_ops.free((void*)0x5000, 0x1000);
-
-  assert(pa_ops.alloc(0x4000) == (void*)0x5000);
-  assert(pa_ops.alloc(0x4000) == (void*)0x9000);
+  assert(pa_ops.alloc(0x1000) == at(0x1000));  // Frame ID 0 is reserved.
+  assert(pa_ops.alloc(0x1000) == at(0x3000));
+  assert(pa_ops.alloc(0x1000) == at(0x5000));
+  pa_ops.free(at(0x1000));
+  assert(pa_ops.alloc(0x1000) == at(0x1000));
+  pa_ops.free(at(0x1000));
+  pa_ops.free(at(0x3000));
+  pa_ops.free(at(0x5000));
+
+  assert(pa_ops.alloc(0x4000) == at(0x5000));
+  assert(pa_ops.alloc(0x4000) == at(0x9000));
   assert(pa_ops.alloc(0x4000) == NULL);
-  pa_ops.free((void*)0x5000, 0x4000);
-  pa_ops.free((void*)0x9000, 0x4000);
+  // Freeing an allocation leaves the adjacent one alone.
+  pa_ops.free(at(0x5000));
+  assert(pa_ops.alloc(0x8000) == NULL);
+  pa_ops.free(at(0x9000));
+  assert(pa_ops.alloc(0x8000) == at(0x5000));
+  pa_ops.free(at(0x5000));
 
-  assert(pa_ops.alloc_aligned_pages(1, 0x2000) == (void*)0x6000);
-  pa_ops.free((void*)0x6000, 0x1000);
+  assert(pa_ops.alloc_aligned_pages(1, 0x2000) == at(0x6000));
+  pa_ops.free(at(0x6000));
 
   log_set_writefn(log_no_output);
   // align size must be multiple of page size.
   assert(pa_ops.alloc_aligned_pages(1, 0x1100) == NULL);
+  log_set_writefn(log_output);
+}
+
+static void test_stats(void) {
+  MemoryMap* map = create_memory_map();
+  page_allocator_init(map);
+
+  // 12 usable frames, one of which holds the bitmap.
+  PageAllocatorStats stats;
+  pa_ops.get_stats(&stats);
+  assert(stats.total_frames == 12);
+  assert(stats.used_frames == 1 && stats.free_frames == 11);
+  // Free runs of 1, 1 and 9 frames.
+  assert(stats.free_blocks[0] == 2 && stats.free_blocks[3] == 1);
+
+  void* p = pa_ops.alloc(0x4000);
+  assert(pa_ops.alloc(0x8000) == NULL);
+  // The 9 frame run is split into 4 used and 5 free frames.
+  pa_ops.get_stats(&stats);
+  assert(stats.free_blocks[0] == 2 && stats.free_blocks[2] == 1);
+  assert(stats.free_blocks[3] == 0);
+  pa_ops.free(p);
+  pa_ops.get_stats(&stats);
+  assert(stats.free_blocks[0] == 2 && stats.free_blocks[3] == 1);
+  assert(stats.free_blocks[2] == 0);
+  assert(stats.free_frames == 11 && stats.high_water_frames == 5);
+  assert(stats.alloc_count == 1 && stats.free_count == 1);
+  assert(stats.alloc_failures == 1);
+}
+
+static void test_large_map(void) {
+  MemoryMap* map = create_large_memory_map();
+  page_allocator_init(map);
+
+  // Fill the first region so that its map lines become fully used.
+  for (uint64_t i = 1; i < 0x100; i++) {
+    assert(pa_ops.alloc(0x1000) == at(i * 0x1000));
+  }
+  // Fully used lines and the reserved region are skipped.
+  assert(pa_ops.alloc(0x1000) == at(0x200000));
+  pa_ops.free(at(0x80000));
+  assert(pa_ops.alloc(0x1000) == at(0x80000));
+
+  // A range crossing map lines.
+  assert(pa_ops.alloc(0x50000) == at(0x201000));
+  for (uint64_t i = 0x10; i <= 0x50; i++) {
+    pa_ops.free(at(i * 0x1000));
+  }
+  assert(pa_ops.alloc(0x41000) == at(0x10000));
+  assert(pa_ops.alloc(0x1000) == at(0x251000));
+  // An allocation ends where the reserved region starts.
+  pa_ops.free(at(0xFF000));
+  assert(pa_ops.alloc_aligned_pages(1, 0x100000) == at(0x300000));
+  pa_ops.free(at(0x300000));
+  assert(pa_ops.alloc(0x1000) == at(0xFF000));
+
+  // Aligned allocations skip the partially used 2MiB block.
+  assert(pa_ops.alloc_aligned_pages(0x40, 0x40000) == at(0x280000));
+  assert(pa_ops.alloc_aligned_pages(0x200, 0x200000) == at(0x400000));
+  assert(pa_ops.alloc_aligned_pages(0x200, 0x200000) == NULL);
+  pa_ops.free(at(0x400000));
+  assert(pa_ops.alloc_aligned_pages(0x200, 0x200000) == at(0x400000));
+}
+
+static bool is_zeroed(const uint8_t* page, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    if (page[i] != 0) return false;
+  }
+  return true;
+}
+
+static void test_zeroed_pages(void) {
+  MemoryMap* map = create_large_memory_map();
+  page_allocator_init(map);
+
+  uint8_t* page = pa_ops.alloc(0x1000);
+  assert(page == at(0x1000));
+  memset(page, 0xAA, 0x1000);
+  pa_ops.free(page);
+
+  // Idle work fills the pool one page at a time until it is full.
+  int refilled = 0;
+  while (pa_ops.do_idle_work()) refilled++;
+  assert(refilled == ZEROED_PAGE_POOL_CAPACITY);
+  assert(is_zeroed(page, 0x1000));
+
+  for (int i = 0; i < ZEROED_PAGE_POOL_CAPACITY; i++) {
+    uint8_t* zeroed = pa_ops.alloc_zeroed_pages(1);
+    assert(zeroed != NULL && is_zeroed(zeroed, 0x1000));
+  }
+
+  // The pool is empty now. Pages are zeroed on demand.
+  uint8_t* dirty = pa_ops.alloc(0x2000);
+  memset(dirty, 0xAA, 0x2000);
+  pa_ops.free(dirty);
+  uint8_t* zeroed = pa_ops.alloc_zeroed_pages(2);
+  assert(zeroed == dirty && is_zeroed(zeroed, 0x2000));
+}
+
+int main() {
+  log_set_writefn(log_output);
+
+  void* mem = mmap(at(0), BACKED_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+  assert(mem == at(0));
+
+  test_small_map();
+  test_stats();
+  test_large_map();
+  test_zeroed_pages();
 
   puts("PASS");
 
@@ -2,14 +2,18 @@
 
 #include <stdbool.h>
 
+#include "alloc_stats.h"
 #include "arch.h"
 #include "log.h"
+#include "trace.h"
 
 /** Flag to indicate that a panic occurred. */
 static bool panicked = false;
 
 noreturn void panic(const char *msg) {
   disable_intr();
+  // Write out buffered records and log synchronously from now on.
+  log_set_deferred(false);
   LOG_ERROR("PANIC: %s\n", msg);
 
   if (panicked) {
@@ -20,6 +24,9 @@ noreturn void panic(const char *msg) {
 
   LOG_ERROR("=== Stack Trace ==============\n");
   print_stack_trace();
+  alloc_stats_dump(LOG_LEVEL_ERROR);
+  // The last events before the panic, if tracing was on.
+  if (trace_enabled != 0) trace_dump();
 
   endless_halt();
 }
@@ -1,10 +1,18 @@
 #ifndef SERIAL_H
 #define SERIAL_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
-typedef void (*SerialWriteFn)(uint8_t c);
-typedef int (*SerialReadFn)(void);
+#include "spinlock.h"
+
+/** Depth of the 16550 Tx and Rx FIFOs. */
+#define SERIAL_FIFO_SIZE 16
+/** Size of the Tx ring. MUST be a power of 2. */
+#define SERIAL_TX_RING_SIZE 4096
+/** Size of the Rx ring. MUST be a power of 2. */
+#define SERIAL_RX_RING_SIZE 256
 
 typedef enum {
   SERIAL_PORT_COM1,
@@ -12,31 +20,51 @@ typedef enum {
   SERIAL_PORT_COM3,
 } SerialPort;
 
+/** 16550 UART. Written bytes are queued in the Tx ring and moved to the FIFO
+ * up to SERIAL_FIFO_SIZE at a time, by the writer when the FIFO is empty and
+ * by the Tx-empty interrupt. The Rx interrupt moves received bytes to the Rx
+ * ring. */
 typedef struct {
   uint64_t addr;
-  SerialWriteFn write_fn;
-  SerialReadFn read_fn;
+  /** Set once the Tx-empty interrupt drains the Tx ring. Until then, writes
+   * wait for the bytes to reach the FIFO. */
+  bool intr_enabled;
+  /** Protects the rings. Taken with interrupts disabled. */
+  Spinlock lock;
+  uint8_t tx_buf[SERIAL_TX_RING_SIZE];
+  uint32_t tx_head;
+  uint32_t tx_tail;
+  uint8_t rx_buf[SERIAL_RX_RING_SIZE];
+  uint32_t rx_head;
+  uint32_t rx_tail;
 } Serial;
 
-/** Initialize a serial console. Set write and read function pointers in this
- * function. */
+/** Initialize a serial console with the FIFO enabled. */
 void serial_init(Serial* serial, SerialPort port, uint32_t baud);
 
-/** Write a single byte to the serial console. */
-static inline void serial_write(const Serial* serial, uint8_t c) {
-  serial->write_fn(c);
-}
+/** Write a single byte to the serial console. Blocks only while the Tx ring
+ * is full. */
+void serial_write(Serial* serial, uint8_t c);
+
+/** Queue as much of `buf` as fits in the Tx ring without waiting. Returns the
+ * number of bytes queued. */
+size_t serial_write_nonblocking(Serial* serial, const uint8_t* buf,
+                                size_t len);
+
+/** Wait until all queued bytes are in the FIFO. Works with interrupts
+ * disabled, e.g. in a panic. */
+void serial_flush(Serial* serial);
 
 /** Write a string to the serial console. */
-static inline void serial_write_string(const Serial* serial, const char* str) {
+static inline void serial_write_string(Serial* serial, const char* str) {
   for (int i = 0; str[i] != '\0'; i++) {
     serial_write(serial, str[i]);
   }
 }
 
 /** Try to read a character from the serial console. Returns -1 if no character
- * is available in Rx-buffer. */
-static inline int serial_read(Serial* serial) { return serial->read_fn(); }
+ * is available in the Rx ring or the Rx buffer. */
+int serial_read(Serial* serial);
 
 /** Read a byte from the serial port (blocking). This function repeatedly calls
  * serial_read() until a byte becomes available. It will never return -1. */
@@ -46,7 +74,12 @@ static inline uint8_t serial_read_blocking(Serial* serial) {
   return ch;
 }
 
-/** Enable serial console interrupt. */
-void enable_serial_interrupt(const Serial* serial);
+/** Enable serial console interrupts. The Tx ring is drained by the Tx-empty
+ * interrupt from now on. */
+void enable_serial_interrupt(Serial* serial);
+
+/** Handle the serial interrupt: move received bytes to the Rx ring and refill
+ * the Tx FIFO from the Tx ring. */
+void serial_handle_interrupt(Serial* serial);
 
 #endif  // SERIAL_H
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdbool.h>
+
+/** Simple test-and-test-and-set spin lock. */
+typedef struct {
+  bool locked;
+} Spinlock;
+
+#define SPINLOCK_INIT {false}
+
+static inline void spin_lock(Spinlock *lock) {
+  while (__atomic_test_and_set(&lock->locked, __ATOMIC_ACQUIRE)) {
+    while (__atomic_load_n(&lock->locked, __ATOMIC_RELAXED)) {
+#if defined(__x86_64__)
+      __asm__ __volatile__("pause");
+#endif
+    }
+  }
+}
+
+static inline void spin_unlock(Spinlock *lock) {
+  __atomic_clear(&lock->locked, __ATOMIC_RELEASE);
+}
+
+/** Take the lock if it is free. Returns false without waiting otherwise. */
+static inline bool spin_trylock(Spinlock *lock) {
+  return !__atomic_test_and_set(&lock->locked, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,189 @@
+#include "timer.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+/** Timers of each slot at each level. The slot of tick `t` at level `l` is
+ * (t >> (l * TIMER_WHEEL_BITS)) & SLOT_MASK. */
+static Timer *wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+/** Number of timers at each level. */
+static uint64_t counts[TIMER_WHEEL_LEVELS];
+/** Current tick. Timers at level 0 expire in [clk, clk + TIMER_WHEEL_SLOTS),
+ * and those at level `l` are in a slot visited before they expire. */
+static uint64_t clk;
+/** Deadline the hardware is programmed for. */
+static uint64_t programmed = TIMER_NO_DEADLINE;
+/** Whether timer_run() is in progress. It programs the hardware at the end. */
+static bool running = false;
+static TimerProgramFn program_fn = NULL;
+
+static inline unsigned int level_shift(int level) {
+  return level * TIMER_WHEEL_BITS;
+}
+
+static void link_timer(Timer **head, Timer *timer) {
+  timer->next = *head;
+  if (timer->next != NULL) timer->next->pprev = &timer->next;
+  *head = timer;
+  timer->pprev = head;
+}
+
+static void unlink_timer(Timer *timer) {
+  *timer->pprev = timer->next;
+  if (timer->next != NULL) timer->next->pprev = timer->pprev;
+  timer->next = NULL;
+  timer->pprev = NULL;
+}
+
+/** Move the timers of the slot to `list`, so that timers added to the slot
+ * while they are processed are left for later. */
+static void take_slot(Timer **slot, Timer **list) {
+  *list = *slot;
+  *slot = NULL;
+  if (*list != NULL) (*list)->pprev = list;
+}
+
+/** Put the timer in the slot of its deadline relative to the current tick. */
+static void enqueue(Timer *timer) {
+  uint64_t tick = timer->deadline >> TIMER_TICK_SHIFT;
+  if (tick < clk) tick = clk;
+  uint64_t delta = tick - clk;
+
+  int level = 0;
+  while (level < TIMER_WHEEL_LEVELS - 1 &&
+         delta >= (1ULL << level_shift(level + 1))) {
+    level++;
+  }
+  // Park timers beyond the reach of the wheel in its last slot. They cascade
+  // down and are put back when their slot is visited.
+  uint64_t reach = 1ULL << level_shift(TIMER_WHEEL_LEVELS);
+  if (delta >= reach) tick = clk + reach - 1;
+
+  timer->tick = tick;
+  timer->level = level;
+  link_timer(&wheel[level][(tick >> level_shift(level)) & SLOT_MASK], timer);
+  counts[level]++;
+}
+
+static void dequeue(Timer *timer) {
+  unlink_timer(timer);
+  counts[timer->level]--;
+}
+
+/** Run the timers of the current tick that expired at `now`. */
+static void expire(uint64_t now) {
+  Timer *list;
+  take_slot(&wheel[0][clk & SLOT_MASK], &list);
+  while (list != NULL) {
+    Timer *timer = list;
+    dequeue(timer);
+    if (timer->deadline <= now) {
+      timer->callback(timer->ctx, now);
+    } else {
+      enqueue(timer);
+    }
+  }
+}
+
+/** Move the timers of the current slot at `level` to lower levels. */
+static void cascade(int level) {
+  Timer *list;
+  take_slot(&wheel[level][(clk >> level_shift(level)) & SLOT_MASK], &list);
+  while (list != NULL) {
+    Timer *timer = list;
+    dequeue(timer);
+    enqueue(timer);
+  }
+}
+
+/** Next tick to visit. Ticks before it have no timer to run or cascade. */
+static uint64_t next_tick() {
+  uint64_t next = clk + 1;
+  for (int level = 0; level < TIMER_WHEEL_LEVELS && counts[level] == 0;
+       level++) {
+    uint64_t span = 1ULL << level_shift(level + 1);
+    next = (clk | (span - 1)) + 1;
+  }
+  return next;
+}
+
+static void program(uint64_t deadline) {
+  programmed = deadline;
+  if (program_fn != NULL) program_fn(deadline);
+}
+
+void timer_init(uint64_t now) {
+  for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+    for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+      wheel[level][slot] = NULL;
+    }
+    counts[level] = 0;
+  }
+  clk = now >> TIMER_TICK_SHIFT;
+  programmed = TIMER_NO_DEADLINE;
+  running = false;
+}
+
+void timer_set_programfn(TimerProgramFn fn) { program_fn = fn; }
+
+void timer_setup(Timer *timer, TimerCallback callback, void *ctx) {
+  *timer = (Timer){.callback = callback, .ctx = ctx};
+}
+
+void timer_arm(Timer *timer, uint64_t deadline) {
+  if (timer_pending(timer)) dequeue(timer);
+  timer->deadline = deadline;
+  enqueue(timer);
+  if (!running && deadline < programmed) program(deadline);
+}
+
+void timer_cancel(Timer *timer) {
+  // The hardware is left programmed. It fires with nothing to run at worst.
+  if (timer_pending(timer)) dequeue(timer);
+}
+
+void timer_run(uint64_t now) {
+  uint64_t target = now >> TIMER_TICK_SHIFT;
+  running = true;
+  for (;;) {
+    expire(now);
+    if (clk >= target) break;
+
+    uint64_t next = next_tick();
+    clk = next < target ? next : target;
+    // Higher levels first, since they may cascade into the current slot of
+    // lower levels.
+    for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+      if ((clk & ((1ULL << level_shift(level)) - 1)) == 0) cascade(level);
+    }
+  }
+  running = false;
+  program(timer_next_deadline());
+}
+
+uint64_t timer_next_deadline() {
+  uint64_t next = TIMER_NO_DEADLINE;
+  for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+    if (counts[level] == 0) continue;
+
+    // The current slot above level 0 holds the furthest timers, so the scan
+    // starts at the one after it.
+    uint64_t start = clk >> level_shift(level);
+    if (level > 0) start++;
+    for (int i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+      const Timer *timer = wheel[level][(start + i) & SLOT_MASK];
+      if (timer == NULL) continue;
+      for (; timer != NULL; timer = timer->next) {
+        // A parked timer has to be visited at its slot first.
+        uint64_t deadline = (timer->deadline >> TIMER_TICK_SHIFT) > timer->tick
+                                ? timer->tick << TIMER_TICK_SHIFT
+                                : timer->deadline;
+        if (deadline < next) next = deadline;
+      }
+      break;
+    }
+  }
+  return next;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Hierarchical timer wheel. It is not reentrant: it is driven from the timer
+ * interrupt and from #VMEXIT handlers, so every function MUST be called with
+ * interrupts blocked, i.e. with IF=0 or GIF=0.
+ */
+
+/** Bits of the wheel index at each level. */
+#define TIMER_WHEEL_BITS 6
+/** Slots at each level of the wheel. */
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+/** Levels of the wheel. Timers further out than the top level covers are
+ * parked there and cascade down again. */
+#define TIMER_WHEEL_LEVELS 5
+/** A slot at level 0 spans 2^TIMER_TICK_SHIFT units of time. */
+#define TIMER_TICK_SHIFT 10
+
+/** Deadline meaning that no timer is armed. */
+#define TIMER_NO_DEADLINE UINT64_MAX
+
+/** Called when the timer expires. `now` is the time it is run at. */
+typedef void (*TimerCallback)(void *ctx, uint64_t now);
+
+/** Program the hardware to call timer_run() once at `deadline`, replacing
+ * the previous deadline. TIMER_NO_DEADLINE stops it. */
+typedef void (*TimerProgramFn)(uint64_t deadline);
+
+/** One-shot timer. The fields are private to the wheel. */
+typedef struct Timer {
+  TimerCallback callback;
+  void *ctx;
+  /** Time the timer expires at. */
+  uint64_t deadline;
+  /** Tick of the slot the timer is in. */
+  uint64_t tick;
+  /** Level of the wheel the timer is in. */
+  int level;
+  struct Timer *next;
+  /** Link pointing to this timer. NULL if the timer is not armed. */
+  struct Timer **pprev;
+} Timer;
+
+/** Empty the wheel and start it at time `now`. Time is in any unit that only
+ * goes forward, e.g. TSC cycles. */
+void timer_init(uint64_t now);
+
+/** Set the function programming the hardware for the next deadline. It is
+ * only called when the next deadline moves earlier or timer_run() finishes,
+ * so the hardware may fire with nothing to run. */
+void timer_set_programfn(TimerProgramFn program_fn);
+
+/** Initialize `timer` to call `callback` with `ctx`. */
+void timer_setup(Timer *timer, TimerCallback callback, void *ctx);
+
+/** Arm `timer` to expire at `deadline`, re-arming it if it is pending. A
+ * deadline in the past expires on the next timer_run(). */
+void timer_arm(Timer *timer, uint64_t deadline);
+
+/** Disarm `timer`. Does nothing if it is not pending. */
+void timer_cancel(Timer *timer);
+
+/** Whether `timer` is armed and has not expired yet. */
+static inline bool timer_pending(const Timer *timer) {
+  return timer->pprev != NULL;
+}
+
+/** Run the callbacks of the timers expired at `now`, and program the next
+ * deadline. Callbacks may arm and cancel timers. */
+void timer_run(uint64_t now);
+
+/** Earliest deadline of the armed timers, or TIMER_NO_DEADLINE. */
+uint64_t timer_next_deadline();
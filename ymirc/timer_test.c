@@ -0,0 +1,215 @@
+#include "timer.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+#define TICK (1ULL << TIMER_TICK_SHIFT)
+#define NUM_RANDOM_TIMERS 256
+
+typedef struct {
+  Timer timer;
+  int fired;
+  uint64_t fired_at;
+  /** Re-armed this much later when fired, if not 0. */
+  uint64_t period;
+} TestTimer;
+
+static uint64_t last_programmed = TIMER_NO_DEADLINE;
+static int num_programmed = 0;
+
+static void test_programfn(uint64_t deadline) {
+  last_programmed = deadline;
+  num_programmed++;
+}
+
+static void test_callback(void *ctx, uint64_t now) {
+  TestTimer *t = (TestTimer *)ctx;
+  assert(now >= t->timer.deadline);
+  t->fired++;
+  t->fired_at = now;
+  if (t->period != 0) timer_arm(&t->timer, t->timer.deadline + t->period);
+}
+
+static void setup(TestTimer *t) {
+  *t = (TestTimer){0};
+  timer_setup(&t->timer, test_callback, t);
+}
+
+static void test_order() {
+  TestTimer t[4];
+  timer_init(0);
+  for (int i = 0; i < 4; i++) setup(&t[i]);
+
+  // One timer in each of the first levels, and one in the same slot.
+  timer_arm(&t[0].timer, 5 * TICK + 3);
+  timer_arm(&t[1].timer, 100 * TICK);
+  timer_arm(&t[2].timer, 5000 * TICK + 1);
+  timer_arm(&t[3].timer, 5 * TICK + 1);
+  assert(timer_next_deadline() == 5 * TICK + 1);
+
+  // Nothing expires before its deadline, even within its tick.
+  timer_run(5 * TICK);
+  assert(t[3].fired == 0 && t[0].fired == 0);
+  timer_run(5 * TICK + 2);
+  assert(t[3].fired == 1 && t[0].fired == 0);
+  assert(timer_next_deadline() == 5 * TICK + 3);
+
+  timer_run(99 * TICK);
+  assert(t[0].fired == 1 && t[1].fired == 0);
+  assert(timer_next_deadline() == 100 * TICK);
+
+  // A long jump runs the rest.
+  timer_run(10000 * TICK);
+  assert(t[1].fired == 1 && t[2].fired == 1);
+  assert(timer_next_deadline() == TIMER_NO_DEADLINE);
+  for (int i = 0; i < 4; i++) assert(!timer_pending(&t[i].timer));
+}
+
+static void test_cancel_and_rearm() {
+  TestTimer t[2];
+  timer_init(1000 * TICK);
+  setup(&t[0]);
+  setup(&t[1]);
+
+  timer_arm(&t[0].timer, 1200 * TICK);
+  timer_arm(&t[1].timer, 1300 * TICK);
+  assert(timer_pending(&t[0].timer));
+  timer_cancel(&t[0].timer);
+  assert(!timer_pending(&t[0].timer));
+  assert(timer_next_deadline() == 1300 * TICK);
+  // Cancelling twice does nothing.
+  timer_cancel(&t[0].timer);
+
+  // Re-arming a pending timer moves it.
+  timer_arm(&t[1].timer, 1100 * TICK);
+  assert(timer_next_deadline() == 1100 * TICK);
+  timer_run(1250 * TICK);
+  assert(t[0].fired == 0 && t[1].fired == 1);
+
+  // A deadline in the past expires on the next run.
+  timer_arm(&t[0].timer, 10);
+  timer_run(1250 * TICK);
+  assert(t[0].fired == 1);
+}
+
+static void test_periodic() {
+  TestTimer t;
+  timer_init(0);
+  setup(&t);
+  t.period = 3 * TICK + 7;
+
+  timer_arm(&t.timer, t.period);
+  // Run once per tick until just after the 100th deadline.
+  for (uint64_t now = 0; now < 100 * t.period + TICK; now += TICK) {
+    timer_run(now);
+  }
+  assert(t.fired == 100);
+  assert(timer_pending(&t.timer));
+  assert(timer_next_deadline() == 101 * t.period);
+}
+
+static void test_far() {
+  TestTimer t;
+  timer_init(0);
+  setup(&t);
+
+  // Beyond the reach of the wheel. The timer is parked and does not fire
+  // early, but the hardware is woken up to cascade it.
+  uint64_t reach = TICK << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS);
+  uint64_t deadline = 3 * reach + 12345;
+  timer_arm(&t.timer, deadline);
+  uint64_t now = 0;
+  int wakeups = 0;
+  while (t.fired == 0) {
+    uint64_t next = timer_next_deadline();
+    assert(next != TIMER_NO_DEADLINE);
+    assert(next > now && next <= deadline);
+    now = next;
+    timer_run(now);
+    wakeups++;
+  }
+  assert(t.fired_at == deadline);
+  assert(wakeups < 16);
+}
+
+static void test_program() {
+  TestTimer t[2];
+  timer_init(0);
+  timer_set_programfn(test_programfn);
+  setup(&t[0]);
+  setup(&t[1]);
+
+  timer_arm(&t[0].timer, 500 * TICK);
+  assert(last_programmed == 500 * TICK);
+  int programmed = num_programmed;
+  // A later deadline leaves the hardware alone.
+  timer_arm(&t[1].timer, 900 * TICK);
+  assert(num_programmed == programmed);
+  timer_arm(&t[1].timer, 300 * TICK);
+  assert(last_programmed == 300 * TICK);
+
+  // Running programs the next deadline.
+  timer_run(400 * TICK);
+  assert(last_programmed == 500 * TICK);
+  timer_run(500 * TICK);
+  assert(last_programmed == TIMER_NO_DEADLINE);
+  timer_set_programfn(NULL);
+}
+
+static uint64_t rand_state = 12345;
+
+static uint64_t next_rand() {
+  rand_state = rand_state * 6364136223846793005ULL + 1442695040888963407ULL;
+  return rand_state >> 16;
+}
+
+static TestTimer timers[NUM_RANDOM_TIMERS];
+
+static void test_random() {
+  uint64_t now = 1ULL << 40;
+  timer_init(now);
+  for (int i = 0; i < NUM_RANDOM_TIMERS; i++) {
+    setup(&timers[i]);
+    // Spread deadlines over all levels.
+    uint64_t range = 1ULL << (next_rand() % 40);
+    timer_arm(&timers[i].timer, now + next_rand() % range);
+  }
+
+  while (timer_next_deadline() != TIMER_NO_DEADLINE) {
+    uint64_t next = timer_next_deadline();
+    assert(next >= now);
+    // Either run at the next deadline, or a bit later.
+    now = next + (next_rand() % 2 ? next_rand() % (TICK * 100) : 0);
+    timer_run(now);
+    for (int i = 0; i < NUM_RANDOM_TIMERS; i++) {
+      TestTimer *t = &timers[i];
+      if (t->timer.deadline <= now) {
+        assert(t->fired == 1);
+      } else {
+        assert(t->fired == 0);
+      }
+    }
+    // Sometimes cancel or move a pending timer.
+    TestTimer *t = &timers[next_rand() % NUM_RANDOM_TIMERS];
+    if (timer_pending(&t->timer)) {
+      if (next_rand() % 2) {
+        timer_cancel(&t->timer);
+        t->timer.deadline = UINT64_MAX;
+      } else {
+        timer_arm(&t->timer, now + next_rand() % (TICK * 10000));
+      }
+    }
+  }
+}
+
+int main() {
+  test_order();
+  test_cancel_and_rearm();
+  test_periodic();
+  test_far();
+  test_program();
+  test_random();
+
+  printf("PASS\n");
+  return 0;
+}
@@ -0,0 +1,66 @@
+#include "trace.h"
+
+#include "arch.h"
+#include "log.h"
+#include "mem.h"
+
+/** Records written into the log between flushes by trace_dump(), so that the
+ * log ring does not overflow in deferred mode. */
+#define DUMP_FLUSH_INTERVAL 32
+
+uint64_t trace_enabled = 0;
+
+/** Rings of all CPUs. Not static so that a debugger can dump them as a raw
+ * array of TraceRecord for the host decoder. */
+TraceRecord trace_buffers[MAX_CPUS][TRACE_RING_RECORDS];
+/** Number of records ever written to each ring. */
+static uint64_t heads[MAX_CPUS];
+
+void trace_set_mask(uint64_t mask) {
+  __atomic_store_n(&trace_enabled, mask, __ATOMIC_RELAXED);
+}
+
+void trace_emit(TraceEvent event, size_t nargs, const uint64_t *args) {
+  unsigned int cpu = cpu_id();
+  // Interrupt handlers that preempt this one take the next slot.
+  uint64_t index = __atomic_fetch_add(&heads[cpu], 1, __ATOMIC_RELAXED);
+  TraceRecord *record = &trace_buffers[cpu][index % TRACE_RING_RECORDS];
+
+  record->event = event;
+  record->cpu = cpu;
+  record->nargs = nargs;
+  for (size_t i = 0; i < TRACE_MAX_ARGS; i++) {
+    record->args[i] = i < nargs ? args[i] : 0;
+  }
+  record->tsc = read_timestamp();
+}
+
+size_t trace_read(unsigned int cpu, TraceRecord *out, size_t max) {
+  uint64_t head = __atomic_load_n(&heads[cpu], __ATOMIC_ACQUIRE);
+  uint64_t count = head < TRACE_RING_RECORDS ? head : TRACE_RING_RECORDS;
+  if (count > max) count = max;
+
+  for (uint64_t i = 0; i < count; i++) {
+    uint64_t index = head - count + i;
+    memcpy(&out[i], &trace_buffers[cpu][index % TRACE_RING_RECORDS],
+           sizeof(TraceRecord));
+  }
+  return count;
+}
+
+void trace_dump(void) {
+  for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+    uint64_t head = __atomic_load_n(&heads[cpu], __ATOMIC_ACQUIRE);
+    uint64_t count = head < TRACE_RING_RECORDS ? head : TRACE_RING_RECORDS;
+
+    for (uint64_t i = 0; i < count; i++) {
+      const TraceRecord *record =
+          &trace_buffers[cpu][(head - count + i) % TRACE_RING_RECORDS];
+      const uint64_t *words = (const uint64_t *)record;
+      log_printf(LOG_LEVEL_NONE, "TRC %x %x %x %x %x %x\n", words[0],
+                 words[1], words[2], words[3], words[4], words[5]);
+      if (i % DUMP_FLUSH_INTERVAL == DUMP_FLUSH_INTERVAL - 1) log_flush();
+    }
+  }
+  log_flush();
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Build with TRACE=0 to compile the tracepoints out. */
+#ifndef TRACE
+#define TRACE 1
+#endif
+
+/** Maximum number of arguments of a tracepoint. */
+#define TRACE_MAX_ARGS 4
+/** Number of records in the ring of each CPU. */
+#define TRACE_RING_RECORDS 2048
+
+typedef enum {
+#define TRACE_EVENT(name, fmt) TRACE_EVENT_##name,
+#include "trace_events.h"
+#undef TRACE_EVENT
+  TRACE_EVENT_NUM,
+} TraceEvent;
+
+_Static_assert(TRACE_EVENT_NUM <= 64, "trace_enabled has a bit per event");
+
+/** Binary trace record. The host decoder reads the same layout, so only
+ * append fields in place of `_reserved`. */
+typedef struct {
+  /** TSC when the record was written. 0 if the slot was never written. */
+  uint64_t tsc;
+  /** TraceEvent of the record. */
+  uint16_t event;
+  /** CPU that wrote the record. */
+  uint8_t cpu;
+  /** Number of valid entries in `args`. */
+  uint8_t nargs;
+  uint32_t _reserved;
+  uint64_t args[TRACE_MAX_ARGS];
+} TraceRecord;
+
+_Static_assert(sizeof(TraceRecord) == 48, "TraceRecord layout changed");
+
+/** Bit N is set if TraceEvent N is enabled. */
+extern uint64_t trace_enabled;
+
+/** Enable exactly the events whose bits are set in `mask`. */
+void trace_set_mask(uint64_t mask);
+
+/** Append a record to the ring of the running CPU. Once the ring is full, the
+ * oldest record is overwritten. Use TRACEPOINT() instead. */
+void trace_emit(TraceEvent event, size_t nargs, const uint64_t *args);
+
+/** Copy the records of `cpu` from the oldest to the newest into `out`.
+ * Returns the number of records copied. */
+size_t trace_read(unsigned int cpu, TraceRecord *out, size_t max);
+
+/** Print the records of all CPUs as "TRC" lines in hex, which the host
+ * decoder reads back from a serial log. */
+void trace_dump(void);
+
+#if TRACE
+/** Record the event `name` with up to TRACE_MAX_ARGS integer arguments. A
+ * disabled tracepoint costs a load and a branch that is predicted not
+ * taken. The arguments are not evaluated unless the event is enabled. */
+#define TRACEPOINT(name, ...)                                                \
+  do {                                                                       \
+    if (__builtin_expect(__atomic_load_n(&trace_enabled, __ATOMIC_RELAXED) & \
+                             (1ULL << TRACE_EVENT_##name),                   \
+                         0)) {                                               \
+      const uint64_t trace_args_[] = {__VA_ARGS__};                          \
+      _Static_assert(sizeof(trace_args_) <= sizeof(trace_args_[0]) *         \
+                                                TRACE_MAX_ARGS,              \
+                     "too many tracepoint arguments");                       \
+      trace_emit(TRACE_EVENT_##name,                                         \
+                 sizeof(trace_args_) / sizeof(trace_args_[0]), trace_args_); \
+    }                                                                        \
+  } while (0)
+#else
+// Keep the arguments type-checked and used, without emitting code.
+#define TRACEPOINT(name, ...)                       \
+  do {                                              \
+    if (0) {                                        \
+      const uint64_t trace_args_[] = {__VA_ARGS__}; \
+      (void)trace_args_;                            \
+      (void)TRACE_EVENT_##name;                     \
+    }                                               \
+  } while (0)
+#endif
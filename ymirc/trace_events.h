@@ -0,0 +1,10 @@
+/** List of tracepoints, included by trace.h and by the host decoder. Each
+ * entry is TRACE_EVENT(name, format). The format names the arguments in the
+ * order they are passed to TRACEPOINT(); %x prints one in hex and %d in
+ * decimal. Append new entries at the end so that old dumps still decode. */
+
+TRACE_EVENT(vmexit, "exitcode=%x info1=%x info2=%x rip=%x")
+TRACE_EVENT(inject_ext_intr, "irq=%d vector=%x")
+TRACE_EVENT(ioio, "port=%x in=%d size=%d")
+TRACE_EVENT(vmmcall, "nr=%d arg=%x")
+TRACE_EVENT(inject_lapic, "vector=%x")
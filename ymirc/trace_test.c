@@ -0,0 +1,83 @@
+#include "trace.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+
+static char log_buffer[1 << 20];
+static size_t log_index = 0;
+
+static void test_log_writefn(char c) {
+  if (log_index < sizeof(log_buffer) - 1) {
+    log_buffer[log_index++] = c;
+    log_buffer[log_index] = '\0';
+  }
+}
+
+static TraceRecord out[TRACE_RING_RECORDS];
+
+static int evaluated = 0;
+
+static uint64_t count_evaluation(void) { return ++evaluated; }
+
+int main() {
+  log_set_writefn(test_log_writefn);
+
+  // Disabled tracepoints record nothing and do not evaluate their arguments.
+  TRACEPOINT(vmexit, count_evaluation(), 2, 3, 4);
+  assert(evaluated == 0);
+  assert(trace_read(0, out, TRACE_RING_RECORDS) == 0);
+
+  trace_set_mask(1ULL << TRACE_EVENT_ioio);
+  TRACEPOINT(vmexit, 1, 2, 3, 4);
+  TRACEPOINT(ioio, 0x3F8, 1, count_evaluation());
+  assert(evaluated == 1);
+  assert(trace_read(0, out, TRACE_RING_RECORDS) == 1);
+  assert(out[0].event == TRACE_EVENT_ioio);
+  assert(out[0].cpu == 0);
+  assert(out[0].nargs == 3);
+  assert(out[0].args[0] == 0x3F8 && out[0].args[1] == 1);
+  assert(out[0].args[2] == 1 && out[0].args[3] == 0);
+  assert(out[0].tsc != 0);
+
+  // The ring keeps the newest records, oldest first. The ioio record and the
+  // first 10 vmmcall records are overwritten.
+  trace_set_mask(~0ULL);
+  for (uint64_t i = 0; i < TRACE_RING_RECORDS + 10; i++) {
+    TRACEPOINT(vmmcall, i, 0);
+  }
+  assert(trace_read(0, out, TRACE_RING_RECORDS) == TRACE_RING_RECORDS);
+  assert(out[0].event == TRACE_EVENT_vmmcall && out[0].args[0] == 10);
+  for (size_t i = 1; i < TRACE_RING_RECORDS; i++) {
+    assert(out[i].args[0] == out[i - 1].args[0] + 1);
+    assert(out[i].tsc >= out[i - 1].tsc);
+  }
+  assert(trace_read(0, out, 4) == 4);
+  assert(out[0].args[0] == TRACE_RING_RECORDS + 6);
+
+  // The dump prints a line of six hex words per record.
+  trace_dump();
+  size_t lines = 0;
+  for (const char *p = log_buffer; (p = strstr(p, "TRC ")) != NULL; p++) {
+    lines++;
+  }
+  assert(lines == TRACE_RING_RECORDS);
+  TraceRecord last = out[3];
+  char expected[128];
+  snprintf(expected, sizeof(expected),
+           "TRC %016lX %016lX %016lX %016lX %016lX %016lX\n",
+           ((uint64_t *)&last)[0], ((uint64_t *)&last)[1],
+           ((uint64_t *)&last)[2], ((uint64_t *)&last)[3],
+           ((uint64_t *)&last)[4], ((uint64_t *)&last)[5]);
+  assert(strcmp(log_buffer + log_index - strlen(expected), expected) == 0);
+
+  trace_set_mask(0);
+  TRACEPOINT(vmmcall, 0, 0);
+  assert(trace_read(0, out, 1) == 1 && out[0].args[0] == last.args[0]);
+
+  puts("PASS");
+
+  return 0;
+}
@@ -0,0 +1,31 @@
+#include "zeroed_page_pool.h"
+
+#include <stdint.h>
+
+#include "arch.h"
+
+void *zeroed_page_pool_alloc(ZeroedPagePool *pool,
+                             const page_allocator_ops_t *ops,
+                             size_t num_pages) {
+  if (num_pages == 1 && pool->count > 0) {
+    return (void *)phys2virt(pool->pages[--pool->count]);
+  }
+
+  uint8_t *pages = ops->alloc_aligned_pages(num_pages, PAGE_SIZE);
+  if (pages == NULL) return NULL;
+  for (size_t i = 0; i < num_pages; i++) {
+    clear_page(pages + i * PAGE_SIZE);
+  }
+  return pages;
+}
+
+bool zeroed_page_pool_refill(ZeroedPagePool *pool,
+                             const page_allocator_ops_t *ops) {
+  if (pool->count >= ZEROED_PAGE_POOL_CAPACITY) return false;
+
+  void *page = ops->alloc(PAGE_SIZE);
+  if (page == NULL) return false;
+  clear_page(page);
+  pool->pages[pool->count++] = virt2phys((Virt)page);
+  return true;
+}
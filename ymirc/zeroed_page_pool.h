@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "mem.h"
+#include "page_allocator_if.h"
+
+/** Number of pre-zeroed pages kept in a pool. */
+#define ZEROED_PAGE_POOL_CAPACITY 64
+
+/** Pool of single pages that are already zeroed. Pages are held as physical
+ * addresses since the direct mapping moves when the page tables are
+ * reconstructed. */
+typedef struct {
+  Phys pages[ZEROED_PAGE_POOL_CAPACITY];
+  size_t count;
+} ZeroedPagePool;
+
+/** Allocate `num_pages` zeroed pages from `ops`. A single page comes from the
+ * pool if it is not empty. */
+void *zeroed_page_pool_alloc(ZeroedPagePool *pool,
+                             const page_allocator_ops_t *ops,
+                             size_t num_pages);
+
+/** Zero one more page into the pool. Returns false if the pool is full or no
+ * memory is left, in which case there is no more work to do. */
+bool zeroed_page_pool_refill(ZeroedPagePool *pool,
+                             const page_allocator_ops_t *ops);
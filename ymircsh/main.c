@@ -1,10 +1,37 @@
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 
-void asm_vmmcall(uint64_t nr) {
-  __asm__ volatile("vmmcall" : : "a"(nr) : "memory");
+/** Number of the VMMCALL that returns the page allocator's usage. */
+#define VMMCALL_NR_ALLOC_STATS 1
+
+/** Issue a VMMCALL. RAX and RBX on return are stored in `ret`. */
+void asm_vmmcall(uint64_t nr, uint64_t arg1, uint64_t arg2, uint64_t ret[2]) {
+  __asm__ volatile("vmmcall"
+                   : "=a"(ret[0]), "=b"(ret[1])
+                   : "a"(nr), "b"(arg1), "c"(arg2)
+                   : "memory");
 }
 
-int main() {
-  asm_vmmcall(0);
+/** Usage: ymircsh [nr [arg1 [arg2]]]
+ * Issues VMMCALL `nr` with `arg1` in RBX and `arg2` in RCX.
+ *   0: Greet the VMM.
+ *   1: Dump the VMM's allocator stats to its log and print the number of
+ *      free and used page frames the VMM returns in RAX and RBX.
+ *   2: Enable the tracepoints set in `arg1`.
+ *   3: Dump the trace rings to the VMM's log.
+ *   4: Set the log level of subsystem `arg1` to `arg2`. Subsystems are core,
+ *      alloc, npt, ioio, msr, cpuid, intr and vmmc from 0. Levels are debug,
+ *      info, warn, error and none from 0.
+ *   5: Dump the VMM's interrupt counters to its log. */
+int main(int argc, char *argv[]) {
+  uint64_t nr = argc > 1 ? strtoull(argv[1], NULL, 0) : 0;
+  uint64_t arg1 = argc > 2 ? strtoull(argv[2], NULL, 0) : 0;
+  uint64_t arg2 = argc > 3 ? strtoull(argv[3], NULL, 0) : 0;
+  uint64_t ret[2];
+  asm_vmmcall(nr, arg1, arg2, ret);
+  if (nr == VMMCALL_NR_ALLOC_STATS) {
+    printf("free frames: %lu\nused frames: %lu\n", ret[0], ret[1]);
+  }
   return 0;
 }